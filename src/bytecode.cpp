@@ -0,0 +1,1169 @@
+#include "bytecode.h"
+#include "escape.h"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+struct Compiler {
+    const IrModule &ir;
+    const ClosureLayout &layout;
+    const EscapeInfo &escapes;
+    Program &program;
+    std::uint32_t fn = 0; // the function being compiled
+    std::uint32_t noMatch = 0; // constant of the uncovered switch message
+    // float unboxing, see bytecode.h
+    bool unbox = false;
+    std::vector<bool> raw{};                   // variables holding raw doubles
+    std::unordered_map<VarId, IrId> lambdas{}; // LET and LETREC lambdas
+    std::unordered_set<IrId> direct{};         // lambdas only called directly
+    std::unordered_set<IrId> rawResult{};      // of them returning raw doubles
+    bool rawReturn = false;                    // the function being compiled
+    bool frameObjects = false; // it builds closures or thunks in its frame
+    // the continuation thunk of each shape of PIPE, by stages << 16 | mask
+    std::unordered_map<std::uint32_t, std::uint32_t> pipes{};
+};
+
+static CompiledFunction &out(Compiler &c) { return c.program.functions[c.fn]; }
+
+static void emit(CompiledFunction &f, Op op) {
+    f.code.push_back(static_cast<std::uint8_t>(op));
+}
+
+static void emit16(CompiledFunction &f, std::size_t value) {
+    if (value > 0xffff) {
+        throw std::runtime_error("bytecode operand " + std::to_string(value) +
+                                 " does not fit in 16 bits in " + f.name);
+    }
+    f.code.push_back(static_cast<std::uint8_t>(value & 0xff));
+    f.code.push_back(static_cast<std::uint8_t>(value >> 8));
+}
+
+// a u32 jump target, returns where it is so it can be patched
+static std::size_t emit32(CompiledFunction &f, std::uint32_t value) {
+    std::size_t at = f.code.size();
+    f.code.resize(at + 4);
+    std::memcpy(f.code.data() + at, &value, 4);
+    return at;
+}
+
+static void patch(CompiledFunction &f, std::size_t at) {
+    auto here = static_cast<std::uint32_t>(f.code.size());
+    std::memcpy(f.code.data() + at, &here, 4);
+}
+
+static std::uint32_t read16(const std::uint8_t *at) {
+    return static_cast<std::uint32_t>(at[0] | at[1] << 8);
+}
+
+static std::uint32_t read32(const std::uint8_t *at) {
+    std::uint32_t value;
+    std::memcpy(&value, at, 4);
+    return value;
+}
+
+static void emitOp(CompiledFunction &f, Op op, std::size_t operand) {
+    emit(f, op);
+    emit16(f, operand);
+}
+
+// room for n operands and the result on the operand stack
+static void reserve(Compiler &c, std::uint32_t n) {
+    out(c).stackSize = std::max(out(c).stackSize, n + 1);
+}
+
+// the lambda a callee atom is known to hold when it is only called directly
+static IrId directLambda(const Compiler &c, IrId callee) {
+    IrId lambda = knownLambda(c.ir, c.lambdas, callee);
+    return c.direct.contains(lambda) ? lambda : kNoIr;
+}
+
+static bool isReal(TypeId type) {
+    return type == kIntType || type == kRationalType || type == kFloatType;
+}
+
+// a primitive on real operands computed in doubles, arithmetic typed float
+// or a comparison with a float operand
+static bool isFloatPrim(const Compiler &c, const IrNode &n) {
+    if (!c.unbox || n.op != IrOp::PRIM) {
+        return false;
+    }
+    const std::uint32_t *ops = operandsOf(c.ir, n);
+    bool real = true;
+    bool anyFloat = false;
+    for (std::uint32_t i = 0; i < n.count; i++) {
+        real = real && isReal(c.ir.nodes[ops[i]].type);
+        anyFloat = anyFloat || c.ir.nodes[ops[i]].type == kFloatType;
+    }
+    switch (static_cast<IrPrim>(n.a)) {
+    case IrPrim::SUB:
+        return real && n.type == kFloatType;
+    case IrPrim::ADD:
+    case IrPrim::MUL:
+    case IrPrim::DIV:
+        return real && n.count == 2 && n.type == kFloatType;
+    case IrPrim::LT:
+    case IrPrim::GT:
+    case IrPrim::LE:
+    case IrPrim::GE:
+    case IrPrim::NUM_EQ:
+        return real && anyFloat;
+    default:
+        return false;
+    }
+}
+
+// does compiling the node leave a raw double
+static bool isRaw(const Compiler &c, IrId id) {
+    const IrNode &n = c.ir.nodes[id];
+    switch (n.op) {
+    case IrOp::VAR:
+        return c.raw[n.a];
+    case IrOp::FORCE:
+        return c.ir.nodes[n.a].op == IrOp::VAR && c.raw[c.ir.nodes[n.a].a];
+    case IrOp::APP:
+        return c.rawResult.contains(directLambda(c, n.a));
+    case IrOp::PRIM:
+        return isFloatPrim(c, n) && n.type == kFloatType;
+    default:
+        return false;
+    }
+}
+
+// from the representation the value on top of the stack has to the wanted
+static void convert(Compiler &c, bool raw, bool wanted) {
+    if (raw != wanted) {
+        emit(out(c), wanted ? Op::UNBOX_F : Op::BOX_F);
+    }
+}
+
+// an atom as a word or as a raw double
+static void loadAs(Compiler &c, IrId id, bool raw) {
+    const IrNode &n = c.ir.nodes[id];
+    switch (n.op) {
+    case IrOp::CONST:
+        emitOp(out(c), Op::CONST, n.a);
+        break;
+    case IrOp::GLOBAL:
+        emitOp(out(c), Op::GLOBAL, n.a);
+        break;
+    case IrOp::VAR: {
+        VarAccess access = varAccess(c.layout, c.fn, n.a);
+        emitOp(out(c), access.local ? Op::LOCAL : Op::ENV, access.index);
+        break;
+    }
+    default:
+        throw std::runtime_error("expected an atom");
+    }
+    convert(c, isRaw(c, id), raw);
+}
+
+static void load(Compiler &c, IrId id) { loadAs(c, id, false); }
+
+static void loadOperands(Compiler &c, const IrNode &n, bool raw) {
+    reserve(c, n.count + 1);
+    const std::uint32_t *ops = operandsOf(c.ir, n);
+    for (std::uint32_t i = 0; i < n.count; i++) {
+        loadAs(c, ops[i], raw);
+    }
+}
+
+// pushes the captures of the function of node for a CLOSURE, THUNK or FILL
+static std::uint32_t loadCaptures(Compiler &c, IrId node) {
+    std::uint32_t fn = c.layout.functionOf.at(node);
+    const std::vector<VarId> &captures = c.layout.functions[fn].captures;
+    reserve(c, static_cast<std::uint32_t>(captures.size()));
+    for (VarId var : captures) {
+        VarAccess access = varAccess(c.layout, c.fn, var);
+        emitOp(out(c), access.local ? Op::LOCAL : Op::ENV, access.index);
+    }
+    return fn;
+}
+
+// frame slots for an object of fn, with a word to spare to align it
+static std::uint32_t region(Compiler &c, std::uint32_t fn) {
+    std::uint32_t slot = out(c).frameSize;
+    out(c).frameSize += c.program.functions[fn].captures + 3;
+    return slot;
+}
+
+// op for function fn of node, or its FRAME_ variant when node does not
+// escape
+static void emitFunction(Compiler &c, Op op, Op frameOp, IrId node,
+                         std::uint32_t fn) {
+    if (!c.escapes.local.contains(node)) {
+        emitOp(out(c), op, fn);
+        return;
+    }
+    emitOp(out(c), frameOp, fn);
+    emit16(out(c), region(c, fn));
+}
+
+// float arithmetic and comparisons on raw doubles
+static void compileFloatPrim(Compiler &c, const IrNode &n) {
+    CompiledFunction &f = out(c);
+    loadOperands(c, n, true);
+    switch (static_cast<IrPrim>(n.a)) {
+    case IrPrim::ADD:
+        emit(f, Op::FADD);
+        return;
+    case IrPrim::SUB:
+        emit(f, n.count == 1 ? Op::FNEG : Op::FSUB);
+        return;
+    case IrPrim::MUL:
+        emit(f, Op::FMUL);
+        return;
+    case IrPrim::DIV:
+        emit(f, Op::FDIV);
+        return;
+    case IrPrim::LT:
+        emit(f, Op::FLT);
+        return;
+    case IrPrim::GT:
+        emit(f, Op::FGT);
+        return;
+    case IrPrim::LE:
+        emit(f, Op::FLE);
+        return;
+    case IrPrim::GE:
+        emit(f, Op::FGE);
+        return;
+    default:
+        emit(f, Op::FEQ);
+        return;
+    }
+}
+
+// the thunk continuing a PIPE of n stages over the rest of its list, made
+// once per n and mask
+static std::uint32_t pipeThunk(Compiler &c, std::uint32_t n,
+                               std::uint32_t mask) {
+    std::uint32_t key = n << 16 | mask;
+    if (auto it = c.pipes.find(key); it != c.pipes.end()) {
+        return it->second;
+    }
+    auto fn = static_cast<std::uint32_t>(c.program.functions.size());
+    CompiledFunction f;
+    f.name = "pipe" + std::to_string(n) + "." + std::to_string(mask);
+    f.kind = FunctionKind::THUNK;
+    f.captures = n + 1;
+    f.stackSize = n + 2;
+    for (std::uint32_t i = 0; i <= n; i++) {
+        emitOp(f, Op::ENV, i);
+    }
+    emitOp(f, Op::PIPE, n);
+    emit16(f, mask);
+    emit16(f, fn);
+    emit(f, Op::RETURN);
+    c.program.functions.push_back(std::move(f));
+    c.pipes[key] = fn;
+    return fn;
+}
+
+// map and filter are one stage pipelines, the operands of a fused PIPE or
+// FOLDL are its stages and the list
+static void compileListPrim(Compiler &c, const IrNode &n) {
+    auto prim = static_cast<IrPrim>(n.a);
+    std::uint32_t mask = prim == IrPrim::MAP      ? 0
+                         : prim == IrPrim::FILTER ? 1
+                                                  : n.c;
+    std::uint32_t stages = prim == IrPrim::FOLDL ? n.count - 3 : n.count - 1;
+    // before anything holds the function being compiled, the thunk is new
+    // to the function list
+    std::uint32_t rest = prim == IrPrim::FOLDL ? 0 : pipeThunk(c, stages, mask);
+    loadOperands(c, n, false);
+    CompiledFunction &f = out(c);
+    emitOp(f, prim == IrPrim::FOLDL ? Op::FOLDL : Op::PIPE, stages);
+    emit16(f, mask);
+    if (prim != IrPrim::FOLDL) {
+        emit16(f, rest);
+    }
+}
+
+static void compilePrim(Compiler &c, const IrNode &n) {
+    if (isFloatPrim(c, n)) {
+        compileFloatPrim(c, n);
+        return;
+    }
+    switch (static_cast<IrPrim>(n.a)) {
+    case IrPrim::MAP:
+    case IrPrim::FILTER:
+    case IrPrim::FOLDL:
+    case IrPrim::PIPE:
+        compileListPrim(c, n);
+        return;
+    default:
+        break;
+    }
+    CompiledFunction &f = out(c);
+    auto prim = static_cast<IrPrim>(n.a);
+    loadOperands(c, n, false);
+    switch (prim) {
+    case IrPrim::ADD:
+    case IrPrim::MUL:
+        // the typechecker only allows a single operand for -
+        if (n.count == 2) {
+            emit(f, prim == IrPrim::ADD ? Op::ADD : Op::MUL);
+        }
+        return;
+    case IrPrim::SUB:
+        emit(f, n.count == 1 ? Op::NEG : Op::SUB);
+        return;
+    case IrPrim::DIV:
+        emit(f, Op::DIV);
+        return;
+    case IrPrim::MOD:
+        emit(f, Op::MOD);
+        return;
+    case IrPrim::LT:
+        emit(f, Op::LT);
+        return;
+    case IrPrim::GT:
+        emit(f, Op::GT);
+        return;
+    case IrPrim::LE:
+        emit(f, Op::LE);
+        return;
+    case IrPrim::GE:
+        emit(f, Op::GE);
+        return;
+    case IrPrim::NUM_EQ:
+        emit(f, Op::NUM_EQ);
+        return;
+    case IrPrim::NOT:
+        emit(f, Op::NOT);
+        return;
+    case IrPrim::CONS:
+        emit(f, Op::CONS);
+        return;
+    // car and cdr are a field of the cell brought to WHNF
+    case IrPrim::CAR:
+    case IrPrim::CDR:
+        emit(f, prim == IrPrim::CAR ? Op::CAR : Op::CDR);
+        emit(f, Op::FORCE);
+        return;
+    case IrPrim::IS_NULL:
+        emit(f, Op::IS_NULL);
+        return;
+    case IrPrim::APPEND:
+        emit(f, Op::APPEND);
+        return;
+    // compiled by compileListPrim above
+    case IrPrim::MAP:
+    case IrPrim::FILTER:
+    case IrPrim::FOLDL:
+    case IrPrim::PIPE:
+        break;
+    case IrPrim::VEC_REF:
+        emit(f, Op::VEC_REF);
+        f.code.push_back(n.c ? 0 : 1);
+        emit(f, Op::FORCE);
+        return;
+    case IrPrim::VEC_LEN:
+        emit(f, Op::VEC_LEN);
+        return;
+    case IrPrim::VEC_MAP:
+        emit(f, Op::VEC_MAP);
+        return;
+    case IrPrim::VEC_FOLD:
+        emit(f, Op::VEC_FOLD);
+        return;
+    case IrPrim::EQ:
+        emit(f, Op::EQ);
+        return;
+    case IrPrim::EQUAL:
+        emit(f, Op::EQUAL);
+        return;
+    case IrPrim::IS_TAG:
+        emitOp(f, Op::IS_TAG, n.c);
+        return;
+    case IrPrim::FIELD:
+        // the value of an unboxed constructor is its field
+        if (n.b != kNoIr &&
+            c.ir.constructors[n.b].rep == Representation::UNBOXED) {
+            return;
+        }
+        emitOp(f, Op::FIELD, n.c);
+        return;
+    }
+    throw std::runtime_error("unknown primitive " + toString(prim));
+}
+
+static void compile(Compiler &c, IrId id, bool tail);
+static void compileBody(Compiler &c, IrId id, bool tail);
+static void compileCall(Compiler &c, const IrNode &n, Op op);
+static void compileTailCall(Compiler &c, IrId id);
+
+// the arms of an IF or SWITCH, each ends in a RETURN in tail position and
+// otherwise jumps past the last one
+static void compileArm(Compiler &c, IrId arm, bool tail,
+                       std::vector<std::size_t> &exits) {
+    compile(c, arm, tail);
+    if (!tail) {
+        convert(c, isRaw(c, arm), false);
+        emit(out(c), Op::JUMP);
+        exits.push_back(emit32(out(c), 0));
+    }
+}
+
+static void compileSwitch(Compiler &c, const IrNode &n, bool tail) {
+    load(c, n.a);
+    emitOp(out(c), Op::SWITCH, n.count);
+    std::vector<std::size_t> targets;
+    for (std::uint32_t i = 0; i <= n.count; i++) {
+        targets.push_back(emit32(out(c), 0));
+    }
+    const std::uint32_t *ops = operandsOf(c.ir, n);
+    std::vector<std::size_t> exits;
+    for (std::uint32_t i = 0; i < n.count; i++) {
+        if (ops[i] != kNoIr) {
+            patch(out(c), targets[i]);
+            compileArm(c, ops[i], tail, exits);
+        }
+    }
+    std::size_t other = out(c).code.size();
+    if (n.c != kNoIr) {
+        compileArm(c, n.c, tail, exits);
+    } else {
+        emitOp(out(c), Op::FAIL, c.noMatch);
+    }
+    for (std::uint32_t i = 0; i <= n.count; i++) {
+        if (i == n.count || ops[i] == kNoIr) {
+            auto at = static_cast<std::uint32_t>(other);
+            std::memcpy(out(c).code.data() + targets[i], &at, 4);
+        }
+    }
+    for (std::size_t exit : exits) {
+        patch(out(c), exit);
+    }
+}
+
+static void compile(Compiler &c, IrId id, bool tail) {
+    const IrNode &n = c.ir.nodes[id];
+    switch (n.op) {
+    case IrOp::CONST:
+    case IrOp::VAR:
+    case IrOp::GLOBAL:
+        reserve(c, 1);
+        loadAs(c, id, isRaw(c, id));
+        break;
+    case IrOp::LET:
+        compile(c, n.b, false);
+        convert(c, isRaw(c, n.b), c.raw[n.a]);
+        emitOp(out(c), Op::STORE, c.layout.slots[n.a]);
+        compileBody(c, n.c, tail);
+        return;
+    case IrOp::LETREC: {
+        // every closure exists before any is filled, so they can capture
+        // each other
+        const std::uint32_t *ops = operandsOf(c.ir, n);
+        std::uint32_t half = n.count / 2;
+        for (std::uint32_t i = 0; i < half; i++) {
+            if (!c.layout.functionOf.contains(ops[half + i])) {
+                throw std::runtime_error("letrec binds a value that is not "
+                                         "a lambda or thunk");
+            }
+            reserve(c, 1);
+            emitFunction(c, Op::ALLOC, Op::FRAME_ALLOC, ops[half + i],
+                         c.layout.functionOf.at(ops[half + i]));
+            emitOp(out(c), Op::STORE, c.layout.slots[ops[i]]);
+        }
+        for (std::uint32_t i = 0; i < half; i++) {
+            loadCaptures(c, ops[half + i]);
+            emitOp(out(c), Op::FILL, c.layout.slots[ops[i]]);
+        }
+        compileBody(c, n.c, tail);
+        return;
+    }
+    case IrOp::IF: {
+        load(c, n.a);
+        emit(out(c), Op::JUMP_FALSE);
+        std::size_t otherwise = emit32(out(c), 0);
+        std::vector<std::size_t> exits;
+        compileArm(c, n.b, tail, exits);
+        patch(out(c), otherwise);
+        compileBody(c, n.c, tail);
+        for (std::size_t exit : exits) {
+            patch(out(c), exit);
+        }
+        return;
+    }
+    case IrOp::SWITCH:
+        compileSwitch(c, n, tail);
+        return;
+    case IrOp::FAIL:
+        emitOp(out(c), Op::FAIL, n.a);
+        return;
+    case IrOp::PRIM:
+        compilePrim(c, n);
+        break;
+    case IrOp::APP:
+        if (tail) {
+            compileTailCall(c, id);
+            return;
+        }
+        compileCall(c, n, Op::CALL);
+        break;
+    case IrOp::LAMBDA:
+        emitFunction(c, Op::CLOSURE, Op::FRAME_CLOSURE, id,
+                     loadCaptures(c, id));
+        break;
+    case IrOp::THUNK:
+    case IrOp::TLAMBDA:
+        emitFunction(c, Op::THUNK, Op::FRAME_THUNK, id, loadCaptures(c, id));
+        break;
+    case IrOp::FORCE:
+        reserve(c, 1);
+        loadAs(c, n.a, isRaw(c, id));
+        if (isLazyAtom(c.ir, c.ir.nodes[n.a])) {
+            emit(out(c), Op::FORCE);
+        }
+        break;
+    // a tlambda is a thunk of its body, types are erased
+    case IrOp::TAPPLY:
+        reserve(c, 1);
+        load(c, n.a);
+        emit(out(c), Op::FORCE);
+        break;
+    case IrOp::VEC:
+        loadOperands(c, n, false);
+        emitOp(out(c), Op::VEC, n.count);
+        break;
+    case IrOp::CON:
+        loadOperands(c, n, false);
+        if (c.ir.constructors[n.a].rep != Representation::UNBOXED) {
+            emitOp(out(c), Op::CONSTRUCT, n.a);
+        }
+        break;
+    }
+    if (tail) {
+        convert(c, isRaw(c, id), c.rawReturn);
+        emit(out(c), Op::RETURN);
+    }
+}
+
+// a function only called directly takes its float parameters raw
+static void compileCall(Compiler &c, const IrNode &n, Op op) {
+    reserve(c, n.count + 1);
+    load(c, n.a);
+    IrId lambda = directLambda(c, n.a);
+    const std::uint32_t *ops = operandsOf(c.ir, n);
+    for (std::uint32_t i = 0; i < n.count; i++) {
+        loadAs(c, ops[i],
+               lambda != kNoIr &&
+                   c.raw[operandsOf(c.ir, c.ir.nodes[lambda])[i]]);
+    }
+    emitOp(out(c), op, n.count);
+}
+
+// a call in tail position, a jump back to the start when the function
+// calls itself, otherwise a TAIL_CALL unless the result still has to be
+// boxed or unboxed
+static void compileTailCall(Compiler &c, IrId id) {
+    const IrNode &n = c.ir.nodes[id];
+    const FunctionLayout &fl = c.layout.functions[c.fn];
+    if (fl.kind == FunctionKind::LAMBDA && !c.frameObjects &&
+        knownLambda(c.ir, c.lambdas, n.a) == fl.node &&
+        n.count == fl.params.size()) {
+        reserve(c, n.count);
+        const std::uint32_t *ops = operandsOf(c.ir, n);
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            loadAs(c, ops[i], c.raw[fl.params[i]]);
+        }
+        for (std::uint32_t i = n.count; i-- > 0;) {
+            emitOp(out(c), Op::STORE, c.layout.slots[fl.params[i]]);
+        }
+        emit(out(c), Op::JUMP);
+        emit32(out(c), 0);
+        return;
+    }
+    // the RETURN is reached when the TAIL_CALL keeps the frame
+    if (isRaw(c, id) == c.rawReturn) {
+        compileCall(c, n, Op::TAIL_CALL);
+    } else {
+        compileCall(c, n, Op::CALL);
+        convert(c, isRaw(c, id), c.rawReturn);
+    }
+    emit(out(c), Op::RETURN);
+}
+
+// the body of a LET, LETREC or the else arm of an IF, which leaves a word
+// when it is not in tail position
+static void compileBody(Compiler &c, IrId id, bool tail) {
+    compile(c, id, tail);
+    if (!tail) {
+        convert(c, isRaw(c, id), false);
+    }
+}
+
+// (f x) or (f x y) of the captures f, x and y
+static std::uint32_t applyThunk(Program &program, std::uint32_t arity) {
+    CompiledFunction f;
+    f.name = "apply" + std::to_string(arity);
+    f.kind = FunctionKind::THUNK;
+    f.captures = arity + 1;
+    f.stackSize = arity + 2;
+    for (std::uint32_t i = 0; i <= arity; i++) {
+        emitOp(f, Op::ENV, i);
+    }
+    emitOp(f, Op::CALL, arity);
+    emit(f, Op::RETURN);
+    program.functions.push_back(std::move(f));
+    return static_cast<std::uint32_t>(program.functions.size() - 1);
+}
+
+// does the body build a closure or thunk in the frame, nested functions
+// have their own frames
+static bool buildsInFrame(const Compiler &c, IrId id) {
+    if (c.layout.functionOf.contains(id)) {
+        return c.escapes.local.contains(id);
+    }
+    for (IrId child : children(c.ir, id)) {
+        if (buildsInFrame(c, child)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the variables that hold raw doubles, in binding order below id since a
+// LET is raw when its value is
+static void markRaw(Compiler &c, IrId id) {
+    const IrNode &n = c.ir.nodes[id];
+    if (n.op == IrOp::LET) {
+        markRaw(c, n.b);
+        const IrVar &var = c.ir.vars[n.a];
+        c.raw[n.a] = var.type == kFloatType && !var.lazy && isRaw(c, n.b);
+        markRaw(c, n.c);
+        return;
+    }
+    for (IrId child : children(c.ir, id)) {
+        markRaw(c, child);
+    }
+}
+
+// the lambdas bound by a LET, LETREC or global that are only ever the callee
+// of an APP passing all their parameters, their evaluated float parameters
+// are raw and so is their result when it is a float
+static void planUnboxing(Compiler &c) {
+    const IrModule &ir = c.ir;
+    std::unordered_map<IrId, std::uint32_t> callees; // to their arity
+    for (const IrNode &n : ir.nodes) {
+        if (n.op == IrOp::APP) {
+            callees[n.a] = n.count;
+        }
+    }
+    std::unordered_set<IrId> escaping;
+    std::vector<bool> escapingGlobal(ir.globals.size(), false);
+    for (IrId id = 0; id < ir.nodes.size(); id++) {
+        const IrNode &n = ir.nodes[id];
+        if (n.op != IrOp::VAR && n.op != IrOp::GLOBAL) {
+            continue;
+        }
+        IrId lambda = kNoIr;
+        if (n.op == IrOp::VAR && c.lambdas.contains(n.a)) {
+            lambda = c.lambdas.at(n.a);
+        } else if (n.op == IrOp::GLOBAL &&
+                   ir.nodes[ir.globals[n.a].body].op == IrOp::LAMBDA) {
+            lambda = ir.globals[n.a].body;
+        }
+        auto call = callees.find(id);
+        if (lambda != kNoIr &&
+            (call == callees.end() || call->second != ir.nodes[lambda].count)) {
+            escaping.insert(lambda);
+        }
+    }
+    for (const auto &[var, lambda] : c.lambdas) {
+        if (!escaping.contains(lambda)) {
+            c.direct.insert(lambda);
+        }
+    }
+    for (const IrGlobal &global : ir.globals) {
+        if (!global.lazy && ir.nodes[global.body].op == IrOp::LAMBDA &&
+            !escaping.contains(global.body)) {
+            c.direct.insert(global.body);
+        }
+    }
+    for (IrId lambda : c.direct) {
+        const IrNode &fn = ir.nodes[lambda];
+        for (std::uint32_t i = 0; i < fn.count; i++) {
+            const IrVar &param = ir.vars[operandsOf(ir, fn)[i]];
+            c.raw[operandsOf(ir, fn)[i]] =
+                param.type == kFloatType && !param.lazy;
+        }
+        if (ir.nodes[fn.b].type == kFloatType) {
+            c.rawResult.insert(lambda);
+        }
+    }
+    for (IrId expr : ir.exprs) {
+        markRaw(c, expr);
+    }
+    for (const IrGlobal &global : ir.globals) {
+        markRaw(c, global.body);
+    }
+}
+
+// the bytes of the operands of the op at code
+static std::size_t operandSize(const std::uint8_t *code) {
+    switch (static_cast<Op>(code[0])) {
+    case Op::CONST:
+    case Op::LOCAL:
+    case Op::ENV:
+    case Op::GLOBAL:
+    case Op::STORE:
+    case Op::FAIL:
+    case Op::CALL:
+    case Op::TAIL_CALL:
+    case Op::CLOSURE:
+    case Op::THUNK:
+    case Op::ALLOC:
+    case Op::FILL:
+    case Op::CONSTRUCT:
+    case Op::VEC:
+    case Op::IS_TAG:
+    case Op::FIELD:
+        return 2;
+    case Op::JUMP:
+    case Op::JUMP_FALSE:
+    case Op::FRAME_CLOSURE:
+    case Op::FRAME_THUNK:
+    case Op::FRAME_ALLOC:
+    case Op::FOLDL:
+    case Op::STORE_LOCAL:
+    case Op::LOCAL_CONST:
+    case Op::LOCAL_LOCAL:
+        return 4;
+    case Op::SWITCH:
+        return 2 + 4 * (read16(code + 1) + 1);
+    case Op::PIPE:
+    case Op::LOCAL_JUMP_FALSE:
+        return 6;
+    case Op::VEC_REF:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// the offsets of the u32 jump targets in the operands of the op at code
+static std::vector<std::size_t> jumpTargets(const std::uint8_t *code) {
+    switch (static_cast<Op>(code[0])) {
+    case Op::JUMP:
+    case Op::JUMP_FALSE:
+        return {0};
+    case Op::LOCAL_JUMP_FALSE:
+        return {2};
+    case Op::SWITCH: {
+        std::vector<std::size_t> at;
+        for (std::uint32_t i = 0; i <= read16(code + 1); i++) {
+            at.push_back(2 + 4 * i);
+        }
+        return at;
+    }
+    default:
+        return {};
+    }
+}
+
+struct Superinstruction {
+    Op first;
+    Op second;
+    Op fused;
+};
+
+/*
+ * picked off the rankSequences profile of benchSuperinstructions, unfused
+ * over fib, tak, ackermann and nqueens. these are four of the five most
+ * run pairs, STORE LOCAL 4.7M, LOCAL CONST 2.6M, LOCAL JUMP_FALSE 1.5M and
+ * LOCAL LOCAL 1.2M. the other, LOCAL STORE at 2.2M, is left out since 1.8M
+ * of its runs go on into a LOCAL, and fusing it left to right would take
+ * the STORE from the bigger STORE LOCAL. the top triples, like LOCAL CONST
+ * NUM_EQ and CONST SUB STORE at about 1M each, extend these pairs by an op
+ * that differs from triple to triple, so each one saves a single dispatch
+ * on a fraction of what its pair already fuses
+ */
+static const Superinstruction kSuperinstructions[] = {
+    {Op::STORE, Op::LOCAL, Op::STORE_LOCAL},
+    {Op::LOCAL, Op::CONST, Op::LOCAL_CONST},
+    {Op::LOCAL, Op::LOCAL, Op::LOCAL_LOCAL},
+    {Op::LOCAL, Op::JUMP_FALSE, Op::LOCAL_JUMP_FALSE},
+};
+
+// the superinstruction running a then b, none when there is no such
+static std::optional<Op> fusion(Op a, Op b) {
+    for (const Superinstruction &s : kSuperinstructions) {
+        if (s.first == a && s.second == b) {
+            return s.fused;
+        }
+    }
+    return std::nullopt;
+}
+
+// fuses the pairs of kSuperinstructions left to right, then moves every jump
+// target to where its op went
+static void fuseSuperinstructions(CompiledFunction &f) {
+    const std::vector<std::uint8_t> &code = f.code;
+    std::vector<bool> landed(code.size() + 1, false);
+    for (std::size_t pc = 0; pc < code.size();
+         pc += 1 + operandSize(&code[pc])) {
+        for (std::size_t at : jumpTargets(&code[pc])) {
+            landed[read32(&code[pc + 1 + at])] = true;
+        }
+    }
+    std::vector<std::uint8_t> fused;
+    fused.reserve(code.size());
+    std::vector<std::uint32_t> moved(code.size() + 1, 0);
+    std::size_t pc = 0;
+    while (pc < code.size()) {
+        moved[pc] = static_cast<std::uint32_t>(fused.size());
+        std::size_t next = pc + 1 + operandSize(&code[pc]);
+        std::size_t end = next;
+        std::optional<Op> op;
+        if (next < code.size() && !landed[next]) {
+            op = fusion(static_cast<Op>(code[pc]), static_cast<Op>(code[next]));
+        }
+        if (op) {
+            end = next + 1 + operandSize(&code[next]);
+            fused.push_back(static_cast<std::uint8_t>(*op));
+            fused.insert(fused.end(), code.begin() + pc + 1,
+                         code.begin() + next);
+            fused.insert(fused.end(), code.begin() + next + 1,
+                         code.begin() + end);
+        } else {
+            fused.insert(fused.end(), code.begin() + pc, code.begin() + end);
+        }
+        pc = end;
+    }
+    moved[code.size()] = static_cast<std::uint32_t>(fused.size());
+    for (pc = 0; pc < fused.size(); pc += 1 + operandSize(&fused[pc])) {
+        for (std::size_t at : jumpTargets(&fused[pc])) {
+            std::uint32_t target = moved[read32(&fused[pc + 1 + at])];
+            std::memcpy(&fused[pc + 1 + at], &target, 4);
+        }
+    }
+    f.code = std::move(fused);
+}
+
+Program compileProgram(const IrModule &ir, const SymbolTable &symbols,
+                       const CompileOptions &options) {
+    ClosureLayout layout = convertClosures(ir);
+    EscapeInfo escapes;
+    if (options.frameAllocate) {
+        escapes = analyzeEscapes(ir);
+    }
+    Program program;
+    program.constants = ir.constants;
+    program.constructors = ir.constructors;
+    program.globals = layout.globals;
+    program.exprs = layout.exprs;
+    for (const FunctionLayout &fl : layout.functions) {
+        CompiledFunction f;
+        f.kind = fl.kind;
+        f.params = static_cast<std::uint32_t>(fl.params.size());
+        f.captures = static_cast<std::uint32_t>(fl.captures.size());
+        f.frameSize = fl.frameSize;
+        if (fl.node == kNoIr) {
+            f.name = "expr";
+        } else {
+            f.name = (fl.kind == FunctionKind::LAMBDA ? "lambda." : "thunk.") +
+                     std::to_string(fl.node);
+        }
+        program.functions.push_back(std::move(f));
+    }
+    for (std::size_t g = 0; g < ir.globals.size(); g++) {
+        program.functions[layout.globals[g]].name =
+            symbols.name(ir.globals[g].name);
+    }
+    for (std::size_t i = 0; i < layout.exprs.size(); i++) {
+        program.functions[layout.exprs[i]].name =
+            "expr." + std::to_string(i);
+    }
+    Compiler c{ir, layout, escapes, program};
+    c.noMatch = static_cast<std::uint32_t>(program.constants.size());
+    program.constants.push_back(Value(std::string("no match clause matched")));
+    c.raw.assign(ir.vars.size(), false);
+    c.unbox = options.unboxFloats;
+    c.lambdas = boundLambdas(ir);
+    if (c.unbox) {
+        planUnboxing(c);
+    }
+    for (std::uint32_t fn = 0; fn < layout.functions.size(); fn++) {
+        c.fn = fn;
+        c.rawReturn = c.rawResult.contains(layout.functions[fn].node);
+        c.frameObjects = buildsInFrame(c, layout.functions[fn].body);
+        compile(c, layout.functions[fn].body, true);
+    }
+    program.apply1 = applyThunk(program, 1);
+    program.apply2 = applyThunk(program, 2);
+    if (options.superinstructions) {
+        for (CompiledFunction &f : program.functions) {
+            fuseSuperinstructions(f);
+        }
+    }
+    return program;
+}
+
+bool transfersControl(Op op) {
+    switch (op) {
+    case Op::JUMP:
+    case Op::JUMP_FALSE:
+    case Op::SWITCH:
+    case Op::FAIL:
+    case Op::CALL:
+    case Op::TAIL_CALL:
+    case Op::RETURN:
+    case Op::FORCE:
+    case Op::VEC_FOLD:
+    case Op::LOCAL_JUMP_FALSE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::string toString(Op op) {
+    switch (op) {
+    case Op::CONST:
+        return "CONST";
+    case Op::LOCAL:
+        return "LOCAL";
+    case Op::ENV:
+        return "ENV";
+    case Op::GLOBAL:
+        return "GLOBAL";
+    case Op::STORE:
+        return "STORE";
+    case Op::JUMP:
+        return "JUMP";
+    case Op::JUMP_FALSE:
+        return "JUMP_FALSE";
+    case Op::SWITCH:
+        return "SWITCH";
+    case Op::FAIL:
+        return "FAIL";
+    case Op::CALL:
+        return "CALL";
+    case Op::TAIL_CALL:
+        return "TAIL_CALL";
+    case Op::RETURN:
+        return "RETURN";
+    case Op::FORCE:
+        return "FORCE";
+    case Op::CLOSURE:
+        return "CLOSURE";
+    case Op::THUNK:
+        return "THUNK";
+    case Op::ALLOC:
+        return "ALLOC";
+    case Op::FRAME_CLOSURE:
+        return "FRAME_CLOSURE";
+    case Op::FRAME_THUNK:
+        return "FRAME_THUNK";
+    case Op::FRAME_ALLOC:
+        return "FRAME_ALLOC";
+    case Op::FILL:
+        return "FILL";
+    case Op::CONSTRUCT:
+        return "CONSTRUCT";
+    case Op::VEC:
+        return "VEC";
+    case Op::ADD:
+        return "ADD";
+    case Op::SUB:
+        return "SUB";
+    case Op::MUL:
+        return "MUL";
+    case Op::DIV:
+        return "DIV";
+    case Op::MOD:
+        return "MOD";
+    case Op::NEG:
+        return "NEG";
+    case Op::LT:
+        return "LT";
+    case Op::GT:
+        return "GT";
+    case Op::LE:
+        return "LE";
+    case Op::GE:
+        return "GE";
+    case Op::NUM_EQ:
+        return "NUM_EQ";
+    case Op::NOT:
+        return "NOT";
+    case Op::CONS:
+        return "CONS";
+    case Op::IS_NULL:
+        return "IS_NULL";
+    case Op::CAR:
+        return "CAR";
+    case Op::CDR:
+        return "CDR";
+    case Op::APPEND:
+        return "APPEND";
+    case Op::PIPE:
+        return "PIPE";
+    case Op::FOLDL:
+        return "FOLDL";
+    case Op::VEC_REF:
+        return "VEC_REF";
+    case Op::VEC_LEN:
+        return "VEC_LEN";
+    case Op::VEC_MAP:
+        return "VEC_MAP";
+    case Op::VEC_FOLD:
+        return "VEC_FOLD";
+    case Op::EQ:
+        return "EQ";
+    case Op::EQUAL:
+        return "EQUAL";
+    case Op::IS_TAG:
+        return "IS_TAG";
+    case Op::FIELD:
+        return "FIELD";
+    case Op::UNBOX_F:
+        return "UNBOX_F";
+    case Op::BOX_F:
+        return "BOX_F";
+    case Op::FADD:
+        return "FADD";
+    case Op::FSUB:
+        return "FSUB";
+    case Op::FMUL:
+        return "FMUL";
+    case Op::FDIV:
+        return "FDIV";
+    case Op::FNEG:
+        return "FNEG";
+    case Op::FLT:
+        return "FLT";
+    case Op::FGT:
+        return "FGT";
+    case Op::FLE:
+        return "FLE";
+    case Op::FGE:
+        return "FGE";
+    case Op::FEQ:
+        return "FEQ";
+    case Op::STORE_LOCAL:
+        return "STORE_LOCAL";
+    case Op::LOCAL_CONST:
+        return "LOCAL_CONST";
+    case Op::LOCAL_LOCAL:
+        return "LOCAL_LOCAL";
+    case Op::LOCAL_JUMP_FALSE:
+        return "LOCAL_JUMP_FALSE";
+    }
+    return "UNKNOWN";
+}
+
+std::string disassemble(const Program &program, std::uint32_t fn) {
+    const CompiledFunction &f = program.functions[fn];
+    std::ostringstream out;
+    out << fn << ' ' << f.name << " params " << f.params << " captures "
+        << f.captures << " frame " << f.frameSize << " stack " << f.stackSize
+        << '\n';
+    const std::uint8_t *code = f.code.data();
+    std::size_t pc = 0;
+    while (pc < f.code.size()) {
+        auto op = static_cast<Op>(code[pc]);
+        out << "  " << pc << ' ' << toString(op);
+        pc++;
+        switch (op) {
+        case Op::CONST:
+            out << ' ' << read16(code + pc) << " ; "
+                << program.constants[read16(code + pc)];
+            pc += 2;
+            break;
+        case Op::CLOSURE:
+        case Op::THUNK:
+        case Op::ALLOC:
+            out << ' ' << read16(code + pc) << " ; "
+                << program.functions[read16(code + pc)].name;
+            pc += 2;
+            break;
+        case Op::FRAME_CLOSURE:
+        case Op::FRAME_THUNK:
+        case Op::FRAME_ALLOC:
+            out << ' ' << read16(code + pc) << ' ' << read16(code + pc + 2)
+                << " ; " << program.functions[read16(code + pc)].name;
+            pc += 4;
+            break;
+        case Op::CONSTRUCT:
+            out << ' ' << read16(code + pc);
+            pc += 2;
+            break;
+        case Op::LOCAL:
+        case Op::ENV:
+        case Op::GLOBAL:
+        case Op::STORE:
+        case Op::FAIL:
+        case Op::FILL:
+        case Op::VEC:
+        case Op::IS_TAG:
+        case Op::FIELD:
+            out << ' ' << read16(code + pc);
+            pc += 2;
+            break;
+        case Op::JUMP:
+        case Op::JUMP_FALSE:
+            out << ' ' << read32(code + pc);
+            pc += 4;
+            break;
+        case Op::SWITCH: {
+            std::uint32_t n = read16(code + pc);
+            out << ' ' << n;
+            pc += 2;
+            for (std::uint32_t i = 0; i <= n; i++) {
+                out << ' ' << read32(code + pc);
+                pc += 4;
+            }
+            break;
+        }
+        case Op::PIPE:
+            out << ' ' << read16(code + pc) << ' ' << read16(code + pc + 2)
+                << ' ' << read16(code + pc + 4) << " ; "
+                << program.functions[read16(code + pc + 4)].name;
+            pc += 6;
+            break;
+        case Op::FOLDL:
+            out << ' ' << read16(code + pc) << ' ' << read16(code + pc + 2);
+            pc += 4;
+            break;
+        case Op::STORE_LOCAL:
+        case Op::LOCAL_LOCAL:
+            out << ' ' << read16(code + pc) << ' ' << read16(code + pc + 2);
+            pc += 4;
+            break;
+        case Op::LOCAL_CONST:
+            out << ' ' << read16(code + pc) << ' ' << read16(code + pc + 2)
+                << " ; " << program.constants[read16(code + pc + 2)];
+            pc += 4;
+            break;
+        case Op::LOCAL_JUMP_FALSE:
+            out << ' ' << read16(code + pc) << ' ' << read32(code + pc + 2);
+            pc += 6;
+            break;
+        case Op::VEC_REF:
+            out << (code[pc] ? " checked" : " unchecked");
+            pc++;
+            break;
+        default:
+            break;
+        }
+        out << '\n';
+    }
+    return out.str();
+}
+
+std::string disassemble(const Program &program) {
+    std::string text;
+    for (std::uint32_t fn = 0; fn < program.functions.size(); fn++) {
+        text += disassemble(program, fn);
+    }
+    return text;
+}
@@ -0,0 +1,179 @@
+#ifndef SPROUT_LANG_BYTECODE_H
+#define SPROUT_LANG_BYTECODE_H
+
+#include "closure.h"
+#include "ir.h"
+#include "symtab.h"
+#include "value.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * bytecode for the stack machine of vm.h, compiled from the ANF IR after
+ * closure conversion. each function is a byte string of an opcode followed
+ * by its operands, u16 indices and u32 absolute jump targets in little
+ * endian. a function runs in a frame of frameSize slots, its parameters
+ * first, with an operand stack on top of it. LOCAL and ENV are the fixed
+ * offset loads of closure.h, a frame slot or a capture of the running
+ * closure, and every other operation pops its operands and pushes its
+ * result. the callee of a frame, a closure or the thunk being evaluated,
+ * sits just below its first slot.
+ *
+ * every call in tail position is a TAIL_CALL, which moves the callee and
+ * arguments down over the frame and runs the callee in it, so tail
+ * recursion, mutual or through closures, runs in constant stack. in a thunk
+ * the frame still updates the thunk with the callee's result. a call that
+ * passes an object built in the frame, see below, keeps the frame and calls
+ * instead, returning at the RETURN that follows every TAIL_CALL. a function
+ * calling itself in tail position by name, like the loop of a named let,
+ * stores the arguments into its parameters and jumps to its start when it
+ * builds nothing in its frame.
+ *
+ * the closures and thunks that escape.h finds never outlive their frame are
+ * built by the FRAME_ variants in a region of frame slots past the bound
+ * variables instead of on the heap, one region per allocation site.
+ *
+ * floats are unboxed where the compiler can see every use. a variable of
+ * type float that is bound to float arithmetic or is an evaluated parameter
+ * of a function only ever called directly holds the raw bits of a double in
+ * its word, and such a function returns its float result raw. the F ops
+ * work on raw doubles, BOX_F allocates a FLOAT where a raw value meets code
+ * that expects words, and UNBOX_F reads a real number as a raw double.
+ *
+ * map, filter and foldl, fused or not, see fuse.h, run their stages in the
+ * vm. the tail of each cell a PIPE produces is a thunk capturing the stage
+ * functions and the rest of the source list, whose function is just the
+ * same PIPE again, one such function per shape of pipeline.
+ *
+ * the pairs of ops that run one after the other most often, by the op
+ * profile of vm.h over fib, tak, ackermann and nqueens, are fused into a
+ * superinstruction after a function is compiled, wherever no jump lands on
+ * the second op. a LOCAL mostly follows the STORE of a let's value, and is
+ * followed by a constant operand, another LOCAL or the test of a cond
+ */
+enum class Op : std::uint8_t {
+    CONST,      // u16 k, push constant k
+    LOCAL,      // u16 s, push frame slot s
+    ENV,        // u16 i, push capture i
+    GLOBAL,     // u16 g, push global g
+    STORE,      // u16 s, pop into frame slot s
+    JUMP,       // u32 target
+    JUMP_FALSE, // u32 target, pop and jump when it is #f
+    // u16 n then n + 1 u32 targets, pop a constructed value and jump by its
+    // tag, the last target for the tags without an arm
+    SWITCH,
+    FAIL,      // u16 k, raise the message in constant k
+    CALL,      // u16 n, call the closure below the n arguments
+    TAIL_CALL, // u16 n, the same in place of the running frame
+    RETURN,    // pop the frame, its result replaces the callee
+    FORCE,     // evaluate the thunk on top of the stack to WHNF
+    CLOSURE,   // u16 f, pop the captures of function f into a new closure
+    THUNK,     // u16 f, the same for a thunk
+    ALLOC,     // u16 f, a closure or thunk of f whose captures are unset
+    FILL,      // u16 s, pop the captures of the object in slot s into it
+    // u16 f then u16 s, CLOSURE, THUNK and ALLOC in the region from slot s
+    FRAME_CLOSURE,
+    FRAME_THUNK,
+    FRAME_ALLOC,
+    CONSTRUCT, // u16 c, pop the fields of constructor c
+    VEC,       // u16 n, pop n lazy elements
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    NEG,
+    LT,
+    GT,
+    LE,
+    GE,
+    NUM_EQ,
+    NOT,
+    CONS,
+    IS_NULL,
+    CAR, // the head of a cons cell, unevaluated, raising on '()
+    CDR,
+    APPEND,
+    // u16 n, u16 mask then u16 f, pop n stage functions and a list, bit i
+    // of mask set when stage i is a filter, and push the first cell of the
+    // pipeline over the list, its tail a thunk of function f
+    PIPE,
+    FOLDL, // u16 n, u16 mask, pop f, z, n stages and a list as PIPE
+    VEC_REF, // u8 checked, the element unevaluated
+    VEC_LEN,
+    VEC_MAP,
+    VEC_FOLD, // calls the function for the last element
+    EQ,
+    EQUAL,
+    IS_TAG, // u16 tag
+    FIELD,  // u16 i, field i of a boxed value or cons cell, unevaluated
+    UNBOX_F,
+    BOX_F,
+    FADD,
+    FSUB,
+    FMUL,
+    FDIV,
+    FNEG,
+    FLT,
+    FGT,
+    FLE,
+    FGE,
+    FEQ,
+    // superinstructions, two ops run by one dispatch, their operands those
+    // of the first op then those of the second
+    STORE_LOCAL,      // u16 s, u16 t
+    LOCAL_CONST,      // u16 s, u16 k
+    LOCAL_LOCAL,      // u16 s, u16 t
+    LOCAL_JUMP_FALSE, // u16 s, u32 target
+};
+
+constexpr std::size_t kOpCount =
+    static_cast<std::size_t>(Op::LOCAL_JUMP_FALSE) + 1;
+
+// the op after op is not the next one in its code, a jump, call, return or
+// force that may enter a thunk, or a failure
+bool transfersControl(Op op);
+
+struct CompiledFunction {
+    std::string name;
+    FunctionKind kind;
+    std::uint32_t params = 0;
+    std::uint32_t captures = 0;
+    std::uint32_t frameSize = 0; // slots, parameters and regions included
+    std::uint32_t stackSize = 0; // operand stack high water mark
+    std::vector<std::uint8_t> code;
+};
+
+struct Program {
+    std::vector<CompiledFunction> functions;
+    std::vector<Value> constants;
+    std::vector<std::uint32_t> globals; // function of each global
+    std::vector<std::uint32_t> exprs;   // function of each expression
+    std::vector<IrConstructor> constructors;
+    // thunks of (f x) and (f x y) with f, x and y captured, vec-map,
+    // vec-fold and the map stages of a PIPE delay their calls in them
+    std::uint32_t apply1 = 0;
+    std::uint32_t apply2 = 0;
+};
+
+struct CompileOptions {
+    // build the objects escape analysis keeps inside their frame there,
+    // otherwise every closure and thunk is on the heap
+    bool frameAllocate = true;
+    // keep floats raw where every use is known, otherwise every float is a
+    // FLOAT object
+    bool unboxFloats = true;
+    // fuse the superinstructions, otherwise every op is dispatched alone
+    bool superinstructions = true;
+};
+
+Program compileProgram(const IrModule &ir, const SymbolTable &symbols,
+                       const CompileOptions &options = {});
+
+std::string toString(Op op);
+// the disassembly of one function or of every function
+std::string disassemble(const Program &program, std::uint32_t fn);
+std::string disassemble(const Program &program);
+
+#endif
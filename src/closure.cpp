@@ -0,0 +1,146 @@
+#include "closure.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+static void walk(ClosureLayout &cl, const IrModule &ir, IrId id,
+                 std::uint32_t fn, std::uint32_t next);
+
+static void bind(ClosureLayout &cl, VarId var, std::uint32_t fn,
+                 std::uint32_t slot) {
+    cl.owner[var] = fn;
+    cl.slots[var] = slot;
+    cl.functions[fn].frameSize =
+        std::max(cl.functions[fn].frameSize, slot + 1);
+}
+
+// a use of var inside fn, captured when fn does not bind it
+static void use(ClosureLayout &cl, VarId var, std::uint32_t fn) {
+    if (cl.owner[var] == kNoFunction) {
+        throw std::runtime_error("variable " + std::to_string(var) +
+                                 " used outside its scope");
+    }
+    FunctionLayout &f = cl.functions[fn];
+    if (cl.owner[var] == fn || f.envIndex.contains(var)) {
+        return;
+    }
+    f.envIndex.emplace(var, static_cast<std::uint32_t>(f.captures.size()));
+    f.captures.push_back(var);
+}
+
+// a new function for body, its free variables are collected while walking
+// it and then become uses in the enclosing function parent
+static std::uint32_t function(ClosureLayout &cl, const IrModule &ir,
+                              FunctionKind kind, IrId node, IrId body,
+                              std::uint32_t parent) {
+    auto fn = static_cast<std::uint32_t>(cl.functions.size());
+    FunctionLayout layout;
+    layout.kind = kind;
+    layout.node = node;
+    layout.body = body;
+    if (node != kNoIr) {
+        if (!cl.functionOf.emplace(node, fn).second) {
+            throw std::runtime_error("IR node " + std::to_string(node) +
+                                     " is shared by two functions");
+        }
+        const IrNode &n = ir.nodes[node];
+        if (n.op == IrOp::LAMBDA) {
+            const std::uint32_t *ops = operandsOf(ir, n);
+            layout.params.assign(ops, ops + n.count);
+        }
+    }
+    cl.functions.push_back(std::move(layout));
+    std::vector<VarId> params = cl.functions[fn].params;
+    for (std::size_t i = 0; i < params.size(); i++) {
+        bind(cl, params[i], fn, static_cast<std::uint32_t>(i));
+    }
+    walk(cl, ir, body, fn, static_cast<std::uint32_t>(params.size()));
+    if (parent != kNoFunction) {
+        std::vector<VarId> captures = cl.functions[fn].captures;
+        for (VarId var : captures) {
+            use(cl, var, parent);
+        }
+    }
+    return fn;
+}
+
+static void walk(ClosureLayout &cl, const IrModule &ir, IrId id,
+                 std::uint32_t fn, std::uint32_t next) {
+    const IrNode &n = ir.nodes[id];
+    switch (n.op) {
+    case IrOp::VAR:
+        use(cl, n.a, fn);
+        return;
+    case IrOp::LET:
+        bind(cl, n.a, fn, next);
+        walk(cl, ir, n.b, fn, next);
+        walk(cl, ir, n.c, fn, next + 1);
+        return;
+    case IrOp::LETREC: {
+        const std::uint32_t *ops = operandsOf(ir, n);
+        std::uint32_t half = n.count / 2;
+        for (std::uint32_t i = 0; i < half; i++) {
+            bind(cl, ops[i], fn, next + i);
+        }
+        for (std::uint32_t i = half; i < n.count; i++) {
+            walk(cl, ir, ops[i], fn, next + half);
+        }
+        walk(cl, ir, n.c, fn, next + half);
+        return;
+    }
+    case IrOp::LAMBDA:
+        function(cl, ir, FunctionKind::LAMBDA, id, n.b, fn);
+        return;
+    case IrOp::THUNK:
+    case IrOp::TLAMBDA:
+        function(cl, ir, FunctionKind::THUNK, id, n.b, fn);
+        return;
+    default:
+        for (IrId child : children(ir, id)) {
+            walk(cl, ir, child, fn, next);
+        }
+    }
+}
+
+ClosureLayout convertClosures(const IrModule &ir) {
+    ClosureLayout cl;
+    cl.owner.assign(ir.vars.size(), kNoFunction);
+    cl.slots.assign(ir.vars.size(), 0);
+    for (const IrGlobal &global : ir.globals) {
+        const IrNode &body = ir.nodes[global.body];
+        if (body.op == IrOp::LAMBDA) {
+            cl.globals.push_back(function(cl, ir, FunctionKind::LAMBDA,
+                                          global.body, body.b, kNoFunction));
+            continue;
+        }
+        FunctionKind kind = global.lazy ? FunctionKind::THUNK
+                                        : FunctionKind::ROOT;
+        cl.globals.push_back(
+            function(cl, ir, kind, kNoIr, global.body, kNoFunction));
+    }
+    for (IrId expr : ir.exprs) {
+        cl.exprs.push_back(
+            function(cl, ir, FunctionKind::ROOT, kNoIr, expr, kNoFunction));
+    }
+    for (const FunctionLayout &f : cl.functions) {
+        if (f.node == kNoIr && !f.captures.empty()) {
+            throw std::runtime_error("a top level form has free variables");
+        }
+    }
+    return cl;
+}
+
+VarAccess varAccess(const ClosureLayout &layout, std::uint32_t fn,
+                    VarId var) {
+    if (layout.owner[var] == fn) {
+        return {true, layout.slots[var]};
+    }
+    const FunctionLayout &f = layout.functions[fn];
+    auto it = f.envIndex.find(var);
+    if (it == f.envIndex.end()) {
+        throw std::runtime_error("variable " + std::to_string(var) +
+                                 " is not captured by function " +
+                                 std::to_string(fn));
+    }
+    return {false, it->second};
+}
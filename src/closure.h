@@ -0,0 +1,63 @@
+#ifndef SPROUT_LANG_CLOSURE_H
+#define SPROUT_LANG_CLOSURE_H
+
+#include "ir.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * closure conversion of the ANF IR. every LAMBDA, THUNK and TLAMBDA node
+ * becomes a function of its own, as does the body of every top level define
+ * and expression. a function reads its parameters and the variables it
+ * binds from slots of its frame, and the variables of enclosing functions it
+ * uses, its free variables, from a flat closure: one allocation holding a
+ * copy of exactly those variables, made where the LAMBDA or THUNK is
+ * evaluated. a free variable of a nested function that the enclosing one
+ * does not bind is free in the enclosing one too, so it is copied down one
+ * closure at a time and never reached through a chain of environments.
+ *
+ * both kinds of access are fixed offsets known at compile time: slot s of
+ * the frame or capture i of the running closure. slots are numbered like a
+ * stack, the parameters first and then one per LET or LETREC variable in
+ * scope, so the branches of an IF or SWITCH reuse the same slots
+ */
+constexpr std::uint32_t kNoFunction = 0xffffffff;
+
+enum class FunctionKind : std::uint8_t {
+    LAMBDA, // called with arguments
+    THUNK,  // THUNK and TLAMBDA, and the body of a lazy global
+    ROOT,   // a top level expression or strict global, run once
+};
+
+struct FunctionLayout {
+    FunctionKind kind;
+    IrId node; // the LAMBDA, THUNK or TLAMBDA node, kNoIr for a root
+    IrId body;
+    std::vector<VarId> params;
+    std::vector<VarId> captures; // free variables in order of first use
+    std::unordered_map<VarId, std::uint32_t> envIndex; // into captures
+    std::uint32_t frameSize = 0; // parameters and let slots
+};
+
+struct ClosureLayout {
+    std::vector<FunctionLayout> functions;
+    std::unordered_map<IrId, std::uint32_t> functionOf; // by node
+    std::vector<std::uint32_t> owner; // per VarId, the function binding it
+    std::vector<std::uint32_t> slots; // per VarId, its slot in the owner
+    std::vector<std::uint32_t> globals; // function of each global
+    std::vector<std::uint32_t> exprs;   // function of each expression
+};
+
+ClosureLayout convertClosures(const IrModule &ir);
+
+// where function fn finds var, a frame slot or a capture
+struct VarAccess {
+    bool local;
+    std::uint32_t index;
+};
+
+VarAccess varAccess(const ClosureLayout &layout, std::uint32_t fn,
+                    VarId var);
+
+#endif
@@ -0,0 +1,232 @@
+#include "cse.h"
+
+#include <string>
+#include <unordered_map>
+
+struct Cse {
+    IrModule &ir;
+    std::vector<VarId> alias; // the variable a dropped one reads
+    // the value number of each variable bound to a shareable operation, and
+    // of the body of each variable bound to a thunk of one
+    std::vector<std::uint32_t> number;
+    std::vector<std::uint32_t> thunkNumber;
+    std::unordered_map<std::string, std::uint32_t> numbers; // by key
+    std::vector<std::string> keys;                          // by number
+    // the evaluated LETs and the thunks in scope by value number
+    std::unordered_map<std::uint32_t, VarId> values;
+    std::unordered_map<std::uint32_t, VarId> thunks;
+    CseStats stats;
+};
+
+static bool shareable(IrPrim prim) {
+    switch (prim) {
+    case IrPrim::CONS:
+    case IrPrim::APPEND:
+    case IrPrim::MAP:
+    case IrPrim::FILTER:
+    case IrPrim::FOLDL:
+    case IrPrim::PIPE:
+    case IrPrim::VEC_MAP:
+    case IrPrim::VEC_FOLD:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static VarId resolve(const Cse &s, VarId var) {
+    return s.alias[var] == kNoIr ? var : s.alias[var];
+}
+
+static std::uint32_t intern(Cse &s, const std::string &key) {
+    auto [it, added] =
+        s.numbers.emplace(key, static_cast<std::uint32_t>(s.keys.size()));
+    if (added) {
+        s.keys.push_back(key);
+    }
+    return it->second;
+}
+
+// a variable with a value number is keyed by it, so two variables computing
+// the same thing are the same operand
+static bool atomKey(const Cse &s, IrId id, std::string &key) {
+    const IrNode &n = s.ir.nodes[id];
+    switch (n.op) {
+    case IrOp::CONST:
+        key += 'k' + std::to_string(n.a);
+        return true;
+    case IrOp::GLOBAL:
+        key += 'g' + std::to_string(n.a);
+        return true;
+    case IrOp::VAR: {
+        VarId var = resolve(s, n.a);
+        if (s.number[var] != kNoIr) {
+            key += '#' + std::to_string(s.number[var]);
+        } else {
+            key += 'v' + std::to_string(var);
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// the key of a shareable operation on atoms, false for anything else. the
+// value of forcing a thunk of a known operation is that operation's
+static bool operationKey(const Cse &s, IrId id, std::string &key) {
+    const IrNode &n = s.ir.nodes[id];
+    switch (n.op) {
+    case IrOp::PRIM: {
+        if (!shareable(static_cast<IrPrim>(n.a))) {
+            return false;
+        }
+        key += '(' + std::to_string(n.a) + '.' + std::to_string(n.b) + '.' +
+               std::to_string(n.c) + ':' + std::to_string(n.type);
+        const std::uint32_t *ops = operandsOf(s.ir, n);
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            key += ' ';
+            if (!atomKey(s, ops[i], key)) {
+                return false;
+            }
+        }
+        key += ')';
+        return true;
+    }
+    case IrOp::FORCE:
+    case IrOp::TAPPLY: {
+        const IrNode &atom = s.ir.nodes[n.a];
+        if (n.op == IrOp::FORCE && atom.op == IrOp::VAR &&
+            s.thunkNumber[resolve(s, atom.a)] != kNoIr) {
+            key += s.keys[s.thunkNumber[resolve(s, atom.a)]];
+            return true;
+        }
+        key += (n.op == IrOp::FORCE ? "(force:" : "(tapply:") +
+               std::to_string(n.type) + ' ';
+        if (!atomKey(s, n.a, key)) {
+            return false;
+        }
+        key += ')';
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// the key of a thunk body of LETs of shareable operations ending in one,
+// its LETs are numbered by the walk of the body already
+static bool thunkKey(const Cse &s, IrId thunk, std::string &key) {
+    IrId id = s.ir.nodes[thunk].b;
+    while (s.ir.nodes[id].op == IrOp::LET) {
+        if (s.number[s.ir.nodes[id].a] == kNoIr) {
+            return false;
+        }
+        id = s.ir.nodes[id].c;
+    }
+    return operationKey(s, id, key);
+}
+
+static void walk(Cse &s, IrId id);
+
+// the LET at id shares an earlier value or thunk, or becomes one to share,
+// false when it was dropped and its body took its place
+static bool bind(Cse &s, IrId id, std::unordered_map<std::uint32_t, VarId> *&in,
+                 std::uint32_t &vn) {
+    const IrNode n = s.ir.nodes[id];
+    const IrNode value = s.ir.nodes[n.b];
+    std::string key;
+    if (value.op == IrOp::THUNK) {
+        if (!thunkKey(s, n.b, key)) {
+            return true;
+        }
+        vn = intern(s, key);
+        if (auto it = s.thunks.find(vn); it != s.thunks.end()) {
+            s.alias[n.a] = it->second;
+            s.ir.nodes[id] = s.ir.nodes[n.c];
+            s.stats.thunks++;
+            return false;
+        }
+        s.thunkNumber[n.a] = vn;
+        // the thunk is its value, read without a FORCE
+        if (auto it = s.values.find(vn); it != s.values.end()) {
+            s.ir.nodes[n.b] =
+                IrNode{IrOp::VAR, s.ir.vars[it->second].type, it->second};
+            s.stats.thunks++;
+            return true;
+        }
+        in = &s.thunks;
+        return true;
+    }
+    if (!operationKey(s, n.b, key)) {
+        return true;
+    }
+    vn = intern(s, key);
+    if (auto it = s.values.find(vn); it != s.values.end()) {
+        s.alias[n.a] = it->second;
+        s.ir.nodes[id] = s.ir.nodes[n.c];
+        s.stats.values++;
+        return false;
+    }
+    s.number[n.a] = vn;
+    // a thunk of the operation in scope, unless the LET already forces it
+    auto it = s.thunks.find(vn);
+    if (it != s.thunks.end() &&
+        !(value.op == IrOp::FORCE && s.ir.nodes[value.a].op == IrOp::VAR &&
+          resolve(s, s.ir.nodes[value.a].a) == it->second)) {
+        IrId thunk = addNode(
+            s.ir, IrNode{IrOp::VAR, s.ir.vars[it->second].type, it->second});
+        s.ir.nodes[n.b] = IrNode{IrOp::FORCE, value.type, thunk};
+        s.stats.forced++;
+    }
+    in = &s.values;
+    return true;
+}
+
+static void walk(Cse &s, IrId id) {
+    const IrNode n = s.ir.nodes[id];
+    if (n.op == IrOp::VAR) {
+        s.ir.nodes[id].a = resolve(s, n.a);
+        return;
+    }
+    if (n.op != IrOp::LET) {
+        for (IrId child : children(s.ir, id)) {
+            walk(s, child);
+        }
+        return;
+    }
+    walk(s, n.b);
+    std::unordered_map<std::uint32_t, VarId> *in = nullptr;
+    std::uint32_t vn = kNoIr;
+    if (!bind(s, id, in, vn)) {
+        walk(s, id);
+        return;
+    }
+    // in scope for the body only
+    if (in) {
+        in->emplace(vn, n.a);
+    }
+    walk(s, n.c);
+    if (in) {
+        in->erase(vn);
+    }
+}
+
+CseStats eliminateCommonSubexpressions(IrModule &ir) {
+    Cse s{ir,
+          std::vector<VarId>(ir.vars.size(), kNoIr),
+          std::vector<std::uint32_t>(ir.vars.size(), kNoIr),
+          std::vector<std::uint32_t>(ir.vars.size(), kNoIr),
+          {},
+          {},
+          {},
+          {},
+          {}};
+    for (IrId expr : ir.exprs) {
+        walk(s, expr);
+    }
+    for (const IrGlobal &global : ir.globals) {
+        walk(s, global.body);
+    }
+    return s.stats;
+}
@@ -0,0 +1,37 @@
+#ifndef SPROUT_LANG_CSE_H
+#define SPROUT_LANG_CSE_H
+
+#include "ir.h"
+
+/*
+ * common subexpression elimination over the ANF IR. sprout has no side
+ * effects, so two LETs binding the same operation on the same atoms have the
+ * same value wherever the first one is in scope. walking each body in
+ * evaluation order, the values of the LETs in scope are kept by a key of
+ * their operation, type and operands, with variables already replaced read
+ * as the one replacing them, so chains of repeated accessors collapse from
+ * the inside out:
+ *  arithmetic, comparisons, car/cdr, fields, tags, vec-ref/vec-len, eq? and
+ *  equal?, a FORCE of an atom and a TAPPLY
+ * operations that build something new, a cons, closure or constructed value,
+ * and calls, whose result may be one, are never shared, eq? tells their
+ * results apart.
+ *
+ * sharing keeps laziness as it was. an evaluated LET repeating one in scope
+ * reads its variable, and a thunk repeating a thunk in scope, the same
+ * operations up to the names of their own LETs, is that thunk. a thunk of
+ * an operation already evaluated in scope is its value, and an evaluated
+ * operation whose thunk is in scope forces that thunk, which runs it at a
+ * place it ran anyway and shares the result with the other forces. no
+ * thunk is ever made for what was evaluated
+ */
+struct CseStats {
+    int values = 0; // evaluated LETs reading an earlier variable
+    int thunks = 0; // thunks replaced by an earlier thunk or value
+    int forced = 0; // evaluated LETs forcing an earlier thunk instead
+};
+
+// rewrites ir in place, run it before analyzeStrictness
+CseStats eliminateCommonSubexpressions(IrModule &ir);
+
+#endif
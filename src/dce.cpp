@@ -0,0 +1,293 @@
+#include "dce.h"
+
+#include <sstream>
+
+// the nodes below the roots that are not seen yet, each once
+static void reach(const IrModule &ir, const std::vector<IrId> &roots,
+                  std::vector<bool> &seen, std::vector<IrId> &order) {
+    std::vector<IrId> stack(roots.rbegin(), roots.rend());
+    while (!stack.empty()) {
+        IrId id = stack.back();
+        stack.pop_back();
+        if (seen[id]) {
+            continue;
+        }
+        seen[id] = true;
+        order.push_back(id);
+        for (IrId child : children(ir, id)) {
+            stack.push_back(child);
+        }
+    }
+}
+
+// evaluating the node always succeeds, so dropping it cannot hide an error
+static bool cannotFail(const IrModule &ir, IrId id) {
+    const IrNode &n = ir.nodes[id];
+    switch (n.op) {
+    case IrOp::CONST:
+    case IrOp::VAR:
+    case IrOp::GLOBAL:
+    case IrOp::LAMBDA:
+    case IrOp::THUNK:
+    case IrOp::TLAMBDA:
+    case IrOp::VEC:
+    case IrOp::CON:
+        return true;
+    case IrOp::PRIM:
+        switch (static_cast<IrPrim>(n.a)) {
+        case IrPrim::LT:
+        case IrPrim::GT:
+        case IrPrim::LE:
+        case IrPrim::GE:
+        case IrPrim::NUM_EQ:
+        case IrPrim::NOT:
+        case IrPrim::CONS:
+        case IrPrim::IS_NULL:
+        case IrPrim::VEC_LEN:
+        case IrPrim::EQ:
+        case IrPrim::IS_TAG:
+        case IrPrim::FIELD:
+            return true;
+        default:
+            return false;
+        }
+    default:
+        return false;
+    }
+}
+
+static bool unused(const std::vector<std::uint32_t> &uses, const IrModule &ir,
+                   const IrNode &n) {
+    if (n.op == IrOp::LET) {
+        return uses[n.a] == 0 && cannotFail(ir, n.b);
+    }
+    const std::uint32_t *ops = operandsOf(ir, n);
+    for (std::uint32_t i = 0; i < n.count / 2; i++) {
+        if (uses[ops[i]] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// one round of dropping the bindings that are dead by the current counts,
+// a dropped binding takes the place of its body
+static int dropBindings(IrModule &ir, const std::vector<IrId> &roots) {
+    std::vector<bool> seen(ir.nodes.size(), false);
+    std::vector<IrId> nodes;
+    reach(ir, roots, seen, nodes);
+    std::vector<std::uint32_t> uses(ir.vars.size(), 0);
+    for (IrId id : nodes) {
+        if (ir.nodes[id].op == IrOp::VAR) {
+            uses[ir.nodes[id].a]++;
+        }
+    }
+    int dropped = 0;
+    for (IrId id : nodes) {
+        for (;;) {
+            const IrNode &n = ir.nodes[id];
+            if ((n.op != IrOp::LET && n.op != IrOp::LETREC) ||
+                !unused(uses, ir, n)) {
+                break;
+            }
+            dropped += n.op == IrOp::LET ? 1 : static_cast<int>(n.count / 2);
+            ir.nodes[id] = ir.nodes[n.c];
+        }
+    }
+    return dropped;
+}
+
+// the arena rebuilt from the kept nodes, in the order they were reached,
+// with every reference to a node, global, constructor or constant
+// renumbered
+static void compact(IrModule &ir, const std::vector<IrId> &nodes,
+                    const std::vector<std::uint32_t> &globalIndex,
+                    const std::vector<std::uint32_t> &constructorIndex,
+                    const std::vector<std::uint32_t> &constantIndex) {
+    std::vector<IrId> index(ir.nodes.size(), kNoIr);
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+        index[nodes[i]] = static_cast<IrId>(i);
+    }
+    auto node = [&](IrId id) { return id == kNoIr ? kNoIr : index[id]; };
+    IrModule kept;
+    kept.nodes.reserve(nodes.size());
+    for (IrId id : nodes) {
+        IrNode n = ir.nodes[id];
+        std::vector<std::uint32_t> ops(operandsOf(ir, n),
+                                       operandsOf(ir, n) + n.count);
+        // the operands that are nodes, LAMBDA parameters and LETREC
+        // variables are not
+        std::uint32_t from = 0;
+        switch (n.op) {
+        case IrOp::CONST:
+        case IrOp::FAIL:
+            n.a = constantIndex[n.a];
+            break;
+        case IrOp::GLOBAL:
+            n.a = globalIndex[n.a];
+            break;
+        case IrOp::VAR:
+            break;
+        case IrOp::LET:
+            n.b = node(n.b);
+            n.c = node(n.c);
+            break;
+        case IrOp::LETREC:
+            from = n.count / 2;
+            n.c = node(n.c);
+            break;
+        case IrOp::IF:
+            n.a = node(n.a);
+            n.b = node(n.b);
+            n.c = node(n.c);
+            break;
+        case IrOp::SWITCH:
+            n.a = node(n.a);
+            n.c = node(n.c);
+            break;
+        case IrOp::PRIM:
+            if (static_cast<IrPrim>(n.a) == IrPrim::FIELD && n.b != kNoIr) {
+                n.b = constructorIndex[n.b];
+            }
+            break;
+        case IrOp::APP:
+        case IrOp::FORCE:
+        case IrOp::TAPPLY:
+            n.a = node(n.a);
+            break;
+        case IrOp::LAMBDA:
+            from = n.count;
+            n.b = node(n.b);
+            break;
+        case IrOp::THUNK:
+        case IrOp::TLAMBDA:
+            n.b = node(n.b);
+            break;
+        case IrOp::VEC:
+            break;
+        case IrOp::CON:
+            n.a = constructorIndex[n.a];
+            break;
+        }
+        for (std::uint32_t i = from; i < n.count; i++) {
+            ops[i] = node(ops[i]);
+        }
+        n.first = static_cast<std::uint32_t>(kept.operands.size());
+        kept.operands.insert(kept.operands.end(), ops.begin(), ops.end());
+        kept.nodes.push_back(n);
+    }
+    for (IrGlobal &global : ir.globals) {
+        global.body = node(global.body);
+    }
+    for (IrId &expr : ir.exprs) {
+        expr = index[expr];
+    }
+    ir.nodes = std::move(kept.nodes);
+    ir.operands = std::move(kept.operands);
+}
+
+DeadCodeReport eliminateDeadCode(IrModule &ir, const SymbolTable &symbols) {
+    DeadCodeReport report;
+    std::vector<IrId> bodies = ir.exprs;
+    for (const IrGlobal &global : ir.globals) {
+        bodies.push_back(global.body);
+    }
+    while (int dropped = dropBindings(ir, bodies)) {
+        report.bindings += dropped;
+    }
+
+    // the defines reachable from the top level expressions, and the nodes
+    // of every kept body
+    std::vector<bool> keepGlobal(ir.globals.size(), false);
+    std::vector<bool> seen(ir.nodes.size(), false);
+    std::vector<IrId> nodes;
+    std::vector<IrId> work = ir.exprs;
+    while (!work.empty()) {
+        std::size_t from = nodes.size();
+        reach(ir, work, seen, nodes);
+        work.clear();
+        for (std::size_t i = from; i < nodes.size(); i++) {
+            const IrNode &n = ir.nodes[nodes[i]];
+            if (n.op == IrOp::GLOBAL && !keepGlobal[n.a]) {
+                keepGlobal[n.a] = true;
+                work.push_back(ir.globals[n.a].body);
+            }
+        }
+    }
+    std::vector<bool> keepConstructor(ir.constructors.size(), false);
+    std::vector<bool> keepConstant(ir.constants.size(), false);
+    for (IrId id : nodes) {
+        const IrNode &n = ir.nodes[id];
+        if (n.op == IrOp::CONST || n.op == IrOp::FAIL) {
+            keepConstant[n.a] = true;
+        } else if (n.op == IrOp::CON) {
+            keepConstructor[n.a] = true;
+        } else if (n.op == IrOp::PRIM &&
+                   static_cast<IrPrim>(n.a) == IrPrim::FIELD && n.b != kNoIr) {
+            keepConstructor[n.b] = true;
+        }
+    }
+
+    // the new index of every kept entry, dropped ones are reported
+    auto renumber = [](const std::vector<bool> &keep) {
+        std::vector<std::uint32_t> index(keep.size(), kNoIr);
+        std::uint32_t next = 0;
+        for (std::size_t i = 0; i < keep.size(); i++) {
+            if (keep[i]) {
+                index[i] = next++;
+            }
+        }
+        return index;
+    };
+    std::vector<std::uint32_t> globalIndex = renumber(keepGlobal);
+    std::vector<std::uint32_t> constructorIndex = renumber(keepConstructor);
+    std::vector<std::uint32_t> constantIndex = renumber(keepConstant);
+    report.nodes = static_cast<int>(ir.nodes.size() - nodes.size());
+    compact(ir, nodes, globalIndex, constructorIndex, constantIndex);
+
+    std::vector<IrGlobal> globals;
+    for (std::size_t g = 0; g < ir.globals.size(); g++) {
+        if (keepGlobal[g]) {
+            globals.push_back(ir.globals[g]);
+        } else {
+            report.globals.push_back(symbols.name(ir.globals[g].name));
+        }
+    }
+    ir.globals = std::move(globals);
+    std::vector<IrConstructor> constructors;
+    for (std::size_t i = 0; i < ir.constructors.size(); i++) {
+        if (keepConstructor[i]) {
+            constructors.push_back(ir.constructors[i]);
+        } else {
+            report.constructors.push_back(
+                symbols.name(ir.constructors[i].name));
+        }
+    }
+    ir.constructors = std::move(constructors);
+    std::vector<Value> constants;
+    for (std::size_t i = 0; i < ir.constants.size(); i++) {
+        if (keepConstant[i]) {
+            constants.push_back(std::move(ir.constants[i]));
+        }
+    }
+    report.constants =
+        static_cast<int>(ir.constants.size() - constants.size());
+    ir.constants = std::move(constants);
+    return report;
+}
+
+std::string toString(const DeadCodeReport &report) {
+    std::ostringstream out;
+    out << "defines removed:";
+    for (const std::string &name : report.globals) {
+        out << ' ' << name;
+    }
+    out << "\nconstructors removed:";
+    for (const std::string &name : report.constructors) {
+        out << ' ' << name;
+    }
+    out << "\nconstants removed: " << report.constants
+        << "\ndead bindings removed: " << report.bindings
+        << "\nIR nodes removed: " << report.nodes << '\n';
+    return out.str();
+}
@@ -0,0 +1,36 @@
+#ifndef SPROUT_LANG_DCE_H
+#define SPROUT_LANG_DCE_H
+
+#include "ir.h"
+#include "symtab.h"
+#include <string>
+#include <vector>
+
+/*
+ * dead code elimination and whole program tree shaking over the ANF IR.
+ *
+ * inside every body a LET or LETREC whose variables are never used is
+ * dropped when evaluating its value cannot fail or loop, an allocation, an
+ * atom or a primitive that always succeeds, until no more bindings die.
+ *
+ * the top level expressions are the entry points. the defines reachable
+ * from them through GLOBAL atoms are kept, and of the data constructors and
+ * constants only the ones a kept body builds, reads a field of or loads.
+ * everything else is dropped and the rest renumbered, so bytecode, the
+ * globals the vm allocates on load and the constants it materializes on
+ * the heap only cover what the program uses. the node arena is rebuilt
+ * from the kept nodes, which also drops what earlier passes left behind
+ */
+struct DeadCodeReport {
+    std::vector<std::string> globals;      // names of the dropped defines
+    std::vector<std::string> constructors; // and data constructors
+    int constants = 0;                     // constants dropped
+    int bindings = 0;                      // dead LET and LETREC variables
+    int nodes = 0;                         // IR nodes dropped
+};
+
+// rewrites ir in place
+DeadCodeReport eliminateDeadCode(IrModule &ir, const SymbolTable &symbols);
+std::string toString(const DeadCodeReport &report);
+
+#endif
@@ -0,0 +1,265 @@
+#include "escape.h"
+
+#include <unordered_map>
+#include <vector>
+
+// what one occurrence of a tracked variable does with it
+struct EscapeUse {
+    bool escapes = false;
+    IrId callee = kNoIr; // the LAMBDA it is passed to
+    std::uint32_t param = 0;
+    // bound to another variable by a LET, the use escapes when that does
+    VarId alias = kNoIr;
+    // forced, which is the identity on a closure, so the result only
+    // escapes like the variable when it may hold one. a forced result that
+    // is not bound to an alias is returned
+    bool forced = false;
+    std::vector<IrId> through; // functions between its binding and the use
+};
+
+struct Escape {
+    const IrModule &ir;
+    std::vector<bool> tracked;
+    std::vector<bool> escaped;
+    std::vector<bool> closure; // may hold a LAMBDA bound in a frame
+    std::vector<std::size_t> depth; // of the function chain at the binding
+    std::vector<std::vector<EscapeUse>> uses;
+    std::unordered_map<IrId, VarId> varOf;   // allocation node to variable
+    std::unordered_map<VarId, IrId> lambdas; // variables bound to a LAMBDA
+};
+
+static bool isAllocation(const IrNode &n) {
+    return n.op == IrOp::LAMBDA || n.op == IrOp::THUNK ||
+           n.op == IrOp::TLAMBDA;
+}
+
+static void track(Escape &e, VarId var, const std::vector<IrId> &chain) {
+    e.tracked[var] = true;
+    e.depth[var] = chain.size();
+}
+
+static void use(Escape &e, IrId atom, const std::vector<IrId> &chain,
+                EscapeUse u) {
+    const IrNode &n = e.ir.nodes[atom];
+    if (n.op != IrOp::VAR || !e.tracked[n.a]) {
+        return;
+    }
+    auto from = chain.begin() + static_cast<std::ptrdiff_t>(e.depth[n.a]);
+    u.through.assign(from, chain.end());
+    e.uses[n.a].push_back(std::move(u));
+}
+
+static void escape(Escape &e, IrId atom, const std::vector<IrId> &chain) {
+    EscapeUse u;
+    u.escapes = true;
+    use(e, atom, chain, u);
+}
+
+static void bindValue(Escape &e, VarId var, IrId value,
+                      const std::vector<IrId> &chain) {
+    const IrNode &n = e.ir.nodes[value];
+    if (!isAllocation(n)) {
+        return;
+    }
+    track(e, var, chain);
+    e.varOf[value] = var;
+    if (n.op == IrOp::LAMBDA) {
+        e.lambdas[var] = value;
+    }
+}
+
+static void walk(Escape &e, IrId id, std::vector<IrId> &chain) {
+    const IrNode &n = e.ir.nodes[id];
+    const std::uint32_t *ops = operandsOf(e.ir, n);
+    switch (n.op) {
+    case IrOp::CONST:
+    case IrOp::GLOBAL:
+    case IrOp::FAIL:
+        return;
+    // an atom in value position is returned or aliased
+    case IrOp::VAR:
+        escape(e, id, chain);
+        return;
+    case IrOp::LET: {
+        const IrNode &value = e.ir.nodes[n.b];
+        if (value.op == IrOp::VAR || value.op == IrOp::FORCE ||
+            value.op == IrOp::TAPPLY) {
+            track(e, n.a, chain);
+            EscapeUse u;
+            u.alias = n.a;
+            u.forced = value.op != IrOp::VAR;
+            use(e, value.op == IrOp::VAR ? n.b : value.a, chain, u);
+        } else {
+            bindValue(e, n.a, n.b, chain);
+            walk(e, n.b, chain);
+        }
+        walk(e, n.c, chain);
+        return;
+    }
+    case IrOp::LETREC: {
+        std::uint32_t half = n.count / 2;
+        for (std::uint32_t i = 0; i < half; i++) {
+            bindValue(e, ops[i], ops[half + i], chain);
+        }
+        for (std::uint32_t i = half; i < n.count; i++) {
+            walk(e, ops[i], chain);
+        }
+        walk(e, n.c, chain);
+        return;
+    }
+    case IrOp::IF:
+        walk(e, n.b, chain);
+        walk(e, n.c, chain);
+        return;
+    case IrOp::SWITCH:
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            if (ops[i] != kNoIr) {
+                walk(e, ops[i], chain);
+            }
+        }
+        if (n.c != kNoIr) {
+            walk(e, n.c, chain);
+        }
+        return;
+    case IrOp::FORCE:
+    case IrOp::TAPPLY: {
+        EscapeUse u;
+        u.forced = true;
+        use(e, n.a, chain, u);
+        return;
+    }
+    case IrOp::APP: {
+        use(e, n.a, chain, EscapeUse{});
+        IrId callee = knownLambda(e.ir, e.lambdas, n.a);
+        bool known = callee != kNoIr && e.ir.nodes[callee].count == n.count;
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            EscapeUse u;
+            u.escapes = !known;
+            u.callee = known ? callee : kNoIr;
+            u.param = i;
+            use(e, ops[i], chain, u);
+        }
+        return;
+    }
+    case IrOp::LAMBDA:
+    case IrOp::THUNK:
+    case IrOp::TLAMBDA:
+        chain.push_back(id);
+        if (n.op == IrOp::LAMBDA) {
+            for (std::uint32_t i = 0; i < n.count; i++) {
+                track(e, ops[i], chain);
+            }
+        }
+        walk(e, n.b, chain);
+        chain.pop_back();
+        return;
+    case IrOp::PRIM:
+    case IrOp::VEC:
+    case IrOp::CON:
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            escape(e, ops[i], chain);
+        }
+        return;
+    }
+}
+
+// a function between a binding and its use keeps the use inside the frame
+// only when it stays inside the frame itself
+static bool functionEscapes(const Escape &e, IrId fn) {
+    auto it = e.varOf.find(fn);
+    return it == e.varOf.end() || e.escaped[it->second];
+}
+
+static bool useEscapes(const Escape &e, VarId var, const EscapeUse &u) {
+    if (u.escapes) {
+        return true;
+    }
+    // forcing anything but a closure yields some other value
+    bool same = !u.forced || e.closure[var];
+    if (same && u.forced && u.alias == kNoIr) {
+        return true;
+    }
+    if (same && u.alias != kNoIr && e.escaped[u.alias]) {
+        return true;
+    }
+    if (u.callee != kNoIr &&
+        e.escaped[operandsOf(e.ir, e.ir.nodes[u.callee])[u.param]]) {
+        return true;
+    }
+    for (IrId fn : u.through) {
+        if (functionEscapes(e, fn)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+EscapeInfo analyzeEscapes(const IrModule &ir) {
+    std::size_t vars = ir.vars.size();
+    Escape e{ir,
+             std::vector<bool>(vars, false),
+             std::vector<bool>(vars, false),
+             std::vector<bool>(vars, false),
+             std::vector<std::size_t>(vars, 0),
+             std::vector<std::vector<EscapeUse>>(vars),
+             {},
+             {}};
+    std::vector<IrId> chain;
+    for (const IrGlobal &global : ir.globals) {
+        walk(e, global.body, chain);
+    }
+    for (IrId expr : ir.exprs) {
+        walk(e, expr, chain);
+    }
+    // the variables a closure flows into through arguments and forces
+    for (const auto &[var, lambda] : e.lambdas) {
+        e.closure[var] = true;
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (VarId var = 0; var < vars; var++) {
+            if (!e.closure[var]) {
+                continue;
+            }
+            for (const EscapeUse &u : e.uses[var]) {
+                VarId to = u.alias;
+                if (u.callee != kNoIr) {
+                    to = operandsOf(ir, ir.nodes[u.callee])[u.param];
+                }
+                if (to != kNoIr && !e.closure[to]) {
+                    e.closure[to] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+    // escaping only ever spreads, so this reaches the greatest fixpoint
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (VarId var = 0; var < vars; var++) {
+            if (!e.tracked[var] || e.escaped[var]) {
+                continue;
+            }
+            for (const EscapeUse &u : e.uses[var]) {
+                if (useEscapes(e, var, u)) {
+                    e.escaped[var] = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    EscapeInfo info;
+    for (const auto &[node, var] : e.varOf) {
+        if (e.escaped[var]) {
+            continue;
+        }
+        info.local.insert(node);
+        if (ir.nodes[node].op == IrOp::LAMBDA) {
+            info.closures++;
+        } else {
+            info.thunks++;
+        }
+    }
+    return info;
+}
@@ -0,0 +1,33 @@
+#ifndef SPROUT_LANG_ESCAPE_H
+#define SPROUT_LANG_ESCAPE_H
+
+#include "ir.h"
+#include <unordered_set>
+
+/*
+ * escape analysis over the ANF IR. a LAMBDA, THUNK or TLAMBDA bound by a LET
+ * or LETREC does not escape when no use of its variable can outlive the
+ * frame of the function that binds it. the uses that keep it inside are
+ *  calling it, forcing it or applying it to a type
+ *  passing it to a known function whose parameter does not escape in turn
+ *  capturing it in a closure or thunk that does not escape either
+ *  binding it to another variable that does not escape, forcing a closure
+ *  being the identity
+ * returning it, storing it in a cons, vec or constructed value, or passing
+ * it to an unknown function or a primitive makes it escape. parameters are
+ * tracked like bindings and the analysis is an optimistic fixpoint, so a
+ * recursive function that only calls its function argument keeps it in the
+ * frame.
+ *
+ * the objects that do not escape are allocated in the frame of the function
+ * that creates them instead of on the heap, see bytecode.h
+ */
+struct EscapeInfo {
+    std::unordered_set<IrId> local; // allocation nodes kept in the frame
+    int closures = 0;               // of them LAMBDA
+    int thunks = 0;                 // THUNK and TLAMBDA
+};
+
+EscapeInfo analyzeEscapes(const IrModule &ir);
+
+#endif
@@ -0,0 +1,390 @@
+#include "fold.h"
+#include "cell.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+
+struct Folder {
+    IrModule &ir;
+    std::vector<std::uint32_t> vars;    // the constant a variable holds
+    std::vector<std::uint32_t> globals; // the constant a global's body is
+    FoldStats stats;
+};
+
+// the rank of a number in the tower as the vm orders it, -1 otherwise
+static int numericRank(const Value &v) {
+    if (isInt(v)) {
+        return 0;
+    } else if (isRational(v)) {
+        return 1;
+    } else if (isDouble(v)) {
+        return 2;
+    } else if (isComplex(v)) {
+        return 3;
+    }
+    return -1;
+}
+
+static Rational asRational(const Value &v) {
+    if (isInt(v)) {
+        return Rational(std::get<int>(v.v), 1);
+    }
+    return std::get<Rational>(v.v);
+}
+
+static double asDouble(const Value &v) {
+    if (isInt(v)) {
+        return static_cast<double>(std::get<int>(v.v));
+    } else if (isRational(v)) {
+        return static_cast<double>(std::get<Rational>(v.v));
+    }
+    return std::get<double>(v.v);
+}
+
+static Complex asComplex(const Value &v) {
+    if (isComplex(v)) {
+        return std::get<Complex>(v.v);
+    }
+    return Complex(asDouble(v));
+}
+
+template <typename T> static T apply(IrPrim op, const T &a, const T &b) {
+    switch (op) {
+    case IrPrim::ADD:
+        return a + b;
+    case IrPrim::SUB:
+        return a - b;
+    case IrPrim::MUL:
+        return a * b;
+    default:
+        return a / b;
+    }
+}
+
+static std::optional<Value> arithmetic(IrPrim op, const Value &a,
+                                       const Value &b) {
+    if (numericRank(a) < 0 || numericRank(b) < 0) {
+        return std::nullopt;
+    }
+    int rank = std::max(numericRank(a), numericRank(b));
+    if (op == IrPrim::DIV && rank == 0) {
+        rank = 1;
+    }
+    // the vm only takes % of fixnums
+    if (op == IrPrim::MOD && rank != 0) {
+        return std::nullopt;
+    }
+    switch (rank) {
+    case 0: {
+        std::int64_t x = std::get<int>(a.v);
+        std::int64_t y = std::get<int>(b.v);
+        std::int64_t z = 0;
+        if (op == IrPrim::MOD) {
+            if (y == 0) {
+                return std::nullopt;
+            }
+            z = x % y;
+        } else {
+            z = apply(op, x, y);
+        }
+        if (z < std::numeric_limits<int>::min() ||
+            z > std::numeric_limits<int>::max()) {
+            return std::nullopt;
+        }
+        return Value(static_cast<int>(z));
+    }
+    case 1:
+        try {
+            return Value(apply(op, asRational(a), asRational(b)));
+        } catch (const std::runtime_error &) {
+            return std::nullopt;
+        }
+    case 2:
+        return Value(apply(op, asDouble(a), asDouble(b)));
+    default:
+        return Value(apply(op, asComplex(a), asComplex(b)));
+    }
+}
+
+// floats negate in place rather than as 0 - x, which loses the sign of 0.0
+static std::optional<Value> negate(const Value &v) {
+    switch (numericRank(v)) {
+    case 2:
+        return Value(-std::get<double>(v.v));
+    case 3: {
+        const Complex &c = std::get<Complex>(v.v);
+        return Value(Complex(-c.re, -c.im));
+    }
+    default:
+        return arithmetic(IrPrim::SUB, Value(0), v);
+    }
+}
+
+template <typename T> static bool order(IrPrim op, const T &a, const T &b) {
+    switch (op) {
+    case IrPrim::LT:
+        return a < b;
+    case IrPrim::GT:
+        return a > b;
+    case IrPrim::LE:
+        return a <= b;
+    case IrPrim::GE:
+        return a >= b;
+    default:
+        return a == b;
+    }
+}
+
+static std::optional<Value> compare(IrPrim op, const Value &a,
+                                    const Value &b) {
+    if (numericRank(a) < 0 || numericRank(b) < 0) {
+        return std::nullopt;
+    }
+    switch (std::max(numericRank(a), numericRank(b))) {
+    case 0:
+        return Value(order(op, std::get<int>(a.v), std::get<int>(b.v)));
+    case 1: {
+        // cross multiplied like the vm
+        Rational x = asRational(a);
+        Rational y = asRational(b);
+        return Value(order(op,
+                           static_cast<long long>(x.numerator) * y.denominator,
+                           static_cast<long long>(y.numerator) *
+                               x.denominator));
+    }
+    case 2:
+        return Value(order(op, asDouble(a), asDouble(b)));
+    default:
+        // every comparison of complex numbers is equality in the vm
+        return Value(asComplex(a) == asComplex(b));
+    }
+}
+
+// equal? of two constants, values of different kinds are different words
+static bool equalConstants(const Value &a, const Value &b) {
+    if (a.v.index() != b.v.index()) {
+        return false;
+    }
+    if (!isList(a)) {
+        return a == b;
+    }
+    const List &x = std::get<List>(a.v);
+    const List &y = std::get<List>(b.v);
+    if (!x || !y) {
+        return !x && !y;
+    }
+    return equalConstants(head(x), head(y)) &&
+           equalConstants(tail(x), tail(y));
+}
+
+// eq? of two constants, known for the immediates and interned symbols, every
+// other constant is its own object
+static std::optional<Value> eqConstants(const Value &a, const Value &b) {
+    bool immediate = isInt(a) || isBool(a) || isChar(a) || isSymbol(a) ||
+                     (isList(a) && !std::get<List>(a.v));
+    if (!immediate) {
+        return std::nullopt;
+    }
+    return Value(equalConstants(a, b));
+}
+
+// the value of a primitive of constant operands, none when it is left to
+// the runtime
+static std::optional<Value> evaluate(const IrModule &ir, const IrNode &n) {
+    const std::uint32_t *ops = operandsOf(ir, n);
+    auto arg = [&](std::uint32_t i) -> const Value & {
+        return ir.constants[ir.nodes[ops[i]].a];
+    };
+    auto prim = static_cast<IrPrim>(n.a);
+    switch (prim) {
+    case IrPrim::ADD:
+    case IrPrim::MUL:
+        if (n.count == 1) {
+            return arg(0);
+        }
+        return arithmetic(prim, arg(0), arg(1));
+    case IrPrim::SUB:
+        if (n.count == 1) {
+            return negate(arg(0));
+        }
+        return arithmetic(prim, arg(0), arg(1));
+    case IrPrim::DIV:
+    case IrPrim::MOD:
+        return arithmetic(prim, arg(0), arg(1));
+    case IrPrim::LT:
+    case IrPrim::GT:
+    case IrPrim::LE:
+    case IrPrim::GE:
+    case IrPrim::NUM_EQ:
+        return compare(prim, arg(0), arg(1));
+    case IrPrim::NOT:
+        if (!isBool(arg(0))) {
+            return std::nullopt;
+        }
+        return Value(!std::get<bool>(arg(0).v));
+    case IrPrim::IS_NULL:
+        if (!isList(arg(0))) {
+            return std::nullopt;
+        }
+        return Value(!std::get<List>(arg(0).v));
+    case IrPrim::CAR:
+    case IrPrim::CDR: {
+        if (!isList(arg(0)) || !std::get<List>(arg(0).v)) {
+            return std::nullopt;
+        }
+        const List &cell = std::get<List>(arg(0).v);
+        return prim == IrPrim::CAR ? head(cell) : tail(cell);
+    }
+    case IrPrim::EQUAL:
+        return Value(equalConstants(arg(0), arg(1)));
+    case IrPrim::EQ:
+        return eqConstants(arg(0), arg(1));
+    default:
+        return std::nullopt;
+    }
+}
+
+// node id becomes constant k, keeping its type
+static void becomeConstant(Folder &f, IrId id, std::uint32_t k) {
+    IrNode &n = f.ir.nodes[id];
+    n = IrNode{IrOp::CONST, n.type, k, 0, 0, 0, 0};
+}
+
+static bool isConstant(const Folder &f, IrId id) {
+    return f.ir.nodes[id].op == IrOp::CONST;
+}
+
+static void fold(Folder &f, IrId id) {
+    IrNode n = f.ir.nodes[id];
+    const std::uint32_t *ops = operandsOf(f.ir, n);
+    switch (n.op) {
+    case IrOp::CONST:
+    case IrOp::FAIL:
+        return;
+    case IrOp::VAR:
+        if (f.vars[n.a] != kNoIr) {
+            becomeConstant(f, id, f.vars[n.a]);
+            f.stats.propagated++;
+        }
+        return;
+    case IrOp::GLOBAL:
+        if (f.globals[n.a] != kNoIr) {
+            becomeConstant(f, id, f.globals[n.a]);
+            f.stats.propagated++;
+        }
+        return;
+    // a constant binding is substituted into its body, which takes the
+    // place of the LET
+    case IrOp::LET:
+        fold(f, n.b);
+        if (isConstant(f, n.b)) {
+            f.vars[n.a] = f.ir.nodes[n.b].a;
+            fold(f, n.c);
+            f.ir.nodes[id] = f.ir.nodes[n.c];
+            return;
+        }
+        fold(f, n.c);
+        return;
+    case IrOp::LETREC:
+        for (std::uint32_t i = n.count / 2; i < n.count; i++) {
+            fold(f, ops[i]);
+        }
+        fold(f, n.c);
+        return;
+    case IrOp::IF: {
+        fold(f, n.a);
+        const IrNode &test = f.ir.nodes[n.a];
+        if (test.op == IrOp::CONST && isBool(f.ir.constants[test.a])) {
+            IrId arm = std::get<bool>(f.ir.constants[test.a].v) ? n.b : n.c;
+            fold(f, arm);
+            f.ir.nodes[id] = f.ir.nodes[arm];
+            f.stats.branches++;
+            return;
+        }
+        fold(f, n.b);
+        fold(f, n.c);
+        return;
+    }
+    case IrOp::SWITCH:
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            if (ops[i] != kNoIr) {
+                fold(f, ops[i]);
+            }
+        }
+        if (n.c != kNoIr) {
+            fold(f, n.c);
+        }
+        return;
+    case IrOp::PRIM: {
+        bool constant = true;
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            fold(f, ops[i]);
+            constant = constant && isConstant(f, ops[i]);
+        }
+        if (!constant) {
+            return;
+        }
+        if (std::optional<Value> value = evaluate(f.ir, n)) {
+            becomeConstant(f, id, addConstant(f.ir, std::move(*value)));
+            f.stats.folded++;
+        }
+        return;
+    }
+    case IrOp::APP:
+        fold(f, n.a);
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            fold(f, ops[i]);
+        }
+        return;
+    case IrOp::LAMBDA:
+    case IrOp::TLAMBDA:
+        fold(f, n.b);
+        return;
+    case IrOp::THUNK:
+        fold(f, n.b);
+        if (isConstant(f, n.b)) {
+            becomeConstant(f, id, f.ir.nodes[n.b].a);
+        }
+        return;
+    // a constant is already in WHNF
+    case IrOp::FORCE:
+        fold(f, n.a);
+        if (isConstant(f, n.a)) {
+            becomeConstant(f, id, f.ir.nodes[n.a].a);
+        }
+        return;
+    case IrOp::TAPPLY:
+        fold(f, n.a);
+        return;
+    case IrOp::VEC:
+    case IrOp::CON:
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            fold(f, ops[i]);
+        }
+        return;
+    }
+}
+
+FoldStats foldConstants(IrModule &ir) {
+    Folder f{ir, std::vector<std::uint32_t>(ir.vars.size(), kNoIr),
+             std::vector<std::uint32_t>(ir.globals.size(), kNoIr), {}};
+    // a global that folds can make the globals before it foldable, the
+    // rounds stop once no more globals fold
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (IrId expr : ir.exprs) {
+            fold(f, expr);
+        }
+        for (std::size_t g = 0; g < ir.globals.size(); g++) {
+            fold(f, ir.globals[g].body);
+            const IrNode &body = ir.nodes[ir.globals[g].body];
+            if (body.op == IrOp::CONST && f.globals[g] == kNoIr) {
+                f.globals[g] = body.a;
+                changed = true;
+            }
+        }
+    }
+    return f.stats;
+}
@@ -0,0 +1,32 @@
+#ifndef SPROUT_LANG_FOLD_H
+#define SPROUT_LANG_FOLD_H
+
+#include "ir.h"
+
+/*
+ * constant folding over the ANF IR. a primitive whose operands are all
+ * constants is evaluated at compile time with the semantics of the vm, the
+ * operands are raised to the larger rank of the numeric tower, / of two ints
+ * is an exact Rational and comparisons of rationals are exact, and equal? and
+ * eq? compare constant data the way the vm compares its words.
+ *
+ * a folded constant replaces the uses of the variable a LET binds it to and
+ * the LET goes away, the same for the uses of a global whose body folds. an
+ * IF on a constant becomes the arm it takes, which prunes the clauses of a
+ * cond after a constant predicate, and a thunk of a constant is the
+ * constant.
+ *
+ * there are no bignums, so an operation the vm would fail on, like a
+ * division by zero or a rational overflow, or an int result that does not
+ * fit in an int constant, is left for the runtime to raise or compute
+ */
+struct FoldStats {
+    int folded = 0;     // primitives evaluated
+    int branches = 0;   // IFs on a constant
+    int propagated = 0; // variable and global atoms replaced by a constant
+};
+
+// rewrites ir in place
+FoldStats foldConstants(IrModule &ir);
+
+#endif
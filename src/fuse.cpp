@@ -0,0 +1,160 @@
+#include "fuse.h"
+
+struct Fuser {
+    IrModule &ir;
+    std::vector<IrId> binding;       // the LET binding each variable
+    std::vector<IrId> scope;         // the function it is bound in
+    std::vector<std::uint32_t> uses; // reachable VAR atoms of it
+    std::vector<bool> dropped;       // merged into its only use
+    FusionStats stats;
+};
+
+static bool isListPrim(const IrNode &n) {
+    if (n.op != IrOp::PRIM) {
+        return false;
+    }
+    auto prim = static_cast<IrPrim>(n.a);
+    return prim == IrPrim::MAP || prim == IrPrim::FILTER ||
+           prim == IrPrim::FOLDL || prim == IrPrim::PIPE;
+}
+
+// the stages of a fold follow its function and initial accumulator
+static std::uint32_t firstStage(const IrNode &n) {
+    return static_cast<IrPrim>(n.a) == IrPrim::FOLDL ? 2 : 0;
+}
+
+static std::uint32_t filterMask(const IrNode &n) {
+    switch (static_cast<IrPrim>(n.a)) {
+    case IrPrim::MAP:
+        return 0;
+    case IrPrim::FILTER:
+        return 1;
+    default:
+        return n.c;
+    }
+}
+
+// the uses of every variable and where it is bound, fn is the innermost
+// LAMBDA, THUNK or TLAMBDA around id, or the root
+static void scan(Fuser &f, IrId id, IrId fn) {
+    const IrNode &n = f.ir.nodes[id];
+    if (n.op == IrOp::VAR) {
+        f.uses[n.a]++;
+        return;
+    }
+    if (n.op == IrOp::LET) {
+        f.binding[n.a] = id;
+        f.scope[n.a] = fn;
+    }
+    bool function = n.op == IrOp::LAMBDA || n.op == IrOp::THUNK ||
+                    n.op == IrOp::TLAMBDA;
+    for (IrId child : children(f.ir, id)) {
+        scan(f, child, function ? id : fn);
+    }
+}
+
+// the map, filter or PIPE the atom is the only use of, bound in the same
+// function so merging it neither repeats nor delays its work, kNoIr when
+// there is none
+static IrId producer(const Fuser &f, IrId atom, IrId fn) {
+    const IrNode &n = f.ir.nodes[atom];
+    if (n.op != IrOp::VAR || f.binding[n.a] == kNoIr || f.uses[n.a] != 1 ||
+        f.scope[n.a] != fn) {
+        return kNoIr;
+    }
+    IrId value = f.ir.nodes[f.binding[n.a]].b;
+    const IrNode &v = f.ir.nodes[value];
+    if (!isListPrim(v) || static_cast<IrPrim>(v.a) == IrPrim::FOLDL) {
+        return kNoIr;
+    }
+    return value;
+}
+
+// the list primitive id takes over the stages of the one producing its
+// list, whose binding is dropped afterwards. producers come first in
+// evaluation order, so they are already fused as far as they go
+static void fuse(Fuser &f, IrId id, IrId fn) {
+    IrNode n = f.ir.nodes[id];
+    const std::uint32_t *ops = operandsOf(f.ir, n);
+    IrId list = ops[n.count - 1];
+    IrId inner = producer(f, list, fn);
+    if (inner == kNoIr) {
+        return;
+    }
+    const IrNode &in = f.ir.nodes[inner];
+    std::uint32_t from = firstStage(n);
+    std::uint32_t innerStages = in.count - 1;
+    std::uint32_t stages = n.count - 1 - from;
+    if (innerStages + stages > kMaxStages) {
+        return;
+    }
+    // f and z of a fold, the stages of the producer then the own ones, and
+    // the source list of the producer
+    const std::uint32_t *innerOps = operandsOf(f.ir, in);
+    std::vector<std::uint32_t> fused(ops, ops + from);
+    fused.insert(fused.end(), innerOps, innerOps + innerStages);
+    fused.insert(fused.end(), ops + from, ops + from + stages);
+    fused.push_back(innerOps[innerStages]);
+    n.c = filterMask(in) | filterMask(n) << innerStages;
+    if (static_cast<IrPrim>(n.a) != IrPrim::FOLDL) {
+        n.a = static_cast<std::uint32_t>(IrPrim::PIPE);
+    }
+    n.first = static_cast<std::uint32_t>(f.ir.operands.size());
+    n.count = static_cast<std::uint32_t>(fused.size());
+    f.ir.operands.insert(f.ir.operands.end(), fused.begin(), fused.end());
+    f.ir.nodes[id] = n;
+    f.dropped[f.ir.nodes[list].a] = true;
+    f.stats.fused++;
+}
+
+static void walk(Fuser &f, IrId id, IrId fn) {
+    const IrNode &n = f.ir.nodes[id];
+    if (isListPrim(n)) {
+        fuse(f, id, fn);
+        return;
+    }
+    bool function = n.op == IrOp::LAMBDA || n.op == IrOp::THUNK ||
+                    n.op == IrOp::TLAMBDA;
+    for (IrId child : children(f.ir, id)) {
+        walk(f, child, function ? id : fn);
+    }
+}
+
+// a dropped binding takes the place of its body
+static void drop(Fuser &f, IrId id) {
+    for (;;) {
+        const IrNode &n = f.ir.nodes[id];
+        if (n.op != IrOp::LET || !f.dropped[n.a]) {
+            break;
+        }
+        f.ir.nodes[id] = f.ir.nodes[n.c];
+    }
+    for (IrId child : children(f.ir, id)) {
+        drop(f, child);
+    }
+}
+
+FusionStats fuseLists(IrModule &ir) {
+    Fuser f{ir,
+            std::vector<IrId>(ir.vars.size(), kNoIr),
+            std::vector<IrId>(ir.vars.size(), kNoIr),
+            std::vector<std::uint32_t>(ir.vars.size(), 0),
+            std::vector<bool>(ir.vars.size(), false),
+            {}};
+    std::vector<IrId> roots = ir.exprs;
+    for (const IrGlobal &global : ir.globals) {
+        roots.push_back(global.body);
+    }
+    for (IrId root : roots) {
+        scan(f, root, root);
+    }
+    for (IrId root : roots) {
+        walk(f, root, root);
+    }
+    if (f.stats.fused > 0) {
+        for (IrId root : roots) {
+            drop(f, root);
+        }
+    }
+    return f.stats;
+}
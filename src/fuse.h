@@ -0,0 +1,35 @@
+#ifndef SPROUT_LANG_FUSE_H
+#define SPROUT_LANG_FUSE_H
+
+#include "ir.h"
+
+/*
+ * fusion of list pipelines over the ANF IR. (map f (filter p xs)) lowers to
+ *  LET t = (filter p xs) in (map f t)
+ * and evaluating it builds the filtered list only for map to take it apart
+ * again. when the list operand of a map, filter or foldl is a variable used
+ * only there, in the same function as the LET binding it to another map or
+ * filter, the two become one PIPE of both stage functions over xs and the
+ * LET goes away, so a chain of maps and filters ending in a foldl walks its
+ * source list once and builds no intermediate list at all.
+ *
+ * this is fusion in the style of streams rather than foldr/build. a PIPE
+ * produces its cells on demand, running the elements of the source through
+ * the stages until one passes every filter and pairing it with a thunk of
+ * the pipeline over the rest, so elements a filter drops cost no stack and
+ * the result stays as lazy as the unfused pipeline. only the map calls are
+ * still delayed, each mapped element is a thunk of (f x). a foldl calls its
+ * function on each element the stages keep with the accumulator evaluated,
+ * like foldl' in haskell
+ */
+struct FusionStats {
+    int fused = 0; // maps and filters merged into the primitive using them
+};
+
+// the filter mask of a PIPE is a u16 bytecode operand
+constexpr std::uint32_t kMaxStages = 16;
+
+// rewrites ir in place
+FusionStats fuseLists(IrModule &ir);
+
+#endif
@@ -0,0 +1,544 @@
+#include "inline.h"
+
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+// inlining a call can expose more calls to known functions, the rounds stop
+// once nothing changes
+constexpr int kInlineRounds = 4;
+
+struct Inliner {
+    IrModule &ir;
+    int budget;
+    std::vector<IrId> order;                 // reachable, parents first
+    std::vector<std::uint32_t> uses;         // atom occurrences per var
+    std::unordered_map<VarId, IrId> values;  // the node a LET binds
+    std::unordered_map<VarId, IrId> lambdas; // LET and LETREC lambdas
+    std::unordered_set<VarId> letBound;      // lambdas bound by a LET
+    std::unordered_set<IrId> recursive;      // function bodies on a cycle
+    std::unordered_map<IrId, int> sizes;
+    InlineStats stats;
+};
+
+// the atoms below a node
+static std::vector<IrId> atomsUnder(const IrModule &ir, IrId root) {
+    std::vector<IrId> atoms;
+    std::vector<IrId> stack{root};
+    while (!stack.empty()) {
+        IrId id = stack.back();
+        stack.pop_back();
+        if (isAtom(ir.nodes[id])) {
+            atoms.push_back(id);
+            continue;
+        }
+        for (IrId child : children(ir, id)) {
+            stack.push_back(child);
+        }
+    }
+    return atoms;
+}
+
+// the nodes of a graph that lie on a cycle, by Tarjan's strongly connected
+// components, a component of one node is a cycle when it calls itself
+static std::vector<bool>
+onCycle(const std::vector<std::vector<std::size_t>> &edges) {
+    std::size_t n = edges.size();
+    std::vector<int> index(n, -1);
+    std::vector<int> low(n, 0);
+    std::vector<bool> stacked(n, false);
+    std::vector<bool> cyclic(n, false);
+    std::vector<std::size_t> stack;
+    int next = 0;
+    std::function<void(std::size_t)> visit = [&](std::size_t v) {
+        index[v] = low[v] = next++;
+        stack.push_back(v);
+        stacked[v] = true;
+        for (std::size_t w : edges[v]) {
+            if (w == v) {
+                cyclic[v] = true;
+            }
+            if (index[w] < 0) {
+                visit(w);
+                low[v] = std::min(low[v], low[w]);
+            } else if (stacked[w]) {
+                low[v] = std::min(low[v], index[w]);
+            }
+        }
+        if (low[v] != index[v]) {
+            return;
+        }
+        std::vector<std::size_t> component;
+        std::size_t w;
+        do {
+            w = stack.back();
+            stack.pop_back();
+            stacked[w] = false;
+            component.push_back(w);
+        } while (w != v);
+        if (component.size() > 1) {
+            for (std::size_t c : component) {
+                cyclic[c] = true;
+            }
+        }
+    };
+    for (std::size_t v = 0; v < n; v++) {
+        if (index[v] < 0) {
+            visit(v);
+        }
+    }
+    return cyclic;
+}
+
+// the lambdas of a letr group that call each other in a cycle
+static void recursiveGroup(Inliner &in, const IrNode &letrec) {
+    const std::uint32_t *ops = operandsOf(in.ir, letrec);
+    std::uint32_t n = letrec.count / 2;
+    std::unordered_map<VarId, std::size_t> member;
+    for (std::uint32_t i = 0; i < n; i++) {
+        member[ops[i]] = i;
+    }
+    std::vector<std::vector<std::size_t>> edges(n);
+    for (std::uint32_t i = 0; i < n; i++) {
+        for (IrId atom : atomsUnder(in.ir, ops[n + i])) {
+            const IrNode &a = in.ir.nodes[atom];
+            if (a.op == IrOp::VAR && member.contains(a.a)) {
+                edges[i].push_back(member[a.a]);
+            }
+        }
+    }
+    std::vector<bool> cyclic = onCycle(edges);
+    for (std::uint32_t i = 0; i < n; i++) {
+        if (cyclic[i]) {
+            in.recursive.insert(ops[n + i]);
+        }
+    }
+}
+
+// top level functions that reach themselves through the globals they use
+static void recursiveGlobals(Inliner &in) {
+    std::vector<std::vector<std::size_t>> edges(in.ir.globals.size());
+    for (std::size_t g = 0; g < in.ir.globals.size(); g++) {
+        if (in.ir.globals[g].body == kNoIr) {
+            continue;
+        }
+        for (IrId atom : atomsUnder(in.ir, in.ir.globals[g].body)) {
+            if (in.ir.nodes[atom].op == IrOp::GLOBAL) {
+                edges[g].push_back(in.ir.nodes[atom].a);
+            }
+        }
+    }
+    std::vector<bool> cyclic = onCycle(edges);
+    for (std::size_t g = 0; g < in.ir.globals.size(); g++) {
+        if (cyclic[g] && in.ir.globals[g].body != kNoIr) {
+            in.recursive.insert(in.ir.globals[g].body);
+        }
+    }
+}
+
+// recomputes the reachable nodes, variable uses and known lambdas
+static void analyze(Inliner &in) {
+    in.order.clear();
+    in.uses.assign(in.ir.vars.size(), 0);
+    in.values.clear();
+    in.lambdas.clear();
+    in.letBound.clear();
+    in.recursive.clear();
+    in.sizes.clear();
+    std::vector<bool> seen(in.ir.nodes.size(), false);
+    std::vector<IrId> stack;
+    auto root = [&](IrId id) {
+        if (id != kNoIr && !seen[id]) {
+            seen[id] = true;
+            stack.push_back(id);
+        }
+    };
+    for (const IrGlobal &global : in.ir.globals) {
+        root(global.body);
+    }
+    for (IrId expr : in.ir.exprs) {
+        root(expr);
+    }
+    while (!stack.empty()) {
+        IrId id = stack.back();
+        stack.pop_back();
+        in.order.push_back(id);
+        for (IrId child : children(in.ir, id)) {
+            // atoms are counted once per occurrence
+            if (in.ir.nodes[child].op == IrOp::VAR) {
+                in.uses[in.ir.nodes[child].a]++;
+            }
+            if (!seen[child]) {
+                seen[child] = true;
+                stack.push_back(child);
+            }
+        }
+    }
+
+    for (IrId id : in.order) {
+        const IrNode &n = in.ir.nodes[id];
+        if (n.op == IrOp::LET) {
+            in.values[n.a] = n.b;
+            if (in.ir.nodes[n.b].op == IrOp::LAMBDA) {
+                in.lambdas[n.a] = n.b;
+                in.letBound.insert(n.a);
+            }
+        } else if (n.op == IrOp::LETREC) {
+            const std::uint32_t *ops = operandsOf(in.ir, n);
+            for (std::uint32_t i = 0; i < n.count / 2; i++) {
+                IrId value = ops[n.count / 2 + i];
+                if (in.ir.nodes[value].op == IrOp::LAMBDA) {
+                    in.lambdas[ops[i]] = value;
+                }
+            }
+            recursiveGroup(in, n);
+        }
+    }
+    recursiveGlobals(in);
+}
+
+// the number of non atom nodes in a function body
+static int sizeOf(Inliner &in, IrId lambda) {
+    auto it = in.sizes.find(lambda);
+    if (it != in.sizes.end()) {
+        return it->second;
+    }
+    int size = 0;
+    std::vector<IrId> stack{in.ir.nodes[lambda].b};
+    while (!stack.empty()) {
+        IrId id = stack.back();
+        stack.pop_back();
+        if (isAtom(in.ir.nodes[id])) {
+            continue;
+        }
+        size++;
+        for (IrId child : children(in.ir, id)) {
+            stack.push_back(child);
+        }
+    }
+    in.sizes[lambda] = size;
+    return size;
+}
+
+// the TLAMBDA an atom is known to hold, through aliases, FORCEs and globals
+static IrId knownTlambda(const Inliner &in, IrId id) {
+    // a lazy global defined as itself would loop forever
+    for (std::size_t steps = 0; steps < in.ir.nodes.size(); steps++) {
+        const IrNode &n = in.ir.nodes[id];
+        if (n.op == IrOp::TLAMBDA) {
+            return id;
+        }
+        if (n.op == IrOp::FORCE) {
+            id = n.a;
+        } else if (n.op == IrOp::GLOBAL && in.ir.globals[n.a].body != kNoIr) {
+            id = in.ir.globals[n.a].body;
+        } else if (n.op == IrOp::VAR && in.values.contains(n.a)) {
+            id = in.values.at(n.a);
+        } else {
+            return kNoIr;
+        }
+    }
+    return kNoIr;
+}
+
+/*
+ * copies a function body for inlining. the variables the body binds get
+ * fresh ids so every variable is still bound exactly once, the parameters
+ * are replaced by the argument atoms, and forcing an argument that is
+ * already a value reads it directly
+ */
+struct Copy {
+    std::unordered_map<VarId, IrId> args;
+    std::unordered_map<VarId, VarId> fresh;
+};
+
+static std::uint32_t rebind(IrModule &ir, Copy &cp, VarId var) {
+    IrVar v = ir.vars[var];
+    VarId copy = addVar(ir, v.name, v.type, v.lazy);
+    cp.fresh[var] = copy;
+    return copy;
+}
+
+static IrId copy(IrModule &ir, Copy &cp, IrId id) {
+    IrNode n = ir.nodes[id];
+    std::vector<std::uint32_t> ops(operandsOf(ir, n),
+                                   operandsOf(ir, n) + n.count);
+    switch (n.op) {
+    case IrOp::CONST:
+    case IrOp::GLOBAL:
+    case IrOp::FAIL:
+        return addNode(ir, n);
+    case IrOp::VAR:
+        if (cp.args.contains(n.a)) {
+            return addNode(ir, ir.nodes[cp.args[n.a]]);
+        }
+        if (cp.fresh.contains(n.a)) {
+            n.a = cp.fresh[n.a];
+        }
+        return addNode(ir, n);
+    case IrOp::LET:
+        n.a = rebind(ir, cp, n.a);
+        n.b = copy(ir, cp, n.b);
+        n.c = copy(ir, cp, n.c);
+        return addNode(ir, n);
+    case IrOp::LETREC:
+        for (std::uint32_t i = 0; i < n.count / 2; i++) {
+            ops[i] = rebind(ir, cp, ops[i]);
+        }
+        for (std::uint32_t i = n.count / 2; i < n.count; i++) {
+            ops[i] = copy(ir, cp, ops[i]);
+        }
+        n.c = copy(ir, cp, n.c);
+        return addNode(ir, n, ops);
+    case IrOp::IF:
+        n.a = copy(ir, cp, n.a);
+        n.b = copy(ir, cp, n.b);
+        n.c = copy(ir, cp, n.c);
+        return addNode(ir, n);
+    case IrOp::PRIM:
+    case IrOp::VEC:
+    case IrOp::CON:
+        for (std::uint32_t &op : ops) {
+            op = copy(ir, cp, op);
+        }
+        return addNode(ir, n, ops);
+    case IrOp::SWITCH:
+        n.a = copy(ir, cp, n.a);
+        for (std::uint32_t &arm : ops) {
+            arm = arm == kNoIr ? kNoIr : copy(ir, cp, arm);
+        }
+        n.c = n.c == kNoIr ? kNoIr : copy(ir, cp, n.c);
+        return addNode(ir, n, ops);
+    case IrOp::APP:
+        n.a = copy(ir, cp, n.a);
+        for (std::uint32_t &op : ops) {
+            op = copy(ir, cp, op);
+        }
+        return addNode(ir, n, ops);
+    case IrOp::LAMBDA:
+        for (std::uint32_t &param : ops) {
+            param = rebind(ir, cp, param);
+        }
+        n.b = copy(ir, cp, n.b);
+        return addNode(ir, n, ops);
+    case IrOp::THUNK:
+    case IrOp::TLAMBDA:
+        n.b = copy(ir, cp, n.b);
+        return addNode(ir, n);
+    case IrOp::FORCE: {
+        n.a = copy(ir, cp, n.a);
+        if (!isLazyAtom(ir, ir.nodes[n.a])) {
+            return n.a;
+        }
+        return addNode(ir, n);
+    }
+    case IrOp::TAPPLY:
+        n.a = copy(ir, cp, n.a);
+        return addNode(ir, n);
+    }
+    return addNode(ir, n);
+}
+
+/* APP f a b with f = LAMBDA (x y) body becomes body[x := a, y := b] in place
+ * of the APP. a parameter that takes its argument evaluated cannot be given
+ * a lazy atom, such calls are left alone
+ */
+static bool betaReduce(Inliner &in, IrId call, IrId lambda) {
+    IrNode app = in.ir.nodes[call];
+    IrNode fn = in.ir.nodes[lambda];
+    if (app.count != fn.count) {
+        return false;
+    }
+    Copy cp;
+    for (std::uint32_t i = 0; i < fn.count; i++) {
+        VarId param = operandsOf(in.ir, fn)[i];
+        IrId arg = operandsOf(in.ir, app)[i];
+        if (!in.ir.vars[param].lazy && isLazyAtom(in.ir, in.ir.nodes[arg])) {
+            return false;
+        }
+        cp.args[param] = arg;
+    }
+    IrNode body = in.ir.nodes[copy(in.ir, cp, fn.b)];
+    body.type = app.type;
+    in.ir.nodes[call] = body;
+    return true;
+}
+
+// TAPPLY t with t = TLAMBDA body becomes a copy of body
+static void foldTapply(Inliner &in, IrId id, IrId tlambda) {
+    Copy cp;
+    IrNode body = in.ir.nodes[copy(in.ir, cp, in.ir.nodes[tlambda].b)];
+    body.type = in.ir.nodes[id].type;
+    in.ir.nodes[id] = body;
+}
+
+// evaluating the value has no effect, so an unused binding of it can go
+static bool pure(const Inliner &in, IrId id) {
+    const IrNode &n = in.ir.nodes[id];
+    switch (n.op) {
+    case IrOp::CONST:
+    case IrOp::VAR:
+    case IrOp::GLOBAL:
+    case IrOp::LAMBDA:
+    case IrOp::THUNK:
+    case IrOp::TLAMBDA:
+        return true;
+    case IrOp::FORCE: {
+        // forcing a global that is a function or a tlambda is free
+        const IrNode &atom = in.ir.nodes[n.a];
+        if (atom.op != IrOp::GLOBAL || in.ir.globals[atom.a].body == kNoIr) {
+            return false;
+        }
+        IrOp op = in.ir.nodes[in.ir.globals[atom.a].body].op;
+        return op == IrOp::LAMBDA || op == IrOp::TLAMBDA;
+    }
+    default:
+        return false;
+    }
+}
+
+// the fields of a node that hold its children, in the order of children
+static std::vector<std::uint32_t *> childEdges(IrModule &ir, IrId id) {
+    IrNode &n = ir.nodes[id];
+    std::uint32_t *ops = ir.operands.data() + n.first;
+    std::vector<std::uint32_t *> edges;
+    switch (n.op) {
+    case IrOp::LET:
+        return {&n.b, &n.c};
+    case IrOp::LETREC:
+        for (std::uint32_t i = n.count / 2; i < n.count; i++) {
+            edges.push_back(ops + i);
+        }
+        edges.push_back(&n.c);
+        return edges;
+    case IrOp::IF:
+        return {&n.a, &n.b, &n.c};
+    case IrOp::PRIM:
+    case IrOp::VEC:
+    case IrOp::CON:
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            edges.push_back(ops + i);
+        }
+        return edges;
+    case IrOp::SWITCH:
+        edges.push_back(&n.a);
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            if (ops[i] != kNoIr) {
+                edges.push_back(ops + i);
+            }
+        }
+        if (n.c != kNoIr) {
+            edges.push_back(&n.c);
+        }
+        return edges;
+    case IrOp::APP:
+        edges.push_back(&n.a);
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            edges.push_back(ops + i);
+        }
+        return edges;
+    case IrOp::LAMBDA:
+    case IrOp::THUNK:
+    case IrOp::TLAMBDA:
+        return {&n.b};
+    case IrOp::FORCE:
+    case IrOp::TAPPLY:
+        return {&n.a};
+    default:
+        return {};
+    }
+}
+
+static bool deadBinding(const Inliner &in, const IrNode &n) {
+    if (n.op == IrOp::LET) {
+        return in.uses[n.a] == 0 && pure(in, n.b);
+    }
+    if (n.op != IrOp::LETREC) {
+        return false;
+    }
+    for (std::uint32_t i = 0; i < n.count / 2; i++) {
+        if (in.uses[operandsOf(in.ir, n)[i]] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the node taking the place of id once the dead bindings at and below it
+// are dropped. the edge to a dead binding is pointed at its body rather
+// than the body copied over it, so every node stays reachable from one
+// place only
+static IrId dropDead(Inliner &in, IrId id) {
+    while (deadBinding(in, in.ir.nodes[id])) {
+        id = in.ir.nodes[id].c;
+    }
+    for (std::uint32_t *edge : childEdges(in.ir, id)) {
+        *edge = dropDead(in, *edge);
+    }
+    return id;
+}
+
+// drops the bindings inlining left unused and restores flat ANF, over the
+// nodes reachable once they are gone
+static void cleanup(Inliner &in) {
+    analyze(in);
+    for (IrGlobal &global : in.ir.globals) {
+        if (global.body != kNoIr) {
+            global.body = dropDead(in, global.body);
+        }
+    }
+    for (IrId &expr : in.ir.exprs) {
+        expr = dropDead(in, expr);
+    }
+    analyze(in);
+    for (IrId id : in.order) {
+        flattenLet(in.ir, id);
+    }
+}
+
+InlineStats inlineCalls(IrModule &ir, int budget) {
+    Inliner in{ir, budget, {}, {}, {}, {}, {}, {}, {}, {}};
+    for (int round = 0; round < kInlineRounds; round++) {
+        analyze(in);
+        bool changed = false;
+        std::vector<IrId> order = in.order;
+        for (IrId id : order) {
+            const IrNode &n = ir.nodes[id];
+            if (n.op == IrOp::TAPPLY) {
+                IrId tlambda = knownTlambda(in, n.a);
+                if (tlambda != kNoIr && !in.recursive.contains(tlambda)) {
+                    foldTapply(in, id, tlambda);
+                    in.stats.tapplyFolded++;
+                    changed = true;
+                }
+                continue;
+            }
+            if (n.op != IrOp::APP) {
+                continue;
+            }
+            IrId lambda = knownLambda(in.ir, in.lambdas, n.a);
+            if (lambda == kNoIr || in.recursive.contains(lambda)) {
+                continue;
+            }
+            // the only use of a let bound lambda, inlining it does not
+            // grow the code whatever its size
+            const IrNode &callee = ir.nodes[n.a];
+            bool single = callee.op == IrOp::VAR &&
+                          in.letBound.contains(callee.a) &&
+                          in.uses[callee.a] == 1;
+            if (!single && sizeOf(in, lambda) > in.budget) {
+                continue;
+            }
+            if (betaReduce(in, id, lambda)) {
+                (single ? in.stats.betaReduced : in.stats.inlined)++;
+                changed = true;
+            }
+        }
+        cleanup(in);
+        if (!changed) {
+            break;
+        }
+    }
+    return in.stats;
+}
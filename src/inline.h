@@ -0,0 +1,32 @@
+#ifndef SPROUT_LANG_INLINE_H
+#define SPROUT_LANG_INLINE_H
+
+#include "ir.h"
+
+/*
+ * inliner over the ANF IR. a call to a known function, a top level function
+ * or a lambda bound by LET or LETREC, is replaced by a copy of the function
+ * body with the parameters substituted by the argument atoms, which is beta
+ * reduction without any work duplication because ANF arguments are atoms.
+ *
+ * a call is inlined when the body is at most budget nodes, or always when it
+ * is the only use of the lambda, like an immediately applied lambda, whose
+ * binding is then dropped. functions that are recursive, a strongly
+ * connected component of the call graph of a letr group or of the top level
+ * defines, are never inlined so inlining always terminates.
+ *
+ * (tapply (tlambda (A) e) T) is folded at compile time into a copy of e,
+ * types are erased at runtime so only the node types of the copy mention
+ * the rigid variable A, and the lambda the copy yields is inlined in turn
+ */
+constexpr int kInlineBudget = 12;
+
+struct InlineStats {
+    int inlined = 0;      // calls replaced by the callee body
+    int betaReduced = 0;  // single use lambdas applied in place
+    int tapplyFolded = 0; // tapply of a known tlambda
+};
+
+InlineStats inlineCalls(IrModule &ir, int budget = kInlineBudget);
+
+#endif
@@ -0,0 +1,438 @@
+#include "ir.h"
+#include "cell.h"
+
+#include <sstream>
+#include <stdexcept>
+
+IrId addNode(IrModule &ir, IrNode node) {
+    ir.nodes.push_back(node);
+    return static_cast<IrId>(ir.nodes.size() - 1);
+}
+
+IrId addNode(IrModule &ir, IrNode node,
+             const std::vector<std::uint32_t> &operands) {
+    node.first = static_cast<std::uint32_t>(ir.operands.size());
+    node.count = static_cast<std::uint32_t>(operands.size());
+    ir.operands.insert(ir.operands.end(), operands.begin(), operands.end());
+    return addNode(ir, node);
+}
+
+VarId addVar(IrModule &ir, SymbolId name, TypeId type, bool lazy) {
+    ir.vars.push_back(IrVar{name, type, lazy});
+    return static_cast<VarId>(ir.vars.size() - 1);
+}
+
+std::uint32_t addConstant(IrModule &ir, Value value) {
+    ir.constants.push_back(std::move(value));
+    return static_cast<std::uint32_t>(ir.constants.size() - 1);
+}
+
+const std::uint32_t *operandsOf(const IrModule &ir, const IrNode &node) {
+    return ir.operands.data() + node.first;
+}
+
+bool isAtom(const IrNode &node) {
+    return node.op == IrOp::CONST || node.op == IrOp::VAR ||
+           node.op == IrOp::GLOBAL;
+}
+
+bool isLazyAtom(const IrModule &ir, const IrNode &node) {
+    if (node.op == IrOp::VAR) {
+        return ir.vars[node.a].lazy;
+    }
+    if (node.op == IrOp::GLOBAL) {
+        return ir.globals[node.a].lazy;
+    }
+    return false;
+}
+
+std::unordered_map<VarId, IrId> boundLambdas(const IrModule &ir) {
+    std::unordered_map<VarId, IrId> lambdas;
+    for (const IrNode &n : ir.nodes) {
+        if (n.op == IrOp::LET && ir.nodes[n.b].op == IrOp::LAMBDA) {
+            lambdas[n.a] = n.b;
+        } else if (n.op == IrOp::LETREC) {
+            const std::uint32_t *ops = operandsOf(ir, n);
+            for (std::uint32_t i = 0; i < n.count / 2; i++) {
+                if (ir.nodes[ops[n.count / 2 + i]].op == IrOp::LAMBDA) {
+                    lambdas[ops[i]] = ops[n.count / 2 + i];
+                }
+            }
+        }
+    }
+    return lambdas;
+}
+
+IrId knownLambda(const IrModule &ir,
+                 const std::unordered_map<VarId, IrId> &lambdas, IrId callee) {
+    const IrNode &n = ir.nodes[callee];
+    if (n.op == IrOp::VAR) {
+        auto it = lambdas.find(n.a);
+        return it == lambdas.end() ? kNoIr : it->second;
+    }
+    if (n.op == IrOp::GLOBAL) {
+        const IrGlobal &global = ir.globals[n.a];
+        if (!global.lazy && global.body != kNoIr &&
+            ir.nodes[global.body].op == IrOp::LAMBDA) {
+            return global.body;
+        }
+    }
+    return kNoIr;
+}
+
+void flattenLet(IrModule &ir, IrId id) {
+    while (ir.nodes[id].op == IrOp::LET &&
+           (ir.nodes[ir.nodes[id].b].op == IrOp::LET ||
+            ir.nodes[ir.nodes[id].b].op == IrOp::LETREC)) {
+        IrId innerId = ir.nodes[id].b;
+        IrNode outer = ir.nodes[id];
+        IrNode inner = ir.nodes[innerId];
+        outer.b = inner.c;
+        inner.c = innerId;
+        inner.type = outer.type;
+        ir.nodes[innerId] = outer;
+        ir.nodes[id] = inner;
+        flattenLet(ir, innerId);
+    }
+}
+
+std::vector<IrId> children(const IrModule &ir, IrId id) {
+    const IrNode &n = ir.nodes[id];
+    const std::uint32_t *ops = operandsOf(ir, n);
+    switch (n.op) {
+    case IrOp::CONST:
+    case IrOp::VAR:
+    case IrOp::GLOBAL:
+    case IrOp::FAIL:
+        return {};
+    case IrOp::LET:
+        return {n.b, n.c};
+    case IrOp::LETREC: {
+        std::vector<IrId> kids(ops + n.count / 2, ops + n.count);
+        kids.push_back(n.c);
+        return kids;
+    }
+    case IrOp::IF:
+        return {n.a, n.b, n.c};
+    case IrOp::PRIM:
+    case IrOp::VEC:
+    case IrOp::CON:
+        return std::vector<IrId>(ops, ops + n.count);
+    case IrOp::SWITCH: {
+        std::vector<IrId> kids{n.a};
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            if (ops[i] != kNoIr) {
+                kids.push_back(ops[i]);
+            }
+        }
+        if (n.c != kNoIr) {
+            kids.push_back(n.c);
+        }
+        return kids;
+    }
+    case IrOp::APP: {
+        std::vector<IrId> kids{n.a};
+        kids.insert(kids.end(), ops, ops + n.count);
+        return kids;
+    }
+    case IrOp::LAMBDA:
+    case IrOp::THUNK:
+    case IrOp::TLAMBDA:
+        return {n.b};
+    case IrOp::FORCE:
+    case IrOp::TAPPLY:
+        return {n.a};
+    }
+    return {};
+}
+
+std::string toString(IrPrim prim) {
+    switch (prim) {
+    case IrPrim::ADD:
+        return "+";
+    case IrPrim::SUB:
+        return "-";
+    case IrPrim::MUL:
+        return "*";
+    case IrPrim::DIV:
+        return "/";
+    case IrPrim::MOD:
+        return "%";
+    case IrPrim::LT:
+        return "<";
+    case IrPrim::GT:
+        return ">";
+    case IrPrim::LE:
+        return "<=";
+    case IrPrim::GE:
+        return ">=";
+    case IrPrim::NUM_EQ:
+        return "=";
+    case IrPrim::NOT:
+        return "not";
+    case IrPrim::CONS:
+        return "cons";
+    case IrPrim::CAR:
+        return "car";
+    case IrPrim::CDR:
+        return "cdr";
+    case IrPrim::IS_NULL:
+        return "null?";
+    case IrPrim::APPEND:
+        return "append";
+    case IrPrim::MAP:
+        return "map";
+    case IrPrim::FILTER:
+        return "filter";
+    case IrPrim::FOLDL:
+        return "foldl";
+    case IrPrim::PIPE:
+        return "pipe";
+    case IrPrim::VEC_REF:
+        return "vec-ref";
+    case IrPrim::VEC_LEN:
+        return "vec-len";
+    case IrPrim::VEC_MAP:
+        return "vec-map";
+    case IrPrim::VEC_FOLD:
+        return "vec-fold";
+    case IrPrim::EQ:
+        return "eq?";
+    case IrPrim::EQUAL:
+        return "equal?";
+    case IrPrim::IS_TAG:
+        return "tag?";
+    case IrPrim::FIELD:
+        return "field";
+    }
+    return "unknown";
+}
+
+struct IrPrinter {
+    const IrModule &ir;
+    const SymbolTable &symbols;
+    const TypeTable &types;
+    std::ostringstream out;
+};
+
+static void printVar(IrPrinter &p, VarId var) {
+    p.out << p.symbols.name(p.ir.vars[var].name) << '.' << var;
+}
+
+static void printNode(IrPrinter &p, IrId id, int indent);
+
+// constants print as sprout literals, lists as quoted data
+static void printConstant(IrPrinter &p, const Value &v) {
+    if (isString(v)) {
+        p.out << '"' << std::get<std::string>(v.v) << '"';
+    } else if (isBool(v)) {
+        p.out << (std::get<bool>(v.v) ? "#t" : "#f");
+    } else if (isSymbol(v)) {
+        p.out << std::get<Symbol>(v.v).name;
+    } else if (isList(v)) {
+        p.out << '(';
+        for (List cell = std::get<List>(v.v); cell;) {
+            printConstant(p, head(cell));
+            if (!isList(tail(cell))) {
+                p.out << " . ";
+                printConstant(p, tail(cell));
+                break;
+            }
+            cell = std::get<List>(tail(cell).v);
+            if (cell) {
+                p.out << ' ';
+            }
+        }
+        p.out << ')';
+    } else {
+        p.out << v;
+    }
+}
+
+static void newline(IrPrinter &p, int indent) {
+    p.out << '\n' << std::string(static_cast<std::size_t>(indent), ' ');
+}
+
+static void printOperands(IrPrinter &p, const IrNode &n, int indent) {
+    const std::uint32_t *ops = operandsOf(p.ir, n);
+    for (std::uint32_t i = 0; i < n.count; i++) {
+        p.out << ' ';
+        printNode(p, ops[i], indent);
+    }
+}
+
+static void printNode(IrPrinter &p, IrId id, int indent) {
+    const IrNode &n = p.ir.nodes[id];
+    switch (n.op) {
+    case IrOp::CONST:
+        if (isList(p.ir.constants[n.a]) || isSymbol(p.ir.constants[n.a])) {
+            p.out << '\'';
+        }
+        printConstant(p, p.ir.constants[n.a]);
+        return;
+    case IrOp::VAR:
+        printVar(p, n.a);
+        return;
+    case IrOp::GLOBAL:
+        p.out << p.symbols.name(p.ir.globals[n.a].name);
+        return;
+    case IrOp::LET:
+        p.out << "(let ";
+        printVar(p, n.a);
+        p.out << ' ';
+        printNode(p, n.b, indent + 2);
+        newline(p, indent);
+        printNode(p, n.c, indent);
+        p.out << ')';
+        return;
+    case IrOp::LETREC: {
+        const std::uint32_t *ops = operandsOf(p.ir, n);
+        std::uint32_t half = n.count / 2;
+        p.out << "(letrec (";
+        for (std::uint32_t i = 0; i < half; i++) {
+            if (i > 0) {
+                newline(p, indent + 9);
+            }
+            p.out << '(';
+            printVar(p, ops[i]);
+            p.out << ' ';
+            printNode(p, ops[half + i], indent + 10);
+            p.out << ')';
+        }
+        p.out << ')';
+        newline(p, indent);
+        printNode(p, n.c, indent);
+        p.out << ')';
+        return;
+    }
+    case IrOp::IF:
+        p.out << "(if ";
+        printNode(p, n.a, indent);
+        newline(p, indent + 4);
+        printNode(p, n.b, indent + 4);
+        newline(p, indent + 4);
+        printNode(p, n.c, indent + 4);
+        p.out << ')';
+        return;
+    case IrOp::FAIL:
+        p.out << "(fail \"" << std::get<std::string>(p.ir.constants[n.a].v)
+              << "\")";
+        return;
+    case IrOp::PRIM:
+        p.out << '(' << toString(static_cast<IrPrim>(n.a));
+        if (static_cast<IrPrim>(n.a) == IrPrim::VEC_REF && n.c) {
+            p.out << "/unchecked";
+        }
+        if (static_cast<IrPrim>(n.a) == IrPrim::IS_TAG ||
+            static_cast<IrPrim>(n.a) == IrPrim::FIELD ||
+            static_cast<IrPrim>(n.a) == IrPrim::PIPE ||
+            (static_cast<IrPrim>(n.a) == IrPrim::FOLDL && n.count > 3)) {
+            p.out << ' ' << n.c;
+        }
+        printOperands(p, n, indent);
+        p.out << ')';
+        return;
+    case IrOp::APP:
+        p.out << '(';
+        printNode(p, n.a, indent);
+        printOperands(p, n, indent);
+        p.out << ')';
+        return;
+    case IrOp::LAMBDA: {
+        const std::uint32_t *ops = operandsOf(p.ir, n);
+        p.out << "(lambda (";
+        for (std::uint32_t i = 0; i < n.count; i++) {
+            if (i > 0) {
+                p.out << ' ';
+            }
+            printVar(p, ops[i]);
+            p.out << ':' << toString(p.types, p.ir.vars[ops[i]].type);
+            if (!p.ir.vars[ops[i]].lazy) {
+                p.out << '!';
+            }
+        }
+        p.out << ')';
+        newline(p, indent + 2);
+        printNode(p, n.b, indent + 2);
+        p.out << ')';
+        return;
+    }
+    case IrOp::THUNK:
+        p.out << "(thunk ";
+        printNode(p, n.b, indent + 7);
+        p.out << ')';
+        return;
+    case IrOp::FORCE:
+        p.out << "(force ";
+        printNode(p, n.a, indent);
+        p.out << ')';
+        return;
+    case IrOp::TLAMBDA:
+        p.out << "(tlambda ";
+        printNode(p, n.b, indent + 9);
+        p.out << ')';
+        return;
+    case IrOp::TAPPLY:
+        p.out << "(tapply ";
+        printNode(p, n.a, indent);
+        p.out << " : " << toString(p.types, n.type) << ')';
+        return;
+    case IrOp::VEC:
+        p.out << "(vec";
+        printOperands(p, n, indent);
+        p.out << ')';
+        return;
+    case IrOp::CON:
+        p.out << '(' << p.symbols.name(p.ir.constructors[n.a].name);
+        printOperands(p, n, indent);
+        p.out << ')';
+        return;
+    case IrOp::SWITCH: {
+        const std::uint32_t *ops = operandsOf(p.ir, n);
+        p.out << "(switch ";
+        printNode(p, n.a, indent);
+        for (std::uint32_t tag = 0; tag < n.count; tag++) {
+            if (ops[tag] == kNoIr) {
+                continue;
+            }
+            newline(p, indent + 2);
+            p.out << '(' << tag << ' ';
+            printNode(p, ops[tag], indent + 3);
+            p.out << ')';
+        }
+        if (n.c != kNoIr) {
+            newline(p, indent + 2);
+            p.out << "(else ";
+            printNode(p, n.c, indent + 3);
+            p.out << ')';
+        }
+        p.out << ')';
+        return;
+    }
+    }
+    throw std::runtime_error("unknown IR node");
+}
+
+std::string toString(const IrModule &ir, const SymbolTable &symbols,
+                     const TypeTable &types, IrId id) {
+    IrPrinter p{ir, symbols, types, {}};
+    printNode(p, id, 0);
+    return p.out.str();
+}
+
+std::string toString(const IrModule &ir, const SymbolTable &symbols,
+                     const TypeTable &types) {
+    IrPrinter p{ir, symbols, types, {}};
+    for (const IrGlobal &global : ir.globals) {
+        p.out << "(define " << symbols.name(global.name) << ':'
+              << toString(types, global.type) << (global.lazy ? " lazy" : "");
+        newline(p, 2);
+        printNode(p, global.body, 2);
+        p.out << ")\n";
+    }
+    for (IrId expr : ir.exprs) {
+        printNode(p, expr, 0);
+        p.out << '\n';
+    }
+    return p.out.str();
+}
@@ -0,0 +1,175 @@
+#ifndef SPROUT_LANG_IR_H
+#define SPROUT_LANG_IR_H
+
+#include "object.h"
+#include "symtab.h"
+#include "typetable.h"
+#include "value.h"
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * the intermediate representation between the typechecked CST and bytecode.
+ * programs are lowered into A-normal form: every operand of an operation is
+ * an atom (a constant, a local variable or a global) and every intermediate
+ * result is named by a LET, so evaluation order and allocation are explicit.
+ *
+ * nodes live in one arena, IrModule::nodes, and refer to each other, to
+ * variables and to constants by 32 bit index. variable length operand lists
+ * are slices of IrModule::operands. passes rewrite the arena in place or
+ * append new nodes, nothing is ever freed individually, only dead code
+ * elimination rebuilds the arena from the reachable nodes.
+ *
+ * laziness is explicit. a lazy let binding or argument is a THUNK node, a
+ * variable that may hold a thunk is marked lazy, and every place that needs
+ * its value in weak head normal form goes through a FORCE. every other
+ * operation produces a value in WHNF, and a function returns one
+ */
+using IrId = std::uint32_t;
+using VarId = std::uint32_t;
+
+constexpr IrId kNoIr = std::numeric_limits<IrId>::max();
+
+enum class IrOp : std::uint8_t {
+    // atoms
+    CONST,  // a: index into constants
+    VAR,    // a: VarId
+    GLOBAL, // a: index into globals
+    // binding and control
+    LET,    // var a = node b, then node c
+    LETREC, // operands: n vars then their n LAMBDA or THUNK nodes, c: body
+    IF,     // a: bool atom, b: then, c: else
+    FAIL,   // a: constant index of the message
+    // operations, operands are atoms
+    PRIM,    // a: IrPrim, operands: arguments, c: IrPrim specific flags
+    APP,     // a: callee atom, operands: argument atoms
+    LAMBDA,  // operands: parameter vars, b: body
+    THUNK,   // b: delayed body
+    FORCE,   // a: atom to evaluate to WHNF
+    TLAMBDA, // b: body, delayed until a TAPPLY like a thunk
+    TAPPLY,  // a: atom holding a TLAMBDA value, the node type is instantiated
+    VEC,     // operands: element atoms
+    CON,     // a: index into constructors, operands: lazy field atoms
+    // a: evaluated atom of a data type, operands: a node per tag, kNoIr for
+    // the tags that take the default c, kNoIr when every tag has an arm
+    SWITCH,
+};
+
+enum class IrPrim : std::uint8_t {
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    LT,
+    GT,
+    LE,
+    GE,
+    NUM_EQ,
+    NOT,
+    CONS,
+    CAR,
+    CDR,
+    IS_NULL,
+    APPEND, // unquote-splice, the first list is copied
+    MAP,
+    FILTER,
+    // operands f, z, the stages fused into it then the list, c: as PIPE
+    FOLDL,
+    // map and filter fused by fuse.h, operands the stage functions in the
+    // order they apply then the list, c: bit i set when stage i is a filter
+    PIPE,
+    VEC_REF, // c: 1 when the index is proven in bounds
+    VEC_LEN,
+    VEC_MAP,
+    VEC_FOLD,
+    EQ,    // eq? identity
+    EQUAL, // equal? structural
+    IS_TAG, // c: does the constructed value carry tag c
+    // c: field c of a constructed value or cons cell, unevaluated, b: index
+    // into constructors, kNoIr for a cons cell
+    FIELD,
+};
+
+struct IrNode {
+    IrOp op = IrOp::CONST;
+    TypeId type = 0;
+    std::uint32_t a = 0;
+    std::uint32_t b = 0;
+    std::uint32_t c = 0;
+    std::uint32_t first = 0; // operand slice
+    std::uint32_t count = 0;
+};
+
+struct IrVar {
+    SymbolId name;
+    TypeId type;
+    bool lazy; // may hold an unevaluated thunk
+};
+
+// a top level define, functions are bound to a LAMBDA node and every other
+// define is a lazily evaluated constant applicative form
+struct IrGlobal {
+    SymbolId name;
+    TypeId type;
+    IrId body;
+    bool lazy;
+};
+
+// a constructor of a data type, index i is constructor i of the DataTable
+// the program was checked with until dead code elimination drops the unused
+// ones, and the layout of its values, see object.h
+struct IrConstructor {
+    SymbolId name;
+    int tag;
+    int arity;
+    Representation rep;
+    TypeId type; // (forall (A) (A -> (Maybe A))), for printing values
+};
+
+struct IrModule {
+    std::vector<IrNode> nodes;
+    std::vector<std::uint32_t> operands;
+    std::vector<Value> constants;
+    std::vector<IrVar> vars;
+    std::vector<IrGlobal> globals;
+    std::vector<IrConstructor> constructors;
+    std::vector<IrId> exprs; // top level expressions in source order
+    SymbolId temp = 0;       // name of the variables passes introduce
+};
+
+IrId addNode(IrModule &ir, IrNode node);
+IrId addNode(IrModule &ir, IrNode node,
+             const std::vector<std::uint32_t> &operands);
+VarId addVar(IrModule &ir, SymbolId name, TypeId type, bool lazy);
+std::uint32_t addConstant(IrModule &ir, Value value);
+
+// the operand slice of a node
+const std::uint32_t *operandsOf(const IrModule &ir, const IrNode &node);
+bool isAtom(const IrNode &node);
+// does evaluating the atom need a FORCE first
+bool isLazyAtom(const IrModule &ir, const IrNode &node);
+// the variables of every LET and LETREC whose value is a LAMBDA
+std::unordered_map<VarId, IrId> boundLambdas(const IrModule &ir);
+// the LAMBDA a callee atom is known to hold, a variable through lambdas or
+// a function define
+IrId knownLambda(const IrModule &ir,
+                 const std::unordered_map<VarId, IrId> &lambdas, IrId callee);
+// LET v = (LET t = x in y) in c becomes LET t = x in (LET v = y in c), the
+// same for a LETREC, so a LET whose value is a let chain is flat ANF again.
+// node ids are kept so the parent of the outer LET does not change
+void flattenLet(IrModule &ir, IrId id);
+// the nodes a node refers to, operand atoms included, in evaluation order
+std::vector<IrId> children(const IrModule &ir, IrId id);
+
+std::string toString(IrPrim prim);
+// s-expression rendering of a node, variables print as name.id
+std::string toString(const IrModule &ir, const SymbolTable &symbols,
+                     const TypeTable &types, IrId id);
+std::string toString(const IrModule &ir, const SymbolTable &symbols,
+                     const TypeTable &types);
+
+#endif
@@ -0,0 +1,1415 @@
+#include "lower.h"
+#include "ast.h"
+#include "cell.h"
+#include "value.h"
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+/*
+ * lowering is written in continuation passing style so the output is flat
+ * ANF without a separate normalization pass. lower hands the operation that
+ * computes an expression to a continuation, which either places it in tail
+ * position or names it with a LET and continues with the variable, and the
+ * LETs that evaluate its operands end up wrapped around that continuation
+ */
+using Cont = std::function<IrId(IrId)>;
+using Atoms = std::function<IrId(const std::vector<IrId> &)>;
+
+// what a symbol refers to in the lowering environment
+struct IrBinding {
+    bool global = false;
+    std::uint32_t index = 0; // VarId or index into globals
+};
+
+struct Lowerer {
+    IrModule ir;
+    TypeChecker &tc;
+    PMap<IrBinding> env;
+};
+
+static const std::unordered_set<std::string> loweredPrims = {
+    "+",   "-",   "*",   "/",   "<",       ">",       "<=",      ">=",
+    "=",   "%",   "not", "and", "or",      "cons",    "car",     "cdr",
+    "null?", "map", "filter", "foldl", "vec-ref", "vec-len", "vec-map",
+    "vec-fold"};
+
+static const std::string &symbolName(const Token &tok) {
+    if (!tok.value || !isString(*tok.value)) {
+        throw std::runtime_error("expected a symbol with a name, found:" +
+                                 toString(tok));
+    }
+    return std::get<std::string>(tok.value->v);
+}
+
+static const TokenNode &astNode(const Token &tok) {
+    if (!tok.value || !isAstPtr(*tok.value)) {
+        throw std::runtime_error("expected a token wrapping a node, found:" +
+                                 toString(tok));
+    }
+    return std::get<AstPtr>(tok.value->v)->node;
+}
+
+static bool isTokenOfKind(const TokenNode &node, TokenKind kind) {
+    return isTokenNodeToken(node) && std::get<Token>(node).kind == kind;
+}
+
+static bool isFormOf(const TokenNode &node, TokenKind kind) {
+    return isTokenNodeList(node) && std::get<TokenList>(node) &&
+           isTokenOfKind(head(std::get<TokenList>(node)), kind);
+}
+
+static std::vector<TokenNode> elements(const TokenList &lst) {
+    std::vector<TokenNode> elems;
+    for (TokenListIterator it(lst), end(TokenList{}); it != end; ++it) {
+        elems.push_back(*it);
+    }
+    return elems;
+}
+
+static SymbolId symbolId(const Token &tok, Lowerer &lw) {
+    return lw.tc.symbols.intern(symbolName(tok));
+}
+
+// the type the typechecker recorded for a compound expression or binding
+static TypeId recordedType(Lowerer &lw, const TokenList &lst) {
+    auto it = lw.tc.info.exprTypes.find(lst.get());
+    if (it == lw.tc.info.exprTypes.end()) {
+        std::ostringstream oss;
+        oss << lst;
+        throw std::runtime_error("no type recorded for " + oss.str());
+    }
+    return zonk(lw.tc.unifier, lw.tc.types, it->second);
+}
+
+static const std::vector<TypeId> &signature(Lowerer &lw, TypeId fn) {
+    return lw.tc.types.node(fn).args;
+}
+
+static IrId atom(Lowerer &lw, IrOp op, std::uint32_t index, TypeId type) {
+    IrNode node;
+    node.op = op;
+    node.type = type;
+    node.a = index;
+    return addNode(lw.ir, node);
+}
+
+static IrId constant(Lowerer &lw, Value value, TypeId type) {
+    return atom(lw, IrOp::CONST, addConstant(lw.ir, std::move(value)), type);
+}
+
+static IrId varAtom(Lowerer &lw, VarId var) {
+    return atom(lw, IrOp::VAR, var, lw.ir.vars[var].type);
+}
+
+static IrId let(Lowerer &lw, VarId var, IrId value, IrId body) {
+    IrNode node;
+    node.op = IrOp::LET;
+    node.type = lw.ir.nodes[body].type;
+    node.a = var;
+    node.b = value;
+    node.c = body;
+    return addNode(lw.ir, node);
+}
+
+static IrId prim(Lowerer &lw, IrPrim op, TypeId type,
+                 const std::vector<IrId> &args, std::uint32_t flags = 0) {
+    IrNode node;
+    node.op = IrOp::PRIM;
+    node.type = type;
+    node.a = static_cast<std::uint32_t>(op);
+    node.c = flags;
+    return addNode(lw.ir, node, args);
+}
+
+static IrId branch(Lowerer &lw, IrId cond, IrId then, IrId otherwise) {
+    IrNode node;
+    node.op = IrOp::IF;
+    node.type = lw.ir.nodes[then].type;
+    node.a = cond;
+    node.b = then;
+    node.c = otherwise;
+    return addNode(lw.ir, node);
+}
+
+static IrId delay(Lowerer &lw, IrOp op, IrId body, TypeId type) {
+    IrNode node;
+    node.op = op;
+    node.type = type;
+    node.b = body;
+    return addNode(lw.ir, node);
+}
+
+// names the result of op and continues with the variable, thunks are
+// bound to lazy variables
+static IrId bindTemp(Lowerer &lw, IrId op, const Cont &k) {
+    const IrNode &node = lw.ir.nodes[op];
+    VarId var = addVar(lw.ir, lw.ir.temp, node.type, node.op == IrOp::THUNK);
+    return let(lw, var, op, k(varAtom(lw, var)));
+}
+
+static IrId lower(Lowerer &lw, const TokenNode &expr, const Cont &finish);
+
+static IrId lowerTail(Lowerer &lw, const TokenNode &expr) {
+    return lower(lw, expr, [](IrId op) { return op; });
+}
+
+// continues with an atom holding the value of expr in WHNF
+static IrId lowerValue(Lowerer &lw, const TokenNode &expr, const Cont &k) {
+    return lower(lw, expr, [&](IrId op) {
+        if (isAtom(lw.ir.nodes[op])) {
+            return k(op);
+        }
+        return bindTemp(lw, op, k);
+    });
+}
+
+static IrId lowerValues(Lowerer &lw, const std::vector<TokenNode> &exprs,
+                        std::size_t from, std::vector<IrId> &atoms,
+                        const Atoms &k) {
+    if (from == exprs.size()) {
+        return k(atoms);
+    }
+    return lowerValue(lw, exprs[from], [&](IrId value) {
+        atoms.push_back(value);
+        return lowerValues(lw, exprs, from + 1, atoms, k);
+    });
+}
+
+static IrId lowerLambda(Lowerer &lw, const TokenList &lst);
+
+// the value of a literal token, nullopt for anything that has to be computed
+static std::optional<Value> literal(const TokenNode &expr) {
+    if (!isTokenNodeToken(expr)) {
+        return std::nullopt;
+    }
+    const Token &tok = std::get<Token>(expr);
+    switch (tok.kind) {
+    case TokenKind::NUMBER:
+    case TokenKind::BOOL:
+    case TokenKind::CHAR:
+    case TokenKind::STRING:
+        return *tok.value;
+    default:
+        return std::nullopt;
+    }
+}
+
+static TypeId literalType(const Value &value) {
+    if (isInt(value)) {
+        return kIntType;
+    } else if (isRational(value)) {
+        return kRationalType;
+    } else if (isDouble(value)) {
+        return kFloatType;
+    } else if (isComplex(value)) {
+        return kComplexType;
+    } else if (isBool(value)) {
+        return kBoolType;
+    } else if (isChar(value)) {
+        return kCharType;
+    }
+    return kStringType;
+}
+
+static IrId lookupSymbol(Lowerer &lw, const Token &tok) {
+    const IrBinding *binding = pmapFind(lw.env, symbolId(tok, lw));
+    if (!binding) {
+        throw std::runtime_error("lowering an unbound symbol " +
+                                 symbolName(tok));
+    }
+    if (binding->global) {
+        return atom(lw, IrOp::GLOBAL, binding->index,
+                    lw.ir.globals[binding->index].type);
+    }
+    return varAtom(lw, binding->index);
+}
+
+// the constructor a symbol names when no binding shadows it
+static const Constructor *constructorOf(Lowerer &lw, const TokenNode &expr) {
+    if (!isTokenOfKind(expr, TokenKind::SYMBOL)) {
+        return nullptr;
+    }
+    SymbolId name = symbolId(std::get<Token>(expr), lw);
+    return pmapFind(lw.env, name) ? nullptr
+                                  : findConstructor(lw.tc.data, name);
+}
+
+static IrId construct(Lowerer &lw, const Constructor &ctor, TypeId type,
+                      const std::vector<IrId> &fields) {
+    IrNode node;
+    node.op = IrOp::CON;
+    node.type = type;
+    node.a = static_cast<std::uint32_t>(&ctor - lw.tc.data.constructors.data());
+    return addNode(lw.ir, node, fields);
+}
+
+// a constructor used as a value, the constructed value when it has no fields
+// and otherwise a function of its fields. types are erased at runtime, so
+// the node is typed over the parameters of the data type
+static IrId constructorValue(Lowerer &lw, const Constructor &ctor) {
+    const DataType &data = lw.tc.data.types[ctor.data];
+    TypeId type = lw.tc.types.instantiate(
+        ctor.type, lw.tc.types.node(data.type).args);
+    if (ctor.arity == 0) {
+        return construct(lw, ctor, type, {});
+    }
+    std::vector<std::uint32_t> params;
+    std::vector<IrId> fields;
+    for (int i = 0; i < ctor.arity; i++) {
+        params.push_back(addVar(lw.ir, lw.ir.temp, signature(lw, type)[i],
+                                true));
+        fields.push_back(varAtom(lw, params.back()));
+    }
+    IrNode fn;
+    fn.op = IrOp::LAMBDA;
+    fn.type = type;
+    fn.b = construct(lw, ctor, data.type, fields);
+    return addNode(lw.ir, fn, params);
+}
+
+/*
+ * speculation, a binding or argument that is cheap to compute and can neither
+ * fail nor diverge is computed where it is bound instead of allocating a
+ * thunk for it, which no program can observe. cheap and total are
+ *  literals, quoted data and variables, a lazy variable is only aliased
+ *  cons and vec applied to such atoms
+ *  at most kCheapOps of + - * not and the comparisons over literals and
+ *  variables that already hold a value
+ * division can fail and forcing a lazy variable can diverge, so neither is
+ */
+constexpr int kCheapOps = 4;
+
+static const std::unordered_set<std::string> cheapPrims = {
+    "+", "-", "*", "<", ">", "<=", ">=", "=", "not"};
+
+// the builtin an application calls, empty when the head is not a builtin
+// or its name is shadowed
+static std::string builtinOf(Lowerer &lw, const TokenNode &expr) {
+    if (!isFormOf(expr, TokenKind::SYMBOL)) {
+        return "";
+    }
+    const Token &tok = std::get<Token>(head(std::get<TokenList>(expr)));
+    if (!loweredPrims.contains(symbolName(tok)) ||
+        pmapFind(lw.env, symbolId(tok, lw))) {
+        return "";
+    }
+    return symbolName(tok);
+}
+
+static bool isBound(Lowerer &lw, const TokenNode &expr, bool evaluated) {
+    if (!isTokenOfKind(expr, TokenKind::SYMBOL)) {
+        return false;
+    }
+    const IrBinding *binding =
+        pmapFind(lw.env, symbolId(std::get<Token>(expr), lw));
+    if (!binding) {
+        return false;
+    }
+    bool lazy = binding->global ? lw.ir.globals[binding->index].lazy
+                                : lw.ir.vars[binding->index].lazy;
+    return !evaluated || !lazy;
+}
+
+static bool isTrivial(Lowerer &lw, const TokenNode &expr, bool evaluated) {
+    return literal(expr) || isFormOf(expr, TokenKind::QUOTE) ||
+           isBound(lw, expr, evaluated) || constructorOf(lw, expr);
+}
+
+static bool isCheapValue(Lowerer &lw, const TokenNode &expr, int &budget) {
+    if (isTrivial(lw, expr, true)) {
+        return true;
+    }
+    if (!cheapPrims.contains(builtinOf(lw, expr)) || --budget < 0) {
+        return false;
+    }
+    for (TokenListIterator it(tail(std::get<TokenList>(expr))),
+         end(TokenList{});
+         it != end; ++it) {
+        if (!isCheapValue(lw, *it, budget)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool isCheap(Lowerer &lw, const TokenNode &expr) {
+    if (isTrivial(lw, expr, false)) {
+        return true;
+    }
+    if (builtinOf(lw, expr) == "cons" ||
+        isFormOf(expr, TokenKind::TYPE_IDENT) ||
+        (isTokenNodeList(expr) && std::get<TokenList>(expr) &&
+         constructorOf(lw, head(std::get<TokenList>(expr))))) {
+        for (TokenListIterator it(tail(std::get<TokenList>(expr))),
+             end(TokenList{});
+             it != end; ++it) {
+            if (!isTrivial(lw, *it, false)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    int budget = kCheapOps;
+    return isCheapValue(lw, expr, budget);
+}
+
+/*
+ * continues with an atom for a lazily passed argument. atoms are passed as
+ * they are, even a lazy variable, lambdas and cheap expressions are built in
+ * place and every other expression is delayed in a thunk
+ */
+static IrId lowerArg(Lowerer &lw, const TokenNode &expr, const Cont &k) {
+    if (std::optional<Value> value = literal(expr)) {
+        return k(constant(lw, *value, literalType(*value)));
+    }
+    if (isTokenOfKind(expr, TokenKind::SYMBOL) && !constructorOf(lw, expr)) {
+        return k(lookupSymbol(lw, std::get<Token>(expr)));
+    }
+    if (isFormOf(expr, TokenKind::LAMBDA)) {
+        return bindTemp(lw, lowerLambda(lw, std::get<TokenList>(expr)), k);
+    }
+    if (isFormOf(expr, TokenKind::QUOTE) || isCheap(lw, expr)) {
+        return lowerValue(lw, expr, k);
+    }
+    TypeId type = recordedType(lw, std::get<TokenList>(expr));
+    return bindTemp(lw, delay(lw, IrOp::THUNK, lowerTail(lw, expr), type), k);
+}
+
+static IrId lowerArgs(Lowerer &lw, const std::vector<TokenNode> &exprs,
+                      std::size_t from, std::vector<IrId> &atoms,
+                      const Atoms &k) {
+    if (from == exprs.size()) {
+        return k(atoms);
+    }
+    return lowerArg(lw, exprs[from], [&](IrId arg) {
+        atoms.push_back(arg);
+        return lowerArgs(lw, exprs, from + 1, atoms, k);
+    });
+}
+
+// binds the parameters of a (PARAM_LIST (x T) ... RETURN_TYPE) list to
+// fresh lazy variables typed by the signature of fn
+static std::vector<std::uint32_t> bindParams(Lowerer &lw,
+                                             const TokenNode &params,
+                                             TypeId fn) {
+    std::vector<std::uint32_t> vars;
+    for (TokenListIterator it(tail(asTokenList(params))), end(TokenList{});
+         it != end; ++it) {
+        if (!isTokenNodeList(*it)) {
+            continue;
+        }
+        const Token &sym = std::get<Token>(head(asTokenList(*it)));
+        VarId var = addVar(lw.ir, symbolId(sym, lw),
+                           signature(lw, fn)[vars.size()], true);
+        lw.env = pmapInsert(lw.env, symbolId(sym, lw), IrBinding{false, var});
+        vars.push_back(var);
+    }
+    return vars;
+}
+
+static IrId function(Lowerer &lw, const TokenNode &params, TypeId fn,
+                     const TokenNode &body) {
+    PMap<IrBinding> saved = lw.env;
+    std::vector<std::uint32_t> vars = bindParams(lw, params, fn);
+    IrNode node;
+    node.op = IrOp::LAMBDA;
+    node.type = fn;
+    node.b = lowerTail(lw, body);
+    lw.env = saved;
+    return addNode(lw.ir, node, vars);
+}
+
+static IrId lowerLambda(Lowerer &lw, const TokenList &lst) {
+    return function(lw, head(tail(lst)), recordedType(lw, lst),
+                    head(tail(tail(lst))));
+}
+
+// the value bound by a let binding or letrec, lambdas are values already.
+// when speculating a cheap rhs is computed in place and a variable is
+// aliased, otherwise the rhs is delayed in a thunk
+static IrId lowerBinding(Lowerer &lw, const TokenNode &rhs, TypeId type,
+                         bool speculate) {
+    if (isFormOf(rhs, TokenKind::LAMBDA)) {
+        return lowerLambda(lw, std::get<TokenList>(rhs));
+    }
+    if (speculate && isTokenOfKind(rhs, TokenKind::SYMBOL) &&
+        !constructorOf(lw, rhs)) {
+        return lookupSymbol(lw, std::get<Token>(rhs));
+    }
+    if (speculate && isCheap(lw, rhs)) {
+        return lowerTail(lw, rhs);
+    }
+    return delay(lw, IrOp::THUNK, lowerTail(lw, rhs), type);
+}
+
+static IrId letrec(Lowerer &lw, const std::vector<VarId> &vars,
+                   const std::vector<IrId> &values, IrId body) {
+    std::vector<std::uint32_t> operands(vars.begin(), vars.end());
+    operands.insert(operands.end(), values.begin(), values.end());
+    IrNode node;
+    node.op = IrOp::LETREC;
+    node.type = lw.ir.nodes[body].type;
+    node.c = body;
+    return addNode(lw.ir, node, operands);
+}
+
+/* (let ((x:T rhs) ...) body) binds every rhs in the outer scope and lets
+ * binds them one after the other, delayed unless they are cheap, see
+ * isCheap. letr binds them all in one LETREC of lambdas and thunks. a named
+ * let (let loop ((x:T init) ...) body) is
+ *  (letrec ((loop (lambda (x ...) body))) (loop init ...))
+ */
+static IrId lowerLet(Lowerer &lw, const TokenList &lst, const Cont &finish) {
+    std::vector<TokenNode> elems = elements(lst);
+    TokenKind kind = std::get<Token>(elems[0]).kind;
+    const Token &name = std::get<Token>(elems[1]);
+    struct Binding {
+        SymbolId name;
+        VarId var;
+        TokenNode rhs;
+    };
+    std::vector<Binding> bindings;
+    for (TokenListIterator it(asTokenList(elems[2])), end(TokenList{});
+         it != end; ++it) {
+        const TokenList &parts = asTokenList(astNode(std::get<Token>(*it)));
+        const TokenNode &rhs = head(tail(tail(parts)));
+        SymbolId sym = symbolId(std::get<Token>(head(parts)), lw);
+        bool lazy = !isFormOf(rhs, TokenKind::LAMBDA) || name.value;
+        bindings.push_back(
+            {sym, addVar(lw.ir, sym, recordedType(lw, parts), lazy), rhs});
+    }
+    PMap<IrBinding> saved = lw.env;
+    if (name.value) {
+        std::vector<TypeId> sig;
+        std::vector<TokenNode> inits;
+        for (const Binding &b : bindings) {
+            sig.push_back(lw.ir.vars[b.var].type);
+            inits.push_back(b.rhs);
+        }
+        sig.push_back(recordedType(lw, lst));
+        SymbolId loopName = symbolId(name, lw);
+        VarId loop = addVar(lw.ir, loopName,
+                            lw.tc.types.funct(std::move(sig)), false);
+        lw.env = pmapInsert(lw.env, loopName, IrBinding{false, loop});
+        std::vector<std::uint32_t> params;
+        for (const Binding &b : bindings) {
+            lw.env = pmapInsert(lw.env, b.name, IrBinding{false, b.var});
+            params.push_back(b.var);
+        }
+        IrNode fn;
+        fn.op = IrOp::LAMBDA;
+        fn.type = lw.ir.vars[loop].type;
+        fn.b = lowerTail(lw, elems[3]);
+        IrId lambda = addNode(lw.ir, fn, params);
+        // the inits are evaluated outside the loop like in the typechecker
+        lw.env = saved;
+        std::vector<IrId> atoms;
+        IrId call = lowerArgs(lw, inits, 0, atoms, [&](const auto &args) {
+            IrNode app;
+            app.op = IrOp::APP;
+            app.type = recordedType(lw, lst);
+            app.a = varAtom(lw, loop);
+            return finish(addNode(lw.ir, app, args));
+        });
+        return letrec(lw, {loop}, {lambda}, call);
+    }
+    std::vector<IrId> values;
+    if (kind == TokenKind::LETR) {
+        for (const Binding &b : bindings) {
+            lw.env = pmapInsert(lw.env, b.name, IrBinding{false, b.var});
+        }
+    }
+    for (const Binding &b : bindings) {
+        IrId value = lowerBinding(lw, b.rhs, lw.ir.vars[b.var].type,
+                                  kind != TokenKind::LETR);
+        const IrNode &node = lw.ir.nodes[value];
+        lw.ir.vars[b.var].lazy =
+            node.op == IrOp::THUNK || isLazyAtom(lw.ir, node);
+        values.push_back(value);
+        if (kind == TokenKind::LETS) {
+            lw.env = pmapInsert(lw.env, b.name, IrBinding{false, b.var});
+        }
+    }
+    if (kind == TokenKind::LET) {
+        for (const Binding &b : bindings) {
+            lw.env = pmapInsert(lw.env, b.name, IrBinding{false, b.var});
+        }
+    }
+    IrId body = lower(lw, elems[3], finish);
+    lw.env = saved;
+    if (kind == TokenKind::LETR) {
+        std::vector<VarId> vars;
+        for (const Binding &b : bindings) {
+            vars.push_back(b.var);
+        }
+        return letrec(lw, vars, values, body);
+    }
+    for (std::size_t i = bindings.size(); i-- > 0;) {
+        body = let(lw, bindings[i].var, values[i], body);
+        flattenLet(lw.ir, body);
+    }
+    return body;
+}
+
+static IrId fail(Lowerer &lw, const std::string &message, TypeId type) {
+    return atom(lw, IrOp::FAIL, addConstant(lw.ir, Value(message)), type);
+}
+
+// (cond (CLAUSE (pred expr)) ...) tests the clauses from clause on, falling
+// off the end is a runtime error
+static IrId lowerCond(Lowerer &lw, const std::vector<TokenNode> &clauses,
+                      std::size_t clause, TypeId type, const Cont &finish) {
+    if (clause == clauses.size()) {
+        return finish(fail(lw, "no cond clause matched", type));
+    }
+    const TokenList &parts =
+        asTokenList(head(tail(asTokenList(clauses[clause]))));
+    return lowerValue(lw, head(parts), [&](IrId pred) {
+        IrId then = lowerTail(lw, head(tail(parts)));
+        IrId otherwise = lowerCond(lw, clauses, clause + 1, type,
+                                   [](IrId op) { return op; });
+        return finish(branch(lw, pred, then, otherwise));
+    });
+}
+
+// a quoted datum as a constant Value, symbols become Symbol values and an
+// improper tail after DOT becomes the cdr of the last cell
+static Value datumValue(const TokenNode &datum) {
+    if (isTokenNodeToken(datum)) {
+        const Token &tok = std::get<Token>(datum);
+        if (tok.kind == TokenKind::SYMBOL ||
+            tok.kind == TokenKind::TYPE_IDENT) {
+            return Value(Symbol(symbolName(tok)));
+        }
+        return *tok.value;
+    }
+    std::vector<TokenNode> elems = elements(std::get<TokenList>(datum));
+    Value rest;
+    std::size_t count = elems.size();
+    if (count >= 2 && isTokenOfKind(elems[count - 2], TokenKind::DOT)) {
+        rest = datumValue(elems[count - 1]);
+        count -= 2;
+    }
+    for (std::size_t i = count; i-- > 0;) {
+        rest = Value(cons(datumValue(elems[i]), rest));
+    }
+    return rest;
+}
+
+static bool hasUnquote(const TokenNode &datum) {
+    if (!isTokenNodeList(datum)) {
+        return false;
+    }
+    for (TokenListIterator it(std::get<TokenList>(datum)), end(TokenList{});
+         it != end; ++it) {
+        if (isTokenOfKind(*it, TokenKind::UNQUOTE) ||
+            isTokenOfKind(*it, TokenKind::UNQUOTESPLICE) || hasUnquote(*it)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static TypeId elementType(Lowerer &lw, TypeId list) {
+    const TypeNode *sig = asConstructed(lw.tc.types, list, "list");
+    return sig ? sig->args.front() : list;
+}
+
+/* a quasiquoted datum of the given list type, the parts without unquotes are
+ * constants and the rest is built with CONS from the last element, spliced
+ * lists are joined with APPEND. an unquoted element is a lazy argument of its
+ * cell
+ */
+static IrId lowerQuasi(Lowerer &lw, const TokenNode &datum, TypeId type,
+                       bool lazy, const Cont &k) {
+    if (!hasUnquote(datum)) {
+        return k(constant(lw, datumValue(datum), type));
+    }
+    const TokenList &lst = std::get<TokenList>(datum);
+    if (isTokenOfKind(head(lst), TokenKind::UNQUOTE)) {
+        return lazy ? lowerArg(lw, head(tail(lst)), k)
+                    : lowerValue(lw, head(tail(lst)), k);
+    }
+    std::vector<TokenNode> elems = elements(lst);
+    std::optional<TokenNode> improper;
+    if (elems.size() >= 2 &&
+        isTokenOfKind(elems[elems.size() - 2], TokenKind::DOT)) {
+        improper = elems.back();
+        elems.resize(elems.size() - 2);
+    }
+    TypeId elem = elementType(lw, type);
+    std::function<IrId(std::size_t, const Cont &)> build =
+        [&](std::size_t i, const Cont &done) -> IrId {
+        if (i == elems.size()) {
+            if (improper) {
+                return lowerQuasi(lw, *improper, type, true, done);
+            }
+            return done(constant(lw, Value(), type));
+        }
+        return build(i + 1, [&](IrId rest) {
+            if (isFormOf(elems[i], TokenKind::UNQUOTESPLICE)) {
+                const TokenNode &spliced =
+                    head(tail(std::get<TokenList>(elems[i])));
+                return lowerValue(lw, spliced, [&](IrId front) {
+                    return bindTemp(
+                        lw, prim(lw, IrPrim::APPEND, type, {front, rest}),
+                        done);
+                });
+            }
+            return lowerQuasi(lw, elems[i], elem, true, [&](IrId first) {
+                return bindTemp(
+                    lw, prim(lw, IrPrim::CONS, type, {first, rest}), done);
+            });
+        });
+    };
+    return build(0, k);
+}
+
+/*
+ * match is lowered from the decision tree of its clauses, see match.h. an
+ * occurrence is bound to a variable the first time a path from the root
+ * needs it, a field with PRIM FIELD and a value to test with a FORCE, so
+ * every occurrence is extracted and forced at most once on each path. TAG
+ * and NIL tests become IS_TAG and IS_NULL before an IF, a literal compares
+ * with = or equal?, and a SWITCH stays a jump table over the tags. a clause
+ * reached by several leaves is a join point, a lambda of its pattern
+ * variables bound around the tree, so no clause body is lowered twice
+ */
+struct MatchLowering {
+    Lowerer &lw;
+    const DecisionTree &tree;
+    std::vector<TokenNode> bodies;
+    std::vector<TypeId> types; // of each occurrence
+    std::vector<std::optional<VarId>> joins;
+    std::vector<std::vector<SymbolId>> params; // of each join
+    TypeId type;
+};
+
+// the atom of each occurrence on the current path, nullopt until bound
+using Occurrences = std::vector<std::optional<IrBinding>>;
+using OccCont = std::function<IrId(const Occurrences &)>;
+
+static IrId bindingAtom(Lowerer &lw, const IrBinding &binding) {
+    if (binding.global) {
+        return atom(lw, IrOp::GLOBAL, binding.index,
+                    lw.ir.globals[binding.index].type);
+    }
+    return varAtom(lw, binding.index);
+}
+
+static bool isLazyBinding(Lowerer &lw, const IrBinding &binding) {
+    return binding.global ? lw.ir.globals[binding.index].lazy
+                          : lw.ir.vars[binding.index].lazy;
+}
+
+// the type of field i of a value of type parent
+static TypeId fieldType(Lowerer &lw, TypeId parent, const Occurrence &occ) {
+    if (occ.ctor == kConsCell) {
+        return occ.field == 0 ? elementType(lw, parent) : parent;
+    }
+    const Constructor &ctor = lw.tc.data.constructors[occ.ctor];
+    TypeId fn = lw.tc.types.instantiate(
+        ctor.type, lw.tc.types.node(zonk(lw.tc.unifier, lw.tc.types, parent))
+                       .args);
+    return signature(lw, fn)[occ.field];
+}
+
+// continues with occurrence occ bound to an atom, extracting it from its
+// parent first if this path has not yet
+static IrId bindOccurrence(MatchLowering &ml, std::size_t occ,
+                           const Occurrences &occs, const OccCont &k);
+
+// continues with occurrence occ bound to a variable holding its WHNF
+static IrId evaluateOccurrence(MatchLowering &ml, std::size_t occ,
+                               const Occurrences &occs, const OccCont &k) {
+    return bindOccurrence(ml, occ, occs, [&](const Occurrences &bound) {
+        if (!isLazyBinding(ml.lw, *bound[occ])) {
+            return k(bound);
+        }
+        IrId value = bindingAtom(ml.lw, *bound[occ]);
+        VarId var = addVar(ml.lw.ir, ml.lw.ir.temp, ml.types[occ], false);
+        IrId force = atom(ml.lw, IrOp::FORCE, value, ml.types[occ]);
+        Occurrences next = bound;
+        next[occ] = IrBinding{false, var};
+        return let(ml.lw, var, force, k(next));
+    });
+}
+
+static IrId bindOccurrence(MatchLowering &ml, std::size_t occ,
+                           const Occurrences &occs, const OccCont &k) {
+    if (occs[occ]) {
+        return k(occs);
+    }
+    const Occurrence &o = ml.tree.occurrences[occ];
+    return evaluateOccurrence(
+        ml, o.parent, occs, [&](const Occurrences &bound) {
+            IrId parent = bindingAtom(ml.lw, *bound[o.parent]);
+            IrId field = prim(ml.lw, IrPrim::FIELD, ml.types[occ], {parent},
+                              o.field);
+            ml.lw.ir.nodes[field].b = o.ctor == kConsCell
+                                          ? kNoIr
+                                          : static_cast<IrId>(o.ctor);
+            VarId var = addVar(ml.lw.ir, ml.lw.ir.temp, ml.types[occ], true);
+            Occurrences next = bound;
+            next[occ] = IrBinding{false, var};
+            return let(ml.lw, var, field, k(next));
+        });
+}
+
+static IrId bindOccurrences(MatchLowering &ml,
+                            const std::vector<std::size_t> &wanted,
+                            std::size_t from, const Occurrences &occs,
+                            const OccCont &k) {
+    if (from == wanted.size()) {
+        return k(occs);
+    }
+    return bindOccurrence(ml, wanted[from], occs,
+                          [&](const Occurrences &bound) {
+                              return bindOccurrences(ml, wanted, from + 1,
+                                                     bound, k);
+                          });
+}
+
+// the body of a clause with its pattern variables bound, finish sees the
+// environment of the match
+static IrId lowerLeaf(MatchLowering &ml, const Decision &d,
+                      const Occurrences &occs, const Cont &finish) {
+    std::vector<std::size_t> wanted;
+    for (const auto &[var, occ] : d.bindings) {
+        wanted.push_back(occ);
+    }
+    return bindOccurrences(ml, wanted, 0, occs, [&](const Occurrences &bound) {
+        Lowerer &lw = ml.lw;
+        if (ml.joins[d.clause]) {
+            std::vector<IrId> args;
+            for (SymbolId param : ml.params[d.clause]) {
+                auto it = std::find_if(
+                    d.bindings.rbegin(), d.bindings.rend(),
+                    [&](const auto &b) { return b.first == param; });
+                args.push_back(bindingAtom(lw, *bound[it->second]));
+            }
+            IrNode app;
+            app.op = IrOp::APP;
+            app.type = ml.type;
+            app.a = varAtom(lw, *ml.joins[d.clause]);
+            return finish(addNode(lw.ir, app, args));
+        }
+        PMap<IrBinding> saved = lw.env;
+        for (const auto &[var, occ] : d.bindings) {
+            lw.env = pmapInsert(lw.env, var, *bound[occ]);
+        }
+        IrId body = lower(lw, ml.bodies[d.clause], [&](IrId op) {
+            PMap<IrBinding> inner = lw.env;
+            lw.env = saved;
+            IrId done = finish(op);
+            lw.env = inner;
+            return done;
+        });
+        lw.env = saved;
+        return body;
+    });
+}
+
+static IrId lowerDecision(MatchLowering &ml, std::size_t id,
+                          const Occurrences &occs, const Cont &finish) {
+    Lowerer &lw = ml.lw;
+    const Decision &d = ml.tree.nodes[id];
+    auto subtree = [&](std::size_t next, const Occurrences &bound) {
+        return lowerDecision(ml, next, bound, [](IrId op) { return op; });
+    };
+    switch (d.kind) {
+    case DecisionKind::FAIL:
+        return finish(fail(lw, "no match clause matched", ml.type));
+    case DecisionKind::LEAF:
+        return lowerLeaf(ml, d, occs, finish);
+    default:
+        break;
+    }
+    return evaluateOccurrence(
+        ml, d.occurrence, occs, [&](const Occurrences &bound) {
+            IrId value = bindingAtom(lw, *bound[d.occurrence]);
+            if (d.kind == DecisionKind::SWITCH) {
+                std::vector<IrId> arms;
+                for (std::size_t arm : d.arms) {
+                    arms.push_back(arm == kNoDecision ? kNoIr
+                                                      : subtree(arm, bound));
+                }
+                IrNode node;
+                node.op = IrOp::SWITCH;
+                node.type = ml.type;
+                node.a = value;
+                node.c = d.no == kNoDecision ? kNoIr : subtree(d.no, bound);
+                return finish(addNode(lw.ir, node, arms));
+            }
+            if (d.kind == DecisionKind::LIT && isBool(d.literal)) {
+                bool yes = std::get<bool>(d.literal.v);
+                IrId then = subtree(yes ? d.yes : d.no, bound);
+                IrId otherwise = subtree(yes ? d.no : d.yes, bound);
+                return finish(branch(lw, value, then, otherwise));
+            }
+            IrId test;
+            if (d.kind == DecisionKind::TAG) {
+                test = prim(lw, IrPrim::IS_TAG, kBoolType, {value},
+                            static_cast<std::uint32_t>(
+                                lw.tc.data.constructors[d.ctor].tag));
+            } else if (d.kind == DecisionKind::NIL) {
+                test = prim(lw, IrPrim::IS_NULL, kBoolType, {value});
+            } else {
+                TypeId type = literalType(d.literal);
+                bool numeric = type <= kComplexType;
+                test = prim(lw, numeric ? IrPrim::NUM_EQ : IrPrim::EQUAL,
+                            kBoolType, {value, constant(lw, d.literal, type)});
+            }
+            return bindTemp(lw, test, [&](IrId cond) {
+                IrId then = subtree(d.yes, bound);
+                IrId otherwise = subtree(d.no, bound);
+                return finish(branch(lw, cond, then, otherwise));
+            });
+        });
+}
+
+static void patternVars(const Pattern &p, std::vector<SymbolId> &vars) {
+    if (p.kind == PatternKind::VAR &&
+        std::find(vars.begin(), vars.end(), p.var) == vars.end()) {
+        vars.push_back(p.var);
+    }
+    for (const Pattern &arg : p.args) {
+        patternVars(arg, vars);
+    }
+}
+
+// the type of every occurrence of the tree, fields after their parents
+static std::vector<TypeId> occurrenceTypes(Lowerer &lw,
+                                           const DecisionTree &tree,
+                                           TypeId scrutinee) {
+    std::vector<TypeId> types{scrutinee};
+    for (std::size_t i = 1; i < tree.occurrences.size(); i++) {
+        const Occurrence &occ = tree.occurrences[i];
+        types.push_back(fieldType(lw, types[occ.parent], occ));
+    }
+    return types;
+}
+
+// (match e (PATTERN_CLAUSE (pattern body)) ...)
+static IrId lowerMatch(Lowerer &lw, const TokenList &lst, const Cont &finish) {
+    std::vector<TokenNode> elems = elements(lst);
+    std::vector<Pattern> patterns;
+    std::vector<TokenNode> bodies;
+    for (TokenListIterator it(asTokenList(elems[2])), end(TokenList{});
+         it != end; ++it) {
+        const TokenList &clause = asTokenList(astNode(std::get<Token>(*it)));
+        patterns.push_back(makePattern(astNode(std::get<Token>(head(clause))),
+                                       lw.tc.data, lw.tc.symbols));
+        bodies.push_back(head(tail(clause)));
+    }
+    DecisionTree tree = compileMatch(patterns, lw.tc.data);
+    MatchLowering ml{lw,
+                     tree,
+                     bodies,
+                     {},
+                     std::vector<std::optional<VarId>>(patterns.size()),
+                     std::vector<std::vector<SymbolId>>(patterns.size()),
+                     recordedType(lw, lst)};
+    std::vector<int> leaves(patterns.size(), 0);
+    for (const Decision &d : tree.nodes) {
+        if (d.kind == DecisionKind::LEAF) {
+            leaves[d.clause]++;
+        }
+    }
+    const TokenNode &scrutinee = astNode(std::get<Token>(elems[1]));
+    Cont match = [&](IrId value) {
+        const IrNode &node = lw.ir.nodes[value];
+        if (node.op == IrOp::CONST) {
+            return bindTemp(lw, value, [&](IrId var) {
+                return match(var);
+            });
+        }
+        ml.types = occurrenceTypes(lw, tree, node.type);
+        Occurrences occs(tree.occurrences.size());
+        occs[0] = IrBinding{node.op == IrOp::GLOBAL, node.a};
+        std::vector<std::pair<VarId, IrId>> joins;
+        for (std::size_t clause = 0; clause < patterns.size(); clause++) {
+            if (leaves[clause] < 2) {
+                continue;
+            }
+            patternVars(patterns[clause], ml.params[clause]);
+            // the types of the variables are those of the occurrences a
+            // leaf binds them to
+            const Decision &leaf = *std::find_if(
+                tree.nodes.begin(), tree.nodes.end(), [&](const Decision &d) {
+                    return d.kind == DecisionKind::LEAF && d.clause == clause;
+                });
+            PMap<IrBinding> saved = lw.env;
+            std::vector<std::uint32_t> vars;
+            std::vector<TypeId> sig;
+            for (SymbolId param : ml.params[clause]) {
+                auto it = std::find_if(
+                    leaf.bindings.rbegin(), leaf.bindings.rend(),
+                    [&](const auto &b) { return b.first == param; });
+                TypeId type = ml.types[it->second];
+                VarId var = addVar(lw.ir, param, type, true);
+                lw.env = pmapInsert(lw.env, param, IrBinding{false, var});
+                vars.push_back(var);
+                sig.push_back(type);
+            }
+            sig.push_back(ml.type);
+            IrNode fn;
+            fn.op = IrOp::LAMBDA;
+            fn.type = lw.tc.types.funct(std::move(sig));
+            fn.b = lowerTail(lw, bodies[clause]);
+            lw.env = saved;
+            IrId lambda = addNode(lw.ir, fn, vars);
+            VarId join = addVar(lw.ir, lw.ir.temp, fn.type, false);
+            ml.joins[clause] = join;
+            joins.emplace_back(join, lambda);
+        }
+        IrId body = lowerDecision(ml, tree.root, occs, finish);
+        for (std::size_t i = joins.size(); i-- > 0;) {
+            body = let(lw, joins[i].first, joins[i].second, body);
+        }
+        return body;
+    };
+    // an irrefutable first clause does not force the scrutinee
+    if (tree.nodes[tree.root].kind == DecisionKind::LEAF) {
+        return lowerArg(lw, scrutinee, match);
+    }
+    return lowerValue(lw, scrutinee, match);
+}
+
+static bool isArithmetic(IrPrim op) {
+    return op == IrPrim::ADD || op == IrPrim::SUB || op == IrPrim::MUL ||
+           op == IrPrim::DIV;
+}
+
+static IrPrim primOf(const std::string &op) {
+    static const std::unordered_map<std::string, IrPrim> prims = {
+        {"+", IrPrim::ADD},         {"-", IrPrim::SUB},
+        {"*", IrPrim::MUL},         {"/", IrPrim::DIV},
+        {"%", IrPrim::MOD},         {"<", IrPrim::LT},
+        {">", IrPrim::GT},          {"<=", IrPrim::LE},
+        {">=", IrPrim::GE},         {"=", IrPrim::NUM_EQ},
+        {"not", IrPrim::NOT},       {"cons", IrPrim::CONS},
+        {"car", IrPrim::CAR},       {"cdr", IrPrim::CDR},
+        {"null?", IrPrim::IS_NULL}, {"map", IrPrim::MAP},
+        {"filter", IrPrim::FILTER}, {"vec-ref", IrPrim::VEC_REF},
+        {"vec-len", IrPrim::VEC_LEN}, {"vec-map", IrPrim::VEC_MAP},
+        {"vec-fold", IrPrim::VEC_FOLD}};
+    return prims.at(op);
+}
+
+// (+ a b c) is ((a + b) + c), each step typed by the larger operand rank,
+// the numeric primitive ids are interned in tower order
+static IrId lowerArithmetic(Lowerer &lw, IrPrim op,
+                            const std::vector<IrId> &args, TypeId type,
+                            const Cont &finish) {
+    if (args.size() == 1) {
+        return finish(prim(lw, op, type, args));
+    }
+    std::function<IrId(std::size_t, IrId)> step = [&](std::size_t i,
+                                                      IrId acc) -> IrId {
+        TypeId partial = std::max(lw.ir.nodes[acc].type,
+                                  lw.ir.nodes[args[i]].type);
+        if (op == IrPrim::DIV && partial == kIntType) {
+            partial = kRationalType;
+        }
+        IrId node = prim(lw, op, i + 1 == args.size() ? type : partial,
+                         {acc, args[i]});
+        if (i + 1 == args.size()) {
+            return finish(node);
+        }
+        return bindTemp(lw, node, [&](IrId next) { return step(i + 1, next); });
+    };
+    return step(1, args[0]);
+}
+
+// (< a b c) is (and (< a b) (< b c))
+static IrId lowerComparison(Lowerer &lw, IrPrim op,
+                            const std::vector<IrId> &args, std::size_t i,
+                            const Cont &finish) {
+    IrId test = prim(lw, op, kBoolType, {args[i], args[i + 1]});
+    if (i + 2 == args.size()) {
+        return finish(test);
+    }
+    return bindTemp(lw, test, [&](IrId holds) {
+        IrId rest = lowerComparison(lw, op, args, i + 1,
+                                    [](IrId node) { return node; });
+        return finish(
+            branch(lw, holds, rest, constant(lw, Value(false), kBoolType)));
+    });
+}
+
+static const VecAccess *vecAccess(Lowerer &lw, const TokenList &app) {
+    auto it = lw.tc.info.vecAccesses.find(app.get());
+    return it == lw.tc.info.vecAccesses.end() ? nullptr : &it->second;
+}
+
+static IrId index(Lowerer &lw, int i) { return constant(lw, i, kIntType); }
+
+// (thunk (vec-ref v i)) with the bounds check dropped
+static IrId elementThunk(Lowerer &lw, IrId vec, int i, TypeId elem) {
+    IrId ref = prim(lw, IrPrim::VEC_REF, elem, {vec, index(lw, i)}, 1);
+    return delay(lw, IrOp::THUNK, ref, elem);
+}
+
+// (vec-map f v) over a (vec T N) with a small N is
+//  (vec (thunk (f (thunk (vec-ref v 0)))) ... )
+static IrId unrollMap(Lowerer &lw, IrId fn, IrId vec, int length,
+                      TypeId type, const Cont &finish) {
+    TypeId in = signature(lw, lw.ir.nodes[fn].type).front();
+    TypeId out = signature(lw, lw.ir.nodes[fn].type).back();
+    std::vector<IrId> elems;
+    std::function<IrId(int)> step = [&](int i) -> IrId {
+        if (i == length) {
+            IrNode node;
+            node.op = IrOp::VEC;
+            node.type = type;
+            return finish(addNode(lw.ir, node, elems));
+        }
+        VarId arg = addVar(lw.ir, lw.ir.temp, in, true);
+        IrNode app;
+        app.op = IrOp::APP;
+        app.type = out;
+        app.a = fn;
+        IrId call = let(lw, arg, elementThunk(lw, vec, i, in),
+                        addNode(lw.ir, app, {varAtom(lw, arg)}));
+        return bindTemp(lw, delay(lw, IrOp::THUNK, call, out), [&](IrId e) {
+            elems.push_back(e);
+            return step(i + 1);
+        });
+    };
+    return step(0);
+}
+
+// (vec-fold f z v) over a (vec T N) with a small N is
+//  (f (thunk (f ... (f z e0) ...)) eN-1), each ei a thunk of (vec-ref v i)
+static IrId unrollFold(Lowerer &lw, IrId fn, IrId init, IrId vec, int length,
+                       TypeId type, const Cont &finish) {
+    if (length == 0) {
+        if (isLazyAtom(lw.ir, lw.ir.nodes[init])) {
+            return finish(atom(lw, IrOp::FORCE, init, type));
+        }
+        return finish(init);
+    }
+    TypeId elem = signature(lw, lw.ir.nodes[fn].type)[1];
+    std::function<IrId(int, IrId)> step = [&](int i, IrId acc) -> IrId {
+        VarId e = addVar(lw.ir, lw.ir.temp, elem, true);
+        IrNode app;
+        app.op = IrOp::APP;
+        app.type = type;
+        app.a = fn;
+        IrId call = let(lw, e, elementThunk(lw, vec, i, elem),
+                        addNode(lw.ir, app, {acc, varAtom(lw, e)}));
+        if (i + 1 == length) {
+            return finish(call);
+        }
+        return bindTemp(lw, delay(lw, IrOp::THUNK, call, type),
+                        [&](IrId next) { return step(i + 1, next); });
+    };
+    return step(0, init);
+}
+
+static IrId lowerPrim(Lowerer &lw, const std::string &op, const TokenList &app,
+                      const Cont &finish) {
+    std::vector<TokenNode> args = elements(tail(app));
+    TypeId type = recordedType(lw, app);
+    std::vector<IrId> atoms;
+    if (op == "and" || op == "or") {
+        return lowerValue(lw, args[0], [&](IrId first) {
+            IrId second = lowerTail(lw, args[1]);
+            IrId shortcut = constant(lw, Value(op == "or"), kBoolType);
+            return finish(op == "and" ? branch(lw, first, second, shortcut)
+                                      : branch(lw, first, shortcut, second));
+        });
+    }
+    if (op == "cons") {
+        return lowerArgs(lw, args, 0, atoms, [&](const auto &fields) {
+            return finish(prim(lw, IrPrim::CONS, type, fields));
+        });
+    }
+    // the initial accumulator of a fold is passed lazily like an argument
+    if (op == "foldl") {
+        return lowerValue(lw, args[0], [&](IrId fn) {
+            return lowerArg(lw, args[1], [&](IrId init) {
+                return lowerValue(lw, args[2], [&](IrId list) {
+                    return finish(
+                        prim(lw, IrPrim::FOLDL, type, {fn, init, list}));
+                });
+            });
+        });
+    }
+    if (op == "vec-fold") {
+        const VecAccess *access = vecAccess(lw, app);
+        return lowerValue(lw, args[0], [&](IrId fn) {
+            return lowerArg(lw, args[1], [&](IrId init) {
+                return lowerValue(lw, args[2], [&](IrId vec) {
+                    if (access && access->unroll) {
+                        return unrollFold(lw, fn, init, vec, access->length,
+                                          type, finish);
+                    }
+                    return finish(
+                        prim(lw, IrPrim::VEC_FOLD, type, {fn, init, vec}));
+                });
+            });
+        });
+    }
+    return lowerValues(lw, args, 0, atoms, [&](const auto &values) {
+        IrPrim p = primOf(op);
+        if (isArithmetic(p)) {
+            return lowerArithmetic(lw, p, values, type, finish);
+        }
+        if (values.size() > 2 && type == kBoolType && p != IrPrim::NOT) {
+            return lowerComparison(lw, p, values, 0, finish);
+        }
+        const VecAccess *access = vecAccess(lw, app);
+        if (p == IrPrim::VEC_MAP && access && access->unroll) {
+            return unrollMap(lw, values[0], values[1], access->length, type,
+                             finish);
+        }
+        std::uint32_t unchecked =
+            p == IrPrim::VEC_REF && access && !access->checked ? 1 : 0;
+        return finish(prim(lw, p, type, values, unchecked));
+    });
+}
+
+/* (f a b) evaluates f and passes a and b lazily. with _ holes
+ *  (f a _ c _) is (lambda (h1 h2) (f a h1 c h2))
+ * where a and c are evaluated, or delayed, once outside the lambda
+ */
+static IrId lowerApplication(Lowerer &lw, const TokenList &lst,
+                             const Cont &finish) {
+    std::vector<TokenNode> args;
+    std::vector<bool> holes;
+    for (TokenListIterator it(tail(lst)), end(TokenList{}); it != end; ++it) {
+        bool hole = isTokenOfKind(*it, TokenKind::PLACEHOLDER);
+        holes.push_back(hole);
+        if (!hole) {
+            args.push_back(*it);
+        }
+    }
+    TypeId type = recordedType(lw, lst);
+    return lowerValue(lw, head(lst), [&](IrId fn) {
+        std::vector<IrId> atoms;
+        return lowerArgs(lw, args, 0, atoms, [&](const auto &given) {
+            const std::vector<TypeId> &sig =
+                signature(lw, zonk(lw.tc.unifier, lw.tc.types,
+                                   lw.ir.nodes[fn].type));
+            std::vector<std::uint32_t> params;
+            std::vector<IrId> operands;
+            std::size_t next = 0;
+            for (std::size_t i = 0; i < holes.size(); i++) {
+                if (!holes[i]) {
+                    operands.push_back(given[next++]);
+                    continue;
+                }
+                VarId hole = addVar(lw.ir, lw.ir.temp, sig[i], true);
+                params.push_back(hole);
+                operands.push_back(varAtom(lw, hole));
+            }
+            IrNode app;
+            app.op = IrOp::APP;
+            app.type = params.empty() ? type : sig.back();
+            app.a = fn;
+            IrId call = addNode(lw.ir, app, operands);
+            if (params.empty()) {
+                return finish(call);
+            }
+            IrNode lambda;
+            lambda.op = IrOp::LAMBDA;
+            lambda.type = type;
+            lambda.b = call;
+            return finish(addNode(lw.ir, lambda, params));
+        });
+    });
+}
+
+static IrId lower(Lowerer &lw, const TokenNode &expr, const Cont &finish) {
+    if (std::optional<Value> value = literal(expr)) {
+        return finish(constant(lw, *value, literalType(*value)));
+    }
+    if (isTokenNodeToken(expr)) {
+        const Token &tok = std::get<Token>(expr);
+        if (tok.kind != TokenKind::SYMBOL) {
+            throw std::runtime_error("cannot lower " + toString(tok));
+        }
+        if (const Constructor *ctor = constructorOf(lw, expr)) {
+            return finish(constructorValue(lw, *ctor));
+        }
+        IrId var = lookupSymbol(lw, tok);
+        if (isLazyAtom(lw.ir, lw.ir.nodes[var])) {
+            return finish(atom(lw, IrOp::FORCE, var, lw.ir.nodes[var].type));
+        }
+        return finish(var);
+    }
+    const TokenList &lst = std::get<TokenList>(expr);
+    const TokenNode &first = head(lst);
+    if (!isTokenNodeToken(first)) {
+        return lowerApplication(lw, lst, finish);
+    }
+    const Token &tok = std::get<Token>(first);
+    switch (tok.kind) {
+    case TokenKind::LAMBDA:
+        return finish(lowerLambda(lw, lst));
+    case TokenKind::LET:
+    case TokenKind::LETS:
+    case TokenKind::LETR:
+        return lowerLet(lw, lst, finish);
+    case TokenKind::COND:
+        return lowerCond(lw, elements(tail(lst)), 0, recordedType(lw, lst),
+                         finish);
+    case TokenKind::TLAMBDA:
+        return finish(delay(lw, IrOp::TLAMBDA,
+                            lowerTail(lw, head(tail(tail(lst)))),
+                            recordedType(lw, lst)));
+    case TokenKind::TAPPLY:
+        return lowerValue(lw, head(tail(lst)), [&](IrId poly) {
+            IrId inst = atom(lw, IrOp::TAPPLY, poly, recordedType(lw, lst));
+            return finish(inst);
+        });
+    case TokenKind::QUOTE:
+        return finish(constant(lw, datumValue(head(tail(lst))),
+                               recordedType(lw, lst)));
+    case TokenKind::QQUOTE:
+        return lowerQuasi(lw, head(tail(lst)), recordedType(lw, lst), false,
+                          finish);
+    case TokenKind::EQ:
+    case TokenKind::EQUALS: {
+        std::vector<IrId> atoms;
+        return lowerValues(lw, elements(tail(lst)), 0, atoms,
+                           [&](const auto &values) {
+                               IrPrim op = tok.kind == TokenKind::EQ
+                                               ? IrPrim::EQ
+                                               : IrPrim::EQUAL;
+                               return finish(
+                                   prim(lw, op, kBoolType, values));
+                           });
+    }
+    // every lowered expression is already in WHNF
+    case TokenKind::FORCE:
+        return lower(lw, head(tail(lst)), finish);
+    case TokenKind::DO: {
+        std::vector<TokenNode> exprs = elements(tail(lst));
+        std::function<IrId(std::size_t)> step = [&](std::size_t i) -> IrId {
+            if (i + 1 == exprs.size()) {
+                return lower(lw, exprs[i], finish);
+            }
+            return lowerValue(lw, exprs[i],
+                              [&](IrId) { return step(i + 1); });
+        };
+        return step(0);
+    }
+    case TokenKind::TYPE_IDENT: {
+        std::vector<IrId> atoms;
+        return lowerArgs(lw, elements(tail(lst)), 0, atoms,
+                         [&](const auto &elems) {
+                             IrNode node;
+                             node.op = IrOp::VEC;
+                             node.type = recordedType(lw, lst);
+                             return finish(addNode(lw.ir, node, elems));
+                         });
+    }
+    case TokenKind::DEFINE:
+        throw std::runtime_error("define is only allowed at the top level");
+    case TokenKind::MATCH:
+        return lowerMatch(lw, lst, finish);
+    case TokenKind::SYMBOL:
+        if (loweredPrims.contains(symbolName(tok)) &&
+            !pmapFind(lw.env, symbolId(tok, lw))) {
+            return lowerPrim(lw, symbolName(tok), lst, finish);
+        }
+        if (const Constructor *ctor = constructorOf(lw, first)) {
+            std::vector<IrId> atoms;
+            return lowerArgs(lw, elements(tail(lst)), 0, atoms,
+                             [&](const auto &fields) {
+                                 return finish(construct(
+                                     lw, *ctor, recordedType(lw, lst),
+                                     fields));
+                             });
+        }
+        return lowerApplication(lw, lst, finish);
+    default:
+        throw std::runtime_error("cannot lower " + toString(tok.kind));
+    }
+}
+
+// a define annotated with a (PARAM_LIST ...) list binds its parameters
+static bool isFunctionDefine(const std::vector<TokenNode> &elems) {
+    const Token &typeTok = std::get<Token>(elems[2]);
+    return typeTok.value && isAstPtr(*typeTok.value) &&
+           isFormOf(astNode(typeTok), TokenKind::PARAM_LIST);
+}
+
+/* (define x:int 3)
+ * (define foo (x:int y:int -> int) body)
+ * (define foo (lambda (x:int y:int -> int) body))
+ * functions become LAMBDA globals and every other define a lazy global
+ */
+static void lowerDefine(Lowerer &lw, const TokenList &lst, std::uint32_t g) {
+    std::vector<TokenNode> elems = elements(lst);
+    IrGlobal &global = lw.ir.globals[g];
+    IrId body;
+    if (elems.size() == 3) {
+        body = lowerLambda(lw, asTokenList(elems[2]));
+    } else if (isFunctionDefine(elems)) {
+        body = function(lw, astNode(std::get<Token>(elems[2])), global.type,
+                        elems[3]);
+    } else {
+        body = lowerBinding(lw, elems[3], global.type, false);
+        // a lazy global is its own thunk
+        if (lw.ir.nodes[body].op == IrOp::THUNK) {
+            body = lw.ir.nodes[body].b;
+        }
+    }
+    lw.ir.globals[g].body = body;
+}
+
+IrModule lowerProgram(const std::vector<TokenNode> &program, TypeChecker &tc) {
+    if (tc.info.scopes.size() != program.size()) {
+        throw std::runtime_error("lowerProgram expects a program checked by "
+                                 "typecheck");
+    }
+    Lowerer lw{IrModule(), tc, PMap<IrBinding>()};
+    lw.ir.temp = tc.symbols.intern("t");
+    for (const Constructor &ctor : tc.data.constructors) {
+        std::size_t siblings = tc.data.types[ctor.data].constructors.size();
+        lw.ir.constructors.push_back(
+            IrConstructor{ctor.name, ctor.tag, ctor.arity,
+                          representation(ctor.arity, siblings), ctor.type});
+    }
+    for (std::size_t i = 0; i < program.size(); i++) {
+        const TokenNode &form = program[i];
+        // data forms only declare types, the typechecker did all the work
+        if (isFormOf(form, TokenKind::DATA)) {
+            continue;
+        }
+        // forms the typecheck cache skipped have no recorded types yet
+        if (isTokenNodeList(form) &&
+            !tc.info.exprTypes.contains(std::get<TokenList>(form).get())) {
+            TypeEnv saved = tc.env;
+            tc.env = tc.info.scopes[i];
+            typeOf(form, tc);
+            tc.env = saved;
+        }
+        if (!isFormOf(form, TokenKind::DEFINE)) {
+            lw.ir.exprs.push_back(lowerTail(lw, form));
+            continue;
+        }
+        const TokenList &lst = std::get<TokenList>(form);
+        const Token &name = std::get<Token>(head(tail(lst)));
+        std::vector<TokenNode> elems = elements(lst);
+        bool lazy = elems.size() == 4 && !isFunctionDefine(elems) &&
+                    !isFormOf(elems[3], TokenKind::LAMBDA);
+        std::uint32_t g = static_cast<std::uint32_t>(lw.ir.globals.size());
+        lw.ir.globals.push_back(
+            IrGlobal{symbolId(name, lw), recordedType(lw, lst), kNoIr, lazy});
+        lw.env = pmapInsert(lw.env, symbolId(name, lw), IrBinding{true, g});
+        lowerDefine(lw, lst, g);
+    }
+    return std::move(lw.ir);
+}
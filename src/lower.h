@@ -0,0 +1,27 @@
+#ifndef SPROUT_LANG_LOWER_H
+#define SPROUT_LANG_LOWER_H
+
+#include "ir.h"
+#include "token.h"
+#include "typechecker.h"
+#include <vector>
+
+/*
+ * lowers a typechecked program to the ANF IR of ir.h. every node is typed
+ * from the facts the typechecker recorded in tc.info, forms the typecheck
+ * cache skipped are typed again in the scope recorded for them, and the
+ * vec access facts turn constant in bounds vec-ref into unchecked indexing
+ * and vec-map/vec-fold over short vectors into straight line code.
+ *
+ * the lazy semantics of docs/semantics.md are made explicit on the way:
+ *  let, lets and letr bindings         THUNK, lambdas are bound directly
+ *  arguments of calls, cons and vec    THUNK unless they are atoms
+ *  non function top level defines      lazy globals, evaluated once
+ *  reading a lazy variable as a value  FORCE
+ * a named let becomes a LETREC of its loop function applied to the inits,
+ * and/or/cond become IF, and an application with _ holes becomes a LAMBDA
+ * over the holes
+ */
+IrModule lowerProgram(const std::vector<TokenNode> &program, TypeChecker &tc);
+
+#endif
@@ -1,10 +1,26 @@
+#include "bytecode.h"
 #include "cell.h"
+#include "cse.h"
+#include "dce.h"
+#include "fold.h"
+#include "fuse.h"
+#include "inline.h"
 #include "lexer.h"
+#include "lower.h"
+#include "object.h"
 #include "parser.h"
 #include "rational.h"
+#include "strictness.h"
 #include "token.h"
+#include "typecache.h"
+#include "typechecker.h"
 #include "value.h"
+#include "vm.h"
+#include "worker.h"
 
+#include <chrono>
+#include <functional>
+#include <limits>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -140,10 +156,1467 @@ void testLexArrow() {
     }
 }
 
+void testTypecheck() {
+    std::vector<ParseCase> cases = {
+        {"(define x:int 3)", false},
+        {"(define x:(vec int 3) (vec 1 2 3))", false},
+        {"(define foo (x:int y:int -> int) (+ x y))", false},
+        {"(define foo (lambda (x:int y:float -> float) (+ x y)))", false},
+        {"(define half:rational (/ 1 2))", false},
+        {"(define v:(vec float 3) (vec 1.0 2.0 3.0)) (vec-ref v 2)", false},
+        {"(define v:(vec float 3) (vec 1.0 2.0 3.0)) (vec-ref v (- 3 1))",
+         false},
+        {"(define dot (a:(vec float 3) b:(vec float 3) -> float) (vec-fold "
+         "(lambda (acc:float x:float -> float) (+ acc x)) 0.0 (vec-map "
+         "(lambda (x:float -> float) (* x x)) a)))",
+         false},
+        {"(define foo (x:int y:int z:int -> int) (+ x (+ y z))) (let "
+         "((f:(int->int->int) (foo 2 _ _))) (f 3 5))",
+         false},
+        {"(lets ((x:int 3) (y:int (+ x 2))) (* x y))", false},
+        {"(let ((x:int 1)) (let ((x:float 2.0)) x))", false},
+        {"(letr ((even:(int->bool) (lambda (n:int -> bool) (cond ((= n 0) "
+         "#t) (else (odd (- n 1)))))) (odd:(int->bool) (lambda (n:int -> "
+         "bool) (cond ((= n 0) #f) (else (even (- n 1))))))) (even 10))",
+         false},
+        {"(define xs:(list int) (cons 1 '()))", false},
+        {"(null? '())", false},
+        {"(let loop ((k:int 0) (acc:int 1)) (cond ((= k 10) acc) (else (loop "
+         "(+ k 1) (* acc 2)))))",
+         false},
+        {"(let loop ((k:int 0)) (cond ((< k 10) (loop (+ k 1))) (else "
+         "(/ k 3))))",
+         false},
+        {"(define foo (a:int b:float c:int d:bool -> float) b) (let "
+         "((g:(float->bool->float) (foo 2 _ 4 _))) (g 1.0 #t))",
+         false},
+        {"(define id:(forall (A) (A -> A)) (tlambda (A) (lambda (x:A -> A) "
+         "x))) ((tapply id int) 42)",
+         false},
+        {"(define id:(forall (A) (A -> A)) (tlambda (B) (lambda (x:B -> B) "
+         "x))) ((tapply id (vec int 4)) (vec 1 2 3 4))",
+         false},
+        {"(define id:(forall (A) (A -> A)) (tlambda (A) (lambda (x:A -> A) "
+         "x))) (let ((a:int ((tapply id int) 1)) (b:int ((tapply id int) 2))) "
+         "(+ a b))",
+         false},
+        {"(define k:(forall (A B) (A -> B -> A)) (tlambda (A B) (lambda "
+         "(x:A y:B -> A) x))) (let ((idInt:(int->float->int) (tapply k int "
+         "float))) (idInt 42 1.0))",
+         false},
+        {"(define app:(forall (A) ((forall (B) (B -> A)) -> A)) (tlambda "
+         "(A) (lambda (f:(forall (B) (B -> A)) -> A) ((tapply f int) 1)))) "
+         "(tapply app float)",
+         false},
+        // Error cases.
+        {"(define x:int 3.0)", true},
+        {"(define id:(forall (A) (A -> A)) (tlambda (A) (lambda (x:A -> A) "
+         "x))) (id 42)",
+         true},
+        {"(define f:(forall (A) (A -> A)) (tlambda (A) (lambda (x:A -> int) "
+         "1)))",
+         true},
+        {"(define v:(vec int 3) (vec 1 2))", true},
+        {"(define v:(vec int 3) (vec 1 2 3)) (vec-ref v 3)", true},
+        {"(define foo (x:int -> int) (foo 1 2))", true},
+        {"(let ((x:int 0)) y)", true},
+        {"(define f (x:int -> int) x) x", true},
+        {"(cond (#t 1) (#f 2.0))", true},
+        {"(define xs:(list int) '(1 #t))", true},
+        {"(let loop ((k:int 0)) (loop (+ k 1)))", true},
+        {"(let loop ((k:int 0)) (cond ((< k 10) (loop 1)) (else #t)))", false},
+        {"(let loop ((k:int 0)) (cond ((< k 10) (loop 1.5)) (else k)))", true},
+        // equal? compares data, eq? any two values
+        {"(define f (x:int -> int) x) (equal? f f)", true},
+        {"(equal? (cons (lambda (x:int -> int) x) '()) '())", true},
+        {"(data Fn (A) (Fn ((A -> A))))\n"
+         "(equal? (Fn (lambda (x:int -> int) x))"
+         " (Fn (lambda (x:int -> int) x)))",
+         true},
+        {"(define f (x:int -> int) x) (eq? f f)", false},
+        {"(data Seq (A) (End) (Item (A (Seq A))))\n"
+         "(equal? (Item 1 End) (Item 1 End))",
+         false}};
+
+    for (const auto &tc : cases) {
+        std::cout << "String to typecheck: " << tc.src << std::endl;
+        try {
+            Lexer lex(tc.src);
+            std::vector<TokenNode> program = parseProgram(lex);
+            TypeChecker checker;
+            for (const TokenNode &form : program) {
+                checker.info = TypeInfo();
+                std::cout << toString(checker.types, typeOf(form, checker))
+                          << std::endl;
+                for (const auto &[site, access] : checker.info.vecAccesses) {
+                    std::cout << "  vec access length=" << access.length
+                              << " index=" << access.index
+                              << " checked=" << access.checked
+                              << " unroll=" << access.unroll << std::endl;
+                }
+            }
+            if (tc.expect_error) {
+                std::cout << "ERROR: expected failure but typechecked"
+                          << std::endl;
+            }
+        } catch (const std::runtime_error &e) {
+            std::cout << e.what() << std::endl;
+            if (!tc.expect_error) {
+                std::cout << "ERROR: expected success but failed" << std::endl;
+            }
+        }
+    }
+}
+
+// typechecks a generated module of chained defines serially and in parallel,
+// the results and diagnostics must match
+void testTypecheckProgram() {
+    std::ostringstream src;
+    const int defines = 20000;
+    src << "(define f0 (x:int -> int) (+ x 1))\n";
+    for (int i = 1; i < defines; i++) {
+        src << "(define f" << i << " (x:int -> int) (f" << i / 2
+            << " (+ x " << i << ")))\n";
+    }
+    src << "(define bad1:int 1.0)\n(define bad2 (x:int -> bool) x)\n";
+    Lexer lex(src.str());
+    std::vector<TokenNode> program = parseProgram(lex);
+    std::string expected;
+    for (unsigned threads : {1u, 2u, 4u, 0u}) {
+        TypeChecker checker;
+        checker.threads = threads;
+        auto start = std::chrono::steady_clock::now();
+        std::string diagnostics;
+        try {
+            typecheck(program, checker);
+        } catch (const std::runtime_error &e) {
+            diagnostics = e.what();
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+        std::cout << "threads=" << threads << " forms=" << program.size()
+                  << " time=" << ms << "ms" << std::endl;
+        if (threads == 1) {
+            expected = diagnostics;
+            std::cout << diagnostics << std::endl;
+        } else if (diagnostics != expected) {
+            std::cout << "ERROR: diagnostics differ from the serial run"
+                      << std::endl;
+        }
+    }
+}
+
+// a module of chained defines where define `edited` gets body or, when
+// retyped, signature (x:int -> float)
+static std::string cachedModule(int edited, int body, bool retyped) {
+    std::ostringstream src;
+    src << "(define v:(vec int 3) (vec 1 2 3))\n";
+    src << "(define f0 (x:int -> int) (+ x (vec-ref v 1)))\n";
+    for (int i = 1; i < 2000; i++) {
+        src << "(define f" << i << " (x:int -> "
+            << (retyped && i == edited ? "float" : "int") << ") (f" << i / 2
+            << " (+ x " << (i == edited ? body : i) << ")))\n";
+    }
+    return src.str();
+}
+
+// rechecks edited versions of a module against a cache, only the edited
+// define and, when its signature changes, its dependents are checked again
+void testTypecheckCache() {
+    struct Run {
+        std::string name;
+        std::string src;
+        std::size_t misses;
+    };
+    std::vector<Run> runs = {
+        {"cold", cachedModule(10, 10, false), 2001},
+        {"unchanged", cachedModule(10, 10, false), 0},
+        {"body edit", cachedModule(10, 99, false), 1},
+        {"signature edit", cachedModule(10, 10, true), 3},
+        {"reverted", cachedModule(10, 10, false), 0}};
+    TypecheckCache cache;
+    for (const Run &run : runs) {
+        Lexer lex(run.src);
+        std::vector<TokenNode> program = parseProgram(lex);
+        TypeChecker checker;
+        checker.cache = &cache;
+        cache.hits = cache.misses = 0;
+        try {
+            typecheck(program, checker);
+        } catch (const std::runtime_error &e) {
+            std::cout << e.what() << std::endl;
+        }
+        std::cout << run.name << ": hits=" << cache.hits
+                  << " misses=" << cache.misses
+                  << " vec facts=" << checker.info.vecAccesses.size()
+                  << std::endl;
+        if (cache.misses != run.misses) {
+            std::cout << "ERROR: expected " << run.misses << " misses"
+                      << std::endl;
+        }
+    }
+    saveTypecheckCache(cache, "out/typecheck.cache");
+    TypecheckCache loaded = loadTypecheckCache("out/typecheck.cache");
+    Lexer lex(cachedModule(10, 10, false));
+    std::vector<TokenNode> program = parseProgram(lex);
+    TypeChecker checker;
+    checker.cache = &loaded;
+    typecheck(program, checker);
+    std::cout << "from disk: hits=" << loaded.hits
+              << " misses=" << loaded.misses
+              << " vec facts=" << checker.info.vecAccesses.size() << std::endl;
+}
+
+// lowers small typechecked programs and prints their IR
+void testLower() {
+    std::vector<std::string> programs = {
+        "(define sq (x:int -> int) (* x x))\n"
+        "(define v:(vec int 3) (vec 1 2 3))\n"
+        "(sq (vec-ref v 2))",
+        "(define sum (n:int -> int) (let loop ((k:int n) (acc:int 0))"
+        " (cond ((= k 0) acc) (#t (loop (- k 1) (+ acc k))))))",
+        "(define f (a:int b:int c:int -> int) (+ a b c))\n"
+        "(let ((g:(int->int) (f 1 _ (+ 2 3)))) (g 4))",
+        "(define v:(vec int 3) (vec 1 2 3))\n"
+        "(vec-fold (lambda (a:int x:int -> int) (+ a x)) 0"
+        " (vec-map (lambda (x:int -> int) (* x 2)) v))",
+        "(define id:(forall (A) (A -> A)) (tlambda (A) (lambda (x:A -> A) x)))"
+        "\n((tapply id int) 3)",
+        "(define xs:(list int) '(1 2 3))\n"
+        "(and (null? (cdr xs)) (< 1 (car xs) 3))",
+        "(define xs:(list int) '(2 3))\n(cons (+ 1 0) (cdr xs))",
+        "(lets ((a:int 1) (b:int (+ a (* a 2))) (c:int b) (d:int (% b 2))"
+        " (e:(list int) (cons a '()))) (+ c d (car e)))"};
+    for (const std::string &src : programs) {
+        Lexer lex(src);
+        std::vector<TokenNode> program = parseProgram(lex);
+        TypeChecker checker;
+        checker.threads = 1;
+        try {
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            std::cout << src << "\n=>\n"
+                      << toString(ir, checker.symbols, checker.types)
+                      << std::endl;
+        } catch (const std::runtime_error &e) {
+            std::cout << "ERROR: " << e.what() << std::endl;
+        }
+    }
+    // defines checked by parallel workers, one with a '() whose element type
+    // is never solved, lower the same as when checked serially
+    std::string src = "(define a (x:int -> bool) (null? '()))\n"
+                      "(define b (x:int -> int) 3)\n"
+                      "(define c (x:int -> (list int)) (cons x '()))\n"
+                      "(a 1)\n(car (c (b 2)))";
+    std::string serial;
+    for (unsigned threads : {1u, 2u, 4u, 0u}) {
+        Lexer lex(src);
+        std::vector<TokenNode> program = parseProgram(lex);
+        TypeChecker checker;
+        checker.threads = threads;
+        std::string got;
+        try {
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            got = toString(ir, checker.symbols, checker.types);
+        } catch (const std::runtime_error &e) {
+            got = e.what();
+        }
+        std::cout << "threads=" << threads << "\n" << got << std::endl;
+        if (threads == 1) {
+            serial = got;
+        } else if (got != serial) {
+            std::cout << "ERROR: lowered differently from the serial run"
+                      << std::endl;
+        }
+    }
+}
+
+// runs strictness analysis on lowered programs, printing the report and IR
+void testStrictness() {
+    struct Case {
+        std::string src;
+        int thunks; // expected thunks eliminated
+        std::string expected;
+    };
+    std::vector<Case> cases = {
+        // the loop is strict in k and acc, so both recursive arguments and
+        // the call from sum are evaluated eagerly
+        {"(define sum (n:int -> int) (let loop ((k:int n) (acc:int 0))"
+         " (cond ((= k 0) acc) (#t (loop (- k 1) (+ acc k))))))",
+         2, ""},
+        // y is only used in one branch and stays lazy
+        {"(define pick (b:bool x:int y:int -> int) (cond (b x) (#t (+ x y))))\n"
+         "(let ((a:int (% 7 3)) (c:int (% 9 4))) (pick #t a c))",
+         1, "1"},
+        // k escapes into f, so its arguments stay lazy even though it is
+        // strict in x
+        {"(define k (x:int y:int -> int) x)\n"
+         "(let ((f:(int->int->int) k)) (f (% 5 3) (% 7 3)))",
+         0, "2"},
+        // the lambda adder returns is called where it is not known, so x
+        // stays lazy
+        {"(define adder (n:int -> (int -> int)) (lambda (x:int -> int)"
+         " (+ x n)))\n(define sq (x:int -> int) (* x x))\n((adder 3) (sq 2))",
+         0, "7"}};
+    for (const Case &c : cases) {
+        Lexer lex(c.src);
+        std::vector<TokenNode> program = parseProgram(lex);
+        TypeChecker checker;
+        checker.threads = 1;
+        try {
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            StrictnessReport report =
+                analyzeStrictness(ir, checker.symbols, true);
+            std::cout << toString(ir, checker.symbols, checker.types)
+                      << std::endl;
+            if (report.thunks != c.thunks) {
+                std::cout << "ERROR: expected " << c.thunks
+                          << " thunks eliminated" << std::endl;
+            }
+            Program code = compileProgram(ir, checker.symbols);
+            Vm vm(code);
+            std::vector<Word> values = run(vm);
+            std::string got;
+            for (std::size_t i = 0; i < values.size(); i++) {
+                got += (i > 0 ? " " : "") +
+                       toString(vm, values[i], ir.nodes[ir.exprs[i]].type,
+                                checker.types, checker.symbols);
+            }
+            if (got != c.expected) {
+                std::cout << "ERROR: expected " << c.expected << ", got "
+                          << got << std::endl;
+            }
+        } catch (const std::runtime_error &e) {
+            std::cout << "ERROR: " << e.what() << std::endl;
+        }
+    }
+}
+
+// inlines small and single use functions and folds tapply of tlambda
+void testInline() {
+    struct Case {
+        std::string src;
+        int inlined; // expected calls inlined, beta reduced or folded
+    };
+    std::vector<Case> cases = {
+        // id is instantiated and applied in place, leaving the constant
+        {"(define id:(forall (A) (A -> A)) (tlambda (A) (lambda (x:A -> A) x)))"
+         "\n((tapply id int) 3)",
+         2},
+        // sq is small enough to inline into both calls
+        {"(define sq (x:int -> int) (* x x))\n(+ (sq 3) (sq 4))", 2},
+        // an immediately applied lambda
+        {"((lambda (x:int y:int -> int) (- x y)) 5 2)", 1},
+        // a letr binding that does not call itself is inlined
+        {"(letr ((f:(int->int) (lambda (x:int -> int) (+ x 1)))) (f 2))", 1},
+        // the loop calls itself and sum is over the budget
+        {"(define sum (n:int -> int) (let loop ((k:int n) (acc:int 0))"
+         " (cond ((= k 0) acc) (#t (loop (- k 1) (+ acc k))))))\n(sum 10)",
+         0},
+        // mutually recursive letr functions are never inlined
+        {"(letr ((ev:(int->bool) (lambda (n:int -> bool)"
+         " (cond ((= n 0) #t) (#t (od (- n 1))))))"
+         " (od:(int->bool) (lambda (n:int -> bool)"
+         " (cond ((= n 0) #f) (#t (ev (- n 1)))))))"
+         " (ev 4))",
+         0},
+        // a let bound lambda called twice is inlined into both calls and
+        // its binding dropped
+        {"(let ((g:(int->int) (lambda (n:int -> int) (* n n))))"
+         " (+ (g 3) (g 4)))",
+         2},
+        {"(let ((g:(int->int) (lambda (n:int -> int) (+ n 1))))"
+         " (+ (g 3) (g 4)))",
+         2},
+        {"(let ((g:(int->int) (lambda (n:int -> int) (+ n 1))))"
+         " (let ((a:int (g 1))) (* (g a) (g 2))))",
+         3}};
+    for (const Case &c : cases) {
+        Lexer lex(c.src);
+        std::vector<TokenNode> program = parseProgram(lex);
+        TypeChecker checker;
+        checker.threads = 1;
+        try {
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            InlineStats stats = inlineCalls(ir);
+            std::cout << c.src << "\n=>\n"
+                      << toString(ir, checker.symbols, checker.types)
+                      << std::endl;
+            int inlined =
+                stats.inlined + stats.betaReduced + stats.tapplyFolded;
+            if (inlined != c.inlined) {
+                std::cout << "ERROR: expected " << c.inlined
+                          << " inlined, got " << inlined << std::endl;
+            }
+        } catch (const std::runtime_error &e) {
+            std::cout << "ERROR: " << e.what() << std::endl;
+        }
+    }
+}
+
+void testMatch() {
+    std::string prelude = "(data Maybe (A) (Nothing) (Just (A)))\n"
+                          "(data List (A) (Nil) (Cons (A (List A))))\n"
+                          "(data Shape (A) (Dot) (Line (A)) (Box (A A)))\n";
+    std::vector<ParseCase> cases = {
+        {"(define orZero (m:(Maybe int) -> int)"
+         " (match m (Nothing 0) ((Just x) x)))\n(orZero (Just 3))",
+         false},
+        // the nested Just is tested once for both of the first clauses
+        {"(define pair (xs:(List (Maybe int)) -> int)"
+         " (match xs ((Cons (Just x) (Cons (Just y) Nil)) (+ x y))"
+         " ((Cons (Just x) _) x) ((Cons Nothing _) 1) (else 0)))",
+         false},
+        // three constructors switch on the tag
+        {"(define area (s:(Shape int) -> int)"
+         " (match s (Dot 0) ((Line n) n) ((Box w h) (* w h))))",
+         false},
+        // builtin lists, dotted tails and literals
+        {"(define f (xs:(list int) -> int)"
+         " (match xs (() 0) ((1 . rest) 1) ((x y) (+ x y)) (_ 9)))",
+         false},
+        {"(define g (b:bool s:string -> int)"
+         " (match b (#t (match s (\"yes\" 1) (else 2))) (#f 3)))",
+         false},
+        // a clause reached from two leaves is a join point
+        {"(define h (a:(Maybe int) -> int)"
+         " (match a ((Just 1) 1) (x 2)))",
+         false},
+        {"(define bad (m:(Maybe int) -> int) (match m ((Just x y) x)))", true},
+        {"(define bad (m:(Maybe int) -> bool) (match m ((Just x) x)))", true},
+        {"(define bad (m:(Maybe int) -> int) (match m (() 0)))", true}};
+    for (const ParseCase &c : cases) {
+        Lexer lex(prelude + c.src);
+        TypeChecker checker;
+        checker.threads = 1;
+        try {
+            std::vector<TokenNode> program = parseProgram(lex);
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            std::cout << c.src << "\n=>\n"
+                      << toString(ir, checker.symbols, checker.types)
+                      << std::endl;
+            if (c.expect_error) {
+                std::cout << "ERROR: expected a type error" << std::endl;
+            }
+        } catch (const std::runtime_error &e) {
+            std::cout << c.src << "\n=> " << e.what() << '\n' << std::endl;
+            if (!c.expect_error) {
+                std::cout << "ERROR: unexpected failure" << std::endl;
+            }
+        }
+    }
+}
+
+// the clause the first matching pattern belongs to, counting every tag,
+// cons shape and literal compared on the way
+static std::size_t naiveMatch(const std::vector<Pattern> &clauses,
+                              const Pattern &value, int &tests) {
+    std::function<bool(const Pattern &, const Pattern &)> matches =
+        [&](const Pattern &p, const Pattern &v) {
+            switch (p.kind) {
+            case PatternKind::WILD:
+            case PatternKind::VAR:
+                return true;
+            case PatternKind::LIT:
+                tests++;
+                return sameLiteral(p.literal, v.literal);
+            case PatternKind::NIL:
+            case PatternKind::CONS:
+                tests++;
+                if (p.kind != v.kind) {
+                    return false;
+                }
+                break;
+            case PatternKind::CTOR:
+                tests++;
+                if (v.ctor != p.ctor) {
+                    return false;
+                }
+                break;
+            }
+            for (std::size_t i = 0; i < p.args.size(); i++) {
+                if (!matches(p.args[i], v.args[i])) {
+                    return false;
+                }
+            }
+            return true;
+        };
+    for (std::size_t i = 0; i < clauses.size(); i++) {
+        if (matches(clauses[i], value)) {
+            return i;
+        }
+    }
+    return clauses.size();
+}
+
+// the same through the decision tree, a tag or cons test is one comparison
+// and a switch is one indexed jump
+static std::size_t treeMatch(const DecisionTree &tree, const DataTable &data,
+                             const Pattern &value, int &tests) {
+    std::function<const Pattern &(std::size_t)> at =
+        [&](std::size_t occ) -> const Pattern & {
+        if (occ == 0) {
+            return value;
+        }
+        const Occurrence &o = tree.occurrences[occ];
+        return at(o.parent).args[o.field];
+    };
+    std::size_t id = tree.root;
+    while (true) {
+        const Decision &d = tree.nodes[id];
+        if (d.kind == DecisionKind::FAIL) {
+            return std::numeric_limits<std::size_t>::max();
+        }
+        if (d.kind == DecisionKind::LEAF) {
+            return d.clause;
+        }
+        tests++;
+        const Pattern &v = at(d.occurrence);
+        switch (d.kind) {
+        case DecisionKind::SWITCH: {
+            std::size_t arm = d.arms[static_cast<std::size_t>(
+                data.constructors[v.ctor].tag)];
+            id = arm == kNoDecision ? d.no : arm;
+            break;
+        }
+        case DecisionKind::TAG:
+            id = v.ctor == d.ctor ? d.yes : d.no;
+            break;
+        case DecisionKind::NIL:
+            id = v.kind == PatternKind::NIL ? d.yes : d.no;
+            break;
+        default:
+            id = sameLiteral(v.literal, d.literal) ? d.yes : d.no;
+            break;
+        }
+    }
+}
+
+/* compares top to bottom clause testing with the decision tree on matches
+ * over nested Maybe and List values, every shape of a list of up to depth
+ * Maybes with a clause per shape, and towers of Just depth deep. the
+ * benchmark counts the tests on every value of up to one more element or
+ * level than the patterns and times the compilation
+ */
+void benchMatch() {
+    Lexer prelude("(data Maybe (A) (Nothing) (Just (A)))\n"
+                  "(data List (A) (Nil) (Cons (A (List A))))");
+    TypeChecker checker;
+    checker.threads = 1;
+    typecheck(parseProgram(prelude), checker);
+    auto pattern = [&](const std::string &src) {
+        Lexer lex(src);
+        return makePattern(parse(lex), checker.data, checker.symbols);
+    };
+    // every list of up to n elements, each Nothing or (Just leaf)
+    std::function<std::vector<std::string>(int, const std::string &)> lists =
+        [&](int n, const std::string &leaf) {
+            std::vector<std::string> out{"Nil"};
+            if (n == 0) {
+                return out;
+            }
+            for (const std::string &rest : lists(n - 1, leaf)) {
+                out.push_back("(Cons Nothing " + rest + ")");
+                out.push_back("(Cons (Just " + leaf + ") " + rest + ")");
+            }
+            return out;
+        };
+    auto tower = [](int n, const std::string &leaf) {
+        std::string out = leaf;
+        for (int i = 0; i < n; i++) {
+            out = "(Just " + out + ")";
+        }
+        return out;
+    };
+    struct Bench {
+        std::string name;
+        std::vector<Pattern> clauses;
+        std::vector<Pattern> values;
+    };
+    std::vector<Bench> benches;
+    for (int depth : {2, 4, 6}) {
+        Bench list{"list of maybe, depth " + std::to_string(depth), {}, {}};
+        for (const std::string &p : lists(depth, "x")) {
+            list.clauses.push_back(pattern(p));
+        }
+        list.clauses.push_back(pattern("_"));
+        for (const std::string &v : lists(depth + 1, "1")) {
+            list.values.push_back(pattern(v));
+        }
+        benches.push_back(std::move(list));
+        Bench nest{"nested just, depth " + std::to_string(depth), {}, {}};
+        for (int i = depth; i >= 0; i--) {
+            nest.clauses.push_back(pattern(tower(i, "Nothing")));
+        }
+        nest.clauses.push_back(pattern(tower(depth + 1, "x")));
+        for (int i = 0; i <= depth + 1; i++) {
+            nest.values.push_back(pattern(tower(i, "Nothing")));
+            nest.values.push_back(pattern(tower(i, "(Just 1)")));
+        }
+        benches.push_back(std::move(nest));
+    }
+    for (const Bench &b : benches) {
+        DecisionTree tree = compileMatch(b.clauses, checker.data);
+        int naive = 0;
+        int decided = 0;
+        for (const Pattern &value : b.values) {
+            std::size_t expected = naiveMatch(b.clauses, value, naive);
+            if (treeMatch(tree, checker.data, value, decided) != expected) {
+                std::cout << "ERROR: " << b.name << " disagrees with the "
+                          << "clauses on a value" << std::endl;
+            }
+        }
+        constexpr int runs = 200;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < runs; i++) {
+            compileMatch(b.clauses, checker.data);
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count() /
+                  runs;
+        std::cout << b.name << ": " << b.clauses.size() << " clauses, "
+                  << b.values.size() << " values, " << naive
+                  << " tests top to bottom, " << decided
+                  << " through the tree of " << tree.nodes.size()
+                  << " nodes, compiled in " << us << "us" << std::endl;
+    }
+    DecisionTree small = compileMatch(benches[0].clauses, checker.data);
+    std::cout << toString(small, checker.data, checker.symbols);
+}
+
+// layouts of constructed values, the tags match reads off them and equal?
+void testObjects() {
+    Lexer lex("(data Maybe (A) (Nothing) (Just (A)))\n"
+              "(data List (A) (Nil) (Cons (A (List A))))\n"
+              "(data Box (A) (Box (A)))\n"
+              "(data Op (A) (Add) (Sub) (Mul) (Div) (Lit (A)))");
+    std::vector<TokenNode> program = parseProgram(lex);
+    TypeChecker checker;
+    typecheck(program, checker);
+    IrModule ir = lowerProgram(program, checker);
+    auto rep = [&](const std::string &name) {
+        SymbolId id = checker.symbols.intern(name);
+        for (const IrConstructor &ctor : ir.constructors) {
+            if (ctor.name == id) {
+                return ctor;
+            }
+        }
+        throw std::runtime_error("no constructor " + name);
+    };
+    auto make = [&](Heap &heap, const std::string &name,
+                    std::vector<Word> fields) {
+        IrConstructor ctor = rep(name);
+        return construct(heap, ctor.rep, ctor.tag, fields.data(), ctor.arity);
+    };
+    auto expect = [](bool ok, const std::string &what) {
+        std::cout << (ok ? "ok " : "ERROR: ") << what << std::endl;
+    };
+    Heap heap;
+    Word nothing = make(heap, "Nothing", {});
+    Word nil = make(heap, "Nil", {});
+    expect(heap.objects == 0 && isImmediate(nothing) && isImmediate(nil),
+           "nullary constructors are immediates");
+    Word just = make(heap, "Just", {fixnum(3)});
+    expect(heap.bytes == 16, "a one field constructor takes 16 bytes");
+    expect(tagOf(just) == 1 && tagOf(nothing) == 0 &&
+               (just & kPointerMask) != 0,
+           "small tags are cached in the pointer");
+    expect(fixnumValue(fieldOf(just, rep("Just").rep, 0)) == 3,
+           "fields are inline after the header");
+    Word box = make(heap, "Box", {just});
+    expect(box == just && heap.objects == 1,
+           "a single field wrapper is its field");
+    Word lit = make(heap, "Lit", {fixnum(7)});
+    expect(tagOf(lit) == 4 && (lit & kPointerMask) == 0 &&
+               tagOf(make(heap, "Div", {})) == 3,
+           "large tags are read from the header");
+    Word xs = make(heap, "Cons",
+                   {just, make(heap, "Cons", {nothing, nil})});
+    Word ys = make(heap, "Cons",
+                   {make(heap, "Just", {fixnum(3)}),
+                    make(heap, "Cons", {nothing, nil})});
+    Word zs = make(heap, "Cons", {just, make(heap, "Cons", {just, nil})});
+    expect(equalWords(xs, ys) && !equalWords(xs, zs) &&
+               !equalWords(xs, nil),
+           "equal? compares tags then fields");
+    expect(equalWords(makeString(heap, "sprout"),
+                      makeString(heap, "sprout")) &&
+               !equalWords(makeFloat(heap, 1.5), makeFloat(heap, 2.5)),
+           "equal? on strings and floats");
+    // a long list is compared without recursing on the cdr
+    Word a = nil;
+    Word b = nil;
+    for (int i = 0; i < 1000000; i++) {
+        a = makeCons(heap, fixnum(i), a);
+        b = makeCons(heap, fixnum(i), b);
+    }
+    expect(equalWords(a, b), "equal? on a million element list");
+    std::cout << heap.objects << " objects, " << heap.bytes << " bytes"
+              << std::endl;
+}
+
+// compiles small programs to bytecode and runs them, closures capture their
+// free variables by copy and read them back with ENV at a fixed offset
+void testVm() {
+    struct Case {
+        std::string src;
+        std::string expected; // the printed top level values
+    };
+    std::string prelude = "(data Maybe (A) (Nothing) (Just (A)))\n"
+                          "(data List (A) (Nil) (Cons (A (List A))))\n";
+    std::vector<Case> cases = {
+        {"(define adder (n:int -> (int -> int)) (lambda (x:int -> int)"
+         " (+ x n)))\n((adder 3) 4)",
+         "7"},
+        {"(define sum (n:int -> int) (let loop ((k:int n) (acc:int 0))"
+         " (cond ((= k 0) acc) (#t (loop (- k 1) (+ acc k))))))\n(sum 100)",
+         "5050"},
+        {"(letr ((ev:(int->bool) (lambda (n:int -> bool)"
+         " (cond ((= n 0) #t) (#t (od (- n 1))))))"
+         " (od:(int->bool) (lambda (n:int -> bool)"
+         " (cond ((= n 0) #f) (#t (ev (- n 1)))))))"
+         " (ev 10))",
+         "#t"},
+        {"(define total (xs:(List (Maybe int)) -> int)"
+         " (match xs (Nil 0) ((Cons Nothing rest) (total rest))"
+         " ((Cons (Just x) rest) (+ x (total rest)))))\n"
+         "(total (Cons (Just 1) (Cons Nothing (Cons (Just 2) Nil))))\n"
+         "(Cons (Just 1) Nil)",
+         "3 (Cons (Just 1) Nil)"},
+        {"(define ones:(list int) (cons 1 ones))\n(car (cdr (cdr ones)))",
+         "1"},
+        {"(+ (/ 1 2) (/ 1 3))\n(* 2 1.5)\n(< (/ 1 3) (/ 1 2))", "5/6 3 #t"},
+        {"(match \"yes\" (\"no\" 0) (\"yes\" 1) (else 2))\n"
+         "(match '(1 2) ((1 x) x) (else 0))",
+         "1 2"},
+        {"(define id:(forall (A) (A -> A)) (tlambda (A) (lambda (x:A -> A) x)))"
+         "\n((tapply id int) 3)",
+         "3"},
+        {"(define v:(vec int 3) (vec 1 2 3))\n"
+         "(vec-fold (lambda (a:int x:int -> int) (+ a x)) 0"
+         " (vec-map (lambda (x:int -> int) (* x 2)) v))",
+         "12"},
+        {"(define pass (f:(int -> int) -> (int -> int)) f)\n"
+         "(define add (n:int -> (int -> int)) (lambda (x:int -> int)"
+         " (+ x n)))\n"
+         "(define wrap (n:int -> (list (int -> int)))"
+         " (cons (lambda (x:int -> int) (+ x n)) (cons (pass (lambda"
+         " (x:int -> int) (* x n))) '())))\n"
+         "((car (wrap 2)) 5)\n((car (cdr (wrap 2))) 5)\n"
+         "((add (+ 1 2)) 4)",
+         "7 10 7"},
+        {"(define scale (k:float x:float -> float) (let ((y:float (* k x)))"
+         " (cond ((> y 10.0) (- y)) (#t (+ y 1)))))\n"
+         "(define adder (k:float -> (float -> float))"
+         " (lambda (x:float -> float) (+ x k)))\n"
+         "(scale 2.0 3.0)\n(scale 4.0 3.0)\n((adder 0.5) (scale 1.5 2.0))",
+         "7 -12 4.5"},
+        {"(define from (n:int -> (list int)) (cons n (from (+ n 1))))\n"
+         "(define big:(list int) (filter (lambda (x:int -> bool) (> x 10))"
+         " (map (lambda (x:int -> int) (* x 3)) (from 0))))\n"
+         "(car (cdr big))\n"
+         "(foldl (lambda (a:int x:int -> int) (+ (* a 10) x)) 0"
+         " (map (lambda (x:int -> int) (+ x 1))"
+         " (filter (lambda (x:int -> bool) (= (% x 2) 0)) '(1 2 3 4 5))))\n"
+         "(map (lambda (x:int -> bool) (> x 1)) (filter (lambda (x:int ->"
+         " bool) (< x 3)) '(3 2 1 0)))\n(foldl (lambda (a:int x:int -> int)"
+         " x) 7 '())",
+         "15 35 (#t #f #f) 7"},
+        {"(define head (m:(Maybe int) -> int) (match m ((Just x) x)))\n"
+         "(head Nothing)",
+         "no match clause matched"},
+        // a shadowed + and an index past int are not constants, the access
+        // stays checked
+        {"(define v:(vec int 3) (vec 1 2 3))\n"
+         "(let ((+:(int->int->int) (lambda (a:int b:int -> int) (* a 100))))"
+         " (vec-ref v (+ 1 1)))",
+         "vec-ref index 100 out of range"},
+        {"(define v:(vec int 3) (vec 1 2 3))\n(vec-ref v (* 65536 65536))",
+         "vec-ref index 4294967296 out of range"},
+        {"(define same (a:(list int) b:(list int) -> bool) (equal? a b))\n"
+         "(same '(1 2) '(1 2))\n(same '(1) '(2))\n(eq? 'a 'b)",
+         "#t #f #f"},
+        // a fixnum past int makes no rational and a result past 63 bits
+        // raises
+        {"(< (* 65536 65536) (/ 1 2))", "rational overflow"},
+        {"(+ (* 65536 65536) (/ 1 2))", "rational overflow"},
+        {"(* (* 65536 65536) (* 65536 65536))", "integer overflow"},
+        {"(let ((x:int (* (* 65536 65536) (* 65536 8192)))) (- 0 (+ x x)))",
+         "integer overflow"},
+        {"(let ((x:int (* (* 65536 65536) (* 65536 8192))))"
+         " (- (- 0 x) (- x 1)))",
+         "-4611686018427387903"},
+        {"(car '())", "car of the empty list"},
+        {"(define rest (xs:(list int) -> (list int)) (cdr xs))\n"
+         "(car (rest '(1 2)))\n(rest (rest '(1)))",
+         "cdr of the empty list"}};
+    for (const Case &c : cases) {
+        Lexer lex(prelude + c.src);
+        TypeChecker checker;
+        checker.threads = 1;
+        std::string got;
+        try {
+            std::vector<TokenNode> program = parseProgram(lex);
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            Program code = compileProgram(ir, checker.symbols);
+            Vm vm(code);
+            std::vector<Word> values = run(vm);
+            for (std::size_t i = 0; i < values.size(); i++) {
+                got += (i > 0 ? " " : "") +
+                       toString(vm, values[i], ir.nodes[ir.exprs[i]].type,
+                                checker.types, checker.symbols);
+            }
+            if (c.src.starts_with("(define adder")) {
+                std::cout << disassemble(code);
+            }
+        } catch (const std::runtime_error &e) {
+            got = e.what();
+        }
+        std::cout << c.src << "\n=> " << got << '\n' << std::endl;
+        if (got != c.expected) {
+            std::cout << "ERROR: expected " << c.expected << std::endl;
+        }
+    }
+}
+
+// heap allocations of recursive code with escape analysis off and on, the
+// closures and thunks that stay in their frame are built there instead
+void benchEscape() {
+    struct Bench {
+        std::string name;
+        std::string src;
+    };
+    std::vector<Bench> benches = {
+        {"helper lambda passed to a known function",
+         "(define both (f:(int -> int) x:int -> int) (+ (f x) (f (+ x 1))))\n"
+         "(define go (n:int acc:int -> int) (cond ((= n 0) acc)"
+         " (#t (go (- n 1) (+ acc (both (lambda (y:int -> int) (* y n)) n))))))"
+         "\n(go 20000 0)"},
+        {"argument thunks forced by the callee",
+         "(define add3 (a:int b:int c:int -> int) (+ a (+ b c)))\n"
+         "(define go (n:int acc:int -> int) (cond ((= n 0) acc)"
+         " (#t (go (- n 1) (+ acc (add3 n (* n 2) (- n 1)))))))\n"
+         "(go 20000 0)"},
+        {"named let loop",
+         "(define sum (n:int -> int) (let loop ((k:int n) (acc:int 0))"
+         " (cond ((= k 0) acc) (#t (loop (- k 1) (+ acc k))))))\n"
+         "(+ (sum 10000) (sum 10000))"}};
+    for (const Bench &b : benches) {
+        for (bool strict : {false, true}) {
+            std::string result[2];
+            for (bool frame : {false, true}) {
+                Lexer lex(b.src);
+                TypeChecker checker;
+                checker.threads = 1;
+                std::vector<TokenNode> program = parseProgram(lex);
+                typecheck(program, checker);
+                IrModule ir = lowerProgram(program, checker);
+                if (strict) {
+                    analyzeStrictness(ir, checker.symbols);
+                }
+                Program code = compileProgram(ir, checker.symbols,
+                                              CompileOptions{frame, true});
+                Vm vm(code);
+                std::size_t objects = vm.heap.objects;
+                std::size_t bytes = vm.heap.bytes;
+                auto start = std::chrono::steady_clock::now();
+                std::vector<Word> values = run(vm);
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+                result[frame] =
+                    toString(vm, values[0], ir.nodes[ir.exprs[0]].type,
+                             checker.types, checker.symbols);
+                std::cout << b.name << (strict ? ", strict" : ", lazy")
+                          << (frame ? ", in frames: " : ", on the heap: ")
+                          << result[frame] << ", "
+                          << vm.heap.objects - objects << " heap objects, "
+                          << vm.heap.bytes - bytes << " bytes, "
+                          << vm.stats.frameObjects << " frame objects, " << us
+                          << "us" << std::endl;
+            }
+            if (result[0] != result[1]) {
+                std::cout << "ERROR: " << b.name << " changed its value"
+                          << std::endl;
+            }
+        }
+    }
+}
+
+// the folded program prints what the unfolded one does
+void testFold() {
+    struct Case {
+        std::string src;
+        std::string expected;
+        int folded; // primitives evaluated and IFs decided
+    };
+    std::vector<Case> cases = {
+        {"(+ (/ 1 2) (/ 1 3))\n(* 2 1.5)\n(< (/ 1 3) (/ 1 2))", "5/6 3 #t",
+         7},
+        // the global folds, then the cond predicate on it
+        {"(define limit:int (* 4 25))\n"
+         "(define f (x:int -> int) (cond ((> limit 50) (+ x 1)) (#t x)))\n"
+         "(f 1)",
+         "2", 3},
+        {"(match \"yes\" (\"no\" 0) (\"yes\" 1) (else 2))", "1", 4},
+        // an int that needs a fixnum and a division by zero are left to the
+        // runtime
+        {"(* 65536 65536)", "4294967296", 0},
+        {"(+ 1 (/ 1 0))", "division by zero", 0},
+        {"(equal? '(1 2) '(1 2))\n(eq? 'a 'a)\n(equal? \"ab\" \"ab\")",
+         "#t #t #t", 3},
+        // negation keeps the sign of zero folded, boxed and unboxed
+        {"(- 0.0)\n(define neg (x:float -> float) (- x))\n(neg 0.0)",
+         "-0 -0", 1}};
+    for (const Case &c : cases) {
+        std::string got[2];
+        FoldStats stats;
+        for (bool folded : {false, true}) {
+            Lexer lex(c.src);
+            TypeChecker checker;
+            checker.threads = 1;
+            try {
+                std::vector<TokenNode> program = parseProgram(lex);
+                typecheck(program, checker);
+                IrModule ir = lowerProgram(program, checker);
+                if (folded) {
+                    stats = foldConstants(ir);
+                    std::cout << c.src << "\n=>\n"
+                              << toString(ir, checker.symbols, checker.types);
+                }
+                Program code = compileProgram(ir, checker.symbols);
+                Vm vm(code);
+                std::vector<Word> values = run(vm);
+                for (std::size_t i = 0; i < values.size(); i++) {
+                    got[folded] +=
+                        (i > 0 ? " " : "") +
+                        toString(vm, values[i], ir.nodes[ir.exprs[i]].type,
+                                 checker.types, checker.symbols);
+                }
+            } catch (const std::runtime_error &e) {
+                got[folded] = e.what();
+            }
+        }
+        std::cout << "=> " << got[1] << ", " << stats.folded << " folded, "
+                  << stats.branches << " branches, " << stats.propagated
+                  << " propagated\n"
+                  << std::endl;
+        if (got[0] != c.expected || got[1] != c.expected) {
+            std::cout << "ERROR: expected " << c.expected << ", unfolded "
+                      << got[0] << std::endl;
+        }
+        if (stats.folded + stats.branches != c.folded) {
+            std::cout << "ERROR: expected " << c.folded << " folded"
+                      << std::endl;
+        }
+    }
+}
+
+// repeated computations are shared, the values are the same with and
+// without, lazily bound ones only with other thunks or values in scope
+void testCse() {
+    struct Case {
+        std::string src;
+        std::string expected;
+        int shared; // values, thunks and forces shared
+    };
+    std::vector<Case> cases = {
+        {"(define second (xs:(list int) -> int)"
+         " (+ (car (cdr xs)) (car (cdr xs))))\n(second '(1 2 3))",
+         "4", 3},
+        {"(define id:(forall (A) (A -> A)) (tlambda (A) (lambda (x:A -> A)"
+         " x)))\n(+ ((tapply id int) 1) ((tapply id int) 2))",
+         "3", 2},
+        // the two lazy arguments are one thunk
+        {"(define f (a:int b:int -> int) (+ a b))\n"
+         "(define g (x:int y:int -> int) (f (* x y) (* x y)))\n(g 3 4)",
+         "24", 1},
+        // the evaluated (* x x) forces the thunk of y, and forcing y again
+        // is that value
+        {"(define h (x:int -> int) (let ((y:int (* x x))) (+ (* x x) y)))"
+         "\n(h 3)",
+         "18", 4},
+        // calls are not shared, the two forces of x in sq are
+        {"(define sq (x:int -> int) (* x x))\n(+ (sq 3) (sq 3))", "18", 1}};
+    for (const Case &c : cases) {
+        std::string got[2];
+        CseStats stats;
+        for (bool shared : {false, true}) {
+            Lexer lex(c.src);
+            TypeChecker checker;
+            checker.threads = 1;
+            try {
+                std::vector<TokenNode> program = parseProgram(lex);
+                typecheck(program, checker);
+                IrModule ir = lowerProgram(program, checker);
+                if (shared) {
+                    stats = eliminateCommonSubexpressions(ir);
+                    std::cout << c.src << "\n=>\n"
+                              << toString(ir, checker.symbols, checker.types);
+                }
+                Program code = compileProgram(ir, checker.symbols);
+                Vm vm(code);
+                std::vector<Word> values = run(vm);
+                for (std::size_t i = 0; i < values.size(); i++) {
+                    got[shared] +=
+                        (i > 0 ? " " : "") +
+                        toString(vm, values[i], ir.nodes[ir.exprs[i]].type,
+                                 checker.types, checker.symbols);
+                }
+            } catch (const std::runtime_error &e) {
+                got[shared] = e.what();
+            }
+        }
+        std::cout << "=> " << got[1] << ", " << stats.values << " values, "
+                  << stats.thunks << " thunks, " << stats.forced
+                  << " forced\n"
+                  << std::endl;
+        if (got[0] != c.expected || got[1] != c.expected) {
+            std::cout << "ERROR: expected " << c.expected << ", unshared "
+                      << got[0] << std::endl;
+        }
+        if (stats.values + stats.thunks + stats.forced != c.shared) {
+            std::cout << "ERROR: expected " << c.shared << " shared"
+                      << std::endl;
+        }
+    }
+}
+
+// a prelude the program only uses a little of, the values are the same
+// after shaking and the bytecode and load time heap are smaller
+void testDeadCode() {
+    std::string src =
+        "(data Maybe (A) (Nothing) (Just (A)))\n"
+        "(data List (A) (Nil) (Cons (A (List A))))\n"
+        "(data Shape (A) (Circle (A)) (Square (A)) (Rect (A A)))\n"
+        "(define pi:float 3.14159)\n"
+        "(define area (s:(Shape float) -> float) (match s"
+        " ((Circle r) (* pi r r)) ((Square a) (* a a)) ((Rect a b) (* a b))))\n"
+        "(define greeting:string \"hello, world\")\n"
+        "(define len (xs:(List int) -> int) (match xs (Nil 0)"
+        " ((Cons _ rest) (+ 1 (len rest)))))\n"
+        "(define from-maybe (d:int m:(Maybe int) -> int)"
+        " (match m (Nothing d) ((Just x) x)))\n"
+        "(define twice (n:int -> int) (let ((unused:(list int) '(1 2 3)))"
+        " (* 2 n)))\n"
+        "(twice (from-maybe 0 (Just 21)))\n(Just 2)";
+    std::string got[2];
+    for (bool shaken : {false, true}) {
+        Lexer lex(src);
+        TypeChecker checker;
+        checker.threads = 1;
+        try {
+            std::vector<TokenNode> program = parseProgram(lex);
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            if (shaken) {
+                std::cout << toString(eliminateDeadCode(ir, checker.symbols));
+            }
+            Program code = compileProgram(ir, checker.symbols);
+            std::size_t bytes = 0;
+            for (const CompiledFunction &f : code.functions) {
+                bytes += f.code.size();
+            }
+            Vm vm(code);
+            std::cout << (shaken ? "shaken: " : "whole: ")
+                      << code.functions.size() << " functions, " << bytes
+                      << " bytes of bytecode, " << code.constants.size()
+                      << " constants, " << vm.heap.objects
+                      << " heap objects on load" << std::endl;
+            std::vector<Word> values = run(vm);
+            for (std::size_t i = 0; i < values.size(); i++) {
+                got[shaken] +=
+                    (i > 0 ? " " : "") +
+                    toString(vm, values[i], ir.nodes[ir.exprs[i]].type,
+                             checker.types, checker.symbols);
+            }
+        } catch (const std::runtime_error &e) {
+            got[shaken] = e.what();
+        }
+    }
+    std::cout << "=> " << got[1] << std::endl;
+    if (got[0] != "42 (Just 2)" || got[1] != got[0]) {
+        std::cout << "ERROR: expected 42 (Just 2), whole program " << got[0]
+                  << std::endl;
+    }
+}
+
+// numeric code with the worker/wrapper split and float unboxing off and on,
+// the workers take their arguments evaluated and floats stay raw doubles
+void benchUnbox() {
+    struct Bench {
+        std::string name;
+        std::string src;
+    };
+    std::vector<Bench> benches = {
+        {"int fib also passed as a value",
+         "(define fib (n:int -> int) (cond ((< n 2) n)"
+         " (#t (+ (fib (- n 1)) (fib (- n 2))))))\n"
+         "(define apply-to (f:(int -> int) x:int -> int) (f x))\n"
+         "(+ (fib 25) (apply-to fib 10))"},
+        {"float fib also passed as a value",
+         "(define ffib (x:float -> float) (cond ((< x 2.0) x)"
+         " (#t (+ (ffib (- x 1.0)) (ffib (- x 2.0))))))\n"
+         "(define apply-to (f:(float -> float) x:float -> float) (f x))\n"
+         "(+ (ffib 25.0) (apply-to ffib 10.0))"},
+        {"float accumulator loop",
+         "(define basel (n:int -> float) (let loop ((k:int n) (acc:float 0.0))"
+         " (cond ((= k 0) acc) (#t (loop (- k 1) (+ acc (/ 1.0 (* k k))))))))"
+         "\n(basel 40000)"}};
+    for (const Bench &b : benches) {
+        std::string result[2];
+        for (bool unbox : {false, true}) {
+            Lexer lex(b.src);
+            TypeChecker checker;
+            checker.threads = 1;
+            std::vector<TokenNode> program = parseProgram(lex);
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            int workers = unbox ? splitWorkers(ir).workers : 0;
+            analyzeStrictness(ir, checker.symbols);
+            Program code = compileProgram(ir, checker.symbols,
+                                          CompileOptions{true, unbox});
+            Vm vm(code);
+            std::size_t objects = vm.heap.objects;
+            auto start = std::chrono::steady_clock::now();
+            std::vector<Word> values = run(vm);
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+            result[unbox] = toString(vm, values[0], ir.nodes[ir.exprs[0]].type,
+                                     checker.types, checker.symbols);
+            std::cout << b.name << (unbox ? ", unboxed: " : ", boxed: ")
+                      << result[unbox] << ", " << workers << " workers, "
+                      << vm.heap.objects - objects << " heap objects, " << us
+                      << "us" << std::endl;
+        }
+        if (result[0] != result[1]) {
+            std::cout << "ERROR: " << b.name << " changed its value"
+                      << std::endl;
+        }
+    }
+}
+
+// tail recursive loops at two sizes, the deepest the frame stack gets and
+// the heap stay the same as the loop grows
+void benchTailCalls() {
+    struct Bench {
+        std::string name;
+        std::string src; // of the loop count N
+    };
+    std::vector<Bench> benches = {
+        {"named let loop",
+         "(define sum (n:int -> int) (let loop ((k:int n) (acc:int 0))"
+         " (cond ((= k 0) acc) (#t (loop (- k 1) (+ acc 1))))))\n(sum N)"},
+        {"mutual recursion in a letr",
+         "(define parity (n:int -> bool) (letr ((ev:(int -> bool)"
+         " (lambda (k:int -> bool) (cond ((= k 0) #t) (#t (od (- k 1))))))"
+         " (od:(int -> bool) (lambda (k:int -> bool) (cond ((= k 0) #f)"
+         " (#t (ev (- k 1))))))) (ev n)))\n(parity N)"},
+        // apply-to is strict in n so no thunk is passed around
+        {"calls through a closure",
+         "(define apply-to (f:(int -> int) n:int -> int)"
+         " (cond ((< n 0) n) (#t (f n))))\n"
+         "(define down (n:int -> int) (cond ((= n 0) 0)"
+         " (#t (apply-to down (- n 1)))))\n(down N)"}};
+    for (const Bench &b : benches) {
+        for (std::string n : {"1000000", "100000000"}) {
+            std::string src = b.src;
+            src.replace(src.find('N'), 1, n);
+            Lexer lex(src);
+            TypeChecker checker;
+            checker.threads = 1;
+            std::vector<TokenNode> program = parseProgram(lex);
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            splitWorkers(ir);
+            analyzeStrictness(ir, checker.symbols);
+            Program code = compileProgram(ir, checker.symbols);
+            Vm vm(code);
+            std::size_t objects = vm.heap.objects;
+            auto start = std::chrono::steady_clock::now();
+            std::vector<Word> values = run(vm);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+            std::cout << b.name << ", " << n << " iterations: "
+                      << toString(vm, values[0], ir.nodes[ir.exprs[0]].type,
+                                  checker.types, checker.symbols)
+                      << ", " << vm.stats.deepest << " frames deep, "
+                      << vm.stats.tailCalls << " tail calls, "
+                      << vm.heap.objects - objects << " heap objects, " << ms
+                      << "ms" << std::endl;
+        }
+    }
+}
+
+// list producers that build their result with cons or a Cons constructor
+// around the recursive call, consumed twice by a strict loop or printed
+void benchListBuilders() {
+    struct Bench {
+        std::string name;
+        std::string src; // of the list length N
+    };
+    std::vector<Bench> benches = {
+        {"map over a list",
+         "(define range (a:int b:int -> (list int)) (cond ((= a b) '())"
+         " (#t (cons a (range (+ a 1) b)))))\n"
+         "(define map1 (f:(int -> int) xs:(list int) -> (list int))"
+         " (cond ((null? xs) '()) (#t (cons (f (car xs)) (map1 f (cdr xs))))))"
+         "\n(define sum (xs:(list int) acc:int -> int) (cond ((null? xs) acc)"
+         " (#t (sum (cdr xs) (+ acc (car xs))))))\n"
+         "(define xs:(list int) (map1 (lambda (x:int -> int) (* x 2))"
+         " (range 0 N)))\n(+ (sum xs 0) (sum xs 0))"},
+        {"filter over a List",
+         "(data List (A) (Nil) (Cons (A (List A))))\n"
+         "(define upto (a:int b:int -> (List int)) (cond ((= a b) Nil)"
+         " (#t (Cons a (upto (+ a 1) b)))))\n"
+         "(define evens (xs:(List int) -> (List int)) (match xs (Nil Nil)"
+         " ((Cons x rest) (cond ((= (% x 2) 0) (Cons x (evens rest)))"
+         " (#t (evens rest))))))\n"
+         "(define total (xs:(List int) acc:int -> int) (match xs (Nil acc)"
+         " ((Cons x rest) (total rest (+ acc x)))))\n"
+         "(define ys:(List int) (evens (upto 0 N)))\n"
+         "(+ (total ys 0) (total ys 0))"},
+        // printed, which forces every field
+        {"a List as the result",
+         "(data List (A) (Nil) (Cons (A (List A))))\n"
+         "(define upto (a:int b:int -> (List int)) (cond ((= a b) Nil)"
+         " (#t (Cons a (upto (+ a 1) b)))))\n(upto 0 N)"}};
+    for (const Bench &b : benches) {
+        std::string src = b.src;
+        src.replace(src.find(" N)"), 2, " 1000000");
+        Lexer lex(src);
+        TypeChecker checker;
+        checker.threads = 1;
+        std::vector<TokenNode> program = parseProgram(lex);
+        typecheck(program, checker);
+        IrModule ir = lowerProgram(program, checker);
+        splitWorkers(ir);
+        analyzeStrictness(ir, checker.symbols);
+        Program code = compileProgram(ir, checker.symbols);
+        Vm vm(code);
+        std::size_t objects = vm.heap.objects;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Word> values = run(vm);
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+        std::string value = toString(vm, values[0],
+                                     ir.nodes[ir.exprs[0]].type,
+                                     checker.types, checker.symbols);
+        if (value.size() > 40) {
+            value = value.substr(0, 40) + "... " +
+                    std::to_string(value.size()) + " chars";
+        }
+        std::cout << b.name << ": " << value << ", " << vm.stats.deepest
+                  << " frames deep, " << vm.stats.calls << " calls, "
+                  << vm.stats.tailCalls << " tail calls, " << vm.stats.forces
+                  << " forces, " << vm.heap.objects - objects
+                  << " heap objects, " << ms << "ms" << std::endl;
+    }
+}
+
+// list pipelines over N elements with fusion off and on, the fused ones
+// build no intermediate lists
+void benchFusion() {
+    struct Bench {
+        std::string name;
+        std::string src; // of the list length N
+    };
+    std::string range = "(define range (a:int b:int -> (list int))"
+                        " (cond ((= a b) '()) (#t (cons a (range (+ a 1) b)))))"
+                        "\n";
+    std::vector<Bench> benches = {
+        {"sum of a filtered map",
+         range + "(foldl (lambda (a:int x:int -> int) (+ a x)) 0"
+                 " (map (lambda (x:int -> int) (* x 3))"
+                 " (filter (lambda (x:int -> bool) (= (% x 2) 0))"
+                 " (map (lambda (x:int -> int) (+ x 1)) (range 0 N)))))"},
+        {"count of a sparse filter",
+         range + "(foldl (lambda (n:int x:int -> int) (+ n 1)) 0"
+                 " (filter (lambda (x:int -> bool) (= (% x 1000) 0))"
+                 " (filter (lambda (x:int -> bool) (> x 10)) (range 0 N))))"},
+        // printed, so every cell of the result is built either way
+        {"a mapped list as the result",
+         range + "(map (lambda (x:int -> int) (* x x))"
+                 " (map (lambda (x:int -> int) (- x 1)) (range 0 N)))"}};
+    for (const Bench &b : benches) {
+        std::string src = b.src;
+        src.replace(src.find(" N)"), 2, " 1000000");
+        for (bool fuse : {false, true}) {
+            Lexer lex(src);
+            TypeChecker checker;
+            checker.threads = 1;
+            std::vector<TokenNode> program = parseProgram(lex);
+            typecheck(program, checker);
+            IrModule ir = lowerProgram(program, checker);
+            int fused = fuse ? fuseLists(ir).fused : 0;
+            analyzeStrictness(ir, checker.symbols);
+            Program code = compileProgram(ir, checker.symbols);
+            Vm vm(code);
+            std::size_t objects = vm.heap.objects;
+            auto start = std::chrono::steady_clock::now();
+            std::vector<Word> values = run(vm);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+            std::string value = toString(vm, values[0],
+                                         ir.nodes[ir.exprs[0]].type,
+                                         checker.types, checker.symbols);
+            if (value.size() > 40) {
+                value = value.substr(0, 40) + "... " +
+                        std::to_string(value.size()) + " chars";
+            }
+            std::cout << b.name << (fuse ? ", fused " : ", unfused ") << fused
+                      << ": " << value << ", " << vm.stats.calls
+                      << " calls, " << vm.stats.forces << " forces, "
+                      << vm.heap.objects - objects << " heap objects, " << ms
+                      << "ms" << std::endl;
+        }
+    }
+}
+
+// call heavy microbenchmarks through every IR pass, timed per op the vm
+// executes, to compare dispatch builds and changes to the loop
+struct DispatchBench {
+    std::string name;
+    std::string src;
+};
+
+// call heavy integer programs, where dispatch is most of the time
+static std::vector<DispatchBench> dispatchBenches() {
+    return {
+        {"fib", "(define fib (n:int -> int) (cond ((< n 2) n)"
+                " (#t (+ (fib (- n 1)) (fib (- n 2))))))\n(fib 25)"},
+        {"tak", "(define tak (x:int y:int z:int -> int) (cond ((not (< y x))"
+                " z) (#t (tak (tak (- x 1) y z) (tak (- y 1) z x)"
+                " (tak (- z 1) x y)))))\n(tak 18 12 6)"},
+        {"ackermann",
+         "(define ack (m:int n:int -> int) (cond ((= m 0) (+ n 1))"
+         " ((= n 0) (ack (- m 1) 1)) (#t (ack (- m 1) (ack m (- n 1))))))\n"
+         "(ack 2 500)\n(ack 3 6)"},
+        {"nqueens",
+         "(define safe (row:int dist:int placed:(list int) -> bool)"
+         " (cond ((null? placed) #t) (#t (let ((q:int (car placed)))"
+         " (and (not (= q row)) (and (not (= q (+ row dist)))"
+         " (and (not (= q (- row dist))) (safe row (+ dist 1)"
+         " (cdr placed)))))))))\n"
+         "(define queens (n:int k:int placed:(list int) -> int)"
+         " (cond ((= k n) 1) (#t (let loop ((row:int 0) (acc:int 0))"
+         " (cond ((= row n) acc) ((safe row 1 placed) (loop (+ row 1)"
+         " (+ acc (queens n (+ k 1) (cons row placed)))))"
+         " (#t (loop (+ row 1) acc)))))))\n(queens 8 0 '())"}};
+}
+
+// the program of a bench through every pass
+static Program compileBench(const DispatchBench &b, TypeChecker &checker,
+                            IrModule &ir, const CompileOptions &options) {
+    Lexer lex(b.src);
+    checker.threads = 1;
+    std::vector<TokenNode> program = parseProgram(lex);
+    typecheck(program, checker);
+    ir = lowerProgram(program, checker);
+    inlineCalls(ir);
+    foldConstants(ir);
+    eliminateCommonSubexpressions(ir);
+    eliminateDeadCode(ir, checker.symbols);
+    splitWorkers(ir);
+    analyzeStrictness(ir, checker.symbols);
+    return compileProgram(ir, checker.symbols, options);
+}
+
+void benchDispatch() {
+    std::cout << (kThreadedDispatch ? "threaded" : "switch") << " dispatch"
+              << std::endl;
+    for (const DispatchBench &b : dispatchBenches()) {
+        TypeChecker checker;
+        IrModule ir;
+        Program code = compileBench(b, checker, ir, {});
+        Vm vm(code);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Word> values = run(vm);
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+        std::string value;
+        for (std::size_t i = 0; i < values.size(); i++) {
+            value += (i > 0 ? " " : "") +
+                     toString(vm, values[i], ir.nodes[ir.exprs[i]].type,
+                              checker.types, checker.symbols);
+        }
+        std::cout << b.name << ": " << value << ", "
+                  << vm.stats.instructions << " ops, " << vm.stats.calls
+                  << " calls, " << ns / 1000000 << "ms, "
+                  << static_cast<double>(ns) /
+                         static_cast<double>(vm.stats.instructions)
+                  << " ns/op" << std::endl;
+    }
+}
+
+void benchSuperinstructions() {
+    OpProfile profile;
+    for (const DispatchBench &b : dispatchBenches()) {
+        TypeChecker checker;
+        IrModule ir;
+        Program code = compileBench(b, checker, ir,
+                                    CompileOptions{true, true, false});
+        Vm vm(code);
+        vm.profile = &profile;
+        run(vm);
+    }
+    std::cout << "op sequences by dispatches saved, unfused\n"
+              << rankSequences(profile, 12);
+    for (const DispatchBench &b : dispatchBenches()) {
+        for (bool fused : {false, true}) {
+            TypeChecker checker;
+            IrModule ir;
+            Program code = compileBench(b, checker, ir,
+                                        CompileOptions{true, true, fused});
+            Vm vm(code);
+            auto start = std::chrono::steady_clock::now();
+            run(vm);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+            std::cout << b.name << (fused ? " fused: " : ": ")
+                      << vm.stats.instructions << " ops, " << ms << "ms"
+                      << std::endl;
+        }
+    }
+}
+
 int main() {
     //    testLexArrow();
     //    printParseReference();
     //  testParse();
+    //  testTypecheck();
+    //  testTypecheckProgram();
+    //  testTypecheckCache();
+    //  testLower();
+    //  testStrictness();
+    //  testInline();
+    //  testMatch();
+    //  benchMatch();
+    //  testObjects();
+    //  testVm();
+    //  benchEscape();
+    //  testFold();
+    //  testDeadCode();
+    //  testCse();
+    //  benchUnbox();
+    //  benchTailCalls();
+    //  benchListBuilders();
+    //  benchFusion();
+    //  benchDispatch();
+    //  benchSuperinstructions();
     Lexer lex("(define f:(int->int) expr");
     std::cout << parse(lex);
     return 0;
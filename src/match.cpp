@@ -0,0 +1,439 @@
+#include "match.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+const Constructor *findConstructor(const DataTable &data, SymbolId name) {
+    auto it = data.byName.find(name);
+    return it == data.byName.end() ? nullptr : &data.constructors[it->second];
+}
+
+static const std::string &symbolName(const Token &tok) {
+    if (!tok.value || !isString(*tok.value)) {
+        throw std::runtime_error("expected a symbol with a name, found:" +
+                                 toString(tok));
+    }
+    return std::get<std::string>(tok.value->v);
+}
+
+static bool isTokenOfKind(const TokenNode &node, TokenKind kind) {
+    return isTokenNodeToken(node) && std::get<Token>(node).kind == kind;
+}
+
+static std::vector<TokenNode> elements(const TokenList &lst) {
+    std::vector<TokenNode> elems;
+    for (TokenListIterator it(lst), end(TokenList{}); it != end; ++it) {
+        elems.push_back(*it);
+    }
+    return elems;
+}
+
+// a constructor applied to one pattern per field
+static Pattern constructorPattern(std::size_t index,
+                                  const std::vector<TokenNode> &fields,
+                                  const DataTable &data,
+                                  SymbolTable &symbols) {
+    const Constructor &ctor = data.constructors[index];
+    if (fields.size() != static_cast<std::size_t>(ctor.arity)) {
+        throw std::runtime_error(
+            "constructor " + symbols.name(ctor.name) + " expects " +
+            std::to_string(ctor.arity) + " fields in a pattern, found " +
+            std::to_string(fields.size()));
+    }
+    Pattern p;
+    p.kind = PatternKind::CTOR;
+    p.ctor = index;
+    for (const TokenNode &field : fields) {
+        p.args.push_back(makePattern(field, data, symbols));
+    }
+    return p;
+}
+
+Pattern makePattern(const TokenNode &pattern, const DataTable &data,
+                    SymbolTable &symbols) {
+    Pattern p;
+    if (isTokenNodeToken(pattern)) {
+        const Token &tok = std::get<Token>(pattern);
+        switch (tok.kind) {
+        case TokenKind::PLACEHOLDER:
+            return p;
+        case TokenKind::SYMBOL: {
+            SymbolId name = symbols.intern(symbolName(tok));
+            auto ctor = data.byName.find(name);
+            if (ctor != data.byName.end() &&
+                data.constructors[ctor->second].arity == 0) {
+                return constructorPattern(ctor->second, {}, data, symbols);
+            }
+            p.kind = PatternKind::VAR;
+            p.var = name;
+            return p;
+        }
+        case TokenKind::NUMBER:
+        case TokenKind::BOOL:
+        case TokenKind::CHAR:
+        case TokenKind::STRING:
+            p.kind = PatternKind::LIT;
+            p.literal = *tok.value;
+            return p;
+        default:
+            throw std::runtime_error("unexpected token in pattern " +
+                                     toString(tok));
+        }
+    }
+    const TokenList &lst = std::get<TokenList>(pattern);
+    if (!lst) {
+        p.kind = PatternKind::NIL;
+        return p;
+    }
+    std::vector<TokenNode> elems = elements(lst);
+    if (isTokenOfKind(elems[0], TokenKind::SYMBOL)) {
+        SymbolId name = symbols.intern(symbolName(std::get<Token>(elems[0])));
+        auto ctor = data.byName.find(name);
+        if (ctor != data.byName.end()) {
+            return constructorPattern(
+                ctor->second,
+                std::vector<TokenNode>(elems.begin() + 1, elems.end()), data,
+                symbols);
+        }
+    }
+    // a list pattern is a chain of cons cells
+    p.kind = PatternKind::NIL;
+    std::size_t count = elems.size();
+    if (count >= 2 && isTokenOfKind(elems[count - 2], TokenKind::DOT)) {
+        p = makePattern(elems[count - 1], data, symbols);
+        count -= 2;
+    }
+    for (std::size_t i = count; i-- > 0;) {
+        Pattern cell;
+        cell.kind = PatternKind::CONS;
+        cell.args = {makePattern(elems[i], data, symbols), std::move(p)};
+        p = std::move(cell);
+    }
+    return p;
+}
+
+bool sameLiteral(const Value &a, const Value &b) {
+    if (a.v.index() != b.v.index()) {
+        return false;
+    }
+    std::ostringstream x;
+    std::ostringstream y;
+    x << a;
+    y << b;
+    return x.str() == y.str();
+}
+
+struct Row {
+    std::vector<Pattern> patterns; // one per column
+    std::vector<std::pair<SymbolId, std::size_t>> bindings;
+    std::size_t clause;
+};
+
+struct Matrix {
+    std::vector<std::size_t> columns; // occurrences
+    std::vector<Row> rows;
+};
+
+struct MatchCompiler {
+    const DataTable &data;
+    DecisionTree tree;
+    std::map<std::tuple<std::size_t, std::size_t, std::uint32_t>, std::size_t>
+        fields;
+};
+
+// the occurrence of a field, the same in every branch that reaches it
+static std::size_t fieldOf(MatchCompiler &mc, std::size_t parent,
+                           std::size_t ctor, std::uint32_t field) {
+    auto key = std::make_tuple(parent, ctor, field);
+    auto it = mc.fields.find(key);
+    if (it != mc.fields.end()) {
+        return it->second;
+    }
+    mc.tree.occurrences.push_back(Occurrence{parent, ctor, field});
+    mc.fields[key] = mc.tree.occurrences.size() - 1;
+    return mc.tree.occurrences.size() - 1;
+}
+
+static std::size_t add(MatchCompiler &mc, Decision decision) {
+    mc.tree.nodes.push_back(std::move(decision));
+    return mc.tree.nodes.size() - 1;
+}
+
+static bool refutable(const Pattern &p) {
+    return p.kind != PatternKind::WILD && p.kind != PatternKind::VAR;
+}
+
+// the head of a pattern, what a test on its column distinguishes
+static bool sameHead(const Pattern &a, const Pattern &b) {
+    if (a.kind != b.kind) {
+        return false;
+    }
+    if (a.kind == PatternKind::CTOR) {
+        return a.ctor == b.ctor;
+    }
+    if (a.kind == PatternKind::LIT) {
+        return sameLiteral(a.literal, b.literal);
+    }
+    return true;
+}
+
+/* the rows that match head at column j, with the column replaced by the
+ * fields of head. a variable binds the whole occurrence and a wildcard or
+ * variable stands for wildcards in every field
+ */
+static Matrix specialize(MatchCompiler &mc, const Matrix &m, std::size_t j,
+                         const Pattern &head) {
+    std::size_t occ = m.columns[j];
+    std::vector<std::size_t> fields;
+    for (std::uint32_t i = 0; i < head.args.size(); i++) {
+        std::size_t ctor =
+            head.kind == PatternKind::CTOR ? head.ctor : kConsCell;
+        fields.push_back(fieldOf(mc, occ, ctor, i));
+    }
+    Matrix out;
+    out.columns = m.columns;
+    out.columns.erase(out.columns.begin() + j);
+    out.columns.insert(out.columns.begin() + j, fields.begin(), fields.end());
+    for (const Row &row : m.rows) {
+        const Pattern &p = row.patterns[j];
+        if (refutable(p) && !sameHead(p, head)) {
+            continue;
+        }
+        Row next;
+        next.bindings = row.bindings;
+        next.clause = row.clause;
+        if (p.kind == PatternKind::VAR) {
+            next.bindings.emplace_back(p.var, occ);
+        }
+        std::vector<Pattern> inner = refutable(p)
+                                         ? p.args
+                                         : std::vector<Pattern>(fields.size());
+        next.patterns = row.patterns;
+        next.patterns.erase(next.patterns.begin() + j);
+        next.patterns.insert(next.patterns.begin() + j, inner.begin(),
+                             inner.end());
+        out.rows.push_back(std::move(next));
+    }
+    return out;
+}
+
+// the rows that do not test column j, for values no head matched
+static Matrix defaults(const Matrix &m, std::size_t j) {
+    Matrix out;
+    out.columns = m.columns;
+    out.columns.erase(out.columns.begin() + j);
+    for (const Row &row : m.rows) {
+        const Pattern &p = row.patterns[j];
+        if (refutable(p)) {
+            continue;
+        }
+        Row next = row;
+        if (p.kind == PatternKind::VAR) {
+            next.bindings.emplace_back(p.var, m.columns[j]);
+        }
+        next.patterns.erase(next.patterns.begin() + j);
+        out.rows.push_back(std::move(next));
+    }
+    return out;
+}
+
+static std::size_t compile(MatchCompiler &mc, const Matrix &m);
+
+static std::size_t compileConstructors(MatchCompiler &mc, const Matrix &m,
+                                       std::size_t j,
+                                       const std::vector<Pattern> &heads) {
+    const DataType &type =
+        mc.data.types[mc.data.constructors[heads[0].ctor].data];
+    std::size_t count = type.constructors.size();
+    bool complete = heads.size() == count;
+    // a single constructor type needs no test
+    if (count == 1) {
+        return compile(mc, specialize(mc, m, j, heads[0]));
+    }
+    Decision d;
+    d.occurrence = m.columns[j];
+    if (heads.size() >= 2 && count >= 3) {
+        d.kind = DecisionKind::SWITCH;
+        d.ctor = heads[0].ctor;
+        d.arms.assign(count, kNoDecision);
+        for (const Pattern &head : heads) {
+            int tag = mc.data.constructors[head.ctor].tag;
+            d.arms[static_cast<std::size_t>(tag)] =
+                compile(mc, specialize(mc, m, j, head));
+        }
+        if (!complete) {
+            d.no = compile(mc, defaults(m, j));
+        }
+        return add(mc, std::move(d));
+    }
+    d.kind = DecisionKind::TAG;
+    d.ctor = heads[0].ctor;
+    d.yes = compile(mc, specialize(mc, m, j, heads[0]));
+    d.no = complete ? compile(mc, specialize(mc, m, j, heads[1]))
+                    : compile(mc, defaults(m, j));
+    return add(mc, std::move(d));
+}
+
+static std::size_t compileList(MatchCompiler &mc, const Matrix &m,
+                               std::size_t j,
+                               const std::vector<Pattern> &heads) {
+    const Pattern *nil = nullptr;
+    const Pattern *cell = nullptr;
+    for (const Pattern &head : heads) {
+        (head.kind == PatternKind::NIL ? nil : cell) = &head;
+    }
+    Decision d;
+    d.kind = DecisionKind::NIL;
+    d.occurrence = m.columns[j];
+    d.yes = nil ? compile(mc, specialize(mc, m, j, *nil))
+                : compile(mc, defaults(m, j));
+    d.no = cell ? compile(mc, specialize(mc, m, j, *cell))
+                : compile(mc, defaults(m, j));
+    return add(mc, std::move(d));
+}
+
+static std::size_t compileLiterals(MatchCompiler &mc, const Matrix &m,
+                                   std::size_t j,
+                                   const std::vector<Pattern> &heads) {
+    // #t and #f cover bool, the test for one is the test for the other
+    if (heads.size() == 2 && isBool(heads[0].literal)) {
+        Decision d;
+        d.kind = DecisionKind::LIT;
+        d.occurrence = m.columns[j];
+        d.literal = heads[0].literal;
+        d.yes = compile(mc, specialize(mc, m, j, heads[0]));
+        d.no = compile(mc, specialize(mc, m, j, heads[1]));
+        return add(mc, std::move(d));
+    }
+    std::size_t next = compile(mc, defaults(m, j));
+    for (std::size_t i = heads.size(); i-- > 0;) {
+        Decision d;
+        d.kind = DecisionKind::LIT;
+        d.occurrence = m.columns[j];
+        d.literal = heads[i].literal;
+        d.yes = compile(mc, specialize(mc, m, j, heads[i]));
+        d.no = next;
+        next = add(mc, std::move(d));
+    }
+    return next;
+}
+
+static std::size_t compile(MatchCompiler &mc, const Matrix &m) {
+    if (m.rows.empty()) {
+        return add(mc, Decision());
+    }
+    const Row &first = m.rows.front();
+    auto test = std::find_if(first.patterns.begin(), first.patterns.end(),
+                             refutable);
+    if (test == first.patterns.end()) {
+        Decision leaf;
+        leaf.kind = DecisionKind::LEAF;
+        leaf.clause = first.clause;
+        leaf.bindings = first.bindings;
+        for (std::size_t i = 0; i < first.patterns.size(); i++) {
+            if (first.patterns[i].kind == PatternKind::VAR) {
+                leaf.bindings.emplace_back(first.patterns[i].var,
+                                           m.columns[i]);
+            }
+        }
+        return add(mc, std::move(leaf));
+    }
+    std::size_t j = static_cast<std::size_t>(test - first.patterns.begin());
+    std::vector<Pattern> heads;
+    for (const Row &row : m.rows) {
+        const Pattern &p = row.patterns[j];
+        if (!refutable(p)) {
+            continue;
+        }
+        bool seen = std::any_of(heads.begin(), heads.end(),
+                                [&](const Pattern &h) {
+                                    return sameHead(h, p);
+                                });
+        if (!seen) {
+            Pattern head = p;
+            head.args.assign(p.args.size(), Pattern());
+            heads.push_back(std::move(head));
+        }
+    }
+    switch (heads[0].kind) {
+    case PatternKind::CTOR:
+        return compileConstructors(mc, m, j, heads);
+    case PatternKind::NIL:
+    case PatternKind::CONS:
+        return compileList(mc, m, j, heads);
+    default:
+        return compileLiterals(mc, m, j, heads);
+    }
+}
+
+DecisionTree compileMatch(const std::vector<Pattern> &clauses,
+                          const DataTable &data) {
+    MatchCompiler mc{data, DecisionTree(), {}};
+    mc.tree.occurrences.push_back(Occurrence());
+    Matrix m;
+    m.columns = {0};
+    for (std::size_t i = 0; i < clauses.size(); i++) {
+        m.rows.push_back(Row{{clauses[i]}, {}, i});
+    }
+    mc.tree.root = compile(mc, m);
+    return std::move(mc.tree);
+}
+
+static void printDecision(std::ostringstream &out, const DecisionTree &tree,
+                          const DataTable &data, const SymbolTable &symbols,
+                          std::size_t id, int indent) {
+    const Decision &d = tree.nodes[id];
+    std::string pad(static_cast<std::size_t>(indent), ' ');
+    out << pad;
+    switch (d.kind) {
+    case DecisionKind::FAIL:
+        out << "fail\n";
+        return;
+    case DecisionKind::LEAF:
+        out << "clause " << d.clause;
+        for (const auto &[var, occ] : d.bindings) {
+            out << ' ' << symbols.name(var) << "=o" << occ;
+        }
+        out << '\n';
+        return;
+    case DecisionKind::SWITCH:
+        out << "switch o" << d.occurrence << '\n';
+        for (std::size_t tag = 0; tag < d.arms.size(); tag++) {
+            if (d.arms[tag] == kNoDecision) {
+                continue;
+            }
+            const DataType &type = data.types[data.constructors[d.ctor].data];
+            std::size_t ctor = type.constructors[tag];
+            out << pad << ' ' << symbols.name(data.constructors[ctor].name)
+                << ":\n";
+            printDecision(out, tree, data, symbols, d.arms[tag], indent + 2);
+        }
+        if (d.no != kNoDecision) {
+            out << pad << " else:\n";
+            printDecision(out, tree, data, symbols, d.no, indent + 2);
+        }
+        return;
+    case DecisionKind::TAG:
+        out << "tag o" << d.occurrence << ' '
+            << symbols.name(data.constructors[d.ctor].name) << '\n';
+        break;
+    case DecisionKind::NIL:
+        out << "null o" << d.occurrence << '\n';
+        break;
+    case DecisionKind::LIT:
+        out << "lit o" << d.occurrence << ' ' << d.literal << '\n';
+        break;
+    }
+    printDecision(out, tree, data, symbols, d.yes, indent + 2);
+    printDecision(out, tree, data, symbols, d.no, indent + 2);
+}
+
+std::string toString(const DecisionTree &tree, const DataTable &data,
+                     const SymbolTable &symbols) {
+    std::ostringstream out;
+    printDecision(out, tree, data, symbols, tree.root, 0);
+    return out.str();
+}
@@ -0,0 +1,121 @@
+#ifndef SPROUT_LANG_MATCH_H
+#define SPROUT_LANG_MATCH_H
+
+#include "symtab.h"
+#include "token.h"
+#include "typetable.h"
+#include "value.h"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * algebraic data types declared by (data Maybe (A) (Nothing) (Just (A))).
+ * the constructors of a type are numbered from 0 in declaration order, the
+ * tag a constructed value carries and a match switches on
+ */
+struct Constructor {
+    SymbolId name;
+    std::size_t data; // index into DataTable::types
+    int tag;
+    int arity;
+    // (forall (A) (A -> (Maybe A))), a nullary one (forall (A) (Maybe A))
+    TypeId type;
+};
+
+struct DataType {
+    std::string name;
+    TypeId type; // the declared type over its parameters, (Maybe A)
+    std::vector<std::size_t> constructors; // indices in tag order
+};
+
+struct DataTable {
+    std::vector<DataType> types;
+    std::vector<Constructor> constructors;
+    std::unordered_map<SymbolId, std::size_t> byName; // constructor names
+};
+
+const Constructor *findConstructor(const DataTable &data, SymbolId name);
+
+/*
+ * the pattern of a match clause
+ *  _ and else                 WILD
+ *  x                          VAR, or CTOR when x names a nullary constructor
+ *  (Just p) (Nothing)         CTOR with one pattern per field
+ *  ()                         NIL
+ *  (p q . rest) (p q)         CONS cells ending in rest or NIL
+ *  42 #\c "s" #t              LIT
+ */
+enum class PatternKind : std::uint8_t { WILD, VAR, CTOR, NIL, CONS, LIT };
+
+struct Pattern {
+    PatternKind kind = PatternKind::WILD;
+    SymbolId var = 0;          // VAR
+    std::size_t ctor = 0;      // CTOR, index into DataTable::constructors
+    Value literal;             // LIT
+    std::vector<Pattern> args; // CTOR fields, CONS car and cdr
+};
+
+// the pattern under a PATTERN token of a clause
+Pattern makePattern(const TokenNode &pattern, const DataTable &data,
+                    SymbolTable &symbols);
+bool sameLiteral(const Value &a, const Value &b);
+
+/*
+ * match compilation into a decision tree, after Maranget's compiling
+ * pattern matching to good decision trees. the clauses form a matrix with a
+ * row per clause and a column per occurrence, a position in the scrutinee
+ * like the second field of its first field. the first row that only has
+ * variables and wildcards left matches, otherwise a column the first row
+ * tests is chosen and the matrix is split by the constructors that appear in
+ * it. every path from the root tests an occurrence at most once: a column
+ * is gone from every matrix below its test, rows that did not test it only
+ * carry on in the default matrix, and a test whose constructors cover the
+ * whole type has no default
+ *  SWITCH   a jump table indexed by tag, for two or more constructors of a
+ *           type with three or more
+ *  TAG      one constructor, the other one of a two constructor type is no
+ *  NIL      empty list or cons cell
+ *  LIT      one literal, chained for several
+ */
+constexpr std::size_t kNoDecision = std::numeric_limits<std::size_t>::max();
+constexpr std::size_t kScrutinee = std::numeric_limits<std::size_t>::max();
+constexpr std::size_t kConsCell = std::numeric_limits<std::size_t>::max();
+
+// field of the constructor ctor or of a cons cell (0 car, 1 cdr) of parent
+struct Occurrence {
+    std::size_t parent = kScrutinee;
+    std::size_t ctor = kConsCell;
+    std::uint32_t field = 0;
+};
+
+enum class DecisionKind : std::uint8_t { FAIL, LEAF, SWITCH, TAG, NIL, LIT };
+
+struct Decision {
+    DecisionKind kind = DecisionKind::FAIL;
+    std::size_t occurrence = 0; // the tested occurrence
+    std::size_t clause = 0;     // LEAF
+    std::vector<std::pair<SymbolId, std::size_t>> bindings; // LEAF
+    std::size_t ctor = 0;          // TAG, any constructor of a SWITCH type
+    Value literal;                 // LIT
+    std::vector<std::size_t> arms; // SWITCH by tag, kNoDecision takes no
+    std::size_t yes = kNoDecision;
+    std::size_t no = kNoDecision; // kNoDecision when yes covers everything
+};
+
+struct DecisionTree {
+    std::vector<Occurrence> occurrences; // 0 is the scrutinee
+    std::vector<Decision> nodes;
+    std::size_t root = 0;
+};
+
+DecisionTree compileMatch(const std::vector<Pattern> &clauses,
+                          const DataTable &data);
+std::string toString(const DecisionTree &tree, const DataTable &data,
+                     const SymbolTable &symbols);
+
+#endif
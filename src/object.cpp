@@ -0,0 +1,205 @@
+#include "object.h"
+
+#include <algorithm>
+#include <cstring>
+
+static std::size_t roundUp(std::size_t n) {
+    return (n + 15) & ~std::size_t{15};
+}
+
+Object *allocate(Heap &heap, ObjectKind kind, std::uint32_t size,
+                 std::size_t payload) {
+    std::size_t bytes = roundUp(sizeof(Object) + payload);
+    if (heap.next == nullptr ||
+        static_cast<std::size_t>(heap.limit - heap.next) < bytes) {
+        // a chunk is at least as large as the object, plus room to align it
+        std::size_t chunk = std::max(kChunkSize, bytes) + 15;
+        heap.chunks.push_back(std::make_unique<std::byte[]>(chunk));
+        std::byte *start = heap.chunks.back().get();
+        auto addr = reinterpret_cast<std::uintptr_t>(start);
+        heap.next = start + (roundUp(addr) - addr);
+        heap.limit = start + chunk;
+    }
+    auto *obj = reinterpret_cast<Object *>(heap.next);
+    heap.next += bytes;
+    heap.bytes += bytes;
+    heap.objects++;
+    obj->kind = kind;
+    obj->unused = 0;
+    obj->tag = 0;
+    obj->size = size;
+    return obj;
+}
+
+static Word pointerTo(Object *obj, int tag) {
+    Word w = reinterpret_cast<Word>(obj);
+    if (tag >= 0 && tag < kPointerTags) {
+        w |= static_cast<Word>(tag + 1) << 2;
+    }
+    return w;
+}
+
+Representation representation(int arity, std::size_t constructors) {
+    if (arity == 0) {
+        return Representation::IMMEDIATE;
+    }
+    if (arity == 1 && constructors == 1) {
+        return Representation::UNBOXED;
+    }
+    return Representation::BOXED;
+}
+
+Word construct(Heap &heap, Representation rep, int tag, const Word *fields,
+               int arity) {
+    switch (rep) {
+    case Representation::IMMEDIATE:
+        return immediate(Immediate::NULLARY, static_cast<Word>(tag));
+    case Representation::UNBOXED:
+        return fields[0];
+    case Representation::BOXED:
+        break;
+    }
+    Object *obj =
+        allocate(heap, ObjectKind::DATA, static_cast<std::uint32_t>(arity),
+                 sizeof(Word) * static_cast<std::size_t>(arity));
+    obj->tag = static_cast<std::uint16_t>(tag);
+    std::memcpy(payloadOf(obj), fields,
+                sizeof(Word) * static_cast<std::size_t>(arity));
+    return pointerTo(obj, tag);
+}
+
+int tagOf(Word w) {
+    if (isImmediate(w)) {
+        return static_cast<int>(immediatePayload(w));
+    }
+    Word cached = (w & kPointerMask) >> 2;
+    if (cached != 0) {
+        return static_cast<int>(cached) - 1;
+    }
+    return objectOf(w)->tag;
+}
+
+Word fieldOf(Word w, Representation rep, int i) {
+    if (rep == Representation::UNBOXED) {
+        return w;
+    }
+    return payloadOf(objectOf(w))[i];
+}
+
+Word makeFloat(Heap &heap, double d) {
+    Object *obj = allocate(heap, ObjectKind::FLOAT, 1, sizeof(double));
+    std::memcpy(payloadOf(obj), &d, sizeof(double));
+    return pointerTo(obj, -1);
+}
+
+double floatValue(Word w) {
+    double d;
+    std::memcpy(&d, payloadOf(objectOf(w)), sizeof(double));
+    return d;
+}
+
+Word makeString(Heap &heap, const std::string &s) {
+    Object *obj = allocate(heap, ObjectKind::STRING,
+                           static_cast<std::uint32_t>(s.size()), s.size());
+    std::memcpy(payloadOf(obj), s.data(), s.size());
+    return pointerTo(obj, -1);
+}
+
+std::string stringValue(Word w) {
+    Object *obj = objectOf(w);
+    return std::string(reinterpret_cast<const char *>(payloadOf(obj)),
+                       obj->size);
+}
+
+Word makeCons(Heap &heap, Word car, Word cdr) {
+    Object *obj = allocate(heap, ObjectKind::CONS, 2, 2 * sizeof(Word));
+    payloadOf(obj)[0] = car;
+    payloadOf(obj)[1] = cdr;
+    return pointerTo(obj, -1);
+}
+
+Word makeRational(Heap &heap, Rational r) {
+    Object *obj = allocate(heap, ObjectKind::RATIONAL, 2, 2 * sizeof(Word));
+    payloadOf(obj)[0] = static_cast<Word>(r.numerator);
+    payloadOf(obj)[1] = static_cast<Word>(r.denominator);
+    return pointerTo(obj, -1);
+}
+
+Rational rationalValue(Word w) {
+    Word *payload = payloadOf(objectOf(w));
+    return Rational(static_cast<int>(payload[0]),
+                    static_cast<int>(payload[1]));
+}
+
+Word makeComplex(Heap &heap, Complex c) {
+    Object *obj = allocate(heap, ObjectKind::COMPLEX, 2, 2 * sizeof(double));
+    std::memcpy(payloadOf(obj), &c.re, sizeof(double));
+    std::memcpy(payloadOf(obj) + 1, &c.im, sizeof(double));
+    return pointerTo(obj, -1);
+}
+
+Complex complexValue(Word w) {
+    Complex c;
+    std::memcpy(&c.re, payloadOf(objectOf(w)), sizeof(double));
+    std::memcpy(&c.im, payloadOf(objectOf(w)) + 1, sizeof(double));
+    return c;
+}
+
+bool equalWords(Word a, Word b) {
+    return equalWords(a, b, [](Word w) { return w; });
+}
+
+bool equalWords(Word a, Word b, const Force &force) {
+    a = force(a);
+    b = force(b);
+    while (a != b) {
+        // distinct immediates differ, a pointer and an immediate of the same
+        // type are a constructed value and a nullary constructor
+        if (!isPointer(a) || !isPointer(b)) {
+            return false;
+        }
+        Object *x = objectOf(a);
+        Object *y = objectOf(b);
+        if (x->kind != y->kind) {
+            return false;
+        }
+        switch (x->kind) {
+        case ObjectKind::FLOAT:
+            return floatValue(a) == floatValue(b);
+        case ObjectKind::STRING:
+        case ObjectKind::SYMBOL:
+            return x->size == y->size &&
+                   std::memcmp(payloadOf(x), payloadOf(y), x->size) == 0;
+        case ObjectKind::RATIONAL:
+            return rationalValue(a) == rationalValue(b);
+        case ObjectKind::COMPLEX:
+            return complexValue(a) == complexValue(b);
+        case ObjectKind::DATA:
+            if (tagOf(a) != tagOf(b)) {
+                return false;
+            }
+            break;
+        case ObjectKind::CONS:
+        case ObjectKind::VECTOR:
+            break;
+        default:
+            // functions have no structure to compare
+            return false;
+        }
+        if (x->size != y->size) {
+            return false;
+        }
+        // every field but the last recursively, the last one in the loop
+        for (std::uint32_t i = 0; i + 1 < x->size; i++) {
+            if (!equalWords(payloadOf(x)[i], payloadOf(y)[i], force)) {
+                return false;
+            }
+        }
+        if (x->size == 0) {
+            return true;
+        }
+        a = force(payloadOf(x)[x->size - 1]);
+        b = force(payloadOf(y)[y->size - 1]);
+    }
+    return true;
+}
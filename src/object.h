@@ -0,0 +1,153 @@
+#ifndef SPROUT_LANG_OBJECT_H
+#define SPROUT_LANG_OBJECT_H
+
+#include "complex.h"
+#include "rational.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * runtime representation of values. a value is one 64 bit Word, either an
+ * immediate or a pointer to an Object on the heap, told apart by the low
+ * bits. objects are 16 byte aligned so a pointer has four free low bits
+ *  ...xxx1   int, the value shifted left by one
+ *  ..kk10    immediate of kind kk with its payload above bit 4: a nullary
+ *            constructor by tag, #t and #f, a char or the empty list
+ *  ..tt00    pointer to an Object, tt is the constructor tag plus one for the
+ *            tags 0 to 2 of a constructed value and 0 when the tag is only
+ *            in the header
+ * so () and Nothing never allocate, and match on a type of up to three
+ * constructors like Maybe or List reads the tag without loading the object
+ */
+using Word = std::uint64_t;
+
+enum class ObjectKind : std::uint8_t {
+    DATA,        // a constructor applied to its fields
+    CONS,        // car and cdr
+    FLOAT,       // a double
+    STRING,      // size bytes, not terminated
+    RATIONAL,    // a normalized Rational
+    COMPLEX,     // two doubles
+    SYMBOL,      // size bytes of the name, interned so eq? compares words
+    VECTOR,      // size lazy elements
+    CLOSURE,     // the function index then its captured variables
+    THUNK,       // the same for a delayed expression
+    BLACKHOLE,   // a thunk under evaluation
+    INDIRECTION, // an evaluated thunk, its value in the first word
+};
+
+// the header of every heap object, the payload follows it directly so a
+// one field constructor takes 16 bytes
+struct Object {
+    ObjectKind kind;
+    std::uint8_t unused = 0;
+    std::uint16_t tag;  // DATA, the constructor tag
+    std::uint32_t size; // words after the header, bytes of STRING and SYMBOL
+};
+
+constexpr Word kPointerMask = 0xf;
+constexpr int kPointerTags = 3; // tags cached in a pointer
+
+enum class Immediate : std::uint8_t { NULLARY, BOOL, CHAR, NIL };
+
+constexpr Word immediate(Immediate kind, Word payload) {
+    return payload << 4 | static_cast<Word>(kind) << 2 | 0x2;
+}
+
+constexpr Word kNil = immediate(Immediate::NIL, 0);
+constexpr Word kFalse = immediate(Immediate::BOOL, 0);
+constexpr Word kTrue = immediate(Immediate::BOOL, 1);
+
+constexpr Word fixnum(std::int64_t i) {
+    return static_cast<Word>(i) << 1 | 1;
+}
+constexpr std::int64_t fixnumValue(Word w) {
+    return static_cast<std::int64_t>(w) >> 1;
+}
+constexpr bool isFixnum(Word w) { return w & 1; }
+constexpr bool isImmediate(Word w) { return (w & 0x3) == 0x2; }
+constexpr bool isPointer(Word w) { return (w & 0x3) == 0 && w != 0; }
+constexpr Immediate immediateKind(Word w) {
+    return static_cast<Immediate>(w >> 2 & 0x3);
+}
+constexpr Word immediatePayload(Word w) { return w >> 4; }
+constexpr Word boolean(bool b) { return b ? kTrue : kFalse; }
+constexpr Word character(char c) {
+    return immediate(Immediate::CHAR, static_cast<unsigned char>(c));
+}
+
+inline Object *objectOf(Word w) {
+    return reinterpret_cast<Object *>(w & ~kPointerMask);
+}
+inline Word *payloadOf(Object *obj) {
+    return reinterpret_cast<Word *>(obj + 1);
+}
+// a pointer to an object without a cached tag
+inline Word objectWord(Object *obj) { return reinterpret_cast<Word>(obj); }
+
+/*
+ * the heap is a bump allocated arena of chunks that is only freed as a
+ * whole, there is no collector yet. it counts what it hands out so the
+ * layout of values can be measured
+ */
+constexpr std::size_t kChunkSize = 1 << 16;
+
+struct Heap {
+    std::vector<std::unique_ptr<std::byte[]>> chunks;
+    std::byte *next = nullptr;
+    std::byte *limit = nullptr;
+    std::size_t bytes = 0;   // handed out, rounded to 16
+    std::size_t objects = 0; // allocations
+};
+
+// an object with payload bytes after the header, 16 byte aligned
+Object *allocate(Heap &heap, ObjectKind kind, std::uint32_t size,
+                 std::size_t payload);
+
+/*
+ * how the values of a constructor are laid out, chosen from its arity and
+ * the number of constructors of its type
+ *  IMMEDIATE  no fields, the tag is the whole value
+ *  UNBOXED    the only constructor of its type with one field, the value is
+ *             the field itself so the wrapper costs nothing
+ *  BOXED      a DATA object of the tag and the fields, the tag cached in the
+ *             pointer when it is below kPointerTags
+ */
+enum class Representation : std::uint8_t { IMMEDIATE, UNBOXED, BOXED };
+
+Representation representation(int arity, std::size_t constructors);
+
+Word construct(Heap &heap, Representation rep, int tag, const Word *fields,
+               int arity);
+// the constructor tag of a value of a type with more than one constructor
+int tagOf(Word w);
+// field i of a constructed value, or of a cons cell with 0 the car
+Word fieldOf(Word w, Representation rep, int i);
+
+Word makeFloat(Heap &heap, double d);
+double floatValue(Word w);
+Word makeString(Heap &heap, const std::string &s);
+std::string stringValue(Word w);
+Word makeCons(Heap &heap, Word car, Word cdr);
+Word makeRational(Heap &heap, Rational r);
+Rational rationalValue(Word w);
+Word makeComplex(Heap &heap, Complex c);
+Complex complexValue(Word w);
+
+/*
+ * equal? over values of the same type, dispatching on the immediate kind and
+ * the object kind and comparing constructed values by integer tag before
+ * their fields. the cdr of a list is followed in a loop so long lists do not
+ * recurse. fields may be unevaluated, force brings each one to WHNF before
+ * it is compared
+ */
+using Force = std::function<Word(Word)>;
+
+bool equalWords(Word a, Word b);
+bool equalWords(Word a, Word b, const Force &force);
+
+#endif
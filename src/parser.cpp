@@ -343,8 +343,8 @@ TokenNode validateTypeList(const TokenNode &types) {
     }
     int state = 0;
     const TokenList &lst = asTokenList(types);
-    const Token &headtok = std::get<Token>(head(lst));
-    if (headtok.kind == TokenKind::FORALL) {
+    if (isTokenNodeToken(head(lst)) &&
+        std::get<Token>(head(lst)).kind == TokenKind::FORALL) {
         return validateForall(types);
     }
     TokenListIterator it(lst);
@@ -384,6 +384,9 @@ TokenNode validateTypeList(const TokenNode &types) {
             if (isTokenNodeToken(node)) {
                 const Token &tok = std::get<Token>(node);
                 if (tok.kind == TokenKind::ARROW) {
+                    // the arrow is kept so the typechecker can tell (int->int)
+                    // apart from a constructor application like (list int)
+                    typeNodes.push(node);
                     it++;
                     state = 0;
                     errtok = &tok;
@@ -980,7 +983,21 @@ TokenNode parseMatch(Lexer &lex) {
     TokenNode scrutinee = parse(lex);
     std::stack<TokenNode> patternClauses;
     while (lex.peek(0).kind != TokenKind::RPAREN) {
-        patternClauses.push(validatePatternClause(parse(lex)));
+        // else heads the catch all clause, unwrapIdent would read it as #t
+        bool catchAll = lex.peek(0).kind == TokenKind::LPAREN &&
+                        lex.peek(1).kind == TokenKind::IDENT &&
+                        lex.peek(1).value &&
+                        std::get<Symbol>(lex.peek(1).value->v).name == "else";
+        TokenNode clause = parse(lex);
+        if (catchAll && isTokenNodeList(clause)) {
+            const TokenList &lst = std::get<TokenList>(clause);
+            const Token &elseTok = std::get<Token>(head(lst));
+            clause = TokenNode{cons(
+                TokenNode{Token(TokenKind::PLACEHOLDER, elseTok.line,
+                                elseTok.column)},
+                tail(lst))};
+        }
+        patternClauses.push(validatePatternClause(clause));
     }
     (void)lex.next(); // consume closing rparen;
     TokenList clauses = TokenList{};
@@ -1159,6 +1176,12 @@ TokenNode parse(Lexer &lex) {
             return parseLet(lex);
         case TokenKind::DATA:
             return parseADT(lex);
+        // the equality keywords head an ordinary application
+        case TokenKind::EQ:
+        case TokenKind::EQUALS: {
+            TokenNode op{lex.next()};
+            return TokenNode{cons(op, parseList(lex))};
+        }
         default:
             return TokenNode{parseList(lex)};
         }
@@ -1173,3 +1196,17 @@ TokenNode parse(Lexer &lex) {
         throw std::runtime_error("error" + toString(lex.peek(0)));
     }
 }
+
+// parses every top level form in the lexer's source in order, used by the
+// typechecker and later passes which operate on whole programs
+std::vector<TokenNode> parseProgram(Lexer &lex) {
+    std::vector<TokenNode> forms;
+    while (lex.peek(0).kind != TokenKind::END) {
+        TokenNode form = parse(lex);
+        if (!validateQuote(form, 0)) {
+            throw std::runtime_error("unquote outside quasiquote");
+        }
+        forms.push_back(form);
+    }
+    return forms;
+}
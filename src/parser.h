@@ -6,6 +6,7 @@
 #include <iostream>
 #include <stack>
 #include <stdexcept>
+#include <vector>
 
 // is the token tok an atomic kind?
 inline bool isAtom(const Token &tok) {
@@ -46,3 +47,4 @@ TokenNode parseMatch(Lexer &lex);
 TokenNode parseTypeApplication(Lexer &lex);
 TokenNode parseADT(Lexer &lex);
 TokenNode parse(Lexer &lex);
+std::vector<TokenNode> parseProgram(Lexer &lex);
@@ -0,0 +1,103 @@
+#ifndef SPROUT_LANG_PMAP_H
+#define SPROUT_LANG_PMAP_H
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/*
+ * persistent hash array mapped trie keyed by dense integer ids such as
+ * interned symbols. the id is used directly as the hash, five bits per level,
+ * and each node stores only its occupied slots. insert copies just the path
+ * down to the changed slot, so every older version of a map stays valid and
+ * copying a map is copying one pointer, which is what makes entering and
+ * leaving scopes, and snapshotting an environment for a branch, O(1)
+ */
+template <typename V> struct PMapNode;
+template <typename V> using PMapPtr = std::shared_ptr<const PMapNode<V>>;
+
+template <typename V> struct PMapSlot {
+    std::uint32_t key = 0;
+    V value{};
+    PMapPtr<V> child; // set when the slot holds a subtree instead of a leaf
+};
+
+template <typename V> struct PMapNode {
+    std::uint32_t bitmap = 0;
+    std::vector<PMapSlot<V>> slots;
+};
+
+template <typename V> struct PMap {
+    PMapPtr<V> root;
+    std::size_t count = 0;
+};
+
+template <typename V>
+PMapPtr<V> pmapInsertNode(const PMapNode<V> *node, std::uint32_t key, V value,
+                          unsigned shift, bool &added) {
+    auto copy = node ? std::make_shared<PMapNode<V>>(*node)
+                     : std::make_shared<PMapNode<V>>();
+    std::uint32_t bit = 1u << ((key >> shift) & 31);
+    std::size_t pos = std::popcount(copy->bitmap & (bit - 1));
+    if (!(copy->bitmap & bit)) {
+        copy->bitmap |= bit;
+        copy->slots.insert(copy->slots.begin() + pos,
+                           PMapSlot<V>{key, std::move(value), nullptr});
+        added = true;
+        return copy;
+    }
+    PMapSlot<V> &slot = copy->slots[pos];
+    if (slot.child) {
+        slot.child =
+            pmapInsertNode(slot.child.get(), key, std::move(value), shift + 5,
+                           added);
+    } else if (slot.key == key) {
+        slot.value = std::move(value);
+    } else {
+        // two keys share this slot, push the old leaf one level down
+        bool ignored = false;
+        PMapPtr<V> sub = pmapInsertNode<V>(nullptr, slot.key,
+                                           std::move(slot.value), shift + 5,
+                                           ignored);
+        slot.child = pmapInsertNode(sub.get(), key, std::move(value),
+                                    shift + 5, added);
+        slot.value = V{};
+    }
+    return copy;
+}
+
+// returns a new map with key bound to value, map itself is unchanged
+template <typename V>
+PMap<V> pmapInsert(const PMap<V> &map, std::uint32_t key, V value) {
+    bool added = false;
+    PMap<V> result;
+    result.root =
+        pmapInsertNode(map.root.get(), key, std::move(value), 0, added);
+    result.count = map.count + (added ? 1 : 0);
+    return result;
+}
+
+template <typename V>
+const V *pmapFind(const PMap<V> &map, std::uint32_t key) {
+    const PMapNode<V> *node = map.root.get();
+    unsigned shift = 0;
+    while (node) {
+        std::uint32_t bit = 1u << ((key >> shift) & 31);
+        if (!(node->bitmap & bit)) {
+            return nullptr;
+        }
+        const PMapSlot<V> &slot =
+            node->slots[std::popcount(node->bitmap & (bit - 1))];
+        if (!slot.child) {
+            return slot.key == key ? &slot.value : nullptr;
+        }
+        node = slot.child.get();
+        shift += 5;
+    }
+    return nullptr;
+}
+
+#endif
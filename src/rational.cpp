@@ -1,6 +1,7 @@
 #include "rational.h"
 
 #include <iostream>
+#include <limits>
 #include <numeric>
 #include <stdexcept>
 #include <string>
@@ -18,6 +19,52 @@ Rational::Rational(int n, int d) {
     }
 }
 
+// n/d reduced in 64 bits and narrowed back to int
+static Rational reduce(long long n, long long d) {
+    if (d == 0) {
+        throw std::runtime_error("division by zero");
+    }
+    long long g = std::gcd(n, d);
+    n /= g;
+    d /= g;
+    if (d < 0) {
+        n = -n;
+        d = -d;
+    }
+    if (n < std::numeric_limits<int>::min() ||
+        n > std::numeric_limits<int>::max() ||
+        d > std::numeric_limits<int>::max()) {
+        throw std::runtime_error("rational overflow");
+    }
+    return Rational(static_cast<int>(n), static_cast<int>(d));
+}
+
+Rational operator+(const Rational &a, const Rational &b) {
+    return reduce(static_cast<long long>(a.numerator) * b.denominator +
+                      static_cast<long long>(b.numerator) * a.denominator,
+                  static_cast<long long>(a.denominator) * b.denominator);
+}
+
+Rational operator-(const Rational &a, const Rational &b) {
+    return reduce(static_cast<long long>(a.numerator) * b.denominator -
+                      static_cast<long long>(b.numerator) * a.denominator,
+                  static_cast<long long>(a.denominator) * b.denominator);
+}
+
+Rational operator*(const Rational &a, const Rational &b) {
+    return reduce(static_cast<long long>(a.numerator) * b.numerator,
+                  static_cast<long long>(a.denominator) * b.denominator);
+}
+
+Rational operator/(const Rational &a, const Rational &b) {
+    return reduce(static_cast<long long>(a.numerator) * b.denominator,
+                  static_cast<long long>(a.denominator) * b.numerator);
+}
+
+Rational operator-(const Rational &a) {
+    return reduce(-static_cast<long long>(a.numerator), a.denominator);
+}
+
 Rational rFromString(std::string str) {
     int split = str.find('/');
     std::string numerator = str.substr(0, split);
@@ -19,6 +19,14 @@ struct Rational {
 Rational rFromString(std::string str);
 std::ostream &operator<<(std::ostream &os, const Rational &r);
 
+// exact arithmetic, intermediate products are computed in 64 bits and the
+// result only overflows when its reduced form does not fit in an int
+Rational operator+(const Rational &a, const Rational &b);
+Rational operator-(const Rational &a, const Rational &b);
+Rational operator*(const Rational &a, const Rational &b);
+Rational operator/(const Rational &a, const Rational &b);
+Rational operator-(const Rational &a);
+
 // infix operator overloads
 inline bool operator==(const Rational &a, const Rational &b) {
     return a.numerator == b.numerator && a.denominator == b.denominator;
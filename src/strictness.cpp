@@ -0,0 +1,356 @@
+#include "strictness.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+/*
+ * the variables an expression is strict in, kept sorted. fails marks an
+ * expression that never produces a value, which is strict in everything
+ */
+struct Demand {
+    bool fails = false;
+    std::vector<VarId> vars;
+};
+
+static bool demands(const Demand &d, VarId var) {
+    return d.fails || std::binary_search(d.vars.begin(), d.vars.end(), var);
+}
+
+// both expressions are evaluated
+static Demand both(const Demand &a, const Demand &b) {
+    Demand d;
+    d.fails = a.fails || b.fails;
+    std::set_union(a.vars.begin(), a.vars.end(), b.vars.begin(), b.vars.end(),
+                   std::back_inserter(d.vars));
+    return d;
+}
+
+// one of the expressions is evaluated
+static Demand either(const Demand &a, const Demand &b) {
+    if (a.fails) {
+        return b;
+    }
+    if (b.fails) {
+        return a;
+    }
+    Demand d;
+    std::set_intersection(a.vars.begin(), a.vars.end(), b.vars.begin(),
+                          b.vars.end(), std::back_inserter(d.vars));
+    return d;
+}
+
+static void drop(Demand &d, VarId var) {
+    auto it = std::lower_bound(d.vars.begin(), d.vars.end(), var);
+    if (it != d.vars.end() && *it == var) {
+        d.vars.erase(it);
+    }
+}
+
+struct Strictness {
+    IrModule &ir;
+    std::unordered_map<VarId, IrId> varLambdas; // variables bound to a LAMBDA
+    std::unordered_map<IrId, std::vector<bool>> strict; // params per LAMBDA
+    std::vector<Demand> memo;
+    std::vector<bool> done;
+};
+
+static Demand demand(Strictness &s, IrId id) {
+    if (s.done[id]) {
+        return s.memo[id];
+    }
+    const IrNode &n = s.ir.nodes[id];
+    const std::uint32_t *ops = operandsOf(s.ir, n);
+    Demand d;
+    switch (n.op) {
+    case IrOp::FORCE:
+        if (s.ir.nodes[n.a].op == IrOp::VAR) {
+            d.vars.push_back(s.ir.nodes[n.a].a);
+        }
+        break;
+    case IrOp::FAIL:
+        d.fails = true;
+        break;
+    case IrOp::LET: {
+        d = demand(s, n.c);
+        // a thunk is only evaluated if the body forces it
+        if (s.ir.nodes[n.b].op != IrOp::THUNK) {
+            d = both(d, demand(s, n.b));
+        } else if (demands(d, n.a)) {
+            d = both(d, demand(s, s.ir.nodes[n.b].b));
+        }
+        drop(d, n.a);
+        break;
+    }
+    case IrOp::LETREC:
+        d = demand(s, n.c);
+        for (std::uint32_t i = 0; i < n.count / 2; i++) {
+            drop(d, ops[i]);
+        }
+        break;
+    case IrOp::IF:
+        d = either(demand(s, n.b), demand(s, n.c));
+        break;
+    case IrOp::SWITCH: {
+        // the arms after the scrutinee atom, one of them is taken
+        std::vector<IrId> arms = children(s.ir, id);
+        d = demand(s, arms[1]);
+        for (std::size_t i = 2; i < arms.size(); i++) {
+            d = either(d, demand(s, arms[i]));
+        }
+        break;
+    }
+    case IrOp::APP: {
+        IrId lambda = knownLambda(s.ir, s.varLambdas, n.a);
+        if (lambda == kNoIr) {
+            break;
+        }
+        const std::vector<bool> &params = s.strict[lambda];
+        for (std::uint32_t i = 0; i < n.count && i < params.size(); i++) {
+            const IrNode &arg = s.ir.nodes[ops[i]];
+            if (params[i] && arg.op == IrOp::VAR) {
+                d.vars.push_back(arg.a);
+            }
+        }
+        std::sort(d.vars.begin(), d.vars.end());
+        d.vars.erase(std::unique(d.vars.begin(), d.vars.end()), d.vars.end());
+        break;
+    }
+    default:
+        // atoms, primitives on evaluated atoms and values that delay their
+        // body force nothing
+        break;
+    }
+    s.memo[id] = d;
+    s.done[id] = true;
+    return d;
+}
+
+// recomputes the strict parameters of every function until they are stable
+static void solve(Strictness &s) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        s.memo.assign(s.ir.nodes.size(), Demand());
+        s.done.assign(s.ir.nodes.size(), false);
+        for (auto &[lambda, params] : s.strict) {
+            const IrNode &fn = s.ir.nodes[lambda];
+            Demand body = demand(s, fn.b);
+            const std::uint32_t *vars = operandsOf(s.ir, fn);
+            for (std::uint32_t i = 0; i < fn.count; i++) {
+                bool strict = params[i] && demands(body, vars[i]);
+                if (strict != params[i]) {
+                    params[i] = strict;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+// finds the thunks to evaluate eagerly and the function each node is in
+static void plan(Strictness &s, const SymbolTable &symbols, IrId id,
+                 std::size_t owner, StrictnessReport &report,
+                 std::vector<IrId> &eager,
+                 std::unordered_map<IrId, std::size_t> &owners) {
+    const IrNode &n = s.ir.nodes[id];
+    auto named = [&](VarId var) {
+        report.functions.push_back({symbols.name(s.ir.vars[var].name), 0, 0});
+        return report.functions.size() - 1;
+    };
+    if (n.op == IrOp::LAMBDA) {
+        owners[id] = owner;
+    }
+    if (n.op == IrOp::LET && s.ir.nodes[n.b].op == IrOp::THUNK &&
+        s.ir.vars[n.a].lazy && demands(demand(s, n.c), n.a)) {
+        eager.push_back(id);
+        report.functions[owner].thunks++;
+    }
+    if (n.op == IrOp::LET && s.ir.nodes[n.b].op == IrOp::LAMBDA) {
+        plan(s, symbols, n.b, named(n.a), report, eager, owners);
+        plan(s, symbols, n.c, owner, report, eager, owners);
+        return;
+    }
+    if (n.op == IrOp::LETREC) {
+        const std::uint32_t *ops = operandsOf(s.ir, n);
+        for (std::uint32_t i = 0; i < n.count / 2; i++) {
+            IrId value = ops[n.count / 2 + i];
+            bool fn = s.ir.nodes[value].op == IrOp::LAMBDA;
+            plan(s, symbols, value, fn ? named(ops[i]) : owner, report, eager,
+                 owners);
+        }
+        plan(s, symbols, n.c, owner, report, eager, owners);
+        return;
+    }
+    for (IrId child : children(s.ir, id)) {
+        plan(s, symbols, child, owner, report, eager, owners);
+    }
+}
+
+// the callee atoms of every direct call, any other use of a function lets
+// it escape to callers the analysis does not see. so does a LAMBDA that is
+// not the value of a LET, LETREC or global, such as one a function returns
+static std::unordered_set<IrId> escaping(const Strictness &s) {
+    std::unordered_set<IrId> callees;
+    for (const IrNode &n : s.ir.nodes) {
+        if (n.op == IrOp::APP) {
+            callees.insert(n.a);
+        }
+    }
+    std::unordered_set<IrId> bound;
+    for (const auto &[var, lambda] : s.varLambdas) {
+        bound.insert(lambda);
+    }
+    for (const IrGlobal &global : s.ir.globals) {
+        if (!global.lazy && global.body != kNoIr &&
+            s.ir.nodes[global.body].op == IrOp::LAMBDA) {
+            bound.insert(global.body);
+        }
+    }
+    std::unordered_set<IrId> escaped;
+    for (IrId id = 0; id < s.ir.nodes.size(); id++) {
+        const IrNode &n = s.ir.nodes[id];
+        if (n.op == IrOp::LAMBDA && !bound.contains(id)) {
+            escaped.insert(id);
+        } else if ((n.op == IrOp::VAR || n.op == IrOp::GLOBAL) &&
+                   !callees.contains(id)) {
+            IrId lambda = knownLambda(s.ir, s.varLambdas, id);
+            if (lambda != kNoIr) {
+                escaped.insert(lambda);
+            }
+        }
+    }
+    return escaped;
+}
+
+/* a call to a function that takes evaluated strict parameters forces the
+ * lazy atoms passed to them first, the APP node is replaced in place by
+ *  LET a' = FORCE a in APP f ... a' ...
+ */
+static void forceArguments(IrModule &ir, IrId call,
+                           const std::vector<bool> &params) {
+    IrNode app = ir.nodes[call];
+    const std::uint32_t *ops = operandsOf(ir, app);
+    std::vector<IrId> args(ops, ops + app.count);
+    std::vector<std::pair<VarId, IrId>> forced;
+    for (std::uint32_t i = 0; i < app.count; i++) {
+        const IrNode &arg = ir.nodes[args[i]];
+        if (!params[i] || !isLazyAtom(ir, arg)) {
+            continue;
+        }
+        VarId var = addVar(ir, ir.temp, arg.type, false);
+        IrNode force;
+        force.op = IrOp::FORCE;
+        force.type = arg.type;
+        force.a = args[i];
+        forced.emplace_back(var, addNode(ir, force));
+        IrNode value;
+        value.op = IrOp::VAR;
+        value.type = arg.type;
+        value.a = var;
+        args[i] = addNode(ir, value);
+    }
+    if (forced.empty()) {
+        return;
+    }
+    IrId body = addNode(ir, app, args);
+    for (std::size_t i = forced.size(); i-- > 0;) {
+        IrNode let;
+        let.op = IrOp::LET;
+        let.type = app.type;
+        let.a = forced[i].first;
+        let.b = forced[i].second;
+        let.c = body;
+        if (i == 0) {
+            ir.nodes[call] = let;
+        } else {
+            body = addNode(ir, let);
+        }
+    }
+}
+
+StrictnessReport analyzeStrictness(IrModule &ir, const SymbolTable &symbols,
+                                   bool report) {
+    Strictness s{ir, boundLambdas(ir), {}, {}, {}};
+    for (IrId id = 0; id < ir.nodes.size(); id++) {
+        if (ir.nodes[id].op == IrOp::LAMBDA) {
+            s.strict[id].assign(ir.nodes[id].count, true);
+        }
+    }
+    solve(s);
+
+    StrictnessReport result;
+    std::vector<IrId> eager;
+    std::unordered_map<IrId, std::size_t> owners;
+    for (const IrGlobal &global : ir.globals) {
+        result.functions.push_back({symbols.name(global.name), 0, 0});
+        plan(s, symbols, global.body, result.functions.size() - 1, result,
+             eager, owners);
+    }
+    for (std::size_t i = 0; i < ir.exprs.size(); i++) {
+        result.functions.push_back({"expr " + std::to_string(i), 0, 0});
+        plan(s, symbols, ir.exprs[i], result.functions.size() - 1, result,
+             eager, owners);
+    }
+    for (IrId let : eager) {
+        ir.nodes[let].b = ir.nodes[ir.nodes[let].b].b;
+        ir.vars[ir.nodes[let].a].lazy = false;
+    }
+    for (IrId let : eager) {
+        flattenLet(ir, let);
+    }
+
+    // functions only called directly take their strict parameters evaluated
+    std::unordered_set<IrId> escaped = escaping(s);
+    for (const auto &[lambda, params] : s.strict) {
+        if (escaped.contains(lambda) || !owners.contains(lambda)) {
+            continue;
+        }
+        const IrNode &fn = ir.nodes[lambda];
+        for (std::uint32_t i = 0; i < fn.count; i++) {
+            VarId param = operandsOf(ir, fn)[i];
+            if (params[i] && ir.vars[param].lazy) {
+                ir.vars[param].lazy = false;
+                result.functions[owners[lambda]].strictParams++;
+            }
+        }
+    }
+    std::size_t calls = ir.nodes.size();
+    for (IrId id = 0; id < calls; id++) {
+        if (ir.nodes[id].op != IrOp::APP) {
+            continue;
+        }
+        IrId lambda = knownLambda(s.ir, s.varLambdas, ir.nodes[id].a);
+        if (lambda != kNoIr && !escaped.contains(lambda)) {
+            forceArguments(ir, id, s.strict[lambda]);
+        }
+    }
+    // forcing a variable that now always holds a value is reading it
+    for (IrNode &n : ir.nodes) {
+        if (n.op == IrOp::FORCE && !isLazyAtom(ir, ir.nodes[n.a])) {
+            n = ir.nodes[n.a];
+        }
+    }
+
+    for (const FunctionStrictness &fn : result.functions) {
+        result.thunks += fn.thunks;
+        result.strictParams += fn.strictParams;
+    }
+    if (report) {
+        std::cout << toString(result);
+    }
+    return result;
+}
+
+std::string toString(const StrictnessReport &report) {
+    std::ostringstream out;
+    for (const FunctionStrictness &fn : report.functions) {
+        out << fn.name << ": " << fn.thunks << " thunks eliminated, "
+            << fn.strictParams << " strict params\n";
+    }
+    out << "total: " << report.thunks << " thunks eliminated, "
+        << report.strictParams << " strict params\n";
+    return out.str();
+}
@@ -0,0 +1,42 @@
+#ifndef SPROUT_LANG_STRICTNESS_H
+#define SPROUT_LANG_STRICTNESS_H
+
+#include "ir.h"
+#include "symtab.h"
+#include <string>
+#include <vector>
+
+/*
+ * strictness analysis over the ANF IR. an expression is strict in a lazy
+ * variable when every evaluation of it to WHNF forces the variable, or
+ * fails, so evaluating the variable's thunk up front cannot change the
+ * result. the analysis computes for every node the variables it is strict
+ * in and for every function which parameters its body is strict in, as a
+ * fixpoint that starts from every parameter strict so recursive functions
+ * like named let loops come out strict in their accumulators.
+ *
+ * the results are used in three ways
+ *  a LET of a THUNK whose body is strict in the variable is evaluated eagerly
+ *  calls to a known function are strict in the arguments of strict params
+ *  a function that is only ever called directly takes its strict parameters
+ *  evaluated, its callers force them, and the FORCEs in its body go away
+ */
+struct FunctionStrictness {
+    std::string name; // global or binding name, anonymous lambdas count
+                      // towards the function they appear in
+    int thunks = 0;       // THUNK allocations turned into eager evaluation
+    int strictParams = 0; // parameters now passed evaluated
+};
+
+struct StrictnessReport {
+    std::vector<FunctionStrictness> functions;
+    int thunks = 0;
+    int strictParams = 0;
+};
+
+// rewrites ir in place, with report set the per function counts are printed
+StrictnessReport analyzeStrictness(IrModule &ir, const SymbolTable &symbols,
+                                   bool report = false);
+std::string toString(const StrictnessReport &report);
+
+#endif
@@ -0,0 +1,14 @@
+#include "symtab.h"
+
+SymbolId SymbolTable::intern(const std::string &name) {
+    auto it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    SymbolId id = static_cast<SymbolId>(names.size());
+    ids.emplace(name, id);
+    names.push_back(name);
+    return id;
+}
+
+const std::string &SymbolTable::name(SymbolId id) const { return names[id]; }
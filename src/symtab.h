@@ -0,0 +1,24 @@
+#ifndef SPROUT_LANG_SYMTAB_H
+#define SPROUT_LANG_SYMTAB_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * interns symbol names to dense integer ids, the typechecker and later passes
+ * key their environments by SymbolId instead of hashing and comparing strings
+ * at every scope
+ */
+using SymbolId = std::uint32_t;
+
+struct SymbolTable {
+    std::unordered_map<std::string, SymbolId> ids;
+    std::vector<std::string> names;
+
+    SymbolId intern(const std::string &name);
+    const std::string &name(SymbolId id) const;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "typecache.h"
+#include "ast.h"
+#include "value.h"
+#include <bit>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+static const char *kCacheHeader = "sprout-typecheck-cache 1";
+
+// 64 bit FNV-1a, std::hash is not guaranteed to be stable between builds and
+// the keys are written to disk
+std::uint64_t hashString(const std::string &text) {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+std::uint64_t hashCombine(std::uint64_t seed, std::uint64_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+// the printed form of a Value loses the difference between 1 and 1.0, so the
+// variant index is hashed too and doubles are hashed by their bits
+static std::uint64_t hashValue(const Value &val) {
+    std::uint64_t h = hashCombine(0, val.v.index());
+    if (isDouble(val)) {
+        return hashCombine(h, std::bit_cast<std::uint64_t>(
+                                  std::get<double>(val.v)));
+    }
+    if (isAstPtr(val)) {
+        return hashCombine(h, hashNode(std::get<AstPtr>(val.v)->node));
+    }
+    std::ostringstream oss;
+    oss << val;
+    return hashCombine(h, hashString(oss.str()));
+}
+
+std::uint64_t hashNode(const TokenNode &node) {
+    if (isTokenNodeToken(node)) {
+        const Token &tok = std::get<Token>(node);
+        std::uint64_t h = hashCombine(1, static_cast<std::uint64_t>(tok.kind));
+        return tok.value ? hashCombine(h, hashValue(*tok.value)) : h;
+    }
+    std::uint64_t h = 2;
+    for (TokenListIterator it(std::get<TokenList>(node)), end(TokenList{});
+         it != end; ++it) {
+        h = hashCombine(h, hashNode(*it));
+    }
+    return h;
+}
+
+void listCells(const TokenNode &node,
+               std::vector<const TokenListNode *> &cells) {
+    if (isTokenNodeToken(node)) {
+        const Token &tok = std::get<Token>(node);
+        if (tok.value && isAstPtr(*tok.value)) {
+            listCells(std::get<AstPtr>(tok.value->v)->node, cells);
+        }
+        return;
+    }
+    for (TokenList lst = std::get<TokenList>(node); lst; lst = tail(lst)) {
+        cells.push_back(lst.get());
+        listCells(head(lst), cells);
+    }
+}
+
+/* one entry per cached form
+ *  form <key> <number of facts>
+ *  fact <cell index> <length> <index> <checked> <unroll>
+ */
+TypecheckCache loadTypecheckCache(const std::string &path) {
+    TypecheckCache cache;
+    std::ifstream in(path);
+    std::string line;
+    if (!in || !std::getline(in, line) || line != kCacheHeader) {
+        return cache;
+    }
+    std::string tag;
+    std::uint64_t key;
+    std::size_t facts;
+    while (in >> tag >> key >> facts) {
+        if (tag != "form") {
+            throw std::runtime_error("malformed typecheck cache " + path);
+        }
+        CachedForm &form = cache.forms[key];
+        for (std::size_t i = 0; i < facts; i++) {
+            std::size_t cell;
+            VecAccess access{};
+            if (!(in >> tag >> cell >> access.length >> access.index >>
+                  access.checked >> access.unroll) ||
+                tag != "fact") {
+                throw std::runtime_error("malformed typecheck cache " + path);
+            }
+            form.vecAccesses.emplace_back(cell, access);
+        }
+    }
+    if (!in.eof()) {
+        throw std::runtime_error("malformed typecheck cache " + path);
+    }
+    return cache;
+}
+
+void saveTypecheckCache(const TypecheckCache &cache, const std::string &path) {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("could not write typecheck cache " + path);
+    }
+    out << kCacheHeader << '\n';
+    for (const auto &[key, form] : cache.forms) {
+        out << "form " << key << ' ' << form.vecAccesses.size() << '\n';
+        for (const auto &[cell, access] : form.vecAccesses) {
+            out << "fact " << cell << ' ' << access.length << ' '
+                << access.index << ' ' << access.checked << ' '
+                << access.unroll << '\n';
+        }
+    }
+}
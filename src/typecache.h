@@ -0,0 +1,50 @@
+#ifndef SPROUT_LANG_TYPECACHE_H
+#define SPROUT_LANG_TYPECACHE_H
+
+#include "token.h"
+#include "typechecker.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * incremental typechecking cache. a top level form that typechecked is
+ * remembered under a key combining the hash of its CST with the names and
+ * printed signatures of the defines it depends on, so a form is only checked
+ * again when its own code or one of those signatures changed. positions are
+ * not hashed, moving a define does not invalidate it, and failures are never
+ * cached so their diagnostics always carry current positions.
+ *
+ * the vec access facts of a cached form are stored by the preorder index of
+ * their application cell in the form rather than by pointer, so they can be
+ * re-attached to a freshly parsed CST, which is what lets the cache live on
+ * disk between batch builds as well as in memory for the REPL
+ */
+struct CachedForm {
+    std::vector<std::pair<std::size_t, VecAccess>> vecAccesses;
+};
+
+struct TypecheckCache {
+    std::unordered_map<std::uint64_t, CachedForm> forms;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+};
+
+// structural hash of a CST node, stable across runs and builds
+std::uint64_t hashNode(const TokenNode &node);
+std::uint64_t hashCombine(std::uint64_t seed, std::uint64_t value);
+std::uint64_t hashString(const std::string &text);
+
+// every cons cell of a form in preorder, descending into AstPtr wrapped nodes
+void listCells(const TokenNode &node,
+               std::vector<const TokenListNode *> &cells);
+
+// an empty cache when the file does not exist or was written by another
+// version of the format
+TypecheckCache loadTypecheckCache(const std::string &path);
+void saveTypecheckCache(const TypecheckCache &cache, const std::string &path);
+
+#endif
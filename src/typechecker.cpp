@@ -1,77 +1,1483 @@
 #include "typechecker.h"
 #include "ast.h"
 #include "token.h"
+#include "typecache.h"
 #include "value.h"
+#include "workpool.h"
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <sstream>
-#include <stack>
 #include <stdexcept>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
-/* work in progress does not compile much TODO */
-Type::Type(int i) { t = i; };
-Type::Type(Rational r) { t = r; };
-Type::Type(Complex c) { t = c; };
-Type::Type(bool b) { t = b; };
-Type::Type(char c) { t = c; };
-Type::Type(std::string str) { t = str; };
-Type::Type(std::shared_ptr<FunctSig> f) { t = f; };
-Type::Type(std::shared_ptr<TypeConstSig> c) { t = c; };
-Type::Type(std::shared_ptr<TypeVar> v) { t = v; };
+/*
+ * the sprout typechecker walks the CST produced by the parser and computes
+ * the type of every expression, throwing a runtime_error on the first type
+ * error. types are explicit (system f style), every binder carries an
+ * annotation, so checking is mostly a bottom up synthesis with a comparison
+ * against the annotation at each binding site. types are interned in the
+ * TypeTable so that comparison is a TypeId compare
+ */
 
-TypeVar::TypeVar(std::string str) { name = str; };
+void insertBinding(SymbolId symbol, TypeId type, TypeEnv &env) {
+    env.values = pmapInsert(env.values, symbol, type);
+}
+
+void insertTypeVar(SymbolId name, TypeId type, TypeEnv &env) {
+    env.typeVars = pmapInsert(env.typeVars, name, type);
+}
+
+std::optional<TypeId> lookupType(SymbolId symbol, const TypeEnv &env) {
+    if (const TypeId *type = pmapFind(env.values, symbol)) {
+        return *type;
+    }
+    return std::nullopt;
+}
+
+std::optional<TypeId> lookupTypeVar(SymbolId name, const TypeEnv &env) {
+    if (const TypeId *type = pmapFind(env.typeVars, name)) {
+        return *type;
+    }
+    return std::nullopt;
+}
+
+std::optional<int> staticLength(const TypeTable &table, TypeId type) {
+    if (const TypeNode *vec = asConstructed(table, type, "vec")) {
+        return vec->nats.front();
+    }
+    return std::nullopt;
+}
+
+// helper for grabbing the location of the first token in a node for error
+// messages
+static std::string location(const TokenNode &node) {
+    if (isTokenNodeToken(node)) {
+        const Token &tok = std::get<Token>(node);
+        return " at line:" + std::to_string(tok.line) +
+               " column:" + std::to_string(tok.column);
+    }
+    for (TokenListIterator it(std::get<TokenList>(node)), end(TokenList{});
+         it != end; ++it) {
+        std::string loc = location(*it);
+        if (!loc.empty()) {
+            return loc;
+        }
+    }
+    return "";
+}
+
+static std::runtime_error typeError(const std::string &msg,
+                                    const TokenNode &at) {
+    std::ostringstream oss;
+    oss << at;
+    return std::runtime_error("type error: " + msg + location(at) +
+                              ", in:" + oss.str());
+}
+
+static const std::string &symbolName(const Token &tok) {
+    if (!tok.value || !isString(*tok.value)) {
+        throw std::runtime_error("expected a symbol with a name, found:" +
+                                 toString(tok));
+    }
+    return std::get<std::string>(tok.value->v);
+}
+
+// the interned id of a SYMBOL or TYPE_VAR token's name
+static SymbolId symbolId(const Token &tok, TypeChecker &tc) {
+    return tc.symbols.intern(symbolName(tok));
+}
+
+static const TokenNode &astNode(const Token &tok) {
+    if (!tok.value || !isAstPtr(*tok.value)) {
+        throw std::runtime_error("expected a token wrapping a node, found:" +
+                                 toString(tok));
+    }
+    return std::get<AstPtr>(tok.value->v)->node;
+}
+
+static bool isTokenOfKind(const TokenNode &node, TokenKind kind) {
+    return isTokenNodeToken(node) && std::get<Token>(node).kind == kind;
+}
+
+static std::vector<TokenNode> elements(const TokenList &lst) {
+    std::vector<TokenNode> elems;
+    for (TokenListIterator it(lst), end(TokenList{}); it != end; ++it) {
+        elems.push_back(*it);
+    }
+    return elems;
+}
+
+static TypeId listType(TypeChecker &tc, TypeId elem) {
+    return tc.types.constructed("list", {elem}, {});
+}
+
+static TypeId vecType(TypeChecker &tc, TypeId elem, int length) {
+    return tc.types.constructed("vec", {elem}, {length});
+}
 
-FunctSig::FunctSig(std::vector<Cell<Value, Value>> params_,
-                   std::vector<Type> signature_)
-    : params(std::move(params_)), signature(std::move(signature_)) {}
+static const std::vector<TypeId> &signature(const TypeChecker &tc,
+                                            TypeId fn) {
+    return tc.types.node(fn).args;
+}
 
-TypeConstSig::TypeConstSig(std::string name_, std::vector<Type> typeArgs_,
-                           std::vector<int> natArgs_)
-    : name(std::move(name_)), typeArgs(std::move(typeArgs_)),
-      natArgs(std::move(natArgs_)) {}
+static std::string typeName(TypeChecker &tc, TypeId type) {
+    return toString(tc.types, zonk(tc.unifier, tc.types, type));
+}
+
+// the structure of type so far, see resolve in unify.h
+static TypeId resolved(TypeChecker &tc, TypeId type) {
+    return resolve(tc.unifier, tc.types, type);
+}
 
-TypeFrame::TypeFrame(std::unordered_map<std::string, Type> bindings_)
-    : bindings(std::move(bindings_)) {}
+/*
+ * does a value of the type hold a function, directly, in a type argument or
+ * in a field of a data type, which equal? has no structure to compare by.
+ * seen holds the data types already looked into, for recursive ones
+ */
+static bool holdsFunction(TypeChecker &tc, TypeId type,
+                          std::unordered_set<std::string> &seen) {
+    TypeNode node = tc.types.node(resolved(tc, type));
+    switch (node.kind) {
+    case TypeKind::FUNCT:
+    case TypeKind::FORALL:
+        return true;
+    case TypeKind::CONST:
+        break;
+    default:
+        return false;
+    }
+    for (TypeId arg : node.args) {
+        if (holdsFunction(tc, arg, seen)) {
+            return true;
+        }
+    }
+    for (const DataType &data : tc.data.types) {
+        if (data.name != node.name || !seen.insert(data.name).second) {
+            continue;
+        }
+        // the fields of (forall (A) (A -> (Maybe A))), a parameter among
+        // them is one of the arguments checked above
+        for (std::size_t i : data.constructors) {
+            TypeNode ctor = tc.types.node(tc.data.constructors[i].type);
+            if (ctor.kind == TypeKind::FORALL) {
+                ctor = tc.types.node(ctor.args[0]);
+            }
+            if (ctor.kind != TypeKind::FUNCT) {
+                continue;
+            }
+            for (std::size_t f = 0; f + 1 < ctor.args.size(); f++) {
+                if (holdsFunction(tc, ctor.args[f], seen)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
 
-TypeEnv::TypeEnv(std::stack<TypeFrame> frames_) { frames = frames_; }
+static bool isMeta(const TypeChecker &tc, TypeId type) {
+    return tc.types.node(type).kind == TypeKind::META;
+}
 
-void insertBinding(std::string symbol, Type type, TypeFrame &frame) {
-    frame.bindings.insert({symbol, type});
+// without unification variables this is an id compare, see unify
+static void expectType(TypeChecker &tc, TypeId found, TypeId expected,
+                       const TokenNode &at) {
+    if (!unify(tc.unifier, tc.types, found, expected)) {
+        throw typeError("expected " + typeName(tc, expected) + ", found " +
+                            typeName(tc, found),
+                        at);
+    }
 }
 
-void insertFrame(TypeFrame &frame, TypeEnv &env) { env.frames.push(frame); }
+// the type variable tokens of a TYPE_PARAM_LIST token
+static std::vector<Token> typeParams(const TokenNode &params) {
+    std::vector<Token> toks;
+    for (TokenListIterator it(asTokenList(astNode(std::get<Token>(params)))),
+         end(TokenList{});
+         it != end; ++it) {
+        toks.push_back(std::get<Token>(*it));
+    }
+    return toks;
+}
 
-Type makeFunctSig(const TokenNode &root) {}
+// binds each type parameter to a fresh rigid type variable in tc.env, the
+// caller restores its saved env to close the scope
+static std::vector<TypeId> bindTypeVars(const std::vector<Token> &params,
+                                        TypeChecker &tc) {
+    std::vector<TypeId> vars;
+    for (const Token &param : params) {
+        TypeId var = tc.types.freshVar(symbolName(param));
+        insertTypeVar(symbolId(param, tc), var, tc.env);
+        vars.push_back(var);
+    }
+    return vars;
+}
 
-Type makeTypeConstSig(const TokenNode &root) {}
+static const std::unordered_set<std::string> primTypes = {
+    "int", "rational", "float", "complex", "bool", "char", "string", "symbol"};
 
-void parseDefineV(const TokenNode &root) {
-    std::size_t toks = size(root);
-    if (toks != 4) {
-        std::ostringstream oss;
-        oss << root;
-        throw std::runtime_error("expression define malformed, found:" +
-                                 oss.str());
+/* converts a type in the CST to a TypeId
+ *  TYPE_IDENT int                         int
+ *  TYPE_IDENT (int ARROW int)             (int -> int)
+ *  TYPE_IDENT (vec int 3)                 (vec int 3)
+ *  TYPE_IDENT (PARAM_LIST (x int) ... )   function signature of a define
+ *  TYPE_IDENT (FORALL TYPE_PARAM_LIST t)  (forall (A) t)
+ *  TYPE_VAR A                             the type variable A in scope
+ */
+TypeId makeType(const TokenNode &root, TypeChecker &tc) {
+    if (isTokenNodeList(root)) {
+        const TokenList &lst = std::get<TokenList>(root);
+        if (!lst) {
+            throw typeError("empty type", root);
+        }
+        const TokenNode &first = head(lst);
+        if (isTokenOfKind(first, TokenKind::FORALL)) {
+            TypeEnv saved = tc.env;
+            std::vector<TypeId> vars =
+                bindTypeVars(typeParams(head(tail(lst))), tc);
+            TypeId body = makeType(head(tail(tail(lst))), tc);
+            tc.env = saved;
+            return tc.types.forall(vars, body);
+        }
+        if (isTokenOfKind(first, TokenKind::PARAM_LIST)) {
+            return makeFunctSig(root, tc);
+        }
+        if (size(lst) == 1) {
+            return makeType(first, tc);
+        }
+        for (TokenListIterator it(lst), end(TokenList{}); it != end; ++it) {
+            if (isTokenOfKind(*it, TokenKind::ARROW)) {
+                return makeFunctSig(root, tc);
+            }
+        }
+        return makeTypeConstSig(root, tc);
+    }
+    const Token &tok = std::get<Token>(root);
+    switch (tok.kind) {
+    case TokenKind::TYPE_IDENT:
+        if (tok.value && isString(*tok.value)) {
+            const std::string &name = std::get<std::string>(tok.value->v);
+            if (name == "vec" || name == "list") {
+                throw typeError("type constructor " + name +
+                                    " must be applied to arguments",
+                                root);
+            }
+            return tc.types.prim(name);
+        }
+        return makeType(astNode(tok), tc);
+    case TokenKind::RETURN_TYPE:
+        return makeType(astNode(tok), tc);
+    case TokenKind::TYPE_VAR:
+    case TokenKind::SYMBOL: {
+        if (std::optional<TypeId> var =
+                lookupTypeVar(symbolId(tok, tc), tc.env)) {
+            return *var;
+        }
+        // the field types of a data form come through as type variables
+        if (primTypes.contains(symbolName(tok))) {
+            return tc.types.prim(symbolName(tok));
+        }
+        throw typeError("unbound type variable " + symbolName(tok), root);
     }
-    TokenList start = tail(asTokenList(root));
-    std::string sym =
-        std::get<std::string>((*(std::get<Token>(head(start))).value).v);
-    start = tail(start);
-    Type t;
-    if (isTokenNodeToken(head(start))) {
-        Token tok = std::get<Token>(head(start));
-        if (isString(*tok.value)) {
-            t = Type(std::get<std::string>((*tok.value).v));
-        } else if (isAstPtr(*tok.value)) {
-            TokenNode temp = (std::get<AstPtr>((*tok.value).v))->node;
+    default:
+        throw typeError("expected a type", root);
+    }
+}
+
+/* builds a function type out of either a define/lambda parameter list
+ *  (PARAM_LIST (x int) (y int) RETURN_TYPE)
+ * or an arrow type list
+ *  (int ARROW int ARROW int)
+ */
+TypeId makeFunctSig(const TokenNode &root, TypeChecker &tc) {
+    const TokenList &lst = asTokenList(root);
+    std::vector<TypeId> sig;
+    if (isTokenOfKind(head(lst), TokenKind::PARAM_LIST)) {
+        for (TokenListIterator it(tail(lst)), end(TokenList{}); it != end;
+             ++it) {
+            if (isTokenOfKind(*it, TokenKind::RETURN_TYPE)) {
+                sig.push_back(makeType(*it, tc));
+                continue;
+            }
+            sig.push_back(makeType(head(tail(asTokenList(*it))), tc));
+        }
+    } else {
+        bool expectType = true;
+        for (TokenListIterator it(lst), end(TokenList{}); it != end; ++it) {
+            bool arrow = isTokenOfKind(*it, TokenKind::ARROW);
+            if (arrow == expectType) {
+                throw typeError("malformed function type", root);
+            }
+            if (!arrow) {
+                sig.push_back(makeType(*it, tc));
+            }
+            expectType = arrow;
+        }
+    }
+    if (sig.empty()) {
+        throw typeError("function type without a return type", root);
+    }
+    return tc.types.funct(std::move(sig));
+}
 
+// builds a constructed type like (vec int 3) or (list int), type level
+// naturals go into natArgs and everything else into typeArgs
+TypeId makeTypeConstSig(const TokenNode &root, TypeChecker &tc) {
+    const TokenList &lst = asTokenList(root);
+    const Token &ctor = std::get<Token>(head(lst));
+    std::string name;
+    if (ctor.kind == TokenKind::TYPE_IDENT && ctor.value &&
+        isString(*ctor.value)) {
+        name = std::get<std::string>(ctor.value->v);
+    } else if (ctor.kind == TokenKind::TYPE_VAR ||
+               ctor.kind == TokenKind::SYMBOL) {
+        name = symbolName(ctor);
+    } else {
+        throw typeError("expected a type constructor", root);
+    }
+    std::vector<TypeId> typeArgs;
+    std::vector<int> natArgs;
+    for (TokenListIterator it(tail(lst)), end(TokenList{}); it != end; ++it) {
+        if (isTokenOfKind(*it, TokenKind::NUMBER)) {
+            const Token &tok = std::get<Token>(*it);
+            if (!isInt(*tok.value) || std::get<int>(tok.value->v) < 0) {
+                throw typeError("type level naturals must be non-negative "
+                                "integers",
+                                root);
+            }
+            natArgs.push_back(std::get<int>(tok.value->v));
         } else {
-            throw std::runtime_error("invalid value in type ident:");
+            typeArgs.push_back(makeType(*it, tc));
+        }
+    }
+    if (name == "vec" && (typeArgs.size() != 1 || natArgs.size() != 1)) {
+        throw typeError("vec types have the form (vec T N)", root);
+    }
+    if (name == "list" && (typeArgs.size() != 1 || !natArgs.empty())) {
+        throw typeError("list types have the form (list T)", root);
+    }
+    return tc.types.constructed(name, std::move(typeArgs), std::move(natArgs));
+}
+
+/*
+ * builtin operators, they are not first class values so they are only
+ * recognized in the head of an application and only when the name is not
+ * shadowed by a binding
+ */
+static const std::unordered_set<std::string> arithmeticPrims = {"+", "-", "*",
+                                                                "/"};
+static const std::unordered_set<std::string> comparisonPrims = {"<", ">", "<=",
+                                                                ">=", "="};
+static const std::unordered_set<std::string> otherPrims = {
+    "%",       "not",     "and",     "or",       "cons",
+    "car",     "cdr",     "null?",   "map",      "filter",
+    "foldl",   "vec-ref", "vec-len", "vec-map",  "vec-fold"};
+
+static bool isPrim(const std::string &name) {
+    return arithmeticPrims.contains(name) || comparisonPrims.contains(name) ||
+           otherPrims.contains(name);
+}
+
+// position of a numeric type in the tower int < rational < float < complex,
+// -1 for non numeric types. the primitive ids are interned in tower order
+static int numericRank(TypeId type) {
+    if (type <= kComplexType) {
+        return static_cast<int>(type);
+    }
+    return -1;
+}
+
+// integer value of an index expression when it is a constant, used to prove
+// (vec-ref v i) in bounds at compile time. + - and * only fold when they are
+// the primitives and not a binding in scope, and a result outside int is
+// not a constant, so the access stays checked
+static std::optional<int> constantIndex(const TokenNode &expr,
+                                        TypeChecker &tc) {
+    if (isTokenOfKind(expr, TokenKind::NUMBER)) {
+        const Token &tok = std::get<Token>(expr);
+        if (isInt(*tok.value)) {
+            return std::get<int>(tok.value->v);
+        }
+        return std::nullopt;
+    }
+    if (!isTokenNodeList(expr) || size(expr) != 3) {
+        return std::nullopt;
+    }
+    std::vector<TokenNode> elems = elements(std::get<TokenList>(expr));
+    if (!isTokenOfKind(elems[0], TokenKind::SYMBOL)) {
+        return std::nullopt;
+    }
+    const Token &tok = std::get<Token>(elems[0]);
+    if (lookupType(symbolId(tok, tc), tc.env)) {
+        return std::nullopt;
+    }
+    const std::string &op = symbolName(tok);
+    std::optional<int> a = constantIndex(elems[1], tc);
+    std::optional<int> b = constantIndex(elems[2], tc);
+    if (!a || !b) {
+        return std::nullopt;
+    }
+    std::int64_t x = *a;
+    std::int64_t y = *b;
+    std::int64_t z = 0;
+    if (op == "+") {
+        z = x + y;
+    } else if (op == "-") {
+        z = x - y;
+    } else if (op == "*") {
+        z = x * y;
+    } else {
+        return std::nullopt;
+    }
+    if (z < std::numeric_limits<int>::min() ||
+        z > std::numeric_limits<int>::max()) {
+        return std::nullopt;
+    }
+    return static_cast<int>(z);
+}
+
+static TypeId typeOfPrim(const std::string &op, const TokenList &app,
+                         TypeChecker &tc) {
+    std::vector<TokenNode> args = elements(tail(app));
+    TokenNode at = TokenNode{app};
+    auto arity = [&](std::size_t n) {
+        if (args.size() != n) {
+            throw typeError(op + " expects " + std::to_string(n) +
+                                " arguments, found " +
+                                std::to_string(args.size()),
+                            at);
+        }
+    };
+    for (const TokenNode &arg : args) {
+        if (isTokenOfKind(arg, TokenKind::PLACEHOLDER)) {
+            throw typeError("placeholders cannot be used with builtin " + op,
+                            at);
+        }
+    }
+    if (arithmeticPrims.contains(op) || comparisonPrims.contains(op)) {
+        if (args.empty() || (args.size() == 1 && op != "-")) {
+            throw typeError(op + " expects at least two arguments", at);
+        }
+        int rank = 0;
+        for (const TokenNode &arg : args) {
+            TypeId t = resolved(tc, typeOf(arg, tc));
+            int r = numericRank(t);
+            if (r < 0) {
+                throw typeError(op + " expects numbers, found " +
+                                    typeName(tc, t),
+                                arg);
+            }
+            if (t == kComplexType && comparisonPrims.contains(op) &&
+                op != "=") {
+                throw typeError("complex numbers are not ordered", arg);
+            }
+            rank = std::max(rank, r);
+        }
+        if (comparisonPrims.contains(op)) {
+            return kBoolType;
+        }
+        // division of exact integers is exact, (/ 1 2) is 1/2
+        if (op == "/" && rank == 0) {
+            rank = 1;
+        }
+        return static_cast<TypeId>(rank);
+    }
+    if (op == "%") {
+        arity(2);
+        checkAgainst(args[0], kIntType, tc);
+        checkAgainst(args[1], kIntType, tc);
+        return kIntType;
+    }
+    if (op == "not" || op == "and" || op == "or") {
+        arity(op == "not" ? 1 : 2);
+        for (const TokenNode &arg : args) {
+            checkAgainst(arg, kBoolType, tc);
+        }
+        return kBoolType;
+    }
+    if (op == "cons") {
+        arity(2);
+        TypeId elem = typeOf(args[0], tc);
+        return checkAgainst(args[1], listType(tc, elem), tc);
+    }
+    if (op == "car" || op == "cdr" || op == "null?") {
+        arity(1);
+        TypeId lst = resolved(tc, typeOf(args[0], tc));
+        const TypeNode *sig = asConstructed(tc.types, lst, "list");
+        if (!sig) {
+            throw typeError(op + " expects a list, found " + typeName(tc, lst),
+                            args[0]);
         }
+        if (op == "car") {
+            return sig->args.front();
+        }
+        return op == "cdr" ? lst : kBoolType;
+    }
+    if (op == "map" || op == "filter" || op == "foldl") {
+        std::size_t listArg = op == "foldl" ? 2 : 1;
+        arity(listArg + 1);
+        TypeId lst = resolved(tc, typeOf(args[listArg], tc));
+        const TypeNode *sig = asConstructed(tc.types, lst, "list");
+        if (!sig) {
+            throw typeError(op + " expects a list, found " + typeName(tc, lst),
+                            args[listArg]);
+        }
+        TypeId elem = sig->args.front();
+        if (op == "filter") {
+            checkAgainst(args[0], tc.types.funct({elem, kBoolType}), tc);
+            return lst;
+        }
+        if (op == "foldl") {
+            // (foldl f z xs) with f:(U -> T -> U) and z:U
+            TypeId acc = typeOf(args[1], tc);
+            checkAgainst(args[0], tc.types.funct({acc, elem, acc}), tc);
+            return acc;
+        }
+        TypeId fn = resolved(tc, typeOf(args[0], tc));
+        if (!isFunctType(tc.types, fn) || signature(tc, fn).size() != 2) {
+            throw typeError("map expects a one argument function, found " +
+                                typeName(tc, fn),
+                            args[0]);
+        }
+        expectType(tc, elem, signature(tc, fn)[0], args[1]);
+        return listType(tc, signature(tc, fn)[1]);
+    }
+
+    // vector operations, the static length from the (vec T N) type is
+    // recorded for every site so lowering can drop bounds checks and unroll
+    std::size_t vecArg = op == "vec-map" ? 1 : (op == "vec-fold" ? 2 : 0);
+    arity(op == "vec-len" ? 1 : (op == "vec-fold" ? 3 : 2));
+    TypeId vec = resolved(tc, typeOf(args[vecArg], tc));
+    const TypeNode *sig = asConstructed(tc.types, vec, "vec");
+    if (!sig) {
+        throw typeError(op + " expects a vec, found " + typeName(tc, vec),
+                        args[vecArg]);
+    }
+    TypeId elem = sig->args.front();
+    int length = sig->nats.front();
+    if (op == "vec-len") {
+        return kIntType;
+    }
+    if (op == "vec-ref") {
+        checkAgainst(args[1], kIntType, tc);
+        std::optional<int> index = constantIndex(args[1], tc);
+        if (index && (*index < 0 || *index >= length)) {
+            throw typeError("index " + std::to_string(*index) +
+                                " out of bounds for " + typeName(tc, vec),
+                            at);
+        }
+        tc.info.vecAccesses[app.get()] =
+            VecAccess{length, index.value_or(-1), !index.has_value(), false};
+        return elem;
+    }
+    tc.info.vecAccesses[app.get()] =
+        VecAccess{length, -1, false, length <= kUnrollLimit};
+    if (op == "vec-map") {
+        TypeId fn = resolved(tc, typeOf(args[0], tc));
+        if (!isFunctType(tc.types, fn) || signature(tc, fn).size() != 2) {
+            throw typeError("vec-map expects a one argument function, found " +
+                                typeName(tc, fn),
+                            args[0]);
+        }
+        expectType(tc, elem, signature(tc, fn)[0], args[1]);
+        return vecType(tc, signature(tc, fn)[1], length);
+    }
+    // (vec-fold f z v) with f:(U -> T -> U) and z:U
+    TypeId acc = typeOf(args[1], tc);
+    checkAgainst(args[0], tc.types.funct({acc, elem, acc}), tc);
+    return acc;
+}
+
+// the type of quoted data, lists must be homogeneous and an improper tail
+// must itself be a list of the same element type
+static TypeId typeOfDatum(const TokenNode &datum, bool quasi,
+                          TypeChecker &tc) {
+    if (isTokenNodeToken(datum)) {
+        const Token &tok = std::get<Token>(datum);
+        switch (tok.kind) {
+        case TokenKind::SYMBOL:
+        case TokenKind::TYPE_IDENT:
+            return kSymbolType;
+        default:
+            return typeOf(datum, tc);
+        }
+    }
+    const TokenList &lst = std::get<TokenList>(datum);
+    // the element type of '() is left to the context
+    if (!lst) {
+        return listType(tc, freshMeta(tc.unifier, tc.types));
+    }
+    if (quasi && isTokenOfKind(head(lst), TokenKind::UNQUOTE)) {
+        return typeOf(head(tail(lst)), tc);
+    }
+    std::optional<TypeId> elem;
+    for (TokenListIterator it(lst), end(TokenList{}); it != end; ++it) {
+        if (isTokenOfKind(*it, TokenKind::DOT)) {
+            ++it;
+            TypeId rest = typeOfDatum(*it, quasi, tc);
+            if (elem) {
+                expectType(tc, rest, listType(tc, *elem), *it);
+            }
+            return rest;
+        }
+        TypeId t;
+        if (quasi && isTokenNodeList(*it) && std::get<TokenList>(*it) &&
+            isTokenOfKind(head(std::get<TokenList>(*it)),
+                          TokenKind::UNQUOTESPLICE)) {
+            const TokenNode &spliced = head(tail(std::get<TokenList>(*it)));
+            TypeId lt = resolved(tc, typeOf(spliced, tc));
+            const TypeNode *sig = asConstructed(tc.types, lt, "list");
+            if (!sig) {
+                throw typeError("unquote-splice expects a list, found " +
+                                    typeName(tc, lt),
+                                spliced);
+            }
+            t = sig->args.front();
+        } else {
+            t = typeOfDatum(*it, quasi, tc);
+        }
+        if (elem) {
+            expectType(tc, t, *elem, *it);
+        } else {
+            elem = t;
+        }
+    }
+    return listType(tc, *elem);
+}
+
+// binds the parameters of a (PARAM_LIST (x T) ... RETURN_TYPE) list to the
+// parameter types of fn in tc.env
+static void bindParams(const TokenNode &params, TypeId fn, TypeChecker &tc) {
+    std::size_t i = 0;
+    for (TokenListIterator it(tail(asTokenList(params))), end(TokenList{});
+         it != end; ++it) {
+        if (isTokenNodeList(*it)) {
+            const Token &sym = std::get<Token>(head(asTokenList(*it)));
+            insertBinding(symbolId(sym, tc), signature(tc, fn)[i++], tc.env);
+        }
+    }
+}
+
+static TypeId typeOfLambda(const TokenList &lst, TypeChecker &tc) {
+    std::vector<TokenNode> elems = elements(lst);
+    TypeId fn = makeFunctSig(elems[1], tc);
+    TypeEnv saved = tc.env;
+    bindParams(elems[1], fn, tc);
+    checkAgainst(elems[2], signature(tc, fn).back(), tc);
+    tc.env = saved;
+    return fn;
+}
+
+static bool isDefineForm(const TokenNode &form) {
+    return isTokenNodeList(form) && std::get<TokenList>(form) &&
+           isTokenOfKind(head(std::get<TokenList>(form)), TokenKind::DEFINE);
+}
+
+static bool isDataForm(const TokenNode &form) {
+    return isTokenNodeList(form) && std::get<TokenList>(form) &&
+           isTokenOfKind(head(std::get<TokenList>(form)), TokenKind::DATA);
+}
+
+// a define whose type is a (PARAM_LIST ...) list binds its parameters
+// directly, (define foo (x:int -> int) body)
+static bool isFunctionDefine(const std::vector<TokenNode> &elems) {
+    const Token &typeTok = std::get<Token>(elems[2]);
+    return typeTok.kind == TokenKind::TYPE_IDENT && typeTok.value &&
+           isAstPtr(*typeTok.value) && isTokenNodeList(astNode(typeTok)) &&
+           isTokenOfKind(head(asTokenList(astNode(typeTok))),
+                         TokenKind::PARAM_LIST);
+}
+
+// the name and declared type of a define, read off its annotation without
+// looking at the body
+static std::pair<SymbolId, TypeId> defineSignature(const TokenList &lst,
+                                                   TypeChecker &tc) {
+    std::vector<TokenNode> elems = elements(lst);
+    SymbolId name = symbolId(std::get<Token>(elems[1]), tc);
+    if (elems.size() == 3) {
+        return {name, makeFunctSig(head(tail(asTokenList(elems[2]))), tc)};
+    }
+    if (isFunctionDefine(elems)) {
+        return {name, makeFunctSig(astNode(std::get<Token>(elems[2])), tc)};
+    }
+    return {name, makeType(elems[2], tc)};
+}
+
+/* (define x:int 3)
+ * (define foo (x:int y:int -> int) body)
+ * (define foo (lambda (x:int y:int -> int) body))
+ * the name is bound before the body is checked so defines can recurse
+ */
+static TypeId typeOfDefine(const TokenList &lst, TypeChecker &tc) {
+    std::vector<TokenNode> elems = elements(lst);
+    auto [name, type] = defineSignature(lst, tc);
+    insertBinding(name, type, tc.env);
+    if (elems.size() == 3) {
+        typeOfLambda(asTokenList(elems[2]), tc);
+    } else if (isFunctionDefine(elems)) {
+        TypeEnv saved = tc.env;
+        bindParams(astNode(std::get<Token>(elems[2])), type, tc);
+        checkAgainst(elems[3], signature(tc, type).back(), tc);
+        tc.env = saved;
+    } else {
+        checkAgainst(elems[3], type, tc);
+    }
+    return type;
+}
+
+/* let binds all names at once, lets binds them one after the other and letr
+ * binds them all before any right hand side is checked.
+ * a named let (let loop ((x:T init) ...) body) also binds loop in body to a
+ * function of the binding types whose result type is inferred from body
+ */
+static TypeId typeOfLet(const TokenList &lst, TypeChecker &tc) {
+    std::vector<TokenNode> elems = elements(lst);
+    TokenKind kind = std::get<Token>(elems[0]).kind;
+    const Token &name = std::get<Token>(elems[1]);
+    struct Binding {
+        SymbolId name;
+        TypeId type;
+        TokenNode rhs;
+    };
+    std::vector<Binding> bindings;
+    for (TokenListIterator it(asTokenList(elems[2])), end(TokenList{});
+         it != end; ++it) {
+        std::vector<TokenNode> parts =
+            elements(asTokenList(astNode(std::get<Token>(*it))));
+        bindings.push_back({symbolId(std::get<Token>(parts[0]), tc),
+                            makeType(parts[1], tc), parts[2]});
+        tc.info.exprTypes[asTokenList(astNode(std::get<Token>(*it))).get()] =
+            bindings.back().type;
+    }
+    TypeEnv saved = tc.env;
+    if (kind == TokenKind::LET) {
+        for (const Binding &b : bindings) {
+            checkAgainst(b.rhs, b.type, tc);
+        }
+    }
+    for (const Binding &b : bindings) {
+        if (kind == TokenKind::LETS) {
+            checkAgainst(b.rhs, b.type, tc);
+        }
+        insertBinding(b.name, b.type, tc.env);
+    }
+    if (kind == TokenKind::LETR) {
+        for (const Binding &b : bindings) {
+            checkAgainst(b.rhs, b.type, tc);
+        }
+    }
+    if (!name.value) {
+        TypeId body = typeOf(elems[3], tc);
+        tc.env = saved;
+        return body;
+    }
+    std::vector<TypeId> sig;
+    for (const Binding &b : bindings) {
+        sig.push_back(b.type);
+    }
+    TypeId result = freshMeta(tc.unifier, tc.types);
+    sig.push_back(result);
+    insertBinding(symbolId(name, tc), tc.types.funct(std::move(sig)), tc.env);
+    expectType(tc, typeOf(elems[3], tc), result, elems[3]);
+    tc.env = saved;
+    result = zonk(tc.unifier, tc.types, result);
+    if (tc.types.node(result).meta) {
+        throw typeError("cannot infer the result type of named let " +
+                            symbolName(name),
+                        TokenNode{lst});
+    }
+    return result;
+}
+
+// (cond (CLAUSE (pred expr)) ...) every predicate is a bool and every branch
+// has the same type
+static TypeId typeOfCond(const TokenList &lst, TypeChecker &tc) {
+    std::optional<TypeId> result;
+    for (TokenListIterator it(tail(lst)), end(TokenList{}); it != end; ++it) {
+        const TokenList &clause = asTokenList(head(tail(asTokenList(*it))));
+        checkAgainst(head(clause), kBoolType, tc);
+        const TokenNode &branch = head(tail(clause));
+        if (result) {
+            checkAgainst(branch, *result, tc);
+        } else {
+            result = typeOf(branch, tc);
+        }
+    }
+    return *result;
+}
+
+/* (data Maybe (A) (Nothing) (Just (A))) declares the type (Maybe A) and its
+ * constructors, each typed over the parameters of the data type like
+ * Just:(forall (A) (A -> (Maybe A))) and Nothing:(forall (A) (Maybe A)).
+ * constructor names are global, declaring one again rebinds the name
+ */
+static TypeId declareData(const TokenList &lst, TypeChecker &tc) {
+    std::vector<TokenNode> elems = elements(lst);
+    if (elems.size() < 4) {
+        throw typeError("data expects a name, type parameters and at least "
+                        "one constructor",
+                        TokenNode{lst});
+    }
+    TypeEnv saved = tc.env;
+    std::vector<TypeId> vars = bindTypeVars(typeParams(elems[2]), tc);
+    DataType type{symbolName(std::get<Token>(elems[1])),
+                  tc.types.constructed(
+                      symbolName(std::get<Token>(elems[1])), vars, {}),
+                  {}};
+    std::vector<Constructor> ctors;
+    for (std::size_t i = 3; i < elems.size(); i++) {
+        const TokenList &decl =
+            asTokenList(astNode(std::get<Token>(elems[i])));
+        std::vector<TypeId> sig;
+        if (tail(decl)) {
+            for (TokenListIterator it(asTokenList(head(tail(decl)))),
+                 end(TokenList{});
+                 it != end; ++it) {
+                sig.push_back(makeType(*it, tc));
+            }
+        }
+        int arity = static_cast<int>(sig.size());
+        sig.push_back(type.type);
+        TypeId body = arity == 0 ? type.type : tc.types.funct(std::move(sig));
+        ctors.push_back(Constructor{symbolId(std::get<Token>(head(decl)), tc),
+                                    tc.data.types.size(),
+                                    static_cast<int>(i - 3), arity,
+                                    tc.types.forall(vars, body)});
+    }
+    tc.env = saved;
+    for (const Constructor &ctor : ctors) {
+        type.constructors.push_back(tc.data.constructors.size());
+        tc.data.byName[ctor.name] = tc.data.constructors.size();
+        tc.data.constructors.push_back(ctor);
+    }
+    tc.data.types.push_back(std::move(type));
+    return tc.data.types.back().type;
+}
+
+// the type of a constructor with its type parameters replaced by fresh
+// unification variables, solved by the fields or the context of a use
+static TypeId instantiateConstructor(const Constructor &ctor,
+                                     TypeChecker &tc) {
+    std::vector<TypeId> metas;
+    for (int i = 0; i < tc.types.node(ctor.type).nats.front(); i++) {
+        metas.push_back(freshMeta(tc.unifier, tc.types));
+    }
+    return tc.types.instantiate(ctor.type, metas);
+}
+
+// (Just 3) is a (Maybe int), constructors are applied to all their fields
+static TypeId typeOfConstruction(const TokenList &lst, const Constructor &ctor,
+                                 TypeChecker &tc) {
+    TypeId type = instantiateConstructor(ctor, tc);
+    std::vector<TokenNode> args = elements(tail(lst));
+    if (args.size() != static_cast<std::size_t>(ctor.arity)) {
+        throw typeError("constructor " + tc.symbols.name(ctor.name) +
+                            " expects " + std::to_string(ctor.arity) +
+                            " fields, found " + std::to_string(args.size()),
+                        TokenNode{lst});
+    }
+    if (ctor.arity == 0) {
+        return type;
+    }
+    std::vector<TypeId> sig = signature(tc, type);
+    for (std::size_t i = 0; i < args.size(); i++) {
+        checkAgainst(args[i], sig[i], tc);
+    }
+    return zonk(tc.unifier, tc.types, sig.back());
+}
+
+static TypeId literalType(const Value &literal) {
+    if (isInt(literal)) {
+        return kIntType;
+    } else if (isDouble(literal)) {
+        return kFloatType;
+    } else if (isRational(literal)) {
+        return kRationalType;
+    } else if (isComplex(literal)) {
+        return kComplexType;
+    } else if (isBool(literal)) {
+        return kBoolType;
+    } else if (isChar(literal)) {
+        return kCharType;
+    }
+    return kStringType;
+}
+
+// checks a pattern against the type of the value it matches and binds its
+// variables in tc.env
+static void checkPattern(const Pattern &p, TypeId type, const TokenNode &at,
+                         TypeChecker &tc) {
+    switch (p.kind) {
+    case PatternKind::WILD:
+        return;
+    case PatternKind::VAR:
+        insertBinding(p.var, type, tc.env);
+        return;
+    case PatternKind::LIT:
+        expectType(tc, literalType(p.literal), type, at);
+        return;
+    case PatternKind::NIL:
+        expectType(tc, listType(tc, freshMeta(tc.unifier, tc.types)), type,
+                   at);
+        return;
+    case PatternKind::CONS: {
+        TypeId elem = freshMeta(tc.unifier, tc.types);
+        expectType(tc, listType(tc, elem), type, at);
+        checkPattern(p.args[0], elem, at, tc);
+        checkPattern(p.args[1], listType(tc, elem), at, tc);
+        return;
+    }
+    case PatternKind::CTOR: {
+        const Constructor &ctor = tc.data.constructors[p.ctor];
+        TypeId inst = instantiateConstructor(ctor, tc);
+        std::vector<TypeId> sig =
+            ctor.arity == 0 ? std::vector<TypeId>{inst} : signature(tc, inst);
+        expectType(tc, sig.back(), type, at);
+        for (std::size_t i = 0; i < p.args.size(); i++) {
+            checkPattern(p.args[i], sig[i], at, tc);
+        }
+        return;
+    }
+    }
+}
+
+// (match e (PATTERN_CLAUSE (pattern body)) ...) every pattern is checked
+// against the type of e and every body, with the pattern variables in
+// scope, has the same type
+static TypeId typeOfMatch(const TokenList &lst, TypeChecker &tc) {
+    std::vector<TokenNode> elems = elements(lst);
+    if (!std::get<TokenList>(elems[2])) {
+        throw typeError("match expects at least one clause", TokenNode{lst});
+    }
+    TypeId scrutinee = typeOf(astNode(std::get<Token>(elems[1])), tc);
+    TypeId result = freshMeta(tc.unifier, tc.types);
+    for (TokenListIterator it(asTokenList(elems[2])), end(TokenList{});
+         it != end; ++it) {
+        const TokenList &clause = asTokenList(astNode(std::get<Token>(*it)));
+        const TokenNode &pattern = astNode(std::get<Token>(head(clause)));
+        Pattern p;
+        try {
+            p = makePattern(pattern, tc.data, tc.symbols);
+        } catch (const std::runtime_error &e) {
+            throw typeError(e.what(), head(clause));
+        }
+        TypeEnv saved = tc.env;
+        checkPattern(p, scrutinee, head(clause), tc);
+        checkAgainst(head(tail(clause)), result, tc);
+        tc.env = saved;
+    }
+    return zonk(tc.unifier, tc.types, result);
+}
+
+// (tlambda (A B) body) has type (forall (A B) T) where T is the type of body
+// with A and B in scope as rigid type variables
+static TypeId typeOfTypeLambda(const TokenList &lst, TypeChecker &tc) {
+    TypeEnv saved = tc.env;
+    std::vector<TypeId> vars = bindTypeVars(typeParams(head(tail(lst))), tc);
+    TypeId body = typeOf(head(tail(tail(lst))), tc);
+    tc.env = saved;
+    return tc.types.forall(vars, body);
+}
+
+// (tapply expr T1 ... Tn) instantiates the forall type of expr
+static TypeId typeOfTypeApplication(const TokenList &lst, TypeChecker &tc) {
+    TypeId poly = resolved(tc, typeOf(head(tail(lst)), tc));
+    if (!isForallType(tc.types, poly)) {
+        throw typeError("tapply expects a polymorphic expression, found " +
+                            typeName(tc, poly),
+                        TokenNode{lst});
+    }
+    std::vector<TypeId> args;
+    for (TokenListIterator it(tail(tail(lst))), end(TokenList{}); it != end;
+         ++it) {
+        args.push_back(makeType(*it, tc));
+    }
+    if (static_cast<int>(args.size()) !=
+        tc.types.node(poly).nats.front()) {
+        throw typeError(typeName(tc, poly) + " expects " +
+                            std::to_string(tc.types.node(poly).nats.front()) +
+                            " type arguments, found " +
+                            std::to_string(args.size()),
+                        TokenNode{lst});
+    }
+    return tc.types.instantiate(poly, args);
+}
+
+/* applications of functions, a _ placeholder in argument position turns the
+ * application into a function of the holes, left to right. each hole is a
+ * fresh unification variable unified with the callee's parameter type
+ *  (foo 2 _ 4 _) with foo:(int->int->int->int->int) is (int->int->int)
+ * a callee whose type is still an unsolved variable, like the car of an
+ * empty quoted list, is solved with a function type of fresh variables
+ */
+static TypeId typeOfApplication(const TokenList &lst, TypeChecker &tc) {
+    TypeId fn = resolved(tc, typeOf(head(lst), tc));
+    std::vector<TokenNode> args = elements(tail(lst));
+    if (isMeta(tc, fn)) {
+        std::vector<TypeId> sig;
+        for (std::size_t i = 0; i <= args.size(); i++) {
+            sig.push_back(freshMeta(tc.unifier, tc.types));
+        }
+        TypeId inferred = tc.types.funct(std::move(sig));
+        unify(tc.unifier, tc.types, fn, inferred);
+        fn = inferred;
+    }
+    if (isForallType(tc.types, fn)) {
+        throw typeError("polymorphic function of type " + typeName(tc, fn) +
+                            " must be instantiated with tapply before it is "
+                            "applied",
+                        TokenNode{lst});
+    }
+    if (!isFunctType(tc.types, fn)) {
+        throw typeError("attempted to apply a non function of type " +
+                            typeName(tc, fn),
+                        TokenNode{lst});
+    }
+    std::vector<TypeId> sig = signature(tc, fn);
+    if (args.size() + 1 != sig.size()) {
+        throw typeError("function of type " + typeName(tc, fn) + " expects " +
+                            std::to_string(sig.size() - 1) +
+                            " arguments, found " + std::to_string(args.size()),
+                        TokenNode{lst});
+    }
+    std::vector<TypeId> holes;
+    for (std::size_t i = 0; i < args.size(); i++) {
+        if (isTokenOfKind(args[i], TokenKind::PLACEHOLDER)) {
+            TypeId hole = freshMeta(tc.unifier, tc.types);
+            unify(tc.unifier, tc.types, hole, sig[i]);
+            holes.push_back(hole);
+        } else {
+            checkAgainst(args[i], sig[i], tc);
+        }
+    }
+    if (holes.empty()) {
+        return sig.back();
+    }
+    holes.push_back(sig.back());
+    return zonk(tc.unifier, tc.types, tc.types.funct(std::move(holes)));
+}
+
+static TypeId synthesize(const TokenNode &expr, TypeChecker &tc) {
+    if (isTokenNodeToken(expr)) {
+        const Token &tok = std::get<Token>(expr);
+        switch (tok.kind) {
+        case TokenKind::NUMBER:
+            if (isInt(*tok.value)) {
+                return kIntType;
+            } else if (isDouble(*tok.value)) {
+                return kFloatType;
+            } else if (isRational(*tok.value)) {
+                return kRationalType;
+            }
+            return kComplexType;
+        case TokenKind::BOOL:
+            return kBoolType;
+        case TokenKind::CHAR:
+            return kCharType;
+        case TokenKind::STRING:
+            return kStringType;
+        case TokenKind::SYMBOL: {
+            const std::string &name = symbolName(tok);
+            if (std::optional<TypeId> type =
+                    lookupType(symbolId(tok, tc), tc.env)) {
+                return *type;
+            }
+            // a constructor used as a value, Nothing or a function of the
+            // fields
+            if (const Constructor *ctor =
+                    findConstructor(tc.data, symbolId(tok, tc))) {
+                return instantiateConstructor(*ctor, tc);
+            }
+            if (isPrim(name)) {
+                throw typeError("builtin " + name +
+                                    " can only be used in operator position",
+                                expr);
+            }
+            throw typeError("unbound symbol " + name, expr);
+        }
+        case TokenKind::PLACEHOLDER:
+            throw typeError("_ is only allowed as an application argument",
+                            expr);
+        default:
+            throw typeError("unexpected token in expression", expr);
+        }
+    }
+    const TokenList &lst = std::get<TokenList>(expr);
+    if (!lst) {
+        throw typeError("empty application", expr);
+    }
+    const TokenNode &first = head(lst);
+    if (isTokenNodeToken(first)) {
+        const Token &tok = std::get<Token>(first);
+        switch (tok.kind) {
+        case TokenKind::LAMBDA:
+            return typeOfLambda(lst, tc);
+        case TokenKind::DEFINE:
+            return typeOfDefine(lst, tc);
+        case TokenKind::LET:
+        case TokenKind::LETS:
+        case TokenKind::LETR:
+            return typeOfLet(lst, tc);
+        case TokenKind::COND:
+            return typeOfCond(lst, tc);
+        case TokenKind::TLAMBDA:
+            return typeOfTypeLambda(lst, tc);
+        case TokenKind::TAPPLY:
+            return typeOfTypeApplication(lst, tc);
+        case TokenKind::QUOTE:
+        case TokenKind::QQUOTE:
+            return typeOfDatum(head(tail(lst)), tok.kind == TokenKind::QQUOTE,
+                               tc);
+        case TokenKind::EQ:
+        case TokenKind::EQUALS: {
+            if (size(lst) != 3) {
+                throw typeError("equality expects two arguments", expr);
+            }
+            TypeId a = typeOf(head(tail(lst)), tc);
+            checkAgainst(head(tail(tail(lst))), a, tc);
+            std::unordered_set<std::string> seen;
+            if (tok.kind == TokenKind::EQUALS && holdsFunction(tc, a, seen)) {
+                throw typeError("equal? is not defined on functions, found " +
+                                    typeName(tc, a),
+                                expr);
+            }
+            return kBoolType;
+        }
+        case TokenKind::FORCE:
+            if (size(lst) != 2) {
+                throw typeError("force expects one argument", expr);
+            }
+            return typeOf(head(tail(lst)), tc);
+        case TokenKind::DO: {
+            if (!tail(lst)) {
+                throw typeError("do expects at least one expression", expr);
+            }
+            TypeId last = kBoolType;
+            for (TokenListIterator it(tail(lst)), end(TokenList{}); it != end;
+                 ++it) {
+                last = typeOf(*it, tc);
+            }
+            return last;
+        }
+        case TokenKind::TYPE_IDENT: {
+            // (vec e1 ... en) builds a (vec T n)
+            if (!tok.value || !isString(*tok.value) ||
+                std::get<std::string>(tok.value->v) != "vec" || !tail(lst)) {
+                throw typeError("types cannot be applied as functions", expr);
+            }
+            TypeId elem = typeOf(head(tail(lst)), tc);
+            for (TokenListIterator it(tail(tail(lst))), end(TokenList{});
+                 it != end; ++it) {
+                checkAgainst(*it, elem, tc);
+            }
+            return vecType(tc, elem, static_cast<int>(size(tail(lst))));
+        }
+        case TokenKind::MATCH:
+            return typeOfMatch(lst, tc);
+        case TokenKind::DATA:
+            return declareData(lst, tc);
+        case TokenKind::SYMBOL: {
+            const std::string &name = symbolName(tok);
+            SymbolId id = symbolId(tok, tc);
+            if (!lookupType(id, tc.env)) {
+                if (isPrim(name)) {
+                    return typeOfPrim(name, lst, tc);
+                }
+                if (const Constructor *ctor = findConstructor(tc.data, id)) {
+                    return typeOfConstruction(lst, *ctor, tc);
+                }
+            }
+            return typeOfApplication(lst, tc);
+        }
+        default:
+            break;
+        }
+    }
+    return typeOfApplication(lst, tc);
+}
+
+TypeId typeOf(const TokenNode &expr, TypeChecker &tc) {
+    TypeId type = synthesize(expr, tc);
+    if (isTokenNodeList(expr)) {
+        tc.info.exprTypes[std::get<TokenList>(expr).get()] = type;
+    }
+    return type;
+}
+
+// checks expr against a known type by unifying, which is how the element
+// type of an empty quoted list is taken from its context
+TypeId checkAgainst(const TokenNode &expr, TypeId expected, TypeChecker &tc) {
+    TypeId found = typeOf(expr, tc);
+    expectType(tc, found, expected, expr);
+    return zonk(tc.unifier, tc.types, found);
+}
+
+// every SYMBOL token in a form, including those inside AstPtr wrapped nodes
+// such as let bindings, shadowing is ignored so the result over approximates
+// the free symbols
+static void collectSymbols(const TokenNode &node, TypeChecker &tc,
+                           std::vector<SymbolId> &out) {
+    if (isTokenNodeList(node)) {
+        for (TokenListIterator it(std::get<TokenList>(node)), end(TokenList{});
+             it != end; ++it) {
+            collectSymbols(*it, tc, out);
+        }
+        return;
+    }
+    const Token &tok = std::get<Token>(node);
+    if (!tok.value) {
+        return;
+    }
+    if (tok.kind == TokenKind::SYMBOL && isString(*tok.value)) {
+        out.push_back(symbolId(tok, tc));
+    } else if (isAstPtr(*tok.value)) {
+        collectSymbols(astNode(tok), tc, out);
+    }
+}
+
+DependencyGraph dependencyGraph(const std::vector<TokenNode> &program,
+                                TypeChecker &tc) {
+    DependencyGraph graph;
+    graph.defines.resize(program.size());
+    graph.deps.resize(program.size());
+    // the define currently visible under each top level name
+    std::unordered_map<SymbolId, std::size_t> visible;
+    for (std::size_t i = 0; i < program.size(); i++) {
+        if (isDefineForm(program[i])) {
+            const TokenList &lst = std::get<TokenList>(program[i]);
+            SymbolId name = symbolId(std::get<Token>(head(tail(lst))), tc);
+            graph.defines[i] = name;
+            visible[name] = i;
+        } else if (isDataForm(program[i])) {
+            // a data form stands under its type name for the forms that use
+            // its constructors
+            std::vector<TokenNode> elems =
+                elements(std::get<TokenList>(program[i]));
+            graph.defines[i] = symbolId(std::get<Token>(elems[1]), tc);
+            for (std::size_t c = 3; c < elems.size(); c++) {
+                const TokenList &decl =
+                    asTokenList(astNode(std::get<Token>(elems[c])));
+                visible[symbolId(std::get<Token>(head(decl)), tc)] = i;
+            }
+        }
+        std::vector<SymbolId> symbols;
+        collectSymbols(program[i], tc, symbols);
+        std::unordered_set<std::size_t> seen;
+        for (SymbolId symbol : symbols) {
+            auto it = visible.find(symbol);
+            if (it != visible.end() && it->second != i &&
+                seen.insert(it->second).second) {
+                graph.deps[i].push_back(it->second);
+            }
+        }
+        std::sort(graph.deps[i].begin(), graph.deps[i].end());
+    }
+    return graph;
+}
+
+// the diagnostics of a program in source order, one per line
+static std::string mergeDiagnostics(
+    const std::vector<std::optional<std::string>> &diagnostics) {
+    std::string merged;
+    for (const std::optional<std::string> &msg : diagnostics) {
+        if (msg) {
+            merged += (merged.empty() ? "" : "\n") + *msg;
+        }
+    }
+    return merged;
+}
+
+/*
+ * checks a whole program in two phases. the first declares every data form
+ * and binds the signature of every top level define in source order,
+ * recording the environment each form sees, which with persistent maps is
+ * one pointer copy per form. every define in sprout is annotated, so after
+ * this pass each form has all the signatures its dependency graph points at
+ * and the bodies can be checked independently on a work stealing pool. each
+ * worker checks with its own copy of the checker, types it interns beyond
+ * the shared prefix never escape the worker, and diagnostics are kept per
+ * form and merged in source order so the reported errors do not depend on
+ * scheduling. when tc.cache is set, forms whose CST and dependency
+ * signatures match a cached entry are not checked again, see typecache.h
+ */
+using VecAccesses = std::unordered_map<const TokenListNode *, VecAccess>;
+using ExprTypes = std::unordered_map<const TokenListNode *, TypeId>;
+
+// the cache key of form i, its own CST hash combined with the name and
+// printed signature of every define it depends on
+static std::uint64_t cacheKey(const std::vector<TokenNode> &program,
+                              std::size_t i,
+                              const std::vector<std::uint64_t> &sigHashes,
+                              const TypeChecker &tc) {
+    const DependencyGraph &graph = tc.info.dependencies;
+    std::uint64_t key = hashNode(program[i]);
+    for (std::size_t dep : graph.deps[i]) {
+        const std::string &name = tc.symbols.name(*graph.defines[dep]);
+        key = hashCombine(key, hashString(name));
+        key = hashCombine(key, sigHashes[dep]);
+    }
+    return key;
+}
+
+static CachedForm cacheFacts(const TokenNode &form, const VecAccesses &facts) {
+    CachedForm cached;
+    if (facts.empty()) {
+        return cached;
+    }
+    std::vector<const TokenListNode *> cells;
+    listCells(form, cells);
+    for (std::size_t cell = 0; cell < cells.size(); cell++) {
+        auto it = facts.find(cells[cell]);
+        if (it != facts.end()) {
+            cached.vecAccesses.emplace_back(cell, it->second);
+        }
+    }
+    return cached;
+}
+
+static void restoreFacts(const TokenNode &form, const CachedForm &cached,
+                         VecAccesses &facts) {
+    if (cached.vecAccesses.empty()) {
+        return;
+    }
+    std::vector<const TokenListNode *> cells;
+    listCells(form, cells);
+    for (const auto &[cell, access] : cached.vecAccesses) {
+        if (cell < cells.size()) {
+            facts[cells[cell]] = access;
+        }
+    }
+}
+
+void typecheck(const std::vector<TokenNode> &program, TypeChecker &tc) {
+    tc.info.dependencies = dependencyGraph(program, tc);
+    std::vector<std::optional<std::string>> diagnostics(program.size());
+    std::vector<TypeEnv> scopes;
+    scopes.reserve(program.size());
+    std::vector<std::uint64_t> sigHashes(program.size());
+    bool failed = false;
+    for (std::size_t i = 0; i < program.size(); i++) {
+        scopes.push_back(tc.env);
+        if (isDataForm(program[i])) {
+            try {
+                declareData(std::get<TokenList>(program[i]), tc);
+                sigHashes[i] = hashNode(program[i]);
+            } catch (const std::exception &e) {
+                diagnostics[i] = e.what();
+                failed = true;
+            }
+            continue;
+        }
+        if (!isDefineForm(program[i])) {
+            continue;
+        }
+        try {
+            auto [name, type] =
+                defineSignature(std::get<TokenList>(program[i]), tc);
+            insertBinding(name, type, tc.env);
+            if (tc.cache) {
+                sigHashes[i] = hashString(toString(tc.types, type));
+            }
+        } catch (const std::exception &e) {
+            diagnostics[i] = e.what();
+            failed = true;
+        }
+    }
+    if (failed) {
+        throw std::runtime_error(mergeDiagnostics(diagnostics));
+    }
+    std::vector<VecAccesses> facts(program.size());
+    std::vector<std::uint64_t> keys(program.size());
+    std::vector<std::size_t> pending;
+    for (std::size_t i = 0; i < program.size(); i++) {
+        // data forms are fully declared by the first phase
+        if (isDataForm(program[i])) {
+            continue;
+        }
+        if (tc.cache) {
+            keys[i] = cacheKey(program, i, sigHashes, tc);
+            auto hit = tc.cache->forms.find(keys[i]);
+            if (hit != tc.cache->forms.end()) {
+                restoreFacts(program[i], hit->second, facts[i]);
+                tc.cache->hits++;
+                continue;
+            }
+            tc.cache->misses++;
+        }
+        pending.push_back(i);
+    }
+    TypeEnv global = tc.env;
+    TypeId shared = static_cast<TypeId>(tc.types.size());
+    std::vector<ExprTypes> exprTypes(program.size());
+    std::vector<unsigned> checkedBy(program.size(), 0);
+    WorkPool pool(tc.threads);
+    std::vector<TypeChecker> locals;
+    if (pool.threads > 1 && pending.size() > 1) {
+        locals.assign(pool.threads, tc);
+        for (TypeChecker &local : locals) {
+            local.info = TypeInfo();
+        }
+    }
+    pool.run(pending.size(), [&](unsigned worker, std::size_t task) {
+        std::size_t i = pending[task];
+        TypeChecker &checker = locals.empty() ? tc : locals[worker];
+        checker.env = scopes[i];
+        // collect the facts of this form on their own so they can be cached
+        // and its types imported in source order
+        VecAccesses outerFacts = std::move(checker.info.vecAccesses);
+        ExprTypes outerTypes = std::move(checker.info.exprTypes);
+        checker.info.vecAccesses.clear();
+        checker.info.exprTypes.clear();
+        try {
+            typeOf(program[i], checker);
+        } catch (const std::exception &e) {
+            diagnostics[i] = e.what();
+        }
+        facts[i] = std::move(checker.info.vecAccesses);
+        exprTypes[i] = std::move(checker.info.exprTypes);
+        checker.info.vecAccesses = std::move(outerFacts);
+        checker.info.exprTypes = std::move(outerTypes);
+        checkedBy[i] = worker;
+    });
+    tc.env = global;
+    tc.info.scopes = std::move(scopes);
+    // types a worker interned past the shared prefix only exist in its copy
+    // of the table. its unsolved metas and rigid variables are numbered in
+    // its own unifier and stamps, so each becomes a fresh one of tc
+    std::vector<std::unordered_map<TypeId, TypeId>> imported(locals.size());
+    auto fresh = [&](const TypeNode &node) {
+        return node.kind == TypeKind::META ? freshMeta(tc.unifier, tc.types)
+                                           : tc.types.freshVar(node.name);
+    };
+    for (std::size_t i : pending) {
+        if (locals.empty()) {
+            tc.info.exprTypes.merge(exprTypes[i]);
+            continue;
+        }
+        TypeChecker &local = locals[checkedBy[i]];
+        for (const auto &[cell, type] : exprTypes[i]) {
+            TypeId zonked = zonk(local.unifier, local.types, type);
+            tc.info.exprTypes[cell] =
+                importType(tc.types, local.types, zonked, shared,
+                           imported[checkedBy[i]], fresh);
+        }
+    }
+    for (std::size_t i : pending) {
+        if (tc.cache && !diagnostics[i]) {
+            tc.cache->forms[keys[i]] = cacheFacts(program[i], facts[i]);
+        }
+    }
+    for (VecAccesses &form : facts) {
+        tc.info.vecAccesses.merge(form);
     }
-    Value v;
-    while (start != TokenList{}) {
+    std::string merged = mergeDiagnostics(diagnostics);
+    if (!merged.empty()) {
+        throw std::runtime_error(merged);
     }
 }
@@ -3,13 +3,17 @@
 
 #include "ast_fwd.h"
 #include "cell.h"
-#include "rational.h"
+#include "match.h"
+#include "pmap.h"
+#include "symtab.h"
 #include "token.h"
+#include "typetable.h"
+#include "unify.h"
 #include "value.h"
-#include <complex.h>
 #include <iostream>
 #include <memory>
-#include <stack>
+#include <optional>
+#include <string>
 #include <unordered_map>
 #include <vector>
 /*
@@ -54,75 +58,107 @@ struct TypeErr {
 };
 
 /*
-number: int, rational, float, complex
-text: char, string
-bool: bool
-fun (t->t)
-  */
-struct TypeConstSig;
-struct FunctSig;
-struct TypeVar;
-
-struct Type {
-    using T =
-        std::variant<double, int, Rational, Complex, bool, char, std::string,
-                     std::shared_ptr<FunctSig>, std::shared_ptr<TypeConstSig>,
-                     std::shared_ptr<TypeVar>>;
-    T t;
-    Type();
-    Type(int i);
-    Type(Rational r);
-    Type(Complex c);
-    Type(bool b);
-    Type(char c);
-    Type(std::string str);
-    Type(std::shared_ptr<FunctSig> f);
-    Type(std::shared_ptr<TypeConstSig> c);
-    Type(std::shared_ptr<TypeVar> v);
-};
+ * types are interned in a TypeTable and referred to by TypeId, see
+ * typetable.h. the CST type syntax is converted with makeType:
+ *  number: int, rational, float, complex
+ *  text: char, string, symbol
+ *  bool: bool
+ *  fun (t->t), constructed (vec t n) (list t), polymorphic (forall (A) t)
+ */
+struct TypeChecker;
 
-Type makeFunctSig(const TokenNode &root);
+TypeId makeType(const TokenNode &root, TypeChecker &tc);
 
-Type makeTypeConstSig(const TokenNode &root);
+TypeId makeFunctSig(const TokenNode &root, TypeChecker &tc);
 
-struct TypeVar {
-    std::string name;
-    TypeVar();
-    TypeVar(std::string str);
-};
+TypeId makeTypeConstSig(const TokenNode &root, TypeChecker &tc);
 
-struct FunctSig {
-    std::vector<Cell<Value, Value>> params;
-    std::vector<Type> signature;
-    FunctSig();
-    FunctSig(std::vector<Cell<Value, Value>> params_,
-             std::vector<Type> signature_);
+// static length N of a (vec T N), nullopt for every other type
+std::optional<int> staticLength(const TypeTable &table, TypeId type);
+
+/*
+ * the typing environment is a pair of persistent maps from interned symbols to
+ * types, one for values and one for type variables introduced by a tlambda or
+ * forall. binding returns a new version and leaves older versions intact, so
+ * a scope is entered by remembering the current TypeEnv and left by restoring
+ * it, both O(1), and lookup does not depend on how many scopes are open
+ */
+struct TypeEnv {
+    PMap<TypeId> values;
+    PMap<TypeId> typeVars;
 };
 
-struct TypeConstSig {
-    std::string name;
-    std::vector<Type> typeArgs;
-    std::vector<int> natArgs;
+void insertBinding(SymbolId symbol, TypeId type, TypeEnv &env);
+void insertTypeVar(SymbolId name, TypeId type, TypeEnv &env);
+std::optional<TypeId> lookupType(SymbolId symbol, const TypeEnv &env);
+std::optional<TypeId> lookupTypeVar(SymbolId name, const TypeEnv &env);
 
-    TypeConstSig();
-    TypeConstSig(std::string name_, std::vector<Type> typeArgs_,
-                 std::vector<int> natArgs_);
+/*
+ * static facts about a vector access site recorded while typechecking, keyed
+ * by the cons cell of the application in the CST. the lowering pass reads
+ * them to emit indexing without a runtime bounds check when the index is a
+ * constant below the (vec T N) length, and to unroll vec-map/vec-fold over
+ * 0..N when N is at most kUnrollLimit
+ */
+constexpr int kUnrollLimit = 4;
+
+struct VecAccess {
+    int length;   // N from (vec T N)
+    int index;    // constant index for vec-ref, -1 if unknown or a loop site
+    bool checked; // does the access still need a runtime bounds check
+    bool unroll;  // loop site over 0..N small enough to fully unroll
 };
 
-struct TypeFrame {
-    std::unordered_map<std::string, Type> bindings;
-    TypeFrame();
-    TypeFrame(std::unordered_map<std::string, Type> bindings_);
+/*
+ * dependency graph of the top level forms of a program. defines[i] is the
+ * name form i defines, if it is a define, or the type it declares, if it is
+ * a data form, and deps[i] lists in increasing order the earlier forms whose
+ * names or constructors form i mentions
+ */
+struct DependencyGraph {
+    std::vector<std::optional<SymbolId>> defines;
+    std::vector<std::vector<std::size_t>> deps;
 };
 
-void insertBinding(std::string symbol, Type type, TypeFrame frame);
+/*
+ * facts recorded while checking for the passes after the typechecker.
+ * exprTypes holds the type of every compound expression and of every let
+ * binding, keyed by the first cons cell of its list like vecAccesses, and
+ * may still mention unification variables, so it is read through zonk.
+ * scopes holds the environment each top level form of the last typecheck
+ * call was checked in
+ */
+struct TypeInfo {
+    std::unordered_map<const TokenListNode *, VecAccess> vecAccesses;
+    std::unordered_map<const TokenListNode *, TypeId> exprTypes;
+    DependencyGraph dependencies;
+    std::vector<TypeEnv> scopes;
+};
 
-struct TypeEnv {
-    std::stack<TypeFrame> frames;
-    TypeEnv();
-    TypeEnv(std::stack<TypeFrame> frames_);
+/*
+ * the typechecker state, the interned types, the scoped environment and the
+ * facts recorded for later passes, threaded through every check like the
+ * Lexer is through the parser
+ */
+struct TypecheckCache;
+
+struct TypeChecker {
+    TypeTable types;
+    SymbolTable symbols;
+    TypeEnv env;
+    Unifier unifier;
+    DataTable data; // types and constructors declared by data forms
+    TypeInfo info;
+    unsigned threads = 0; // workers for typecheck, 0 uses every core
+    TypecheckCache *cache = nullptr; // optional, see typecache.h
 };
 
-void insertFrame(TypeFrame &frame, TypeEnv &env);
+TypeId typeOf(const TokenNode &expr, TypeChecker &tc);
+TypeId checkAgainst(const TokenNode &expr, TypeId expected, TypeChecker &tc);
+DependencyGraph dependencyGraph(const std::vector<TokenNode> &program,
+                                TypeChecker &tc);
+// checks every form of a program, top level define bodies are checked in
+// parallel and all errors are thrown together in source order
+void typecheck(const std::vector<TokenNode> &program, TypeChecker &tc);
 
 #endif // !TYPE_CHECKER_H
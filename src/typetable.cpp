@@ -0,0 +1,384 @@
+#include "typetable.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+bool operator==(const TypeNode &a, const TypeNode &b) {
+    return a.kind == b.kind && a.name == b.name && a.args == b.args &&
+           a.nats == b.nats;
+}
+
+std::size_t TypeNodeHash::operator()(const TypeNode &node) const {
+    std::size_t h = std::hash<std::string>{}(node.name) ^
+                    static_cast<std::size_t>(node.kind);
+    auto mix = [&h](std::size_t v) {
+        h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    };
+    for (TypeId arg : node.args) {
+        mix(arg);
+    }
+    for (int n : node.nats) {
+        mix(static_cast<std::size_t>(n) * 31 + 7);
+    }
+    return h;
+}
+
+std::size_t TypeIdsHash::operator()(const std::vector<TypeId> &ids) const {
+    std::size_t h = ids.size();
+    for (TypeId id : ids) {
+        h ^= id + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+    return h;
+}
+
+bool operator==(const SubstKey &a, const SubstKey &b) {
+    return a.type == b.type && a.subst == b.subst && a.depth == b.depth;
+}
+
+std::size_t SubstKeyHash::operator()(const SubstKey &key) const {
+    std::size_t h = (static_cast<std::size_t>(key.type) << 32) ^ key.subst;
+    return h ^ (static_cast<std::size_t>(key.depth) + 0x9e3779b97f4a7c15ULL +
+                (h << 6) + (h >> 2));
+}
+
+TypeTable::TypeTable() {
+    for (const char *name : {"int", "rational", "float", "complex", "bool",
+                             "char", "string", "symbol"}) {
+        prim(name);
+    }
+}
+
+// returns the id of an equal node if one was interned already, otherwise
+// appends the node
+TypeId TypeTable::intern(TypeNode node) {
+    node.meta = node.kind == TypeKind::META;
+    for (TypeId arg : node.args) {
+        node.meta = node.meta || nodes[arg].meta;
+    }
+    switch (node.kind) {
+    case TypeKind::PRIM:
+    case TypeKind::VAR:
+    case TypeKind::META:
+        node.free = 0;
+        break;
+    case TypeKind::BOUND:
+        node.free = node.nats.front() + 1;
+        break;
+    case TypeKind::FUNCT:
+    case TypeKind::CONST:
+        node.free = 0;
+        for (TypeId arg : node.args) {
+            node.free = std::max(node.free, nodes[arg].free);
+        }
+        break;
+    case TypeKind::FORALL:
+        node.free = std::max(0, nodes[node.args.front()].free -
+                                    node.nats.front());
+        break;
+    }
+    auto it = index.find(node);
+    if (it != index.end()) {
+        return it->second;
+    }
+    TypeId id = static_cast<TypeId>(nodes.size());
+    index.emplace(node, id);
+    nodes.push_back(std::move(node));
+    return id;
+}
+
+const TypeNode &TypeTable::node(TypeId id) const { return nodes[id]; }
+
+std::size_t TypeTable::size() const { return nodes.size(); }
+
+TypeId TypeTable::prim(const std::string &name) {
+    return intern(TypeNode{TypeKind::PRIM, name, {}, {}});
+}
+
+TypeId TypeTable::funct(std::vector<TypeId> signature) {
+    return intern(TypeNode{TypeKind::FUNCT, "", std::move(signature), {}});
+}
+
+TypeId TypeTable::constructed(const std::string &name,
+                              std::vector<TypeId> typeArgs,
+                              std::vector<int> natArgs) {
+    return intern(TypeNode{TypeKind::CONST, name, std::move(typeArgs),
+                           std::move(natArgs)});
+}
+
+TypeId TypeTable::freshVar(const std::string &name) {
+    return intern(TypeNode{TypeKind::VAR, name, {}, {stamps++}});
+}
+
+TypeId TypeTable::bound(int index) {
+    return intern(TypeNode{TypeKind::BOUND, "", {}, {index}});
+}
+
+TypeId TypeTable::meta(int index) {
+    return intern(TypeNode{TypeKind::META, "", {}, {index}});
+}
+
+// a rebuilt forall keeps the binder names of the original for printing
+TypeId TypeTable::withArgs(TypeId id, std::vector<TypeId> args) {
+    if (args == nodes[id].args) {
+        return id;
+    }
+    TypeNode copy = nodes[id];
+    copy.args = std::move(args);
+    TypeId result = intern(std::move(copy));
+    if (nodes[id].kind == TypeKind::FORALL && !binderNames.contains(result) &&
+        binderNames.contains(id)) {
+        binderNames[result] = binderNames[id];
+    }
+    return result;
+}
+
+// rebuilds a FUNCT, CONST or FORALL node with its children mapped through fn,
+// fn gets the child and the number of binders the child sits under
+template <typename Fn>
+static TypeId rebuild(TypeTable &table, TypeId id, int depth, Fn &&fn) {
+    const TypeNode &n = table.node(id);
+    int inner = n.kind == TypeKind::FORALL ? n.nats.front() : 0;
+    std::vector<TypeId> args = n.args;
+    for (TypeId &arg : args) {
+        arg = fn(arg, depth + inner);
+    }
+    return table.withArgs(id, std::move(args));
+}
+
+static std::uint64_t memoKey(TypeId id, int depth) {
+    return (static_cast<std::uint64_t>(id) << 32) |
+           static_cast<std::uint32_t>(depth);
+}
+
+TypeId TypeTable::forall(const std::vector<TypeId> &vars, TypeId body) {
+    if (vars.empty()) {
+        return body;
+    }
+    std::unordered_map<TypeId, int> position;
+    for (std::size_t i = 0; i < vars.size(); i++) {
+        position[vars[i]] = static_cast<int>(i);
+    }
+    std::unordered_map<std::uint64_t, TypeId> memo;
+    std::function<TypeId(TypeId, int)> abstract = [&](TypeId id, int depth) {
+        auto cached = memo.find(memoKey(id, depth));
+        if (cached != memo.end()) {
+            return cached->second;
+        }
+        TypeId result = id;
+        switch (node(id).kind) {
+        case TypeKind::VAR: {
+            auto it = position.find(id);
+            if (it != position.end()) {
+                result = bound(it->second + depth);
+            }
+            break;
+        }
+        case TypeKind::FUNCT:
+        case TypeKind::CONST:
+        case TypeKind::FORALL:
+            result = rebuild(*this, id, depth, abstract);
+            break;
+        default:
+            break;
+        }
+        memo[memoKey(id, depth)] = result;
+        return result;
+    };
+    TypeId abstracted = abstract(body, 0);
+    TypeId id = intern(TypeNode{TypeKind::FORALL,
+                                "",
+                                {abstracted},
+                                {static_cast<int>(vars.size())}});
+    if (!binderNames.contains(id)) {
+        std::vector<std::string> names;
+        for (TypeId var : vars) {
+            names.push_back(node(var).name);
+        }
+        binderNames[id] = names;
+    }
+    return id;
+}
+
+TypeId TypeTable::shift(TypeId id, int amount, int depth) {
+    if (amount == 0 || node(id).free <= depth) {
+        return id;
+    }
+    if (node(id).kind == TypeKind::BOUND) {
+        return bound(node(id).nats.front() + amount);
+    }
+    return rebuild(*this, id, depth, [&](TypeId child, int d) {
+        return shift(child, amount, d);
+    });
+}
+
+SubstId TypeTable::substitution(const std::vector<TypeId> &args) {
+    auto it = substIds.find(args);
+    if (it != substIds.end()) {
+        return it->second;
+    }
+    SubstId id = static_cast<SubstId>(substs.size());
+    substIds.emplace(args, id);
+    substs.push_back(args);
+    return id;
+}
+
+// only subterms with free BOUND indices are visited, closed subterms such as
+// the concrete argument types are shared as they are. results are kept in
+// substMemo across calls, so a repeated (tapply id int) is one lookup and a
+// new forall type only rebuilds the subterms no earlier instantiation under
+// the same arguments has seen
+TypeId TypeTable::instantiate(TypeId forallType,
+                              const std::vector<TypeId> &args) {
+    const TypeNode &fa = node(forallType);
+    if (fa.kind != TypeKind::FORALL) {
+        throw std::runtime_error("attempted to instantiate non forall type " +
+                                 toString(*this, forallType));
+    }
+    int n = fa.nats.front();
+    if (static_cast<int>(args.size()) != n) {
+        throw std::runtime_error(
+            "forall type " + toString(*this, forallType) + " expects " +
+            std::to_string(n) + " type arguments, found " +
+            std::to_string(args.size()));
+    }
+    SubstId sigma = substitution(args);
+    auto whole = substMemo.find(SubstKey{forallType, sigma, -1});
+    if (whole != substMemo.end()) {
+        return whole->second;
+    }
+    std::function<TypeId(TypeId, int)> subst = [&](TypeId id, int depth) {
+        if (node(id).free <= depth) {
+            return id;
+        }
+        auto cached = substMemo.find(SubstKey{id, sigma, depth});
+        if (cached != substMemo.end()) {
+            return cached->second;
+        }
+        TypeId result;
+        if (node(id).kind == TypeKind::BOUND) {
+            int k = node(id).nats.front() - depth;
+            result = k < n ? shift(args[k], depth) : bound(k - n + depth);
+        } else {
+            result = rebuild(*this, id, depth, subst);
+        }
+        substMemo[SubstKey{id, sigma, depth}] = result;
+        return result;
+    };
+    TypeId result = subst(fa.args.front(), 0);
+    substMemo[SubstKey{forallType, sigma, -1}] = result;
+    return result;
+}
+
+bool isFunctType(const TypeTable &table, TypeId id) {
+    return table.node(id).kind == TypeKind::FUNCT;
+}
+
+bool isForallType(const TypeTable &table, TypeId id) {
+    return table.node(id).kind == TypeKind::FORALL;
+}
+
+const TypeNode *asConstructed(const TypeTable &table, TypeId id,
+                              const std::string &name) {
+    const TypeNode &n = table.node(id);
+    if (n.kind == TypeKind::CONST && n.name == name) {
+        return &n;
+    }
+    return nullptr;
+}
+
+// scope holds the names of the enclosing binders, innermost first, so BOUND k
+// prints as scope[k]
+static void printType(const TypeTable &table, TypeId id,
+                      std::vector<std::string> &scope, std::string &out) {
+    const TypeNode &n = table.node(id);
+    switch (n.kind) {
+    case TypeKind::PRIM:
+    case TypeKind::VAR:
+        out += n.name;
+        return;
+    case TypeKind::META:
+        out += "?" + std::to_string(n.nats.front());
+        return;
+    case TypeKind::BOUND: {
+        std::size_t k = static_cast<std::size_t>(n.nats.front());
+        out += k < scope.size() ? scope[k] : "#" + std::to_string(k);
+        return;
+    }
+    case TypeKind::FUNCT:
+        out += '(';
+        for (std::size_t i = 0; i < n.args.size(); i++) {
+            if (i > 0 || n.args.size() == 1) {
+                out += i > 0 ? " -> " : "-> ";
+            }
+            printType(table, n.args[i], scope, out);
+        }
+        out += ')';
+        return;
+    case TypeKind::CONST:
+        out += '(' + n.name;
+        for (TypeId arg : n.args) {
+            out += ' ';
+            printType(table, arg, scope, out);
+        }
+        for (int nat : n.nats) {
+            out += ' ' + std::to_string(nat);
+        }
+        out += ')';
+        return;
+    case TypeKind::FORALL: {
+        std::vector<std::string> names;
+        auto it = table.binderNames.find(id);
+        for (int i = 0; i < n.nats.front(); i++) {
+            names.push_back(it != table.binderNames.end()
+                                ? it->second[i]
+                                : "T" + std::to_string(scope.size() + i));
+        }
+        out += "(forall (";
+        for (std::size_t i = 0; i < names.size(); i++) {
+            out += (i > 0 ? " " : "") + names[i];
+        }
+        out += ") ";
+        std::vector<std::string> inner = names;
+        inner.insert(inner.end(), scope.begin(), scope.end());
+        printType(table, n.args.front(), inner, out);
+        out += ')';
+        return;
+    }
+    }
+}
+
+std::string toString(const TypeTable &table, TypeId id) {
+    std::vector<std::string> scope;
+    std::string out;
+    printType(table, id, scope, out);
+    return out;
+}
+
+TypeId importType(TypeTable &to, const TypeTable &from, TypeId id,
+                  TypeId shared, std::unordered_map<TypeId, TypeId> &memo,
+                  const std::function<TypeId(const TypeNode &)> &fresh) {
+    if (id < shared) {
+        return id;
+    }
+    auto cached = memo.find(id);
+    if (cached != memo.end()) {
+        return cached->second;
+    }
+    TypeNode copy = from.node(id);
+    if (copy.kind == TypeKind::VAR || copy.kind == TypeKind::META) {
+        return memo[id] = fresh(copy);
+    }
+    for (TypeId &arg : copy.args) {
+        arg = importType(to, from, arg, shared, memo, fresh);
+    }
+    TypeId result = to.intern(std::move(copy));
+    auto names = from.binderNames.find(id);
+    if (names != from.binderNames.end() && !to.binderNames.contains(result)) {
+        to.binderNames[result] = names->second;
+    }
+    memo[id] = result;
+    return result;
+}
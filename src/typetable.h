@@ -0,0 +1,143 @@
+#ifndef SPROUT_LANG_TYPETABLE_H
+#define SPROUT_LANG_TYPETABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * hash consed table of every type the typechecker builds. a type is interned
+ * once and from then on referred to by its TypeId, so two types are equal iff
+ * their ids are equal and compound types share their children.
+ *
+ * type variables bound by a forall are stored as de Bruijn indices (BOUND),
+ * so alpha equivalent types like (forall (A) (A -> A)) and
+ * (forall (B) (B -> B)) intern to the same id. type variables introduced by a
+ * tlambda or while checking under a forall are rigid VAR nodes made unique by
+ * a stamp, which forallType abstracts back into BOUND indices
+ */
+using TypeId = std::uint32_t;
+
+enum class TypeKind : std::uint8_t {
+    PRIM,
+    FUNCT,
+    CONST,
+    VAR,
+    BOUND,
+    FORALL,
+    META
+};
+
+struct TypeNode {
+    TypeKind kind = TypeKind::PRIM;
+    std::string name;          // primitive, constructor or variable name
+    std::vector<TypeId> args;  // FUNCT params then return, CONST type
+                               // arguments, FORALL body
+    std::vector<int> nats;     // CONST type level naturals, VAR stamp,
+                               // BOUND index, FORALL binder count, META
+                               // unification variable
+    int free = 0; // 1 + the largest free BOUND index, 0 if closed, derived
+                  // from the other fields and not part of the identity
+    bool meta = false; // contains a META node, derived like free
+};
+
+bool operator==(const TypeNode &a, const TypeNode &b);
+
+struct TypeNodeHash {
+    std::size_t operator()(const TypeNode &node) const;
+};
+
+/*
+ * instantiation is done with explicit substitutions: the argument list of a
+ * tapply is interned once as a SubstId and a subterm is substituted under it
+ * at most once per binder depth, no matter how many forall types share that
+ * subterm or how often the same tapply appears
+ */
+using SubstId = std::uint32_t;
+
+struct TypeIdsHash {
+    std::size_t operator()(const std::vector<TypeId> &ids) const;
+};
+
+struct SubstKey {
+    TypeId type;
+    SubstId subst;
+    int depth;
+};
+
+bool operator==(const SubstKey &a, const SubstKey &b);
+
+struct SubstKeyHash {
+    std::size_t operator()(const SubstKey &key) const;
+};
+
+// the primitive types are interned first, in this order, by the TypeTable
+// constructor so they have fixed ids
+constexpr TypeId kIntType = 0;
+constexpr TypeId kRationalType = 1;
+constexpr TypeId kFloatType = 2;
+constexpr TypeId kComplexType = 3;
+constexpr TypeId kBoolType = 4;
+constexpr TypeId kCharType = 5;
+constexpr TypeId kStringType = 6;
+constexpr TypeId kSymbolType = 7;
+
+struct TypeTable {
+    std::deque<TypeNode> nodes; // deque so references survive interning
+    std::unordered_map<TypeNode, TypeId, TypeNodeHash> index;
+    // binder names of forall types, only used for printing
+    std::unordered_map<TypeId, std::vector<std::string>> binderNames;
+    int stamps = 0;
+    // interned tapply argument lists and the memoized results of
+    // substituting them, a whole instantiation is cached under depth -1
+    std::unordered_map<std::vector<TypeId>, SubstId, TypeIdsHash> substIds;
+    std::vector<std::vector<TypeId>> substs;
+    std::unordered_map<SubstKey, TypeId, SubstKeyHash> substMemo;
+
+    TypeTable();
+
+    TypeId intern(TypeNode node);
+    const TypeNode &node(TypeId id) const;
+    std::size_t size() const;
+
+    TypeId prim(const std::string &name);
+    // signature holds the parameter types followed by the return type
+    TypeId funct(std::vector<TypeId> signature);
+    TypeId constructed(const std::string &name, std::vector<TypeId> typeArgs,
+                       std::vector<int> natArgs);
+    TypeId freshVar(const std::string &name);
+    TypeId bound(int index);
+    // a unification variable, see unify.h
+    TypeId meta(int index);
+    // the node id with its children replaced by args
+    TypeId withArgs(TypeId id, std::vector<TypeId> args);
+    // abstracts the rigid variables vars out of body
+    TypeId forall(const std::vector<TypeId> &vars, TypeId body);
+    // substitutes args for the binders of a forall type, memoized by
+    // (forallType, args)
+    TypeId instantiate(TypeId forallType, const std::vector<TypeId> &args);
+    SubstId substitution(const std::vector<TypeId> &args);
+    // raises the free BOUND indices of id by amount, used when a type moves
+    // under binders
+    TypeId shift(TypeId id, int amount, int depth = 0);
+};
+
+bool isFunctType(const TypeTable &table, TypeId id);
+bool isForallType(const TypeTable &table, TypeId id);
+// the constructed type args of id when it is built by constructor name
+const TypeNode *asConstructed(const TypeTable &table, TypeId id,
+                              const std::string &name);
+std::string toString(const TypeTable &table, TypeId id);
+// the id in to of type id from another table, the first shared ids of both
+// tables are the same types, used to bring types interned by a copy of a
+// table back into the original. a VAR or META past the shared ids only means
+// something in the copy, fresh gives the one of to standing for it
+TypeId importType(TypeTable &to, const TypeTable &from, TypeId id,
+                  TypeId shared, std::unordered_map<TypeId, TypeId> &memo,
+                  const std::function<TypeId(const TypeNode &)> &fresh);
+
+#endif
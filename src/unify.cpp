@@ -0,0 +1,141 @@
+#include "unify.h"
+
+#include <unordered_set>
+#include <utility>
+
+TypeId freshMeta(Unifier &u, TypeTable &types) {
+    std::uint32_t index = static_cast<std::uint32_t>(u.parent.size());
+    u.parent.push_back(index);
+    u.rank.push_back(0);
+    u.solution.push_back(std::nullopt);
+    u.ids.push_back(types.meta(static_cast<int>(index)));
+    return u.ids.back();
+}
+
+std::uint32_t findMeta(Unifier &u, std::uint32_t index) {
+    std::uint32_t root = index;
+    while (u.parent[root] != root) {
+        root = u.parent[root];
+    }
+    while (u.parent[index] != root) {
+        std::uint32_t next = u.parent[index];
+        u.parent[index] = root;
+        index = next;
+    }
+    return root;
+}
+
+static std::uint32_t metaIndex(const TypeTable &types, TypeId type) {
+    return static_cast<std::uint32_t>(types.node(type).nats.front());
+}
+
+TypeId resolve(Unifier &u, const TypeTable &types, TypeId type) {
+    if (types.node(type).kind != TypeKind::META) {
+        return type;
+    }
+    std::uint32_t root = findMeta(u, metaIndex(types, type));
+    return u.solution[root] ? *u.solution[root] : u.ids[root];
+}
+
+// does the variable with root index occur in type, only subterms containing
+// variables are visited and each at most once
+static bool occurs(Unifier &u, const TypeTable &types, std::uint32_t root,
+                   TypeId type, std::unordered_set<TypeId> &seen) {
+    type = resolve(u, types, type);
+    const TypeNode &n = types.node(type);
+    if (!n.meta || !seen.insert(type).second) {
+        return false;
+    }
+    if (n.kind == TypeKind::META) {
+        return findMeta(u, metaIndex(types, type)) == root;
+    }
+    for (TypeId arg : n.args) {
+        if (occurs(u, types, root, arg, seen)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// var is an unsolved root, type is not a variable
+static bool bindMeta(Unifier &u, const TypeTable &types, TypeId var,
+                     TypeId type) {
+    std::uint32_t root = metaIndex(types, var);
+    std::unordered_set<TypeId> seen;
+    // variables are created outside of any forall so they can not be solved
+    // with a type that refers to a forall binder
+    if (types.node(type).free > 0 || occurs(u, types, root, type, seen)) {
+        return false;
+    }
+    u.solution[root] = type;
+    u.generation++;
+    return true;
+}
+
+bool unify(Unifier &u, TypeTable &types, TypeId a, TypeId b) {
+    a = resolve(u, types, a);
+    b = resolve(u, types, b);
+    if (a == b) {
+        return true;
+    }
+    const TypeNode &na = types.node(a);
+    const TypeNode &nb = types.node(b);
+    // interned types without variables are equal iff their ids are
+    if (!na.meta && !nb.meta) {
+        return false;
+    }
+    if (na.kind == TypeKind::META && nb.kind == TypeKind::META) {
+        std::uint32_t ra = metaIndex(types, a);
+        std::uint32_t rb = metaIndex(types, b);
+        if (u.rank[ra] < u.rank[rb]) {
+            std::swap(ra, rb);
+        }
+        u.parent[rb] = ra;
+        if (u.rank[ra] == u.rank[rb]) {
+            u.rank[ra]++;
+        }
+        u.generation++;
+        return true;
+    }
+    if (na.kind == TypeKind::META) {
+        return bindMeta(u, types, a, b);
+    }
+    if (nb.kind == TypeKind::META) {
+        return bindMeta(u, types, b, a);
+    }
+    if (na.kind != nb.kind || na.name != nb.name || na.nats != nb.nats ||
+        na.args.size() != nb.args.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < na.args.size(); i++) {
+        if (!unify(u, types, na.args[i], nb.args[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TypeId zonk(Unifier &u, TypeTable &types, TypeId type) {
+    if (!types.node(type).meta) {
+        return type;
+    }
+    auto cached = u.zonked.find(type);
+    if (cached != u.zonked.end() && cached->second.first == u.generation) {
+        return cached->second.second;
+    }
+    TypeId result;
+    if (types.node(type).kind == TypeKind::META) {
+        TypeId solved = resolve(u, types, type);
+        result = types.node(solved).kind == TypeKind::META
+                     ? solved
+                     : zonk(u, types, solved);
+    } else {
+        std::vector<TypeId> args = types.node(type).args;
+        for (TypeId &arg : args) {
+            arg = zonk(u, types, arg);
+        }
+        result = types.withArgs(type, std::move(args));
+    }
+    u.zonked[type] = {u.generation, result};
+    return result;
+}
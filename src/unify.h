@@ -0,0 +1,45 @@
+#ifndef SPROUT_LANG_UNIFY_H
+#define SPROUT_LANG_UNIFY_H
+
+#include "typetable.h"
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * union find unifier over interned types, used for the little local inference
+ * sprout needs: the types of _ placeholder holes, the result type of a named
+ * let loop and the element type of an empty quoted list. a unification
+ * variable is a META node whose index is an element of the union find
+ * forest. unifying two variables links their roots by rank, binding a
+ * variable records the type at its root, and finding a root compresses the
+ * path, so nothing is ever substituted through a whole type. zonk replaces
+ * the solved variables of a type once, when a result leaves the construct
+ * that introduced them, and subterms without variables are skipped using the
+ * meta flag of the interned node
+ */
+struct Unifier {
+    std::vector<std::uint32_t> parent;
+    std::vector<std::uint8_t> rank;
+    std::vector<std::optional<TypeId>> solution; // at roots, never a META
+    std::vector<TypeId> ids;                     // META node of each index
+    // zonked types tagged with the generation they were computed in, solving
+    // or linking a variable starts a new generation
+    std::unordered_map<TypeId, std::pair<std::uint32_t, TypeId>> zonked;
+    std::uint32_t generation = 0;
+};
+
+TypeId freshMeta(Unifier &u, TypeTable &types);
+std::uint32_t findMeta(Unifier &u, std::uint32_t index);
+// the solution of type if it is a solved variable, the root variable if it
+// is an unsolved one and type itself otherwise
+TypeId resolve(Unifier &u, const TypeTable &types, TypeId type);
+// makes a and b equal by solving variables, false if they cannot be, in
+// which case some variables may already be solved
+bool unify(Unifier &u, TypeTable &types, TypeId a, TypeId b);
+// type with every solved variable replaced by its solution
+TypeId zonk(Unifier &u, TypeTable &types, TypeId type);
+
+#endif
@@ -19,8 +19,9 @@ struct Value;
 template <typename CarT, typename CdrT = CarT> struct Cell;
 
 /*
- * linked list/tree structure over Values, will be emitted as the final
- * intermediate representation after lowering before bytecode generation
+ * linked list/tree structure over Values, the runtime representation of
+ * quoted list constants. the intermediate representation produced by
+ * lowering is the arena based IR in ir.h
  */
 using List = std::shared_ptr<const Cell<Value, Value>>;
 
@@ -0,0 +1,1180 @@
+#include "vm.h"
+#include "cell.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+static Word symbolWord(Vm &vm, const std::string &name) {
+    auto it = vm.symbols.find(name);
+    if (it != vm.symbols.end()) {
+        return it->second;
+    }
+    Object *obj = allocate(vm.heap, ObjectKind::SYMBOL,
+                           static_cast<std::uint32_t>(name.size()),
+                           name.size());
+    std::memcpy(payloadOf(obj), name.data(), name.size());
+    return vm.symbols[name] = objectWord(obj);
+}
+
+// a constant of the program as a word, lists become cons cells
+static Word constantWord(Vm &vm, const Value &v) {
+    if (isInt(v)) {
+        return fixnum(std::get<int>(v.v));
+    } else if (isDouble(v)) {
+        return makeFloat(vm.heap, std::get<double>(v.v));
+    } else if (isRational(v)) {
+        return makeRational(vm.heap, std::get<Rational>(v.v));
+    } else if (isComplex(v)) {
+        return makeComplex(vm.heap, std::get<Complex>(v.v));
+    } else if (isBool(v)) {
+        return boolean(std::get<bool>(v.v));
+    } else if (isChar(v)) {
+        return character(std::get<char>(v.v));
+    } else if (isString(v)) {
+        return makeString(vm.heap, std::get<std::string>(v.v));
+    } else if (isSymbol(v)) {
+        return symbolWord(vm, std::get<Symbol>(v.v).name);
+    } else if (isList(v)) {
+        const List &cell = std::get<List>(v.v);
+        if (!cell) {
+            return kNil;
+        }
+        return makeCons(vm.heap, constantWord(vm, head(cell)),
+                        constantWord(vm, tail(cell)));
+    }
+    throw std::runtime_error("constant has no runtime representation");
+}
+
+// a closure or thunk of fn with room for its captures
+static Object *functionObject(Vm &vm, ObjectKind kind, std::uint32_t fn) {
+    std::uint32_t captures = vm.program.functions[fn].captures;
+    Object *obj = allocate(vm.heap, kind, captures + 1,
+                           sizeof(Word) * (captures + 1));
+    payloadOf(obj)[0] = fn;
+    return obj;
+}
+
+// the same in the frame region at slot, aligned like the heap so the word
+// of the object can be told from an immediate
+static Object *frameObject(Vm &vm, Word *slot, ObjectKind kind,
+                           std::uint32_t fn) {
+    auto at = reinterpret_cast<std::uintptr_t>(slot);
+    at = (at + kPointerMask) & ~static_cast<std::uintptr_t>(kPointerMask);
+    auto *obj = reinterpret_cast<Object *>(at);
+    obj->kind = kind;
+    obj->unused = 0;
+    obj->tag = 0;
+    obj->size = vm.program.functions[fn].captures + 1;
+    payloadOf(obj)[0] = fn;
+    vm.stats.frameObjects++;
+    return obj;
+}
+
+Vm::Vm(const Program &program)
+    : program(program), stack(kStackWords) {
+    sp = stack.data();
+    for (const Value &v : program.constants) {
+        constants.push_back(constantWord(*this, v));
+    }
+    // strict globals are evaluated by run, in order
+    for (std::uint32_t fn : program.globals) {
+        switch (program.functions[fn].kind) {
+        case FunctionKind::LAMBDA:
+            globals.push_back(
+                objectWord(functionObject(*this, ObjectKind::CLOSURE, fn)));
+            break;
+        case FunctionKind::THUNK:
+            globals.push_back(
+                objectWord(functionObject(*this, ObjectKind::THUNK, fn)));
+            break;
+        case FunctionKind::ROOT:
+            globals.push_back(kNil);
+            break;
+        }
+    }
+}
+
+// a frame running fn with slot 0 at base
+static void pushFrame(Vm &vm, const CompiledFunction &fn, Word *base, Word *env,
+                      Object *update) {
+    if (base + fn.frameSize + fn.stackSize >
+        vm.stack.data() + vm.stack.size()) {
+        throw std::runtime_error("stack overflow");
+    }
+    vm.frames.push_back(Frame{&fn, fn.code.data(), base, env, update});
+    vm.sp = base + fn.frameSize;
+    vm.stats.deepest = std::max(vm.stats.deepest, vm.frames.size());
+}
+
+static int numericRank(Word w) {
+    if (isFixnum(w)) {
+        return 0;
+    }
+    switch (objectOf(w)->kind) {
+    case ObjectKind::RATIONAL:
+        return 1;
+    case ObjectKind::FLOAT:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+static Rational asRational(Word w) {
+    if (isFixnum(w)) {
+        std::int64_t i = fixnumValue(w);
+        if (i < std::numeric_limits<int>::min() ||
+            i > std::numeric_limits<int>::max()) {
+            throw std::runtime_error("rational overflow");
+        }
+        return Rational(static_cast<int>(i), 1);
+    }
+    return rationalValue(w);
+}
+
+static double asDouble(Word w) {
+    if (isFixnum(w)) {
+        return static_cast<double>(fixnumValue(w));
+    }
+    if (objectOf(w)->kind == ObjectKind::RATIONAL) {
+        return static_cast<double>(rationalValue(w));
+    }
+    return floatValue(w);
+}
+
+static Complex asComplex(Word w) {
+    if (numericRank(w) == 3) {
+        return complexValue(w);
+    }
+    return Complex(asDouble(w));
+}
+
+/*
+ * + - and * of two fixnums straight on their words 2x + 1 and 2y + 1, the
+ * int64 arithmetic overflows exactly when the result leaves the 63 bits of
+ * a fixnum, which raises rather than wraps
+ */
+static Word fixnumArithmetic(Op op, Word a, Word b) {
+    auto x = static_cast<std::int64_t>(a);
+    auto y = static_cast<std::int64_t>(b - 1);
+    std::int64_t r = 0;
+    bool overflow = false;
+    switch (op) {
+    case Op::ADD:
+        overflow = __builtin_add_overflow(x, y, &r);
+        break;
+    case Op::SUB:
+        overflow = __builtin_sub_overflow(x, y, &r);
+        break;
+    default:
+        overflow = __builtin_mul_overflow(fixnumValue(a), y, &r);
+        r |= 1;
+        break;
+    }
+    if (overflow) {
+        throw std::runtime_error("integer overflow");
+    }
+    return static_cast<Word>(r);
+}
+
+template <typename T> static T apply(Op op, const T &a, const T &b) {
+    switch (op) {
+    case Op::ADD:
+        return a + b;
+    case Op::SUB:
+        return a - b;
+    case Op::MUL:
+        return a * b;
+    default:
+        return a / b;
+    }
+}
+
+/*
+ * arithmetic over the numeric tower, both operands are raised to the rank
+ * of the larger one like the typechecker types the result, and / of two
+ * ints is an exact rational
+ */
+static Word arithmetic(Vm &vm, Op op, Word a, Word b) {
+    int rank = std::max(numericRank(a), numericRank(b));
+    if (op == Op::DIV && rank == 0) {
+        rank = 1;
+    }
+    switch (rank) {
+    case 0: {
+        if (op != Op::MOD) {
+            return fixnumArithmetic(op, a, b);
+        }
+        std::int64_t y = fixnumValue(b);
+        if (y == 0) {
+            throw std::runtime_error("division by zero");
+        }
+        return fixnum(fixnumValue(a) % y);
+    }
+    case 1:
+        return makeRational(vm.heap, apply(op, asRational(a), asRational(b)));
+    case 2:
+        return makeFloat(vm.heap, apply(op, asDouble(a), asDouble(b)));
+    default:
+        return makeComplex(vm.heap, apply(op, asComplex(a), asComplex(b)));
+    }
+}
+
+// floats negate in place rather than as 0 - x, which loses the sign of 0.0
+static Word negate(Vm &vm, Word w) {
+    switch (numericRank(w)) {
+    case 0:
+        return fixnumArithmetic(Op::SUB, fixnum(0), w);
+    case 2:
+        return makeFloat(vm.heap, -asDouble(w));
+    case 3: {
+        Complex c = asComplex(w);
+        return makeComplex(vm.heap, Complex(-c.re, -c.im));
+    }
+    default:
+        return arithmetic(vm, Op::SUB, fixnum(0), w);
+    }
+}
+
+static bool compare(Op op, Word a, Word b) {
+    int rank = std::max(numericRank(a), numericRank(b));
+    if (rank == 3) {
+        return asComplex(a) == asComplex(b);
+    }
+    if (rank == 1) {
+        Rational x = asRational(a);
+        Rational y = asRational(b);
+        // cross multiplied, exact where the comparison operators of
+        // Rational go through double
+        long long l = static_cast<long long>(x.numerator) * y.denominator;
+        long long r = static_cast<long long>(y.numerator) * x.denominator;
+        switch (op) {
+        case Op::LT:
+            return l < r;
+        case Op::GT:
+            return l > r;
+        case Op::LE:
+            return l <= r;
+        case Op::GE:
+            return l >= r;
+        default:
+            return l == r;
+        }
+    }
+    double x = asDouble(a);
+    double y = asDouble(b);
+    switch (op) {
+    case Op::LT:
+        return x < y;
+    case Op::GT:
+        return x > y;
+    case Op::LE:
+        return x <= y;
+    case Op::GE:
+        return x >= y;
+    default:
+        return x == y;
+    }
+}
+
+static Word execute(Vm &vm, std::size_t depth);
+
+Word force(Vm &vm, Word w) {
+    if (!isPointer(w)) {
+        return w;
+    }
+    Object *obj = objectOf(w);
+    switch (obj->kind) {
+    case ObjectKind::INDIRECTION:
+        return payloadOf(obj)[0];
+    case ObjectKind::BLACKHOLE:
+        throw std::runtime_error("a thunk needs its own value, the program "
+                                 "loops");
+    case ObjectKind::THUNK: {
+        std::size_t depth = vm.frames.size();
+        *vm.sp++ = w;
+        obj->kind = ObjectKind::BLACKHOLE;
+        vm.stats.forces++;
+        pushFrame(vm, vm.program.functions[payloadOf(obj)[0]], vm.sp,
+                  payloadOf(obj) + 1, obj);
+        return execute(vm, depth);
+    }
+    default:
+        return w;
+    }
+}
+
+Word call(Vm &vm, Word fn, const std::vector<Word> &args) {
+    Object *obj = objectOf(fn);
+    const CompiledFunction &f = vm.program.functions[payloadOf(obj)[0]];
+    if (f.params != args.size()) {
+        throw std::runtime_error(f.name + " called with the wrong number "
+                                 "of arguments");
+    }
+    std::size_t depth = vm.frames.size();
+    *vm.sp++ = fn;
+    for (Word arg : args) {
+        *vm.sp++ = arg;
+    }
+    vm.stats.calls++;
+    pushFrame(vm, f, vm.sp - args.size(), payloadOf(obj) + 1, nullptr);
+    return execute(vm, depth);
+}
+
+// a copy of the spine of front ending in rest, forcing the spine
+static Word append(Vm &vm, Word front, Word rest) {
+    std::vector<Word> cars;
+    for (Word cell = front; cell != kNil;) {
+        cars.push_back(payloadOf(objectOf(cell))[0]);
+        cell = force(vm, payloadOf(objectOf(cell))[1]);
+    }
+    for (std::size_t i = cars.size(); i-- > 0;) {
+        rest = makeCons(vm.heap, cars[i], rest);
+    }
+    return rest;
+}
+
+// x through the stages of a pipeline, false when a filter drops it. a map
+// stage delays its call in a thunk of (f x)
+static bool runStages(Vm &vm, const Word *fns, std::uint32_t n,
+                      std::uint32_t mask, Word &x) {
+    for (std::uint32_t i = 0; i < n; i++) {
+        if (mask >> i & 1) {
+            if (call(vm, fns[i], {x}) == kFalse) {
+                return false;
+            }
+            continue;
+        }
+        Object *thunk =
+            functionObject(vm, ObjectKind::THUNK, vm.program.apply1);
+        payloadOf(thunk)[1] = fns[i];
+        payloadOf(thunk)[2] = x;
+        x = objectWord(thunk);
+    }
+    return true;
+}
+
+// the first cell of the pipeline over list, its tail a thunk of rest over
+// the stages and the tail of the source cell the element came from
+static Word pipe(Vm &vm, const Word *fns, std::uint32_t n, std::uint32_t mask,
+                 std::uint32_t rest, Word list) {
+    for (Word cell = force(vm, list); cell != kNil;) {
+        Object *source = objectOf(cell);
+        Word x = payloadOf(source)[0];
+        if (runStages(vm, fns, n, mask, x)) {
+            Object *tail = functionObject(vm, ObjectKind::THUNK, rest);
+            std::copy(fns, fns + n, payloadOf(tail) + 1);
+            payloadOf(tail)[n + 1] = payloadOf(source)[1];
+            return makeCons(vm.heap, x, objectWord(tail));
+        }
+        cell = force(vm, payloadOf(source)[1]);
+    }
+    return kNil;
+}
+
+// foldl over the elements the stages keep, the accumulator is evaluated at
+// every step
+static Word foldLeft(Vm &vm, Word fn, Word acc, const Word *fns,
+                     std::uint32_t n, std::uint32_t mask, Word list) {
+    for (Word cell = force(vm, list); cell != kNil;) {
+        Object *source = objectOf(cell);
+        Word x = payloadOf(source)[0];
+        if (runStages(vm, fns, n, mask, x)) {
+            acc = call(vm, fn, {acc, x});
+        }
+        cell = force(vm, payloadOf(source)[1]);
+    }
+    return force(vm, acc);
+}
+
+// a field holding a thunk evaluated since gets its value, so later reads
+// skip the INDIRECTION
+static Word field(Word w, std::uint32_t i) {
+    Word &slot = payloadOf(objectOf(w))[i];
+    if (isPointer(slot) && objectOf(slot)->kind == ObjectKind::INDIRECTION) {
+        slot = payloadOf(objectOf(slot))[0];
+    }
+    return slot;
+}
+
+static std::uint32_t read16(const std::uint8_t *at) {
+    return static_cast<std::uint32_t>(at[0] | at[1] << 8);
+}
+
+static std::uint32_t read32(const std::uint8_t *at) {
+    std::uint32_t value;
+    std::memcpy(&value, at, 4);
+    return value;
+}
+
+/*
+ * each op is the code after its OP label and ends in NEXT. threaded, NEXT
+ * reads the following op and jumps straight to its code through a table of
+ * label addresses, so every op has an indirect jump of its own for the
+ * branch predictor to learn from. with the switch, NEXT leaves the switch
+ * for the loop to read the next op
+ */
+#ifdef SPROUT_LANG_THREADED_DISPATCH
+#define OP(name)                                                               \
+    case Op::name:                                                             \
+    op_##name
+#define NEXT                                                                   \
+    do {                                                                       \
+        op = static_cast<Op>(*ip++);                                           \
+        executed++;                                                            \
+        if (profile) {                                                         \
+            note(op);                                                          \
+        }                                                                      \
+        goto *labels[static_cast<std::uint8_t>(op)];                           \
+    } while (false)
+// label addresses and computed goto are GNU extensions
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#else
+#define OP(name) case Op::name
+#define NEXT break
+#endif
+
+/*
+ * the dispatch loop, running the frame on top of vm.frames until the frame
+ * count drops back to depth, and returning the value of the frame that did.
+ * the registers of the running frame live in locals and are written back to
+ * it before anything that pushes a frame or may run the loop again
+ */
+static Word execute(Vm &vm, std::size_t depth) {
+    const CompiledFunction *functions = vm.program.functions.data();
+    const Word *constants = vm.constants.data();
+    Word *globals = vm.globals.data();
+    Frame *frame = &vm.frames.back();
+    const std::uint8_t *code = frame->fn->code.data(); // jump targets
+    const std::uint8_t *ip = frame->ip;
+    Word *base = frame->base;
+    Word *env = frame->env;
+    Word *sp = vm.sp;
+    std::size_t executed = 0; // ops, added to vm.stats on return
+    OpProfile *profile = vm.profile;
+    // the last two ops of the straight line code running, kOpCount for none
+    std::size_t last = kOpCount;
+    std::size_t before = kOpCount;
+
+    auto save = [&]() {
+        frame->ip = ip;
+        vm.sp = sp;
+    };
+    auto restore = [&]() {
+        frame = &vm.frames.back();
+        code = frame->fn->code.data();
+        ip = frame->ip;
+        base = frame->base;
+        env = frame->env;
+        sp = vm.sp;
+    };
+    auto enter = [&](const CompiledFunction &fn, Word *at, Word *captures,
+                     Object *update) {
+        save();
+        pushFrame(vm, fn, at, captures, update);
+        restore();
+    };
+    /*
+     * a call site keeps no inline cache. the closure already holds the
+     * index of its function, so finding the code is one indexed load and
+     * the arity compare is the only check, no more than a cache hit costs
+     */
+    auto callee = [&](Object *obj,
+                      std::uint32_t n) -> const CompiledFunction & {
+        const CompiledFunction &fn = functions[payloadOf(obj)[0]];
+        if (fn.params != n) {
+            throw std::runtime_error(fn.name + " called with the wrong "
+                                     "number of arguments");
+        }
+        return fn;
+    };
+    auto callTop = [&](std::uint32_t n) {
+        Object *obj = objectOf(sp[-static_cast<std::ptrdiff_t>(n) - 1]);
+        const CompiledFunction &fn = callee(obj, n);
+        vm.stats.calls++;
+        enter(fn, sp - n, payloadOf(obj) + 1, nullptr);
+    };
+    // the callee below the n arguments on top of the stack replaces the
+    // running frame, unless it or an argument is an object built in the
+    // frame
+    auto tailCallTop = [&](std::uint32_t n) {
+        Word *args = sp - n - 1;
+        const auto *from = reinterpret_cast<const Object *>(base);
+        const auto *to =
+            reinterpret_cast<const Object *>(base + frame->fn->frameSize);
+        for (Word *w = args; w < sp; w++) {
+            if (isPointer(*w) && objectOf(*w) >= from && objectOf(*w) < to) {
+                callTop(n);
+                return;
+            }
+        }
+        Object *obj = objectOf(*args);
+        const CompiledFunction &fn = callee(obj, n);
+        if (base + fn.frameSize + fn.stackSize >
+            vm.stack.data() + vm.stack.size()) {
+            throw std::runtime_error("stack overflow");
+        }
+        vm.stats.calls++;
+        vm.stats.tailCalls++;
+        std::memmove(base - 1, args, sizeof(Word) * (n + 1));
+        frame->fn = &fn;
+        frame->env = env = payloadOf(obj) + 1;
+        ip = code = fn.code.data();
+        sp = base + fn.frameSize;
+    };
+    auto forceTop = [&]() {
+        if (!isPointer(sp[-1])) {
+            return;
+        }
+        Object *obj = objectOf(sp[-1]);
+        switch (obj->kind) {
+        case ObjectKind::INDIRECTION:
+            sp[-1] = payloadOf(obj)[0];
+            return;
+        case ObjectKind::BLACKHOLE:
+            throw std::runtime_error("a thunk needs its own value, the "
+                                     "program loops");
+        case ObjectKind::THUNK:
+            obj->kind = ObjectKind::BLACKHOLE;
+            vm.stats.forces++;
+            enter(functions[payloadOf(obj)[0]], sp, payloadOf(obj) + 1, obj);
+            return;
+        default:
+            return;
+        }
+    };
+    auto function = [&](ObjectKind kind, std::uint32_t fn, bool frame) {
+        Object *obj = frame ? frameObject(vm, base + read16(ip + 2), kind, fn)
+                            : functionObject(vm, kind, fn);
+        std::uint32_t n = functions[fn].captures;
+        std::memcpy(payloadOf(obj) + 1, sp - n, sizeof(Word) * n);
+        sp -= n;
+        *sp++ = objectWord(obj);
+    };
+
+    auto note = [&](Op op) {
+        auto o = static_cast<std::size_t>(op);
+        if (last < kOpCount) {
+            profile->pairs[last * kOpCount + o]++;
+            if (before < kOpCount) {
+                profile->triples[(before * kOpCount + last) * kOpCount + o]++;
+            }
+        }
+        before = transfersControl(op) ? kOpCount : last;
+        last = transfersControl(op) ? kOpCount : o;
+    };
+
+#ifdef SPROUT_LANG_THREADED_DISPATCH
+    static const void *const labels[] = {
+        &&op_CONST, &&op_LOCAL, &&op_ENV, &&op_GLOBAL, &&op_STORE, &&op_JUMP,
+        &&op_JUMP_FALSE, &&op_SWITCH, &&op_FAIL, &&op_CALL, &&op_TAIL_CALL,
+        &&op_RETURN, &&op_FORCE, &&op_CLOSURE, &&op_THUNK, &&op_ALLOC,
+        &&op_FILL, &&op_FRAME_CLOSURE, &&op_FRAME_THUNK, &&op_FRAME_ALLOC,
+        &&op_CONSTRUCT, &&op_VEC, &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV,
+        &&op_MOD, &&op_NEG, &&op_LT, &&op_GT, &&op_LE, &&op_GE, &&op_NUM_EQ,
+        &&op_NOT, &&op_CONS, &&op_IS_NULL, &&op_CAR, &&op_CDR, &&op_APPEND,
+        &&op_PIPE, &&op_FOLDL, &&op_VEC_REF, &&op_VEC_LEN, &&op_VEC_MAP,
+        &&op_VEC_FOLD, &&op_EQ, &&op_EQUAL, &&op_IS_TAG, &&op_FIELD,
+        &&op_UNBOX_F, &&op_BOX_F, &&op_FADD, &&op_FSUB, &&op_FMUL, &&op_FDIV,
+        &&op_FNEG, &&op_FLT, &&op_FGT, &&op_FLE, &&op_FGE, &&op_FEQ,
+        &&op_STORE_LOCAL, &&op_LOCAL_CONST, &&op_LOCAL_LOCAL,
+        &&op_LOCAL_JUMP_FALSE};
+    static_assert(std::size(labels) == kOpCount);
+#endif
+    Op op;
+    for (;;) {
+        op = static_cast<Op>(*ip++);
+        executed++;
+        if (profile) {
+            note(op);
+        }
+#ifdef SPROUT_LANG_THREADED_DISPATCH
+        goto *labels[static_cast<std::uint8_t>(op)];
+#endif
+        switch (op) {
+        OP(CONST):
+            *sp++ = constants[read16(ip)];
+            ip += 2;
+            NEXT;
+        OP(LOCAL):
+            *sp++ = base[read16(ip)];
+            ip += 2;
+            NEXT;
+        OP(ENV):
+            *sp++ = env[read16(ip)];
+            ip += 2;
+            NEXT;
+        OP(GLOBAL):
+            *sp++ = globals[read16(ip)];
+            ip += 2;
+            NEXT;
+        OP(STORE):
+            base[read16(ip)] = *--sp;
+            ip += 2;
+            NEXT;
+        OP(JUMP):
+            ip = code + read32(ip);
+            NEXT;
+        OP(JUMP_FALSE):
+            if (*--sp == kFalse) {
+                ip = code + read32(ip);
+            } else {
+                ip += 4;
+            }
+            NEXT;
+        OP(SWITCH): {
+            std::uint32_t n = read16(ip);
+            auto tag = static_cast<std::uint32_t>(tagOf(*--sp));
+            ip = code + read32(ip + 2 + 4 * std::min(tag, n));
+            NEXT;
+        }
+        OP(FAIL):
+            throw std::runtime_error(std::get<std::string>(
+                vm.program.constants[read16(ip)].v));
+        OP(CALL): {
+            std::uint32_t n = read16(ip);
+            ip += 2;
+            callTop(n);
+            NEXT;
+        }
+        OP(TAIL_CALL): {
+            std::uint32_t n = read16(ip);
+            ip += 2;
+            tailCallTop(n);
+            NEXT;
+        }
+        OP(RETURN): {
+            Word result = sp[-1];
+            if (frame->update) {
+                frame->update->kind = ObjectKind::INDIRECTION;
+                payloadOf(frame->update)[0] = result;
+            }
+            sp = base - 1;
+            vm.frames.pop_back();
+            if (vm.frames.size() == depth) {
+                vm.sp = sp;
+                vm.stats.instructions += executed;
+                return result;
+            }
+            *sp++ = result;
+            vm.sp = sp;
+            restore();
+            NEXT;
+        }
+        OP(FORCE):
+            forceTop();
+            NEXT;
+        OP(CLOSURE):
+            function(ObjectKind::CLOSURE, read16(ip), false);
+            ip += 2;
+            NEXT;
+        OP(THUNK):
+            function(ObjectKind::THUNK, read16(ip), false);
+            ip += 2;
+            NEXT;
+        OP(FRAME_CLOSURE):
+            function(ObjectKind::CLOSURE, read16(ip), true);
+            ip += 4;
+            NEXT;
+        OP(FRAME_THUNK):
+            function(ObjectKind::THUNK, read16(ip), true);
+            ip += 4;
+            NEXT;
+        OP(ALLOC):
+        OP(FRAME_ALLOC): {
+            std::uint32_t fn = read16(ip);
+            ObjectKind kind = functions[fn].kind == FunctionKind::LAMBDA
+                                  ? ObjectKind::CLOSURE
+                                  : ObjectKind::THUNK;
+            Object *obj = op == Op::ALLOC
+                              ? functionObject(vm, kind, fn)
+                              : frameObject(vm, base + read16(ip + 2), kind,
+                                            fn);
+            ip += op == Op::ALLOC ? 2 : 4;
+            std::fill_n(payloadOf(obj) + 1, functions[fn].captures, kNil);
+            *sp++ = objectWord(obj);
+            NEXT;
+        }
+        OP(FILL): {
+            Object *obj = objectOf(base[read16(ip)]);
+            ip += 2;
+            std::uint32_t n = obj->size - 1;
+            std::memcpy(payloadOf(obj) + 1, sp - n, sizeof(Word) * n);
+            sp -= n;
+            NEXT;
+        }
+        OP(CONSTRUCT): {
+            const IrConstructor &ctor = vm.program.constructors[read16(ip)];
+            ip += 2;
+            sp -= ctor.arity;
+            Word value = construct(vm.heap, ctor.rep, ctor.tag, sp,
+                                   ctor.arity);
+            *sp++ = value;
+            NEXT;
+        }
+        OP(VEC): {
+            std::uint32_t n = read16(ip);
+            ip += 2;
+            Object *obj = allocate(vm.heap, ObjectKind::VECTOR, n,
+                                   sizeof(Word) * n);
+            sp -= n;
+            std::memcpy(payloadOf(obj), sp, sizeof(Word) * n);
+            *sp++ = objectWord(obj);
+            NEXT;
+        }
+        OP(ADD): {
+            Word b = *--sp;
+            Word a = sp[-1];
+            sp[-1] = isFixnum(a & b) ? fixnumArithmetic(op, a, b)
+                                     : arithmetic(vm, op, a, b);
+            NEXT;
+        }
+        OP(SUB): {
+            Word b = *--sp;
+            Word a = sp[-1];
+            sp[-1] = isFixnum(a & b) ? fixnumArithmetic(op, a, b)
+                                     : arithmetic(vm, op, a, b);
+            NEXT;
+        }
+        OP(MUL): {
+            Word b = *--sp;
+            Word a = sp[-1];
+            sp[-1] = isFixnum(a & b) ? fixnumArithmetic(op, a, b)
+                                     : arithmetic(vm, op, a, b);
+            NEXT;
+        }
+        OP(DIV):
+        OP(MOD): {
+            Word b = *--sp;
+            sp[-1] = arithmetic(vm, op, sp[-1], b);
+            NEXT;
+        }
+        OP(NEG):
+            sp[-1] = negate(vm, sp[-1]);
+            NEXT;
+        OP(LT):
+        OP(GT):
+        OP(LE):
+        OP(GE):
+        OP(NUM_EQ): {
+            Word b = *--sp;
+            Word a = sp[-1];
+            if (isFixnum(a & b)) {
+                // shifted fixnums order like their values
+                auto x = static_cast<std::int64_t>(a);
+                auto y = static_cast<std::int64_t>(b);
+                bool holds = op == Op::LT   ? x < y
+                             : op == Op::GT ? x > y
+                             : op == Op::LE ? x <= y
+                             : op == Op::GE ? x >= y
+                                            : x == y;
+                sp[-1] = boolean(holds);
+            } else {
+                sp[-1] = boolean(compare(op, a, b));
+            }
+            NEXT;
+        }
+        OP(NOT):
+            sp[-1] = boolean(sp[-1] == kFalse);
+            NEXT;
+        OP(CONS): {
+            Word cdr = *--sp;
+            sp[-1] = makeCons(vm.heap, sp[-1], cdr);
+            NEXT;
+        }
+        OP(IS_NULL):
+            sp[-1] = boolean(sp[-1] == kNil);
+            NEXT;
+        OP(CAR):
+            if (sp[-1] == kNil) {
+                throw std::runtime_error("car of the empty list");
+            }
+            sp[-1] = field(sp[-1], 0);
+            NEXT;
+        OP(CDR):
+            if (sp[-1] == kNil) {
+                throw std::runtime_error("cdr of the empty list");
+            }
+            sp[-1] = field(sp[-1], 1);
+            NEXT;
+        OP(APPEND): {
+            Word rest = *--sp;
+            Word front = sp[-1];
+            save();
+            Word joined = append(vm, front, rest);
+            restore();
+            sp[-1] = joined;
+            NEXT;
+        }
+        // the stage functions stay on the stack below the nested runs
+        OP(PIPE): {
+            std::uint32_t n = read16(ip);
+            std::uint32_t mask = read16(ip + 2);
+            std::uint32_t rest = read16(ip + 4);
+            ip += 6;
+            Word list = *--sp;
+            save();
+            Word cell = pipe(vm, sp - n, n, mask, rest, list);
+            restore();
+            sp -= n;
+            *sp++ = cell;
+            NEXT;
+        }
+        OP(FOLDL): {
+            std::uint32_t n = read16(ip);
+            std::uint32_t mask = read16(ip + 2);
+            ip += 4;
+            Word list = *--sp;
+            Word *args = sp - n - 2;
+            save();
+            Word acc = foldLeft(vm, args[0], args[1], args + 2, n, mask, list);
+            restore();
+            sp -= n + 2;
+            *sp++ = acc;
+            NEXT;
+        }
+        OP(VEC_REF): {
+            bool checked = *ip++;
+            std::int64_t i = fixnumValue(*--sp);
+            Object *vec = objectOf(sp[-1]);
+            if (checked && (i < 0 || i >= vec->size)) {
+                throw std::runtime_error("vec-ref index " + std::to_string(i) +
+                                         " out of range");
+            }
+            sp[-1] = payloadOf(vec)[i];
+            NEXT;
+        }
+        OP(VEC_LEN):
+            sp[-1] = fixnum(objectOf(sp[-1])->size);
+            NEXT;
+        OP(VEC_MAP): {
+            // every element is a thunk of (f x)
+            Object *in = objectOf(*--sp);
+            Word fn = sp[-1];
+            Object *out = allocate(vm.heap, ObjectKind::VECTOR, in->size,
+                                   sizeof(Word) * in->size);
+            for (std::uint32_t i = 0; i < in->size; i++) {
+                Object *thunk =
+                    functionObject(vm, ObjectKind::THUNK, vm.program.apply1);
+                payloadOf(thunk)[1] = fn;
+                payloadOf(thunk)[2] = payloadOf(in)[i];
+                payloadOf(out)[i] = objectWord(thunk);
+            }
+            sp[-1] = objectWord(out);
+            NEXT;
+        }
+        OP(VEC_FOLD): {
+            // (f (thunk (f ... (f z e0) ...)) eN-1), the last call is made
+            // from the loop
+            Object *vec = objectOf(*--sp);
+            Word acc = *--sp;
+            Word fn = sp[-1];
+            if (vec->size == 0) {
+                sp[-1] = acc;
+                forceTop();
+                NEXT;
+            }
+            for (std::uint32_t i = 0; i + 1 < vec->size; i++) {
+                Object *thunk =
+                    functionObject(vm, ObjectKind::THUNK, vm.program.apply2);
+                payloadOf(thunk)[1] = fn;
+                payloadOf(thunk)[2] = acc;
+                payloadOf(thunk)[3] = payloadOf(vec)[i];
+                acc = objectWord(thunk);
+            }
+            *sp++ = acc;
+            *sp++ = payloadOf(vec)[vec->size - 1];
+            callTop(2);
+            NEXT;
+        }
+        OP(EQ): {
+            Word b = *--sp;
+            sp[-1] = boolean(sp[-1] == b);
+            NEXT;
+        }
+        OP(EQUAL): {
+            Word b = *--sp;
+            Word a = sp[-1];
+            save();
+            bool same = equalWords(a, b, [&](Word w) { return force(vm, w); });
+            restore();
+            sp[-1] = boolean(same);
+            NEXT;
+        }
+        OP(IS_TAG):
+            sp[-1] = boolean(tagOf(sp[-1]) == static_cast<int>(read16(ip)));
+            ip += 2;
+            NEXT;
+        OP(FIELD):
+            sp[-1] = field(sp[-1], read16(ip));
+            ip += 2;
+            NEXT;
+        OP(UNBOX_F):
+            sp[-1] = std::bit_cast<Word>(asDouble(sp[-1]));
+            NEXT;
+        OP(BOX_F):
+            sp[-1] = makeFloat(vm.heap, std::bit_cast<double>(sp[-1]));
+            NEXT;
+        OP(FNEG):
+            sp[-1] = std::bit_cast<Word>(-std::bit_cast<double>(sp[-1]));
+            NEXT;
+        OP(FADD):
+        OP(FSUB):
+        OP(FMUL):
+        OP(FDIV): {
+            auto y = std::bit_cast<double>(*--sp);
+            auto x = std::bit_cast<double>(sp[-1]);
+            double z = op == Op::FADD   ? x + y
+                       : op == Op::FSUB ? x - y
+                       : op == Op::FMUL ? x * y
+                                        : x / y;
+            sp[-1] = std::bit_cast<Word>(z);
+            NEXT;
+        }
+        OP(FLT):
+        OP(FGT):
+        OP(FLE):
+        OP(FGE):
+        OP(FEQ): {
+            auto y = std::bit_cast<double>(*--sp);
+            auto x = std::bit_cast<double>(sp[-1]);
+            bool holds = op == Op::FLT   ? x < y
+                         : op == Op::FGT ? x > y
+                         : op == Op::FLE ? x <= y
+                         : op == Op::FGE ? x >= y
+                                         : x == y;
+            sp[-1] = boolean(holds);
+            NEXT;
+        }
+        OP(STORE_LOCAL):
+            base[read16(ip)] = *--sp;
+            *sp++ = base[read16(ip + 2)];
+            ip += 4;
+            NEXT;
+        OP(LOCAL_CONST):
+            *sp++ = base[read16(ip)];
+            *sp++ = constants[read16(ip + 2)];
+            ip += 4;
+            NEXT;
+        OP(LOCAL_LOCAL):
+            *sp++ = base[read16(ip)];
+            *sp++ = base[read16(ip + 2)];
+            ip += 4;
+            NEXT;
+        OP(LOCAL_JUMP_FALSE):
+            if (base[read16(ip)] == kFalse) {
+                ip = code + read32(ip + 2);
+            } else {
+                ip += 6;
+            }
+            NEXT;
+        default:
+            throw std::runtime_error("unknown opcode " +
+                                     std::to_string(static_cast<int>(op)));
+        }
+    }
+}
+
+#ifdef SPROUT_LANG_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+#undef OP
+#undef NEXT
+
+std::string rankSequences(const OpProfile &profile, std::size_t top) {
+    struct Sequence {
+        std::size_t saved; // dispatches, one less than the ops per run
+        std::size_t count;
+        std::vector<std::size_t> ops;
+    };
+    std::vector<Sequence> sequences;
+    for (std::size_t i = 0; i < profile.pairs.size(); i++) {
+        if (profile.pairs[i] > 0) {
+            sequences.push_back(Sequence{profile.pairs[i], profile.pairs[i],
+                                         {i / kOpCount, i % kOpCount}});
+        }
+    }
+    for (std::size_t i = 0; i < profile.triples.size(); i++) {
+        if (profile.triples[i] > 0) {
+            sequences.push_back(
+                Sequence{2 * profile.triples[i], profile.triples[i],
+                         {i / (kOpCount * kOpCount), i / kOpCount % kOpCount,
+                          i % kOpCount}});
+        }
+    }
+    std::sort(sequences.begin(), sequences.end(),
+              [](const Sequence &a, const Sequence &b) {
+                  return a.saved > b.saved;
+              });
+    std::ostringstream out;
+    for (std::size_t i = 0; i < std::min(top, sequences.size()); i++) {
+        out << sequences[i].count;
+        for (std::size_t op : sequences[i].ops) {
+            out << ' ' << toString(static_cast<Op>(op));
+        }
+        out << '\n';
+    }
+    return out.str();
+}
+
+// a root function with no closure below its frame
+static Word runRoot(Vm &vm, std::uint32_t fn) {
+    std::size_t depth = vm.frames.size();
+    *vm.sp++ = kNil;
+    pushFrame(vm, vm.program.functions[fn], vm.sp, nullptr, nullptr);
+    return execute(vm, depth);
+}
+
+std::vector<Word> run(Vm &vm) {
+    for (std::size_t g = 0; g < vm.program.globals.size(); g++) {
+        std::uint32_t fn = vm.program.globals[g];
+        if (vm.program.functions[fn].kind == FunctionKind::ROOT) {
+            vm.globals[g] = runRoot(vm, fn);
+        }
+    }
+    std::vector<Word> values;
+    for (std::uint32_t fn : vm.program.exprs) {
+        values.push_back(runRoot(vm, fn));
+    }
+    return values;
+}
+
+// the name of the data type a constructor type returns
+static const std::string &dataName(const TypeTable &types, TypeId ctor) {
+    const TypeNode *node = &types.node(ctor);
+    if (node->kind == TypeKind::FORALL) {
+        node = &types.node(node->args.front());
+    }
+    if (node->kind == TypeKind::FUNCT) {
+        node = &types.node(node->args.back());
+    }
+    return node->name;
+}
+
+static void show(Vm &vm, std::ostream &out, Word w, TypeId type,
+                 TypeTable &types, const SymbolTable &symbols);
+
+// prints w, except that the last field of a constructed value is left in w
+// and type to be printed next, returning whether it was
+static bool showStep(Vm &vm, std::ostream &out, Word &w, TypeId &type,
+                     TypeTable &types, const SymbolTable &symbols) {
+    w = force(vm, w);
+    switch (type) {
+    case kIntType:
+        out << fixnumValue(w);
+        return false;
+    case kRationalType:
+        out << rationalValue(w);
+        return false;
+    case kFloatType:
+        out << floatValue(w);
+        return false;
+    case kComplexType:
+        out << complexValue(w);
+        return false;
+    case kBoolType:
+        out << (w == kTrue ? "#t" : "#f");
+        return false;
+    case kCharType:
+        out << static_cast<char>(immediatePayload(w));
+        return false;
+    case kStringType:
+    case kSymbolType:
+        out << stringValue(w);
+        return false;
+    default:
+        break;
+    }
+    const TypeNode &node = types.node(type);
+    if (node.kind != TypeKind::CONST) {
+        out << "#<procedure>";
+        return false;
+    }
+    if (node.name == "list") {
+        out << '(';
+        for (Word cell = w; cell != kNil;) {
+            if (cell != w) {
+                out << ' ';
+            }
+            show(vm, out, payloadOf(objectOf(cell))[0], node.args.front(),
+                 types, symbols);
+            cell = force(vm, payloadOf(objectOf(cell))[1]);
+        }
+        out << ')';
+        return false;
+    }
+    if (node.name == "vec") {
+        Object *vec = objectOf(w);
+        out << "(vec";
+        for (std::uint32_t i = 0; i < vec->size; i++) {
+            out << ' ';
+            show(vm, out, payloadOf(vec)[i], node.args.front(), types,
+                 symbols);
+        }
+        out << ')';
+        return false;
+    }
+    std::vector<const IrConstructor *> ctors;
+    for (const IrConstructor &ctor : vm.program.constructors) {
+        if (dataName(types, ctor.type) == node.name) {
+            ctors.push_back(&ctor);
+        }
+    }
+    // the only constructor of a type may be unboxed, its value is not
+    // tagged. tree shaking can leave one constructor of a tagged type
+    const IrConstructor *ctor =
+        ctors.size() == 1 && ctors.front()->rep == Representation::UNBOXED
+            ? ctors.front()
+            : nullptr;
+    for (const IrConstructor *c : ctors) {
+        if (!ctor && c->tag == tagOf(w)) {
+            ctor = c;
+        }
+    }
+    if (!ctor) {
+        out << "#<unknown " << node.name << '>';
+        return false;
+    }
+    if (ctor->arity == 0) {
+        out << symbols.name(ctor->name);
+        return false;
+    }
+    TypeId fn = ctor->type;
+    if (types.node(fn).kind == TypeKind::FORALL) {
+        fn = types.instantiate(fn, node.args);
+    }
+    out << '(' << symbols.name(ctor->name);
+    for (int i = 0; i + 1 < ctor->arity; i++) {
+        out << ' ';
+        show(vm, out, fieldOf(w, ctor->rep, i), types.node(fn).args[i],
+             types, symbols);
+    }
+    out << ' ';
+    w = fieldOf(w, ctor->rep, ctor->arity - 1);
+    type = types.node(fn).args[ctor->arity - 1];
+    return true;
+}
+
+// the last field continues the loop rather than recursing, so a long chain
+// of constructors like a List prints in constant stack
+static void show(Vm &vm, std::ostream &out, Word w, TypeId type,
+                 TypeTable &types, const SymbolTable &symbols) {
+    std::size_t open = 0;
+    while (showStep(vm, out, w, type, types, symbols)) {
+        open++;
+    }
+    out << std::string(open, ')');
+}
+
+std::string toString(Vm &vm, Word w, TypeId type, TypeTable &types,
+                     const SymbolTable &symbols) {
+    std::ostringstream out;
+    show(vm, out, w, type, types, symbols);
+    return out.str();
+}
@@ -0,0 +1,101 @@
+#ifndef SPROUT_LANG_VM_H
+#define SPROUT_LANG_VM_H
+
+#include "bytecode.h"
+#include "object.h"
+#include "symtab.h"
+#include "typetable.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * the bytecode interpreter. values are the Words of object.h on one
+ * contiguous stack, each frame is its slots followed by its operands with
+ * the closure or thunk it runs just below. a closure is a CLOSURE object of
+ * its function index and its captures, a thunk the same as a THUNK object
+ * that FORCE overwrites with an INDIRECTION to its value once evaluated, a
+ * BLACKHOLE while it runs so a thunk that needs its own value fails instead
+ * of looping.
+ *
+ * calls and forces push a frame and continue in the same dispatch loop, a
+ * TAIL_CALL runs the callee in the frame of its caller. a thunk frame keeps
+ * the thunk it updates across tail calls, so forcing the suspended
+ * recursive call in the tail of a cons runs it in the frame of the force.
+ * primitives that need values deeper than WHNF, like equal? and append, and
+ * printing, force through a nested run of the loop that returns once the
+ * frame it pushed returns
+ */
+struct Frame {
+    const CompiledFunction *fn;
+    const std::uint8_t *ip; // where the frame continues after a call
+    Word *base;             // slot 0
+    Word *env;              // captures of the running closure or thunk
+    Object *update;         // the thunk a thunk frame updates with its result
+};
+
+constexpr std::size_t kStackWords = 1 << 20;
+
+// the dispatch loop jumps from op to op through GCC's computed goto, built
+// with -DSPROUT_LANG_SWITCH_DISPATCH or by another compiler it is a switch
+#if defined(__GNUC__) && !defined(SPROUT_LANG_SWITCH_DISPATCH)
+#define SPROUT_LANG_THREADED_DISPATCH
+constexpr bool kThreadedDispatch = true;
+#else
+constexpr bool kThreadedDispatch = false;
+#endif
+
+struct VmStats {
+    std::size_t calls = 0;
+    std::size_t forces = 0;       // thunks evaluated
+    std::size_t frameObjects = 0; // closures and thunks built in a frame
+    std::size_t tailCalls = 0;    // calls that reused the caller's frame
+    std::size_t deepest = 0;      // most frames live at once
+    std::size_t instructions = 0; // ops executed
+};
+
+/*
+ * how often each sequence of two and three ops ran one right after the
+ * other in straight line code, only the last op of a sequence may transfer
+ * control. a run with Vm::profile set counts into it
+ */
+struct OpProfile {
+    std::vector<std::size_t> pairs =
+        std::vector<std::size_t>(kOpCount * kOpCount);
+    std::vector<std::size_t> triples =
+        std::vector<std::size_t>(kOpCount * kOpCount * kOpCount);
+};
+
+struct Vm {
+    const Program &program;
+    Heap heap;
+    std::vector<Word> constants;
+    std::vector<Word> globals;
+    std::vector<Word> stack;
+    Word *sp = nullptr;
+    std::vector<Frame> frames;
+    std::unordered_map<std::string, Word> symbols; // interned SYMBOL objects
+    VmStats stats;
+    OpProfile *profile = nullptr; // counts op sequences into it when set
+
+    explicit Vm(const Program &program);
+};
+
+// brings the strict globals to WHNF and runs every top level expression,
+// returning their values
+std::vector<Word> run(Vm &vm);
+// w in WHNF, evaluating it when it is a thunk
+Word force(Vm &vm, Word w);
+Word call(Vm &vm, Word fn, const std::vector<Word> &args);
+
+// the sequences of a profile by the dispatches one superinstruction for
+// each would save, the top ones with their counts, one per line
+std::string rankSequences(const OpProfile &profile, std::size_t top);
+
+// a value of the given type as sprout prints it, forcing what it shows
+std::string toString(Vm &vm, Word w, TypeId type, TypeTable &types,
+                     const SymbolTable &symbols);
+
+#endif
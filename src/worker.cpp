@@ -0,0 +1,72 @@
+#include "worker.h"
+
+#include <unordered_set>
+
+static bool isNumeric(TypeId type) {
+    return type == kIntType || type == kFloatType;
+}
+
+// a lambda calling the worker global with its own fresh parameters
+static IrId wrapper(IrModule &ir, std::uint32_t worker) {
+    const IrGlobal global = ir.globals[worker];
+    const IrNode fn = ir.nodes[global.body];
+    std::vector<std::uint32_t> params;
+    std::vector<std::uint32_t> args;
+    for (std::uint32_t i = 0; i < fn.count; i++) {
+        const IrVar param = ir.vars[operandsOf(ir, fn)[i]];
+        VarId var = addVar(ir, param.name, param.type, true);
+        params.push_back(var);
+        args.push_back(addNode(ir, IrNode{IrOp::VAR, param.type, var}));
+    }
+    IrId callee =
+        addNode(ir, IrNode{IrOp::GLOBAL, global.type, worker});
+    IrId call = addNode(
+        ir, IrNode{IrOp::APP, ir.nodes[fn.b].type, callee}, args);
+    IrNode lambda{IrOp::LAMBDA, fn.type};
+    lambda.b = call;
+    return addNode(ir, lambda, params);
+}
+
+WorkerStats splitWorkers(IrModule &ir) {
+    WorkerStats stats;
+    std::unordered_set<IrId> callees;
+    for (const IrNode &n : ir.nodes) {
+        if (n.op == IrOp::APP) {
+            callees.insert(n.a);
+        }
+    }
+    // the uses of each global as a value
+    std::vector<std::vector<IrId>> values(ir.globals.size());
+    for (IrId id = 0; id < ir.nodes.size(); id++) {
+        const IrNode &n = ir.nodes[id];
+        if (n.op == IrOp::GLOBAL && !callees.contains(id)) {
+            values[n.a].push_back(id);
+        }
+    }
+    std::size_t globals = ir.globals.size();
+    for (std::uint32_t g = 0; g < globals; g++) {
+        const IrGlobal &global = ir.globals[g];
+        if (values[g].empty() || global.lazy ||
+            ir.nodes[global.body].op != IrOp::LAMBDA) {
+            continue;
+        }
+        const IrNode &fn = ir.nodes[global.body];
+        bool numeric = false;
+        for (std::uint32_t i = 0; i < fn.count; i++) {
+            numeric = numeric || isNumeric(ir.vars[operandsOf(ir, fn)[i]].type);
+        }
+        if (!numeric) {
+            continue;
+        }
+        IrId body = wrapper(ir, g);
+        ir.globals.push_back(
+            IrGlobal{ir.globals[g].name, ir.globals[g].type, body, false});
+        auto index = static_cast<std::uint32_t>(ir.globals.size() - 1);
+        for (IrId use : values[g]) {
+            ir.nodes[use].a = index;
+            stats.redirected++;
+        }
+        stats.workers++;
+    }
+    return stats;
+}
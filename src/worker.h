@@ -0,0 +1,27 @@
+#ifndef SPROUT_LANG_WORKER_H
+#define SPROUT_LANG_WORKER_H
+
+#include "ir.h"
+
+/*
+ * worker/wrapper split of the top level functions with an int or float
+ * parameter that are also used as values, passed to another function or
+ * stored. such a function escapes, so strictness analysis cannot pass it
+ * its strict parameters evaluated and every recursive call builds thunks.
+ *
+ * the function itself becomes the worker and keeps every direct call. a new
+ * global, the wrapper, is a thin lambda that calls the worker with its
+ * parameters, and every use of the function as a value is redirected to it.
+ * the worker is then only called directly, so strictness analysis has the
+ * callers and the wrapper evaluate its strict parameters, and the bytecode
+ * compiler passes its float parameters and result unboxed, see bytecode.h
+ */
+struct WorkerStats {
+    int workers = 0;    // functions split
+    int redirected = 0; // uses as a value now taking the wrapper
+};
+
+// rewrites ir in place, run it before analyzeStrictness
+WorkerStats splitWorkers(IrModule &ir);
+
+#endif
@@ -0,0 +1,73 @@
+#include "workpool.h"
+
+#include <algorithm>
+#include <thread>
+
+WorkPool::WorkPool(unsigned threads)
+    : threads(threads > 0
+                  ? threads
+                  : std::max(1u, std::thread::hardware_concurrency())) {}
+
+std::optional<std::size_t> popTask(WorkQueue &queue) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) {
+        return std::nullopt;
+    }
+    std::size_t task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return task;
+}
+
+std::optional<std::size_t> stealTask(WorkQueue &queue) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) {
+        return std::nullopt;
+    }
+    std::size_t task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return task;
+}
+
+void WorkPool::run(std::size_t count,
+                   const std::function<void(unsigned, std::size_t)> &work) {
+    unsigned workers =
+        static_cast<unsigned>(std::min<std::size_t>(threads, count));
+    if (workers <= 1) {
+        for (std::size_t task = 0; task < count; task++) {
+            work(0, task);
+        }
+        return;
+    }
+    // seeding contiguous blocks keeps neighbouring tasks, which tend to touch
+    // the same data, on one thread until stealing kicks in
+    std::vector<WorkQueue> queues(workers);
+    for (unsigned w = 0; w < workers; w++) {
+        std::size_t first = count * w / workers;
+        std::size_t last = count * (w + 1) / workers;
+        for (std::size_t task = last; task > first; task--) {
+            queues[w].tasks.push_back(task - 1);
+        }
+    }
+    auto loop = [&](unsigned self) {
+        while (true) {
+            std::optional<std::size_t> task = popTask(queues[self]);
+            for (unsigned i = 1; !task && i < workers; i++) {
+                task = stealTask(queues[(self + i) % workers]);
+            }
+            // no task is ever added after seeding, so once every queue is
+            // empty the batch is done
+            if (!task) {
+                return;
+            }
+            work(self, *task);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < workers; w++) {
+        pool.emplace_back(loop, w);
+    }
+    loop(0);
+    for (std::thread &t : pool) {
+        t.join();
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef SPROUT_LANG_WORKPOOL_H
+#define SPROUT_LANG_WORKPOOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+/*
+ * work stealing pool for batches of independent tasks, numbered 0..count-1.
+ * each worker owns a deque seeded with a contiguous block of tasks, pops from
+ * the back of its own deque and, once that is empty, steals from the front of
+ * the others, so uneven task costs still keep every thread busy. tasks must
+ * not throw, callers record their failures in per task slots
+ */
+struct WorkQueue {
+    std::mutex lock;
+    std::deque<std::size_t> tasks;
+};
+
+struct WorkPool {
+    unsigned threads;
+
+    // 0 threads uses the hardware concurrency
+    explicit WorkPool(unsigned threads = 0);
+
+    // runs work(worker, task) for every task and returns once all are done,
+    // worker is in 0..threads-1 so callers can keep per worker state
+    void run(std::size_t count,
+             const std::function<void(unsigned, std::size_t)> &work);
+};
+
+std::optional<std::size_t> popTask(WorkQueue &queue);
+std::optional<std::size_t> stealTask(WorkQueue &queue);
+
+#endif